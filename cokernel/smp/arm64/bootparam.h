@@ -53,6 +53,22 @@ struct ihk_smp_boot_param_numa_node {
 	int linux_numa_id;
 };
 
+/* Host topology, covering all Linux NUMA nodes and CPUs */
+#define IHK_SMP_HOST_NODE_ONLINE          0x01
+#define IHK_SMP_HOST_NODE_CPU             0x02
+#define IHK_SMP_HOST_NODE_MEMORY          0x04
+
+struct ihk_smp_boot_param_host_node {
+	int flags;
+	int lwk_numa_id; /* -1 if the LWK has no memory on it */
+	int tier;        /* Memory tier, 0 is the top one */
+};
+
+struct ihk_smp_boot_param_linux_cpu {
+	int numa_id;     /* Linux NUMA id, -1 if not possible */
+	int llc_cpu;     /* Lowest Linux CPU sharing the LLC, -1 if unknown */
+};
+
 struct ihk_dump_page {
 	unsigned long start;
 	unsigned long map_count;
@@ -66,6 +82,58 @@ struct ihk_dump_page_set {
 	unsigned long phy_page;
 };
 
+/*
+ * Clock page maintained by Linux on each timekeeping update, in the
+ * style of the vDSO data page. The writer increments seq before and
+ * after an update, readers retry while seq is odd or has changed.
+ * Time is base + ((counter - cycle_last) & mask) * mult >> shift,
+ * with the bases kept in nanoseconds shifted left by shift.
+ */
+#define IHK_SMP_CLOCK_MODE_NONE       0 /* use the boot time snapshot */
+#define IHK_SMP_CLOCK_MODE_COUNTER    1 /* counter based, see above */
+
+struct ihk_smp_clock_page {
+	volatile unsigned int seq;
+	unsigned int mode;
+	unsigned long cycle_last;
+	unsigned long mask;
+	unsigned int mult;
+	unsigned int shift;
+	unsigned long wall_time_sec;
+	unsigned long wall_time_snsec;
+	unsigned long monotonic_time_sec;
+	unsigned long monotonic_time_snsec;
+};
+
+/*
+ * Mailboxes of the calls from Linux to a set of LWK CPUs, one per LWK
+ * CPU. Linux fills in the mailbox of each target and publishes it by
+ * changing seq, sets pending to the number of targets and interrupts
+ * them with the IKC vector. A target runs the handler of req, stores
+ * ret, sets done to seq and decrements pending. The last one interrupts
+ * the master channel CPU to wake up the caller.
+ */
+#define IHK_SMP_CALL_NR_ARGS	4
+#define IHK_SMP_CALL_NR_REQS	32
+#define IHK_SMP_CALL_NOP	0	/* Handled by IHK, for round trips */
+
+/* Handler of the LWK, see ihk_mc_register_cpu_call() */
+typedef long (*ihk_mc_cpu_call_func_t)(int req, unsigned long *args);
+
+struct ihk_smp_call_mbox {
+	volatile unsigned long seq;
+	volatile unsigned long done;
+	int req;
+	long ret;
+	unsigned long args[IHK_SMP_CALL_NR_ARGS];
+} __attribute__((aligned(64)));
+
+struct ihk_smp_call_area {
+	volatile int pending;
+	int nr_mboxes;
+	struct ihk_smp_call_mbox mbox[0];
+};
+
 #define IHK_DUMP_PAGE_SET_INCOMPLETE 0
 #define IHK_DUMP_PAGE_SET_COMPLETED  1
 #define DUMP_LEVEL_ALL 0
@@ -98,10 +166,19 @@ struct tofu_globals {
  * [struct ihk_smp_boot_param_numa_node] ...
  * [struct ihk_smp_boot_param_numa_node]
  * [struct ihk_smp_boot_param_memory_chunk] ...
- * [struct ihk_smp_boot_param_memory_chunk]],
+ * [struct ihk_smp_boot_param_memory_chunk]
+ * [int distance] ... [int distance]
+ * [struct ihk_smp_boot_param_host_node] ...
+ * [struct ihk_smp_boot_param_host_node]
+ * [int host distance] ... [int host distance]
+ * [struct ihk_smp_boot_param_linux_cpu] ...
+ * [struct ihk_smp_boot_param_linux_cpu]],
  * where the number of CPUs, the number of numa nodes and
  * the number of memory ranges are determined by the nr_cpus,
  * nr_numa_nodes and nr_memory_chunks fields, respectively.
+ * There are nr_numa_nodes^2 distances between the LWK NUMA nodes,
+ * nr_host_numa_nodes host nodes with nr_host_numa_nodes^2 distances,
+ * and nr_linux_cpus Linux CPUs.
  */
 struct smp_boot_param {
 	/*
@@ -140,6 +217,8 @@ struct smp_boot_param {
 	unsigned long boot_tsc;
 	unsigned long boot_sec;
 	unsigned long boot_nsec;
+	unsigned long clock_page; /* Physical address, 0 if none */
+	unsigned long call_area; /* Physical address, 0 if none */
 	unsigned int ihk_ikc_cpu_hwids[SMP_MAX_CPUS];
 #ifdef IHK_IKC_USE_LINUX_WORK_IRQ
 	void *ihk_ikc_cpu_raised_list[SMP_MAX_CPUS];
@@ -153,7 +232,10 @@ struct smp_boot_param {
 	int nr_cpus;
 	int nr_numa_nodes;
 	int nr_memory_chunks;
+	int nr_host_numa_nodes;
 	int osnum;
+	int ikc_master_cpu; /* Linux CPU of the master channel */
+	unsigned int debug_mask; /* IHK_DEBUG_*, changed by Linux at run time */
 	unsigned int dump_level;
 	struct ihk_dump_page_set dump_page_set;
 	int linux_default_huge_page_shift;
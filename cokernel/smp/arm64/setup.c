@@ -38,6 +38,9 @@ int nr_spi_table = 0;
 #endif // !IHK_IKC_USE_LINUX_WORK_IRQ
 
 struct ihk_dump_page * dump_page;
+static struct ihk_smp_clock_page *clock_page;
+static struct ihk_smp_call_area *call_area;
+static ihk_mc_cpu_call_func_t call_funcs[IHK_SMP_CALL_NR_REQS];
 
 struct start_kernel_param {
 	unsigned long param_addr;
@@ -266,6 +269,17 @@ void arch_init(void)
 
 	dump_page = (struct ihk_dump_page *)map_fixed_area(boot_param->dump_page_set.phy_page, boot_param->dump_page_set.page_size, 0);
 
+	if (boot_param->clock_page) {
+		clock_page = map_fixed_area(boot_param->clock_page,
+					    PAGE_SIZE, 0);
+	}
+
+	if (boot_param->call_area) {
+		call_area = map_fixed_area(boot_param->call_area,
+				sizeof(*call_area) + boot_param->nr_cpus *
+				sizeof(struct ihk_smp_call_mbox), 0);
+	}
+
 	kputs("IHK/McKernel started.\n");
 
 	kprintf("ns_per_tsc: %lu\n", boot_param->ns_per_tsc);
@@ -276,6 +290,9 @@ void arch_ready(void)
 	/* Make it ready */
 	boot_param->status = 2;
 	barrier();
+
+	/* Wake up Linux waiting for it in ihk_host_ikc_init_first() */
+	ihk_mc_interrupt_host(boot_param->ikc_master_cpu, IHK_GV_IKC);
 }
 
 void done_init(void)
@@ -378,6 +395,60 @@ void ihk_mc_get_boot_time(unsigned long *tv_sec, unsigned long *tv_nsec,
 	*tsc = boot_param->boot_tsc;
 }
 
+/*
+ * Read Linux' wall-clock (monotonic != 0: monotonic) time from the shared
+ * clock page. Returns -EAGAIN when Linux doesn't publish counter based
+ * time, callers shall then use ihk_mc_get_boot_time().
+ */
+int ihk_mc_get_linux_time(int monotonic, unsigned long *tv_sec,
+			  unsigned long *tv_nsec)
+{
+	struct ihk_smp_clock_page *cp = clock_page;
+	unsigned int seq;
+	unsigned long sec, ns, cnt;
+
+	if (!cp) {
+		return -EAGAIN;
+	}
+
+retry:
+	seq = cp->seq;
+	asm volatile("dmb ishld" : : : "memory");
+	if (seq & 1) {
+		cpu_pause();
+		goto retry;
+	}
+
+	if (cp->mode != IHK_SMP_CLOCK_MODE_COUNTER) {
+		return -EAGAIN;
+	}
+
+	if (monotonic) {
+		sec = cp->monotonic_time_sec;
+		ns = cp->monotonic_time_snsec;
+	}
+	else {
+		sec = cp->wall_time_sec;
+		ns = cp->wall_time_snsec;
+	}
+	/* rdtsc() is ordered by its isb. A read behind cycle_last taken
+	 * on another CPU counts as no time passed */
+	cnt = rdtsc();
+	if ((long)(cnt - cp->cycle_last) > 0) {
+		ns += ((cnt - cp->cycle_last) & cp->mask) * cp->mult;
+	}
+	ns >>= cp->shift;
+
+	asm volatile("dmb ishld" : : : "memory");
+	if (cp->seq != seq) {
+		goto retry;
+	}
+
+	*tv_sec = sec + ns / 1000000000UL;
+	*tv_nsec = ns % 1000000000UL;
+	return 0;
+}
+
 char *ihk_get_kargs(void)
 {
 	return boot_param->kernel_args;
@@ -485,6 +556,135 @@ int ihk_mc_get_numa_distance(int i, int j)
 	return *distance;
 }
 
+static char *host_topology(void)
+{
+	return (char *)boot_param + sizeof(*boot_param) +
+		boot_param->nr_cpus * sizeof(struct ihk_smp_boot_param_cpu) +
+		boot_param->nr_numa_nodes *
+			sizeof(struct ihk_smp_boot_param_numa_node) +
+		boot_param->nr_memory_chunks *
+			sizeof(struct ihk_smp_boot_param_memory_chunk) +
+		boot_param->nr_numa_nodes * boot_param->nr_numa_nodes *
+			sizeof(int);
+}
+
+int ihk_mc_get_nr_linux_numa_nodes(void)
+{
+	return boot_param->nr_host_numa_nodes;
+}
+
+/* Host view of a Linux NUMA node, lwk_numa_id is -1 if the LWK
+ * has no memory on it */
+int ihk_mc_get_linux_numa_node(int linux_numa_id, int *flags,
+		int *lwk_numa_id, int *tier)
+{
+	struct ihk_smp_boot_param_host_node *node;
+
+	if (linux_numa_id < 0 ||
+		linux_numa_id >= boot_param->nr_host_numa_nodes)
+		return -1;
+
+	node = (struct ihk_smp_boot_param_host_node *)host_topology() +
+		linux_numa_id;
+
+	if (flags) *flags = node->flags;
+	if (lwk_numa_id) *lwk_numa_id = node->lwk_numa_id;
+	if (tier) *tier = node->tier;
+
+	return 0;
+}
+
+int ihk_mc_get_linux_numa_distance(int i, int j)
+{
+	int *distance;
+	int n = boot_param->nr_host_numa_nodes;
+
+	if (i < 0 || i >= n || j < 0 || j >= n) {
+		return -1;
+	}
+
+	distance = (int *)(host_topology() +
+			n * sizeof(struct ihk_smp_boot_param_host_node));
+	distance += (i * n + j);
+
+	return *distance;
+}
+
+int ihk_mc_get_linux_cpu_topology(int linux_cpu, int *linux_numa_id,
+		int *llc_cpu)
+{
+	struct ihk_smp_boot_param_linux_cpu *cpu;
+	int n = boot_param->nr_host_numa_nodes;
+
+	if (linux_cpu < 0 || linux_cpu >= boot_param->nr_linux_cpus)
+		return -1;
+
+	cpu = (struct ihk_smp_boot_param_linux_cpu *)(host_topology() +
+			n * sizeof(struct ihk_smp_boot_param_host_node) +
+			n * n * sizeof(int)) + linux_cpu;
+
+	if (linux_numa_id) *linux_numa_id = cpu->numa_id;
+	if (llc_cpu) *llc_cpu = cpu->llc_cpu;
+
+	return 0;
+}
+
+int ihk_mc_debug_enabled(int bit)
+{
+	return !!(*(volatile unsigned int *)&boot_param->debug_mask &
+		  (1U << bit));
+}
+
+int ihk_mc_register_cpu_call(int req, ihk_mc_cpu_call_func_t func)
+{
+	if (req <= IHK_SMP_CALL_NOP || req >= IHK_SMP_CALL_NR_REQS) {
+		return -EINVAL;
+	}
+
+	call_funcs[req] = func;
+	return 0;
+}
+
+/* Called on IKC interrupts, see struct ihk_smp_call_area */
+void ihk_mc_cpu_call_handler(void)
+{
+	struct ihk_smp_call_mbox *mbox;
+	ihk_mc_cpu_call_func_t func = NULL;
+	int cpu = ihk_mc_get_processor_id();
+	unsigned long seq;
+
+	if (!call_area || cpu >= call_area->nr_mboxes) {
+		return;
+	}
+
+	mbox = &call_area->mbox[cpu];
+	seq = mbox->seq;
+	if (seq == mbox->done) {
+		return;
+	}
+	asm volatile("dmb ishld" : : : "memory");
+
+	if (mbox->req > IHK_SMP_CALL_NOP && mbox->req < IHK_SMP_CALL_NR_REQS) {
+		func = call_funcs[mbox->req];
+	}
+
+	if (mbox->req == IHK_SMP_CALL_NOP) {
+		mbox->ret = 0;
+	}
+	else if (func) {
+		mbox->ret = func(mbox->req, mbox->args);
+	}
+	else {
+		mbox->ret = -ENOSYS;
+	}
+
+	asm volatile("dmb ish" : : : "memory");
+	mbox->done = seq;
+	if (__sync_sub_and_fetch(&call_area->pending, 1) == 0) {
+		ihk_mc_interrupt_host(boot_param->ikc_master_cpu, IHK_GV_IKC);
+	}
+}
+
 int ihk_mc_get_nr_memory_chunks(void)
 {
 	return boot_param->nr_memory_chunks;
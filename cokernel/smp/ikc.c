@@ -85,7 +85,15 @@ int ihk_mc_ikc_init_first(struct ihk_ikc_channel_desc *channel,
 		int (*packet_handler)(struct ihk_ikc_channel_desc *,
 			void *, void *))
 {
-	return ihk_mc_ikc_init_first_local(channel, packet_handler);
+	int ret;
+
+	ret = ihk_mc_ikc_init_first_local(channel, packet_handler);
+	if (ret)
+		return ret;
+
+	/* Notify the Linux CPU the host bound the master channel to */
+	channel->send.intr_cpu = boot_param->ikc_master_cpu;
+	return 0;
 }
 
 int ihk_ikc_send_interrupt(struct ihk_ikc_channel_desc *channel)
@@ -34,13 +34,147 @@ static inline int CORE_ISSET_ANY(struct smp_coreset *p)
 	return 0;
 }
 
+/*
+ * Frequency and power management knobs of a CPU, see struct
+ * ihk_pwr_setting of ihk_host_user.h. They are applied by the CPU
+ * itself when it comes up and by Linux through the CPU register
+ * IKC requests afterwards, both with ihk_smp_pwr_apply().
+ */
+#define IHK_SMP_PWR_KEEP	(-1)
+
+struct ihk_smp_boot_param_pwr {
+	int min_perf;
+	int max_perf;
+	int epp;
+	int epb;
+	int turbo;
+	int cstate_limit;
+};
+
 struct ihk_smp_boot_param_cpu {
 	int numa_id;
 	int hw_id;
 	int linux_cpu_id;
 	int ikc_cpu;
+	struct ihk_smp_boot_param_pwr pwr;
 };
 
+#define IHK_MSR_TSC			0x00000010
+#define IHK_MSR_PKG_CST_CONFIG_CONTROL	0x000000e2
+#define IHK_MSR_MPERF			0x000000e7
+#define IHK_MSR_APERF			0x000000e8
+#define IHK_MSR_PERF_CTL		0x00000199
+#define IHK_MSR_ENERGY_PERF_BIAS	0x000001b0
+#define IHK_MSR_PM_ENABLE		0x00000770
+#define IHK_MSR_HWP_CAPABILITIES	0x00000771
+#define IHK_MSR_HWP_REQUEST		0x00000774
+
+/* CPUID.06H features the caller has checked */
+#define IHK_SMP_PWR_FEAT_HWP		0x1	/* EAX[7] */
+#define IHK_SMP_PWR_FEAT_HWP_EPP	0x2	/* EAX[10] */
+#define IHK_SMP_PWR_FEAT_EPB		0x4	/* ECX[3] */
+
+/* The C-state limit is locked by the BIOS, the rest is applied */
+#define IHK_SMP_PWR_CSTATE_LOCKED	1
+
+typedef int (*ihk_smp_pwr_rdmsr_t)(void *arg, unsigned int msr,
+				   unsigned long *val);
+typedef int (*ihk_smp_pwr_wrmsr_t)(void *arg, unsigned int msr,
+				   unsigned long val);
+
+static inline int ihk_smp_pwr_apply(const struct ihk_smp_boot_param_pwr *pwr,
+				    unsigned int features,
+				    ihk_smp_pwr_rdmsr_t rd_fn,
+				    ihk_smp_pwr_wrmsr_t wr_fn, void *arg)
+{
+	unsigned long val, cap;
+	int ret;
+
+	if (features & IHK_SMP_PWR_FEAT_HWP) {
+		ret = rd_fn(arg, IHK_MSR_PM_ENABLE, &val);
+		if (ret)
+			return ret;
+		if (!(val & 1))
+			features &= ~IHK_SMP_PWR_FEAT_HWP;
+	}
+
+	if (features & IHK_SMP_PWR_FEAT_HWP) {
+		int max = pwr->max_perf;
+
+		ret = rd_fn(arg, IHK_MSR_HWP_CAPABILITIES, &cap);
+		if (ret)
+			return ret;
+		ret = rd_fn(arg, IHK_MSR_HWP_REQUEST, &val);
+		if (ret)
+			return ret;
+
+		/* Without turbo the ceiling is the guaranteed performance */
+		if (pwr->turbo == 0 &&
+		    (max == IHK_SMP_PWR_KEEP || max > (int)((cap >> 8) & 0xff)))
+			max = (cap >> 8) & 0xff;
+		else if (pwr->turbo == 1 && max == IHK_SMP_PWR_KEEP)
+			max = cap & 0xff;
+
+		if (pwr->min_perf != IHK_SMP_PWR_KEEP)
+			val = (val & ~0xffUL) | (pwr->min_perf & 0xff);
+		if (max != IHK_SMP_PWR_KEEP)
+			val = (val & ~0xff00UL) | ((unsigned long)(max & 0xff) << 8);
+		if (pwr->epp != IHK_SMP_PWR_KEEP &&
+		    (features & IHK_SMP_PWR_FEAT_HWP_EPP))
+			val = (val & ~0xff000000UL) |
+				((unsigned long)(pwr->epp & 0xff) << 24);
+
+		ret = wr_fn(arg, IHK_MSR_HWP_REQUEST, val);
+		if (ret)
+			return ret;
+	}
+	else if (pwr->max_perf != IHK_SMP_PWR_KEEP ||
+		 pwr->turbo != IHK_SMP_PWR_KEEP) {
+		ret = rd_fn(arg, IHK_MSR_PERF_CTL, &val);
+		if (ret)
+			return ret;
+
+		/* Target ratio in [15:8], IDA (turbo) disengage in [32] */
+		if (pwr->max_perf != IHK_SMP_PWR_KEEP)
+			val = (val & ~0xff00UL) |
+				((unsigned long)(pwr->max_perf & 0xff) << 8);
+		if (pwr->turbo == 0)
+			val |= (1UL << 32);
+		else if (pwr->turbo == 1)
+			val &= ~(1UL << 32);
+
+		ret = wr_fn(arg, IHK_MSR_PERF_CTL, val);
+		if (ret)
+			return ret;
+	}
+
+	if (pwr->epb != IHK_SMP_PWR_KEEP &&
+	    (features & IHK_SMP_PWR_FEAT_EPB)) {
+		ret = rd_fn(arg, IHK_MSR_ENERGY_PERF_BIAS, &val);
+		if (ret)
+			return ret;
+		val = (val & ~0xfUL) | (pwr->epb & 0xf);
+		ret = wr_fn(arg, IHK_MSR_ENERGY_PERF_BIAS, val);
+		if (ret)
+			return ret;
+	}
+
+	if (pwr->cstate_limit != IHK_SMP_PWR_KEEP) {
+		ret = rd_fn(arg, IHK_MSR_PKG_CST_CONFIG_CONTROL, &val);
+		if (ret)
+			return ret;
+		/* CFG lock */
+		if (val & (1UL << 15))
+			return IHK_SMP_PWR_CSTATE_LOCKED;
+		val = (val & ~0xfUL) | (pwr->cstate_limit & 0xf);
+		ret = wr_fn(arg, IHK_MSR_PKG_CST_CONFIG_CONTROL, val);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 struct ihk_smp_boot_param_memory_chunk {
 	unsigned long start, end;
 	int numa_id;
@@ -54,6 +188,22 @@ struct ihk_smp_boot_param_numa_node {
 	int linux_numa_id;
 };
 
+/* Host topology, covering all Linux NUMA nodes and CPUs */
+#define IHK_SMP_HOST_NODE_ONLINE          0x01
+#define IHK_SMP_HOST_NODE_CPU             0x02
+#define IHK_SMP_HOST_NODE_MEMORY          0x04
+
+struct ihk_smp_boot_param_host_node {
+	int flags;
+	int lwk_numa_id; /* -1 if the LWK has no memory on it */
+	int tier;        /* Memory tier, 0 is the top one */
+};
+
+struct ihk_smp_boot_param_linux_cpu {
+	int numa_id;     /* Linux NUMA id, -1 if not possible */
+	int llc_cpu;     /* Lowest Linux CPU sharing the LLC, -1 if unknown */
+};
+
 struct ihk_dump_page {
 	unsigned long start;
 	unsigned long map_count;
@@ -67,6 +217,58 @@ struct ihk_dump_page_set {
 	unsigned long phy_page;
 };
 
+/*
+ * Clock page maintained by Linux on each timekeeping update, in the
+ * style of the vDSO data page. The writer increments seq before and
+ * after an update, readers retry while seq is odd or has changed.
+ * Time is base + ((counter - cycle_last) & mask) * mult >> shift,
+ * with the bases kept in nanoseconds shifted left by shift.
+ */
+#define IHK_SMP_CLOCK_MODE_NONE       0 /* use the boot time snapshot */
+#define IHK_SMP_CLOCK_MODE_COUNTER    1 /* counter based, see above */
+
+struct ihk_smp_clock_page {
+	volatile unsigned int seq;
+	unsigned int mode;
+	unsigned long cycle_last;
+	unsigned long mask;
+	unsigned int mult;
+	unsigned int shift;
+	unsigned long wall_time_sec;
+	unsigned long wall_time_snsec;
+	unsigned long monotonic_time_sec;
+	unsigned long monotonic_time_snsec;
+};
+
+/*
+ * Mailboxes of the calls from Linux to a set of LWK CPUs, one per LWK
+ * CPU. Linux fills in the mailbox of each target and publishes it by
+ * changing seq, sets pending to the number of targets and interrupts
+ * them with the IKC vector. A target runs the handler of req, stores
+ * ret, sets done to seq and decrements pending. The last one interrupts
+ * the master channel CPU to wake up the caller.
+ */
+#define IHK_SMP_CALL_NR_ARGS	4
+#define IHK_SMP_CALL_NR_REQS	32
+#define IHK_SMP_CALL_NOP	0	/* Handled by IHK, for round trips */
+
+/* Handler of the LWK, see ihk_mc_register_cpu_call() */
+typedef long (*ihk_mc_cpu_call_func_t)(int req, unsigned long *args);
+
+struct ihk_smp_call_mbox {
+	volatile unsigned long seq;
+	volatile unsigned long done;
+	int req;
+	long ret;
+	unsigned long args[IHK_SMP_CALL_NR_ARGS];
+} __attribute__((aligned(64)));
+
+struct ihk_smp_call_area {
+	volatile int pending;
+	int nr_mboxes;
+	struct ihk_smp_call_mbox mbox[0];
+};
+
 #define IHK_DUMP_PAGE_SET_INCOMPLETE 0
 #define IHK_DUMP_PAGE_SET_COMPLETED  1
 #define DUMP_LEVEL_ALL 0
@@ -80,10 +282,19 @@ struct ihk_dump_page_set {
  * [struct ihk_smp_boot_param_numa_node] ...
  * [struct ihk_smp_boot_param_numa_node]
  * [struct ihk_smp_boot_param_memory_chunk] ...
- * [struct ihk_smp_boot_param_memory_chunk]],
+ * [struct ihk_smp_boot_param_memory_chunk]
+ * [int distance] ... [int distance]
+ * [struct ihk_smp_boot_param_host_node] ...
+ * [struct ihk_smp_boot_param_host_node]
+ * [int host distance] ... [int host distance]
+ * [struct ihk_smp_boot_param_linux_cpu] ...
+ * [struct ihk_smp_boot_param_linux_cpu]],
  * where the number of CPUs, the number of numa nodes and
  * the number of memory ranges are determined by the nr_cpus,
  * nr_numa_nodes and nr_memory_chunks fields, respectively.
+ * There are nr_numa_nodes^2 distances between the LWK NUMA nodes,
+ * nr_host_numa_nodes host nodes with nr_host_numa_nodes^2 distances,
+ * and nr_linux_cpus Linux CPUs.
  */
 struct smp_boot_param {
 	/*
@@ -123,6 +334,8 @@ struct smp_boot_param {
 	unsigned long boot_tsc;
 	unsigned long boot_sec;
 	unsigned long boot_nsec;
+	unsigned long clock_page; /* Physical address, 0 if none */
+	unsigned long call_area; /* Physical address, 0 if none */
 #ifdef IHK_IKC_USE_LINUX_WORK_IRQ
 	void *ihk_ikc_cpu_raised_list[SMP_MAX_CPUS];
 	void *ikc_irq_work_func;
@@ -134,7 +347,10 @@ struct smp_boot_param {
 	int nr_cpus;
 	int nr_numa_nodes;
 	int nr_memory_chunks;
+	int nr_host_numa_nodes;
 	int osnum;
+	int ikc_master_cpu; /* Linux CPU of the master channel */
+	unsigned int debug_mask; /* IHK_DEBUG_*, changed by Linux at run time */
 	unsigned int dump_level;
 	int linux_default_huge_page_shift;
 	struct ihk_dump_page_set dump_page_set;
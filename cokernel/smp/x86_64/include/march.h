@@ -38,4 +38,9 @@ enum extra_reg_type {
 
 #define ENABLE_SSE
 
+/* Applies the power settings passed by Linux, see ihkosctl set pwr.
+ * The LWK has to call it on each CPU during its initialization.
+ */
+void ihk_mc_pwr_init_cpu(void);
+
 #endif
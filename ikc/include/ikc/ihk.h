@@ -40,9 +40,23 @@ typedef void * ihk_wait_t;
 #include <ihk/lock.h>
 #include <ihk/mm.h>
 #include <errno.h>
+#include <ihk/ihk_debug.h>
 
 #define IHK_EXPORT_SYMBOL(x)
 
+/* Checks the debug mask passed in the boot parameters */
+int ihk_mc_debug_enabled(int bit);
+
+/* Runs the call from Linux posted to this CPU, if any */
+void ihk_mc_cpu_call_handler(void);
+
+#define ihk_ikc_dbg(bit, ...)					\
+	do {							\
+		if (ihk_mc_debug_enabled(bit)) {		\
+			kprintf(__VA_ARGS__);			\
+		}						\
+	} while (0)
+
 #else /* !IHK_OS_MANYCORE */
 
 #include <linux/kernel.h>
@@ -60,6 +74,7 @@ typedef void * ihk_wait_t;
 #include <asm/errno.h>
 #include <asm/io.h>
 #include <ihk/ihk_host_driver.h>
+#include <ihk/misc/debug.h>
 
 #define IHK_EXPORT_SYMBOL        EXPORT_SYMBOL
 
@@ -86,6 +101,7 @@ typedef void * ihk_wait_t;
 #define ihk_ikc_mb                mb
 
 #define kprintf                  printk
+#define ihk_ikc_dbg              ihk_dbg
 
 typedef wait_queue_head_t        ihk_wait_t;
 
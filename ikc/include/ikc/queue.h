@@ -34,10 +34,33 @@ struct ihk_ikc_queue_head {
 	uint32_t        channel_id;
 	uint32_t        read_cpu;
 	uint32_t        write_cpu;
-	uint32_t        dummy2;
+	uint32_t        prio_off;	/* High-priority ring, 0 if none */
 /* 64 */
 };
 
+/* Packets of the high-priority ring carved out of a regular queue */
+#define IHK_IKC_PRIO_QUEUE_PKTS	8
+
+static inline struct ihk_ikc_queue_head *
+ihk_ikc_prio_queue(struct ihk_ikc_queue_head *q)
+{
+	if (!q || !q->prio_off)
+		return NULL;
+
+	return (struct ihk_ikc_queue_head *)((char *)q + q->prio_off);
+}
+
+/* Bytes used by a queue including its high-priority ring */
+static inline unsigned long ihk_ikc_queue_span(struct ihk_ikc_queue_head *q)
+{
+	struct ihk_ikc_queue_head *pq = ihk_ikc_prio_queue(q);
+
+	if (pq)
+		return q->prio_off + sizeof(*pq) + pq->queue_size;
+
+	return sizeof(*q) + q->queue_size;
+}
+
 struct ihk_ikc_queue_desc {
 	struct ihk_ikc_queue_head *queue;  /* Virtual address */
 	struct ihk_ikc_queue_head  cache;  /* Cache for local reference */
@@ -87,6 +110,7 @@ int ihk_ikc_init_queue(struct ihk_ikc_queue_head *q,
                        int id, int type, int size, int packetsize);
 int ihk_ikc_queue_is_empty(struct ihk_ikc_queue_head *q);
 int ihk_ikc_queue_is_full(struct ihk_ikc_queue_head *q);
+int ihk_ikc_channel_is_empty(struct ihk_ikc_channel_desc *c);
 int ihk_ikc_read_queue(struct ihk_ikc_queue_head *q, void *packet, int flag);
 int ihk_ikc_write_queue(struct ihk_ikc_queue_head *q, void *packet, int flag);
 
@@ -105,6 +129,11 @@ void ihk_ikc_disable_channel(struct ihk_ikc_channel_desc *channel);
 void ihk_ikc_channel_set_cpu(struct ihk_ikc_channel_desc *c, int cpu);
 
 #define IKC_NO_NOTIFY    0x100
+/* Use the high-priority ring of the channel, e.g. for control messages
+ * which must not wait behind a full data path. Falls back to the regular
+ * ring if the receiver did not set one up.
+ */
+#define IKC_PRIO_HIGH    0x200
 
 int ihk_ikc_send(struct ihk_ikc_channel_desc *channel, void *p, int opt);
 int ihk_ikc_recv(struct ihk_ikc_channel_desc *channel, void *p, int opt);
@@ -11,6 +11,7 @@
 #include <asm/bitops.h>
 #include <asm/smp.h>
 #include <linux/interrupt.h>
+#include <linux/timex.h>
 
 #define IHK_IKC_SEND_RETRY	1000
 #ifdef POSTK_DEBUG_TEMP_FIX_49 /* IHK_IKC_RECV_HANDLER_IN_WORKQ enabled */
@@ -36,44 +37,59 @@ static void __ihk_ikc_reception_handler(ihk_os_t os)
 	struct ihk_ikc_channel_desc *m_channel;
 	struct ihk_ikc_channel_desc *r_channel;
 	int found = 0;
+	int mchannel_cpu;
+	unsigned long long start = get_cycles();
+	unsigned long nr = 0;
 	//printk("%s: id=%d\n", __FUNCTION__, smp_processor_id());
-	if (smp_processor_id() == 0) {
-		m_channel = ihk_ikc_get_master_channel(os);
-		if (m_channel) {
-			while (ihk_ikc_channel_enabled(m_channel) &&
-			       !ihk_ikc_queue_is_empty(m_channel->recv.queue)) {
-				ihk_ikc_recv_handler(m_channel, m_channel->handler, os, 0);
-			}
+	m_channel = ihk_ikc_get_master_channel(os);
+	if (!m_channel) {
+		/* Regular channels are established through the master one */
+		return;
+	}
+
+	/* The master channel is drained on the CPU it is bound to */
+	mchannel_cpu = m_channel->recv.queue->read_cpu;
+	if (smp_processor_id() == mchannel_cpu) {
+		while (ihk_ikc_channel_enabled(m_channel) &&
+		       !ihk_ikc_channel_is_empty(m_channel)) {
+			ihk_ikc_recv_handler(m_channel, m_channel->handler, os, 0);
+			nr++;
 		}
 	}
 
 	r_channel = ihk_ikc_get_regular_channel(os, smp_processor_id());
 	if (!r_channel) {
-		/* It is fine not to have this channel for CPU 0 as we may be
-		 * in initialization phase where only master channel exists yet.
-		 * Otherwise, print a warning */
-		if (smp_processor_id() > 0) {
+		/* It is fine not to have this channel on the master channel's
+		 * CPU as we may be in initialization phase where only master
+		 * channel exists yet. Otherwise, print a warning */
+		if (smp_processor_id() != mchannel_cpu) {
 			printk("%s: WARNING: r_channel for CPU %d does not exist\n",
 					__FUNCTION__, smp_processor_id());
 		}
-		return;
+		goto out;
 	}
 	while (ihk_ikc_channel_enabled(r_channel) &&
-	       !ihk_ikc_queue_is_empty(r_channel->recv.queue)) {
+	       !ihk_ikc_channel_is_empty(r_channel)) {
 		found = 1;
 		ihk_ikc_recv_handler(r_channel, r_channel->handler, os, 0);
+		nr++;
 	}
 	if(!found) {
 		//printk("%s: WARNING: no handler is called,r_channel enabled=%d,is_empty=%d\n", __FUNCTION__, ihk_ikc_channel_enabled(r_channel), ihk_ikc_queue_is_empty(r_channel->recv.queue));
 	}
+ out:
+	ihk_host_os_account(os, IHK_OS_ACCT_IKC, start, nr);
 }
 
 /** \brief Worker thread for IKC interrupts */
 static void ikc_work_func(struct work_struct *work)
 {
 	ihk_os_t os = ihk_ikc_linux_get_os_from_work(work);
+	unsigned long long start = get_cycles();
+
 	__ihk_ikc_reception_handler(os);
 	kfree(work);
+	ihk_host_os_account(os, IHK_OS_ACCT_WORK, start, 1);
 }
 
 /** \brief IKC interrupt handler (interrupt context) */
@@ -131,7 +147,7 @@ struct ihk_ikc_queue_head *ihk_ikc_alloc_queue(int qpages)
 
 void ihk_ikc_free_queue(struct ihk_ikc_queue_head *q)
 {
-	int qpages = (q->queue_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	int qpages = (ihk_ikc_queue_span(q) + PAGE_SIZE - 1) >> PAGE_SHIFT;
 	int order = fls(qpages) - 1;
 
 	free_pages((unsigned long)q, order);
@@ -171,17 +187,23 @@ int ihk_ikc_send(struct ihk_ikc_channel_desc *channel, void *p, int opt)
 {
 	int r;
 	unsigned long flags;
+	struct ihk_ikc_queue_head *q;
 	int attempts = 0;
 
 	if (!channel || !p) {
 		return -EINVAL;
 	}
 
+	q = channel->send.queue;
+	if ((opt & IKC_PRIO_HIGH) && ihk_ikc_prio_queue(q)) {
+		q = ihk_ikc_prio_queue(q);
+	}
+
 	local_irq_save(flags);
 retry:
 	/* Add main packet to target channel */
 	if (ihk_ikc_channel_enabled(channel)) {
-		r = ihk_ikc_write_queue(channel->send.queue, p, opt);
+		r = ihk_ikc_write_queue(q, p, opt);
 
 		if (r != 0) {
 			if (++attempts > IHK_IKC_SEND_RETRY) {
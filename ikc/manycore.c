@@ -48,13 +48,16 @@ static void ihk_ikc_interrupt_handler(void *priv)
 	struct ihk_ikc_channel_desc *m_channel;
 	struct ihk_ikc_channel_desc *r_channel;
 
+	/* Calls from Linux, independent of the channels */
+	ihk_mc_cpu_call_handler();
+
 	if (ihk_mc_get_processor_id() == 0) {
 		m_channel = ihk_ikc_get_master_channel(NULL);
 		if (!m_channel)
 			goto no_m_channel;
 
 		while (ihk_ikc_channel_enabled(m_channel) &&
-		       !ihk_ikc_queue_is_empty(m_channel->recv.queue) &&
+		       !ihk_ikc_channel_is_empty(m_channel) &&
 		       m_channel->recv.queue->read_cpu == ihk_mc_get_processor_id()) {
 			ihk_ikc_recv_handler(m_channel, m_channel->handler, NULL, 0);
 		}
@@ -66,7 +69,7 @@ no_m_channel:
 		return;
 
 	while (ihk_ikc_channel_enabled(r_channel) &&
-	       !ihk_ikc_queue_is_empty(r_channel->recv.queue) &&
+	       !ihk_ikc_channel_is_empty(r_channel) &&
 	       r_channel->recv.queue->read_cpu == ihk_mc_get_processor_id()) {
 		ihk_ikc_recv_handler(r_channel, r_channel->handler, NULL, 0);
 	}
@@ -78,16 +81,22 @@ int ihk_ikc_send(struct ihk_ikc_channel_desc *channel, void *p, int opt)
 {
 	int r;
 	unsigned long flags;
+	struct ihk_ikc_queue_head *q;
 
 	if(!channel || !p)
 		return -EINVAL;
 
+	q = channel->send.queue;
+	if ((opt & IKC_PRIO_HIGH) && ihk_ikc_prio_queue(q)) {
+		q = ihk_ikc_prio_queue(q);
+	}
+
 	flags = cpu_disable_interrupt_save();
 
 retry:
 	/* Add main packet to target channel */
 	if (ihk_ikc_channel_enabled(channel)) {
-		r = ihk_ikc_write_queue(channel->send.queue, p, opt);
+		r = ihk_ikc_write_queue(q, p, opt);
 
 		if (r != 0) {
 			kprintf("%s: couldn't append packet -> retrying\n", __FUNCTION__);
@@ -154,8 +163,8 @@ struct ihk_ikc_queue_head *ihk_ikc_alloc_queue(int qpages)
 
 void ihk_ikc_free_queue(struct ihk_ikc_queue_head *q)
 {
-	ihk_mc_free_pages(q, (sizeof(struct ihk_ikc_queue_head) + 
-	                      q->queue_size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+	ihk_mc_free_pages(q, (ihk_ikc_queue_span(q) + PAGE_SIZE - 1)
+	                  >> PAGE_SHIFT);
 }
 
 void *ihk_ikc_malloc(int size)
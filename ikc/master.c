@@ -18,7 +18,7 @@
 #endif
 #else
 #ifndef dkprintf
-#define dkprintf(...)
+#define dkprintf(...) ihk_ikc_dbg(IHK_DEBUG_IKC_BIT, __VA_ARGS__)
 #endif
 #endif
 
@@ -20,7 +20,7 @@
 #endif
 #else
 #ifndef dkprintf
-#define dkprintf(...)
+#define dkprintf(...) ihk_ikc_dbg(IHK_DEBUG_IKC_BIT, __VA_ARGS__)
 #endif
 #endif
 
@@ -54,6 +54,9 @@ static void *memcpyl(void *dest, const void *src, size_t n)
 int ihk_ikc_init_queue(struct ihk_ikc_queue_head *q,
                        int id, int type, int size, int packetsize)
 {
+	int prio_size = sizeof(struct ihk_ikc_queue_head) +
+		IHK_IKC_PRIO_QUEUE_PKTS * packetsize;
+
 	if (!q) {
 		return -EINVAL;
 	}
@@ -65,6 +68,29 @@ int ihk_ikc_init_queue(struct ihk_ikc_queue_head *q,
 	q->pktsize = packetsize;
 	q->pktcount = (size - sizeof(struct ihk_ikc_queue_head)) / packetsize;
 
+	/*
+	 * Carve the high-priority ring out of the tail if the regular
+	 * one keeps enough room. It is found by the sender through
+	 * prio_off so that no change to the connection protocol is needed.
+	 */
+	if (size - (int)sizeof(struct ihk_ikc_queue_head) - prio_size >=
+	    2 * IHK_IKC_PRIO_QUEUE_PKTS * packetsize) {
+		struct ihk_ikc_queue_head *pq;
+
+		q->pktcount = (size - sizeof(struct ihk_ikc_queue_head)
+			       - prio_size) / packetsize;
+		q->prio_off = sizeof(struct ihk_ikc_queue_head) +
+			q->pktcount * packetsize;
+
+		pq = (struct ihk_ikc_queue_head *)((char *)q + q->prio_off);
+		memset(pq, 0, sizeof(*pq));
+		pq->id = id;
+		pq->type = type;
+		pq->pktsize = packetsize;
+		pq->pktcount = IHK_IKC_PRIO_QUEUE_PKTS;
+		pq->queue_size = pq->pktsize * pq->pktcount;
+	}
+
 	q->read_off = q->max_read_off = q->write_off = 0;
 	q->read_cpu = 0;
 	q->write_cpu = 0;
@@ -83,6 +109,17 @@ int ihk_ikc_queue_is_empty(struct ihk_ikc_queue_head *q)
 	return q->read_off == q->max_read_off;
 }
 
+int ihk_ikc_channel_is_empty(struct ihk_ikc_channel_desc *c)
+{
+	struct ihk_ikc_queue_head *pq = ihk_ikc_prio_queue(c->recv.queue);
+
+	if (pq && !ihk_ikc_queue_is_empty(pq)) {
+		return 0;
+	}
+
+	return ihk_ikc_queue_is_empty(c->recv.queue);
+}
+
 int ihk_ikc_queue_is_full(struct ihk_ikc_queue_head *q)
 {
 	uint64_t r, w;
@@ -426,9 +463,8 @@ void ihk_ikc_free_channel(struct ihk_ikc_channel_desc *desc)
 	ihk_ikc_spinlock_unlock(&desc->packet_pool_lock, flags);
 
 	if (desc->recv.queue) {
-		qpages = (desc->recv.queue->queue_size
-		          + sizeof(struct ihk_ikc_queue_head) + PAGE_SIZE - 1)
-			>> PAGE_SHIFT;
+		qpages = (ihk_ikc_queue_span(desc->recv.queue)
+		          + PAGE_SIZE - 1) >> PAGE_SHIFT;
 		if (desc->recv.qrphys) {
 			ihk_ikc_unmap_virtual(ihk_os_to_dev(os),
 			                      desc->recv.queue,
@@ -440,9 +476,8 @@ void ihk_ikc_free_channel(struct ihk_ikc_channel_desc *desc)
 	}
 
 	if (desc->send.queue) {
-		qpages = (desc->send.queue->queue_size
-		          + sizeof(struct ihk_ikc_queue_head) + PAGE_SIZE - 1)
-			>> PAGE_SHIFT;
+		qpages = (ihk_ikc_queue_span(desc->send.queue)
+		          + PAGE_SIZE - 1) >> PAGE_SHIFT;
 		if (desc->send.qrphys) {
 			ihk_ikc_unmap_virtual(ihk_os_to_dev(os),
 			                      desc->send.queue,
@@ -472,7 +507,17 @@ int ihk_ikc_recv(struct ihk_ikc_channel_desc *channel, void *p, int opt)
 	local_irq_save(flags);
 #endif
 	if (ihk_ikc_channel_enabled(channel)) {
-		r = ihk_ikc_read_queue(channel->recv.queue, p, opt);
+		struct ihk_ikc_queue_head *pq;
+
+		/* The high-priority ring is always drained first */
+		pq = ihk_ikc_prio_queue(channel->recv.queue);
+		r = -1;
+		if (pq) {
+			r = ihk_ikc_read_queue(pq, p, opt);
+		}
+		if (r) {
+			r = ihk_ikc_read_queue(channel->recv.queue, p, opt);
+		}
 
 		/* We set channel here instead of setting it on
 		 * allocation and skipping those bytes when receiving
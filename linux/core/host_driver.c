@@ -34,6 +34,9 @@
 #include <linux/version.h>
 #include <linux/cred.h>
 #include <linux/mutex.h>
+#include <linux/uio.h>
+#include <linux/percpu.h>
+#include <linux/timex.h>
 #include <ihk/ihk_host_user.h>
 #include <ihk/ihk_host_driver.h>
 #include <asm/spinlock.h>
@@ -48,7 +51,7 @@
 #define dkprintf(...) kprintf(__VA_ARGS__)
 #define ekprintf(...) kprintf(__VA_ARGS__)
 #else
-#define dkprintf(...) do { if (0) printk(__VA_ARGS__); } while (0)
+#define dkprintf(...) ihk_dbg(IHK_DEBUG_IKC_BIT, __VA_ARGS__)
 #define ekprintf(...) printk(__VA_ARGS__)
 #endif
 
@@ -91,6 +94,298 @@ struct ihk_event {
 #define IHK_OS_MONITOR_KERNEL_FROZEN 9
 #define IHK_OS_MONITOR_KERNEL_THAW 10
 
+/*
+ * Debug categories
+ */
+ihk_debug_key_t ihk_debug_keys[IHK_DEBUG_NR] = {
+	[0 ... IHK_DEBUG_NR - 1] = IHK_DEBUG_KEY_INIT
+};
+
+static const char * const ihk_debug_names[IHK_DEBUG_NR] = IHK_DEBUG_NAMES;
+
+/* Protects the per-OS masks, ihk_debug_mask and the key counts */
+static DEFINE_MUTEX(ihk_debug_lock);
+static unsigned int ihk_debug_mask;
+/* The keys of the module can't be switched before module_init */
+static int ihk_debug_keys_ready;
+
+static void ihk_debug_update_keys(unsigned int old, unsigned int new)
+{
+	int bit;
+
+	for (bit = 0; bit < IHK_DEBUG_NR; bit++) {
+		unsigned int b = 1U << bit;
+
+		if (!(old & b) && (new & b)) {
+			ihk_debug_key_inc(&ihk_debug_keys[bit]);
+		}
+		else if ((old & b) && !(new & b)) {
+			ihk_debug_key_dec(&ihk_debug_keys[bit]);
+		}
+	}
+}
+
+/** \brief Parse a number, or a comma separated list of category
+ *  names, "all" and "none" */
+static int ihk_debug_parse_mask(const char *val, unsigned int *maskp)
+{
+	unsigned int mask = 0;
+	const char *p = val;
+	int bit;
+
+	if (!kstrtouint(val, 0, &mask)) {
+		if (mask & ~IHK_DEBUG_ALL) {
+			return -EINVAL;
+		}
+		*maskp = mask;
+		return 0;
+	}
+
+	while (*p && *p != '\n') {
+		size_t len = strcspn(p, ",\n");
+
+		if (len == 3 && !strncmp(p, "all", len)) {
+			mask |= IHK_DEBUG_ALL;
+		}
+		else if (len && !(len == 4 && !strncmp(p, "none", len))) {
+			for (bit = 0; bit < IHK_DEBUG_NR; bit++) {
+				if (strlen(ihk_debug_names[bit]) == len &&
+				    !strncmp(p, ihk_debug_names[bit], len)) {
+					break;
+				}
+			}
+			if (bit == IHK_DEBUG_NR) {
+				return -EINVAL;
+			}
+			mask |= 1U << bit;
+		}
+
+		p += len;
+		if (*p == ',') {
+			p++;
+		}
+	}
+
+	*maskp = mask;
+	return 0;
+}
+
+static int ihk_debug_format_mask(char *buf, size_t size, unsigned int mask)
+{
+	int len = 0;
+	int bit;
+
+	for (bit = 0; bit < IHK_DEBUG_NR; bit++) {
+		if (mask & (1U << bit)) {
+			len += scnprintf(buf + len, size - len, "%s%s",
+					 len ? "," : "", ihk_debug_names[bit]);
+		}
+	}
+
+	if (!len) {
+		len = scnprintf(buf, size, "none");
+	}
+
+	return len;
+}
+
+static int ihk_debug_mask_param_set(const char *val,
+				    const struct kernel_param *kp)
+{
+	unsigned int mask;
+	int ret;
+
+	ret = ihk_debug_parse_mask(val, &mask);
+	if (ret) {
+		return ret;
+	}
+
+	mutex_lock(&ihk_debug_lock);
+	if (ihk_debug_keys_ready) {
+		ihk_debug_update_keys(ihk_debug_mask, mask);
+	}
+	ihk_debug_mask = mask;
+	mutex_unlock(&ihk_debug_lock);
+
+	return 0;
+}
+
+static const struct kernel_param_ops ihk_debug_mask_param_ops = {
+	.set = ihk_debug_mask_param_set,
+	.get = param_get_uint,
+};
+
+module_param_cb(debug_mask, &ihk_debug_mask_param_ops, &ihk_debug_mask, 0644);
+MODULE_PARM_DESC(debug_mask, "Debug categories enabled on the host for all OS instances");
+
+/** \brief Switch the debug categories of an OS instance. Host messages
+ *  are printed while any instance enables their category, the LWK
+ *  only prints its own. */
+static int ihk_os_set_debug_mask(struct ihk_host_linux_os_data *data,
+				 unsigned int mask)
+{
+	int ret = 0;
+
+	if (mask & ~IHK_DEBUG_ALL) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&ihk_debug_lock);
+	if (data->ops->set_debug_mask) {
+		ret = __ihk_os_set_debug_mask(data, mask);
+		if (ret) {
+			goto out;
+		}
+	}
+
+	ihk_debug_update_keys(data->debug_mask, mask);
+	data->debug_mask = mask;
+ out:
+	mutex_unlock(&ihk_debug_lock);
+	return ret;
+}
+
+/* /sys/class/mcos/mcos<N>/debug_mask */
+static ssize_t debug_mask_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct ihk_host_linux_os_data *data = dev_get_drvdata(dev);
+	int len;
+
+	len = ihk_debug_format_mask(buf, PAGE_SIZE - 1, data->debug_mask);
+	buf[len++] = '\n';
+	return len;
+}
+
+static ssize_t debug_mask_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct ihk_host_linux_os_data *data = dev_get_drvdata(dev);
+	unsigned int mask;
+	int ret;
+
+	ret = ihk_debug_parse_mask(buf, &mask);
+	if (ret) {
+		return ret;
+	}
+
+	ret = ihk_os_set_debug_mask(data, mask);
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR(debug_mask, 0644, debug_mask_show, debug_mask_store);
+
+/* /sys/class/mcos/mcos<N>/cpu_acct, writing 0 resets the counters */
+static const char * const ihk_os_acct_names[IHK_OS_ACCT_NR] = {
+	"irq", "ikc", "work"
+};
+
+/* Room kept at the end of the page for the truncation note */
+#define IHK_OS_ACCT_TRUNC_LEN	48
+
+static ssize_t cpu_acct_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct ihk_host_linux_os_data *data = dev_get_drvdata(dev);
+	struct ihk_os_cpu_acct *acct;
+	int cpu, type, len, n;
+	int dropped = 0;
+	char line[16 + IHK_OS_ACCT_NR * 42];
+
+	len = scnprintf(buf, PAGE_SIZE, "cpu");
+	for (type = 0; type < IHK_OS_ACCT_NR; type++) {
+		len += scnprintf(buf + len, PAGE_SIZE - len, " %s_nr %s_cycles",
+				 ihk_os_acct_names[type],
+				 ihk_os_acct_names[type]);
+	}
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+
+	/* Only the CPUs that did something for this OS */
+	for_each_possible_cpu(cpu) {
+		acct = per_cpu_ptr(data->cpu_acct, cpu);
+		for (type = 0; type < IHK_OS_ACCT_NR; type++) {
+			if (acct->nr[type] || acct->cycles[type]) {
+				break;
+			}
+		}
+		if (type == IHK_OS_ACCT_NR) {
+			continue;
+		}
+
+		n = scnprintf(line, sizeof(line), "%d", cpu);
+		for (type = 0; type < IHK_OS_ACCT_NR; type++) {
+			n += scnprintf(line + n, sizeof(line) - n,
+				       " %lu %llu", acct->nr[type],
+				       acct->cycles[type]);
+		}
+		n += scnprintf(line + n, sizeof(line) - n, "\n");
+
+		/* Leave out whole lines which don't fit in the page */
+		if (dropped || len + n > PAGE_SIZE - IHK_OS_ACCT_TRUNC_LEN) {
+			dropped++;
+			continue;
+		}
+		memcpy(buf + len, line, n);
+		len += n;
+	}
+
+	if (dropped) {
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "# truncated, %d cpus not shown\n", dropped);
+	}
+
+	return len;
+}
+
+static ssize_t cpu_acct_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct ihk_host_linux_os_data *data = dev_get_drvdata(dev);
+	unsigned long val;
+	int cpu;
+
+	if (kstrtoul(buf, 0, &val) || val) {
+		return -EINVAL;
+	}
+
+	for_each_possible_cpu(cpu) {
+		memset(per_cpu_ptr(data->cpu_acct, cpu), 0,
+		       sizeof(struct ihk_os_cpu_acct));
+	}
+
+	return count;
+}
+
+static DEVICE_ATTR(cpu_acct, 0644, cpu_acct_show, cpu_acct_store);
+
+/* /sys/class/mcos/mcos<N>/stats, writing 0 resets them */
+static ssize_t stats_show(struct device *dev,
+			  struct device_attribute *attr, char *buf)
+{
+	struct ihk_host_linux_os_data *data = dev_get_drvdata(dev);
+
+	return __ihk_os_show_stats(data, buf);
+}
+
+static ssize_t stats_store(struct device *dev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct ihk_host_linux_os_data *data = dev_get_drvdata(dev);
+	unsigned long val;
+
+	if (kstrtoul(buf, 0, &val) || val) {
+		return -EINVAL;
+	}
+
+	__ihk_os_reset_stats(data);
+	return count;
+}
+
+static DEVICE_ATTR(stats, 0644, stats_show, stats_store);
+
 /*
  * OS character device file operations.
  */
@@ -889,19 +1184,15 @@ static int __ihk_os_clear_kmsg(struct ihk_host_linux_os_data *data)
 	return 0;
 }
 
-static int __ihk_os_register_event(struct ihk_host_linux_os_data *os, void __user *_desc)
+static int __ihk_os_register_event(struct ihk_host_linux_os_data *os,
+				   struct ihk_os_ioctl_eventfd_desc *desc)
 {
 	struct ihk_event *ep;
-	struct ihk_os_ioctl_eventfd_desc desc;
 	struct eventfd_ctx *event;
 	struct file *filp;
 	unsigned long flags;
 
-	if (copy_from_user(&desc, _desc, sizeof(desc))) {
-		return -EFAULT;
-	}
-
-	filp = eventfd_fget(desc.fd);
+	filp = eventfd_fget(desc->fd);
 	if (IS_ERR(filp)) {
 		return PTR_ERR(filp);
 	}
@@ -911,7 +1202,7 @@ static int __ihk_os_register_event(struct ihk_host_linux_os_data *os, void __use
 	}
 	ep = kzalloc(sizeof(struct ihk_event), GFP_KERNEL);
 	ep->event = event;
-	ep->type = desc.type;
+	ep->type = desc->type;
 	spin_lock_irqsave(&os->event_list_lock, flags);
 	list_add_tail(&ep->list, &os->event_list);
 	spin_unlock_irqrestore(&os->event_list_lock, flags);
@@ -1064,31 +1355,60 @@ static int __ihk_os_get_cpu_usage(struct ihk_host_linux_os_data *data, unsigned
 	return 0;
 }
 
-static int __ihk_os_read_kaddr(struct ihk_host_linux_os_data *data, void __user *arg)
+static int __ihk_os_read_kaddr(struct ihk_host_linux_os_data *data,
+			       struct ihk_os_read_kaddr_desc *desc)
 {
-	struct ihk_os_read_kaddr_desc desc;
 	unsigned long phys;
 
-	if (copy_from_user(&desc, arg, sizeof(desc))) {
-		return -EFAULT;
-	}
-
-	if (desc.flags & IHK_OS_READ_KADDR_PHYS) {
-		phys = desc.kaddr;
+	if (desc->flags & IHK_OS_READ_KADDR_PHYS) {
+		phys = desc->kaddr;
 	}
 	else {
-		if (data->ops->vtop(data, data->priv, desc.kaddr, &phys) != 0) {
+		if (data->ops->vtop(data, data->priv, desc->kaddr, &phys) != 0) {
 			return -EFAULT;
 		}
 	}
 
-	if (copy_to_user(desc.ubuf, phys_to_virt(phys), desc.len)) {
+	if (copy_to_user(desc->ubuf, phys_to_virt(phys), desc->len)) {
 		return -EFAULT;
 	}
 
 	return 0;
 }
 
+/** \brief Request the Linux CPU the master channel is bound to.
+ *  Takes effect on the next boot. */
+static int __ihk_os_set_ikc_master_cpu(struct ihk_host_linux_os_data *data,
+				       unsigned long arg)
+{
+	int cpu = (int)arg;
+
+	if (__ihk_os_status(data) != IHK_OS_STATUS_NOT_BOOTED) {
+		pr_err("%s: error: OS %d is already booted\n",
+		       __func__, data->minor);
+		return -EBUSY;
+	}
+
+	if (cpu != IHK_IKC_MASTER_CPU_AUTO &&
+	    (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))) {
+		pr_err("%s: error: invalid CPU %d\n", __func__, cpu);
+		return -EINVAL;
+	}
+
+	data->ikc_master_cpu = cpu;
+	return 0;
+}
+
+/** \brief Reports the master channel CPU of a booted OS,
+ *  or the requested one otherwise. The value can be negative
+ *  (IHK_IKC_MASTER_CPU_AUTO) so it is not passed as return value. */
+static int __ihk_os_get_ikc_master_cpu(struct ihk_host_linux_os_data *data,
+				       int *cpu)
+{
+	*cpu = data->mchannel ? data->mchannel_cpu : data->ikc_master_cpu;
+	return 0;
+}
+
 /** \brief Handles ioctl calls with the additional request number */
 static long __ihk_os_ioctl_call_aux(struct ihk_host_linux_os_data *os,
                                     unsigned int request, unsigned long arg,
@@ -1111,223 +1431,201 @@ static long __ihk_os_ioctl_call_aux(struct ihk_host_linux_os_data *os,
 	return -EINVAL;
 }
 
-static int __ihk_os_ioctl_perm(unsigned int request)
-{
-	int ret = 0;
-	kuid_t euid;
-
-	switch (request) {
-	case IHK_OS_QUERY_STATUS:
-	case IHK_OS_GET_NUM_NUMA_NODES:
-	case IHK_OS_QUERY_FREE_MEM:
-	case IHK_OS_ALLOC_CPU:
-	case IHK_OS_ALLOC_MEM:
-	case IHK_OS_RESERVE_CPU:
-	case IHK_OS_RESERVE_MEM:
-	case IHK_OS_READ_KMSG:
-	case IHK_OS_CLEAR_KMSG:
-	case IHK_OS_QUERY_CPU:
-	case IHK_OS_QUERY_MEM:
-	case IHK_OS_GET_BUILDID:
-	case IHK_OS_STATUS:
-	case IHK_OS_GET_USAGE:
-	case IHK_OS_GET_CPU_USAGE:
-	case IHK_OS_GET_NUM_CPUS:
-	case IHK_OS_READ_KADDR:
-		break;
-	default:
-		if (request >= IHK_OS_DEBUG_START && 
-			request <= IHK_OS_DEBUG_END) {
-			break;
-		}
-		else if (request >= IHK_OS_AUX_CALL_START &&
-		           request <= IHK_OS_AUX_CALL_END) {
-			break;
-		}
+/*
+ * Requests of the OS file indexed by their offset from IHK_OS_LOAD.
+ * Unprivileged requests are flagged IHK_IOCTL_PERM_ANY, the others
+ * require root. When in_size / out_size is set, the argument is copied
+ * in before and / or out after the call and the handler gets a kernel
+ * pointer to it.
+ */
+enum ihk_ioctl_perm {
+	IHK_IOCTL_PERM_ROOT = 0,
+	IHK_IOCTL_PERM_ANY,
+};
 
-		euid = current_euid();
-		dprintf("%s: request=0x%x, euid=%u\n",
-			__FUNCTION__, request, euid.val);
-		if (euid.val) {
-			ret = -EPERM;
-		}
-		break;
+typedef long (*ihk_os_ioctl_func_t)(struct ihk_host_linux_os_data *data,
+				    unsigned long arg, struct file *file);
+
+struct ihk_os_ioctl_desc {
+	ihk_os_ioctl_func_t func;
+	enum ihk_ioctl_perm perm;
+	unsigned short in_size;
+	unsigned short out_size;
+};
+
+/* Largest argument copied by the dispatcher */
+union ihk_os_ioctl_arg {
+	struct ihk_os_read_kaddr_desc read_kaddr;
+	struct ihk_os_ioctl_eventfd_desc eventfd;
+	int cpu;
+};
+
+#define IHK_OS_IOCTL_FUNC(name, call)					\
+static long ihk_os_ioctl_##name(struct ihk_host_linux_os_data *data,	\
+				unsigned long arg, struct file *file)	\
+{									\
+	return call;							\
+}
+
+IHK_OS_IOCTL_FUNC(load, __ihk_os_ioctl_load(data, (char __user *)arg))
+IHK_OS_IOCTL_FUNC(boot, __ihk_os_boot(data, arg))
+IHK_OS_IOCTL_FUNC(shutdown, __ihk_os_shutdown(data, arg))
+IHK_OS_IOCTL_FUNC(alloc_cpu, __ihk_os_allocate_cpu(data, arg))
+IHK_OS_IOCTL_FUNC(alloc_mem, __ihk_os_allocate_mem(data, arg))
+IHK_OS_IOCTL_FUNC(reserve_cpu, __ihk_os_reserve_cpu(data, arg))
+IHK_OS_IOCTL_FUNC(reserve_mem, __ihk_os_reserve_mem(data, arg))
+IHK_OS_IOCTL_FUNC(assign_cpu, __ihk_os_assign_cpu(data, arg))
+IHK_OS_IOCTL_FUNC(release_cpu, __ihk_os_release_cpu(data, arg))
+IHK_OS_IOCTL_FUNC(set_ikc_map, __ihk_os_set_ikc_map(data, arg))
+IHK_OS_IOCTL_FUNC(get_ikc_map, __ihk_os_get_ikc_map(data, arg))
+IHK_OS_IOCTL_FUNC(set_pwr, __ihk_os_set_pwr(data, arg))
+IHK_OS_IOCTL_FUNC(get_pwr, __ihk_os_get_pwr(data, arg))
+IHK_OS_IOCTL_FUNC(get_buildid, __ihk_os_get_buildid(data, arg))
+IHK_OS_IOCTL_FUNC(get_num_cpus, __ihk_os_get_num_cpus(data))
+IHK_OS_IOCTL_FUNC(query_cpu, __ihk_os_query_cpu(data, arg))
+IHK_OS_IOCTL_FUNC(assign_mem, __ihk_os_assign_mem(data, arg))
+IHK_OS_IOCTL_FUNC(release_mem, __ihk_os_release_mem(data, arg))
+IHK_OS_IOCTL_FUNC(query_mem, __ihk_os_query_mem(data, arg))
+IHK_OS_IOCTL_FUNC(set_group, __ihk_os_set_group(data, arg))
+IHK_OS_IOCTL_FUNC(get_group, __ihk_os_get_group(data))
+IHK_OS_IOCTL_FUNC(query_status, __ihk_os_query_status(data))
+IHK_OS_IOCTL_FUNC(notify_hungup, (__ihk_os_notify_hungup(data), 0))
+IHK_OS_IOCTL_FUNC(get_num_numa_nodes, __ihk_os_get_num_numa_nodes(data))
+IHK_OS_IOCTL_FUNC(query_free_mem, __ihk_os_query_free_mem(data))
+IHK_OS_IOCTL_FUNC(set_kargs, __ihk_os_set_kargs(data, (char __user *)arg))
+IHK_OS_IOCTL_FUNC(read_kmsg, __ihk_os_read_kmsg(data, (char __user *)arg))
+IHK_OS_IOCTL_FUNC(status, __ihk_os_status(data))
+IHK_OS_IOCTL_FUNC(clear_kmsg, __ihk_os_clear_kmsg(data))
+IHK_OS_IOCTL_FUNC(dump, __ihk_os_dump(data, (char __user *)arg))
+IHK_OS_IOCTL_FUNC(register_event,
+		  __ihk_os_register_event(data, (void *)arg))
+IHK_OS_IOCTL_FUNC(eventfd, (ihk_os_eventfd(data, (int)arg), 0))
+IHK_OS_IOCTL_FUNC(freeze, __ihk_os_freeze(data))
+IHK_OS_IOCTL_FUNC(thaw, __ihk_os_thaw(data))
+IHK_OS_IOCTL_FUNC(get_usage, __ihk_os_get_usage(data, arg))
+IHK_OS_IOCTL_FUNC(get_cpu_usage, __ihk_os_get_cpu_usage(data, arg))
+IHK_OS_IOCTL_FUNC(read_kaddr, __ihk_os_read_kaddr(data, (void *)arg))
+IHK_OS_IOCTL_FUNC(set_ikc_master_cpu, __ihk_os_set_ikc_master_cpu(data, arg))
+IHK_OS_IOCTL_FUNC(get_ikc_master_cpu,
+		  __ihk_os_get_ikc_master_cpu(data, (int *)arg))
+IHK_OS_IOCTL_FUNC(set_debug_mask, ihk_os_set_debug_mask(data, arg))
+IHK_OS_IOCTL_FUNC(get_debug_mask, data->debug_mask)
+
+#define IHK_OS_IOCTL(request, name, perm, in, out)			\
+	[(request) - IHK_OS_LOAD] = {					\
+		ihk_os_ioctl_##name, IHK_IOCTL_PERM_##perm, in, out	\
+	}
+
+static const struct ihk_os_ioctl_desc ihk_os_ioctls[] = {
+	IHK_OS_IOCTL(IHK_OS_LOAD, load, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_BOOT, boot, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_SHUTDOWN, shutdown, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_QUERY_STATUS, query_status, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_SET_KARGS, set_kargs, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_QUERY_FREE_MEM, query_free_mem, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_DUMP, dump, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_ALLOC_CPU, alloc_cpu, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_ALLOC_MEM, alloc_mem, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_RESERVE_CPU, reserve_cpu, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_RESERVE_MEM, reserve_mem, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_STATUS, status, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_REGISTER_EVENT, register_event, ROOT,
+		     sizeof(struct ihk_os_ioctl_eventfd_desc), 0),
+	IHK_OS_IOCTL(IHK_OS_EVENTFD, eventfd, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_READ_KMSG, read_kmsg, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_CLEAR_KMSG, clear_kmsg, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_ASSIGN_CPU, assign_cpu, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_RELEASE_CPU, release_cpu, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_ASSIGN_MEM, assign_mem, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_RELEASE_MEM, release_mem, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_QUERY_CPU, query_cpu, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_QUERY_MEM, query_mem, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_SET_IKC_MAP, set_ikc_map, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_IKC_MAP, get_ikc_map, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_FREEZE, freeze, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_THAW, thaw, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_USAGE, get_usage, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_CPU_USAGE, get_cpu_usage, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_NUM_NUMA_NODES, get_num_numa_nodes, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_NOTIFY_HUNGUP, notify_hungup, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_BUILDID, get_buildid, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_NUM_CPUS, get_num_cpus, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_READ_KADDR, read_kaddr, ANY,
+		     sizeof(struct ihk_os_read_kaddr_desc), 0),
+	IHK_OS_IOCTL(IHK_OS_SET_IKC_MASTER_CPU, set_ikc_master_cpu, ROOT,
+		     0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_IKC_MASTER_CPU, get_ikc_master_cpu, ANY,
+		     0, sizeof(int)),
+	IHK_OS_IOCTL(IHK_OS_SET_PWR, set_pwr, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_PWR, get_pwr, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_SET_DEBUG_MASK, set_debug_mask, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_DEBUG_MASK, get_debug_mask, ANY, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_SET_GROUP, set_group, ROOT, 0, 0),
+	IHK_OS_IOCTL(IHK_OS_GET_GROUP, get_group, ANY, 0, 0),
+};
+
+static int ihk_ioctl_perm(enum ihk_ioctl_perm perm)
+{
+	if (perm == IHK_IOCTL_PERM_ANY) {
+		return 0;
 	}
-	dprintf("%s: request=0x%x, ret=%d\n", __FUNCTION__, request, ret);
 
-	return ret;
+	return uid_eq(current_euid(), GLOBAL_ROOT_UID) ? 0 : -EPERM;
 }
 
 /** \brief ioctl handling for a OS file */
 static long ihk_host_os_ioctl(struct file *file, unsigned int request,
                               unsigned long arg)
 {
-	int ret = -EINVAL;
+	long ret;
 	struct ihk_host_linux_os_data *data;
 	struct ihk_file *ifile;
+	const struct ihk_os_ioctl_desc *desc;
+	union ihk_os_ioctl_arg karg;
+	unsigned int nr = request - IHK_OS_LOAD;
 	
 	ifile = file->private_data;
 	data = ifile->osdata;
 
 /*	dprintf("IHK: ioctl request = %x, arg = %lx\n", request, arg); */
 
-	ret = __ihk_os_ioctl_perm(request);
-	if (ret) {
-		dprintf("%s: __ihk_os_ioctl_perm(0x%x) error(%d)\n",
-			__FUNCTION__, request, ret);
-		return ret;
+	/* Companion modules, unprivileged */
+	if (request >= IHK_OS_AUX_CALL_START &&
+	    request <= IHK_OS_AUX_CALL_END) {
+		return __ihk_os_ioctl_call_aux(data, request, arg, file);
 	}
 
-	switch (request) {
-	case IHK_OS_LOAD:
-		ret = __ihk_os_ioctl_load(data, (char * __user)arg);
-		break;
-
-	case IHK_OS_BOOT:
-		ret = __ihk_os_boot(data, arg);
-		break;
-
-	case IHK_OS_SHUTDOWN:
-		ret = __ihk_os_shutdown(data, arg);
-		break;
-
-	case IHK_OS_ALLOC_CPU:
-		ret = __ihk_os_allocate_cpu(data, arg);
-		break;
-
-	case IHK_OS_ALLOC_MEM:
-		ret = __ihk_os_allocate_mem(data, arg);
-		break;
-
-	case IHK_OS_RESERVE_CPU:
-		ret = __ihk_os_reserve_cpu(data, arg);
-		break;
-
-	case IHK_OS_RESERVE_MEM:
-		ret = __ihk_os_reserve_mem(data, arg);
-		break;
-
-	case IHK_OS_ASSIGN_CPU:
-		ret = __ihk_os_assign_cpu(data, arg);
-		break;
-
-	case IHK_OS_RELEASE_CPU:
-		ret = __ihk_os_release_cpu(data, arg);
-		break;
-
-	case IHK_OS_SET_IKC_MAP:
-		ret = __ihk_os_set_ikc_map(data, arg);
-		break;
-
-	case IHK_OS_GET_IKC_MAP:
-		ret = __ihk_os_get_ikc_map(data, arg);
-		break;
-
-	case IHK_OS_GET_BUILDID:
-		ret = __ihk_os_get_buildid(data, arg);
-		break;
-
-	case IHK_OS_GET_NUM_CPUS:
-		ret = __ihk_os_get_num_cpus(data);
-		break;
-
-	case IHK_OS_QUERY_CPU:
-		ret = __ihk_os_query_cpu(data, arg);
-		break;
-
-	case IHK_OS_ASSIGN_MEM:
-		ret = __ihk_os_assign_mem(data, arg);
-		break;
-
-	case IHK_OS_RELEASE_MEM:
-		ret = __ihk_os_release_mem(data, arg);
-		break;
-
-	case IHK_OS_QUERY_MEM:
-		ret = __ihk_os_query_mem(data, arg);
-		break;
-
-	case IHK_OS_QUERY_STATUS:
-		ret = __ihk_os_query_status(data);
-		break;
-
-	case IHK_OS_NOTIFY_HUNGUP:
-		__ihk_os_notify_hungup(data);
-		ret = 0;
-		break;
-
-	case IHK_OS_GET_NUM_NUMA_NODES:
-		ret = __ihk_os_get_num_numa_nodes(data);
-		break;
-
-	case IHK_OS_QUERY_FREE_MEM:
-		ret = __ihk_os_query_free_mem(data);
-		break;
-
-	case IHK_OS_SET_KARGS:
-		ret = __ihk_os_set_kargs(data, (char * __user)arg);
-		break;
-
-	case IHK_OS_READ_KMSG:
-		ret = __ihk_os_read_kmsg(data, (char * __user)arg);
-		break;
-
-	case IHK_OS_STATUS:
-		ret = __ihk_os_status(data);
-		dkprintf("%s: __ihk_os_status returned %d\n", __FUNCTION__, ret);
-		break;
-
-	case IHK_OS_CLEAR_KMSG:
-		ret = __ihk_os_clear_kmsg(data);
-		break;
-
-	case IHK_OS_DUMP:
-		ret = __ihk_os_dump(data, (char __user *)arg);
-		break;
-
-	case IHK_OS_REGISTER_EVENT:
-		ret = __ihk_os_register_event(data, (void __user *)arg);
-		break;
-
-	case IHK_OS_EVENTFD:
-		ihk_os_eventfd(data, (int)arg);
-		ret = 0;
-		break;
+	if (request >= IHK_OS_DEBUG_START &&
+	    request <= IHK_OS_DEBUG_END) {
+		return __ihk_os_ioctl_debug_request(data, request, arg);
+	}
 
-	case IHK_OS_FREEZE:
-		ret = __ihk_os_freeze(data);
-		dkprintf("__ihk_os_freeze(ret=%d)\n",ret);
-		break;
+	if (nr >= ARRAY_SIZE(ihk_os_ioctls) || !ihk_os_ioctls[nr].func) {
+		return -EINVAL;
+	}
+	desc = &ihk_os_ioctls[nr];
 
-	case IHK_OS_THAW:
-		ret = __ihk_os_thaw(data);
-		dkprintf("__ihk_os_thaw  (ret=%d)\n",ret);
-		break;
+	ret = ihk_ioctl_perm(desc->perm);
+	if (ret) {
+		dprintf("%s: request=0x%x not permitted\n",
+			__FUNCTION__, request);
+		return ret;
+	}
 
-	case IHK_OS_GET_USAGE:
-		ret = __ihk_os_get_usage(data, arg);
-		dkprintf("__ihk_os_get_usage  (ret=%d)\n",ret);
-		break;
+	if (!desc->in_size && !desc->out_size) {
+		return desc->func(data, arg, file);
+	}
 
-	case IHK_OS_GET_CPU_USAGE:
-		ret = __ihk_os_get_cpu_usage(data, arg);
-		dkprintf("__ihk_os_get_cpu_usage  (ret=%d)\n",ret);
-		break;
+	if (desc->in_size &&
+	    copy_from_user(&karg, (void __user *)arg, desc->in_size)) {
+		return -EFAULT;
+	}
 
-	case IHK_OS_READ_KADDR:
-		ret = __ihk_os_read_kaddr(data, (void __user *)arg);
-		break;
+	ret = desc->func(data, (unsigned long)&karg, file);
 
-	default:
-		if (request >= IHK_OS_DEBUG_START && 
-		    request <= IHK_OS_DEBUG_END) {
-			ret = __ihk_os_ioctl_debug_request(data,
-			                                   request, arg);
-		} else if (request >= IHK_OS_AUX_CALL_START &&
-		           request <= IHK_OS_AUX_CALL_END) {
-			ret = __ihk_os_ioctl_call_aux(data, request, arg, file);
-		}
-		break;
+	if (ret >= 0 && desc->out_size &&
+	    copy_to_user((void __user *)arg, &karg, desc->out_size)) {
+		return -EFAULT;
 	}
 
 	return ret;
@@ -1548,6 +1846,7 @@ static int __ihk_device_create_os_init(struct ihk_host_linux_device_data *data,
 	spin_lock_init(&os->wait_lock);
 	spin_lock_init(&os->event_list_lock);
 	INIT_LIST_HEAD(&os->ikc_channels);
+	os->ikc_master_cpu = IHK_IKC_MASTER_CPU_AUTO;
 
 	os->regular_channels = kzalloc(sizeof(*os->regular_channels) *
 			num_possible_cpus(), GFP_KERNEL);
@@ -1557,7 +1856,14 @@ static int __ihk_device_create_os_init(struct ihk_host_linux_device_data *data,
 		goto ERR;
 	}
 
-	INIT_LIST_HEAD(&os->wait_list);
+	os->cpu_acct = alloc_percpu(struct ihk_os_cpu_acct);
+	if (!os->cpu_acct) {
+		ret = -ENOMEM;
+		printk("ihk: error allocating CPU accounting\n");
+		goto ERR;
+	}
+
+	INIT_LIST_HEAD(&os->wait_list);
 	INIT_LIST_HEAD(&os->aux_call_list);
 	INIT_LIST_HEAD(&os->event_list);
 
@@ -1582,6 +1888,7 @@ static int __ihk_device_create_os_init(struct ihk_host_linux_device_data *data,
 
 ERR:
 	if (os) {
+		free_percpu(os->cpu_acct);
 		kfree(os->regular_channels);
 		kfree(os);
 	}
@@ -1724,7 +2031,7 @@ static int __ihk_device_create_os(struct ihk_host_linux_device_data *data,
 	os_data[minor] = os;
 	os->minor = minor;
 
-	os->lindev = device_create(mcos_class, NULL, os->dev_num, NULL,
+	os->lindev = device_create(mcos_class, NULL, os->dev_num, os,
 			OS_DEV_NAME "%d", minor);
 	if (IS_ERR(os->lindev)) {
 		printk("ihk: device_create failed.\n");
@@ -1733,6 +2040,21 @@ static int __ihk_device_create_os(struct ihk_host_linux_device_data *data,
 		goto error;
 	}
 
+	if (device_create_file(os->lindev, &dev_attr_debug_mask)) {
+		pr_warn("ihk: creating debug_mask of %s%d failed\n",
+			OS_DEV_NAME, minor);
+	}
+
+	if (device_create_file(os->lindev, &dev_attr_cpu_acct)) {
+		pr_warn("ihk: creating cpu_acct of %s%d failed\n",
+			OS_DEV_NAME, minor);
+	}
+
+	if (device_create_file(os->lindev, &dev_attr_stats)) {
+		pr_warn("ihk: creating stats of %s%d failed\n",
+			OS_DEV_NAME, minor);
+	}
+
 	mutex_unlock(&os_lock);
 
 	return minor;
@@ -1800,10 +2122,20 @@ static int __ihk_device_destroy_os(struct ihk_host_linux_device_data *data,
 	os_data[os->minor] = NULL;
 
 	cdev_del(&os->cdev);
+	if (!IS_ERR_OR_NULL(os->lindev)) {
+		device_remove_file(os->lindev, &dev_attr_debug_mask);
+		device_remove_file(os->lindev, &dev_attr_cpu_acct);
+		device_remove_file(os->lindev, &dev_attr_stats);
+	}
 	device_destroy(mcos_class, os->dev_num);
 
+	mutex_lock(&ihk_debug_lock);
+	ihk_debug_update_keys(os->debug_mask, 0);
+	mutex_unlock(&ihk_debug_lock);
+
 	if (os->regular_channels)
 		kfree(os->regular_channels);
+	free_percpu(os->cpu_acct);
 	kfree(os);
 
 	ret = 0;
@@ -1940,99 +2272,407 @@ static int __ihk_device_query_mem(struct ihk_host_linux_device_data *data,
 	return data->ops->query_mem(data, arg);
 }
 
-/** \brief ioctl handler for the device file */
-static long ihk_host_device_ioctl(struct file *file, unsigned int request,
-                                  unsigned long arg)
+/** \brief Create a reservation group */
+static int __ihk_device_create_group(struct ihk_host_linux_device_data *data,
+		unsigned long arg)
 {
-	int ret = -EINVAL;
-	struct ihk_host_linux_device_data *data;
-	
-	data = file->private_data;
+	if (!data->ops || !data->ops->create_group)
+		return -1;
 
-	switch (request) {
-	case IHK_DEVICE_GET_BUILDID:
-		ret = __ihk_device_get_buildid(data, arg);
-		break;
+	return data->ops->create_group(data, arg);
+}
 
-	case IHK_DEVICE_CREATE_OS:
-		ret = __ihk_device_create_os(data, arg);
-		break;
-	
-	case IHK_DEVICE_DESTROY_OS:
-		if (arg > OS_MAX_MINOR || !os_data[arg]) {
-			printk("IHK: error: no OS exists with id %lu\n", arg);
-			return ret;
-		}
+/** \brief Release and remove a reservation group */
+static int __ihk_device_destroy_group(struct ihk_host_linux_device_data *data,
+		unsigned long arg)
+{
+	if (!data->ops || !data->ops->destroy_group)
+		return -1;
 
-		ret = __ihk_device_destroy_os(data, os_data[arg]);
-		break;
+	return data->ops->destroy_group(data, arg);
+}
 
-	case IHK_DEVICE_RESERVE_CPU:
-		ret = __ihk_device_reserve_cpu(data, arg);
-		break;
+/** \brief Query a reservation group */
+static int __ihk_device_query_group(struct ihk_host_linux_device_data *data,
+		unsigned long arg)
+{
+	if (!data->ops || !data->ops->query_group)
+		return -1;
 
-	case IHK_DEVICE_RELEASE_CPU:
-		ret = __ihk_device_release_cpu(data, arg);
-		break;
+	return data->ops->query_group(data, arg);
+}
 
-	case IHK_DEVICE_RESERVE_MEM:
-		ret = __ihk_device_reserve_mem(data, arg);
-		break;
+/** \brief Reserve CPU cores into a reservation group */
+static int __ihk_device_reserve_cpu_group(struct ihk_host_linux_device_data *data,
+		unsigned long arg)
+{
+	if (!data->ops || !data->ops->reserve_cpu_group)
+		return -1;
 
-#ifdef ENABLE_KRM_WORKAROUND
-	case IHK_DEVICE_RESERVE_MEM_MAX_RATIO:
-		ret = __ihk_device_reserve_mem_max_ratio(data, arg);
-		break;
-#endif
+	return data->ops->reserve_cpu_group(data, arg);
+}
 
-	case IHK_DEVICE_RELEASE_MEM:
-		ret = __ihk_device_release_mem(data, arg);
-		break;
+/** \brief Release CPU cores of a reservation group */
+static int __ihk_device_release_cpu_group(struct ihk_host_linux_device_data *data,
+		unsigned long arg)
+{
+	if (!data->ops || !data->ops->release_cpu_group)
+		return -1;
 
-	case IHK_DEVICE_RELEASE_MEM_PARTIALLY:
-		ret = __ihk_device_release_mem_partially(data, arg);
-		break;
+	return data->ops->release_cpu_group(data, arg);
+}
 
-	case IHK_DEVICE_GET_NUM_CPUS:
-		ret = __ihk_device_get_num_cpus(data);
-		break;
+/** \brief Reserve memory into a reservation group */
+static int __ihk_device_reserve_mem_group(struct ihk_host_linux_device_data *data,
+		unsigned long arg)
+{
+	if (!data->ops || !data->ops->reserve_mem_group)
+		return -1;
 
-	case IHK_DEVICE_QUERY_CPU:
-		ret = __ihk_device_query_cpu(data, arg);
-		break;
+	return data->ops->reserve_mem_group(data, arg);
+}
 
-	case IHK_DEVICE_QUERY_MEM:
-		ret = __ihk_device_query_mem(data, arg);
-		break;
+/** \brief Release memory of a reservation group */
+static int __ihk_device_release_mem_group(struct ihk_host_linux_device_data *data,
+		unsigned long arg)
+{
+	if (!data->ops || !data->ops->release_mem_group)
+		return -1;
 
-	case IHK_DEVICE_GET_KMSG_BUF:
-		ret = __ihk_device_get_kmsg_buf(file, (void __user *)arg);
-		break;
+	return data->ops->release_mem_group(data, arg);
+}
 
-	case IHK_DEVICE_READ_KMSG_BUF:
-		ret = __ihk_device_read_kmsg_buf(file, (void __user *)arg);
-		break;
+/** \brief Release memory of a reservation group */
+static int __ihk_device_release_mem_partially_group(
+		struct ihk_host_linux_device_data *data,
+		unsigned long arg)
+{
+	if (!data->ops || !data->ops->release_mem_partially_group)
+		return -1;
 
-	case IHK_DEVICE_RELEASE_KMSG_BUF:
-		ret = __ihk_device_release_kmsg_buf(file, arg);
-		break;
+	return data->ops->release_mem_partially_group(data, arg);
+}
 
-	case IHK_DEVICE_DETECT_HUNGUP:
-		ret = __ihk_device_detect_hungup(data, arg);
-		break;
+/** \brief Format statistics of lifecycle operations */
+static ssize_t __ihk_device_show_stats(struct ihk_host_linux_device_data *data,
+		char *buf)
+{
+	if (!data->ops || !data->ops->show_stats)
+		return -EINVAL;
 
-	default:
-		if (request >= IHK_DEVICE_DEBUG_START && 
-		    request <= IHK_DEVICE_DEBUG_END) {
-			ret = __ihk_device_ioctl_debug_request(data,
-			                                       request, arg);
+	return data->ops->show_stats(data, buf);
+}
+
+/** \brief Reset statistics of lifecycle operations */
+static void __ihk_device_reset_stats(struct ihk_host_linux_device_data *data)
+{
+	if (!data->ops || !data->ops->reset_stats)
+		return;
+
+	data->ops->reset_stats(data);
+}
+
+/* /sys/class/mcd/mcd<N>/stats, writing 0 resets them */
+static ssize_t dev_stats_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct ihk_host_linux_device_data *data = dev_get_drvdata(dev);
+
+	return __ihk_device_show_stats(data, buf);
+}
+
+static ssize_t dev_stats_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct ihk_host_linux_device_data *data = dev_get_drvdata(dev);
+	unsigned long val;
+
+	if (kstrtoul(buf, 0, &val) || val) {
+		return -EINVAL;
+	}
+
+	__ihk_device_reset_stats(data);
+	return count;
+}
+
+static struct device_attribute dev_attr_dev_stats =
+	__ATTR(stats, 0644, dev_stats_show, dev_stats_store);
+
+static void __ihk_device_lock_mem(struct ihk_host_linux_device_data *data)
+{
+	if (data->ops->lock_mem) {
+		data->ops->lock_mem(data, data->priv);
+	}
+}
+
+static void __ihk_device_unlock_mem(struct ihk_host_linux_device_data *data)
+{
+	if (data->ops->unlock_mem) {
+		data->ops->unlock_mem(data, data->priv);
+	}
+}
+
+/** \brief Kernel address of [off, off + size) of the memory of os
+ *  (of any OS if NULL), or NULL if the driver can't access it through
+ *  the linear map. Must be called under __ihk_device_lock_mem(). */
+static void *ihk_host_device_linear(struct ihk_host_linux_device_data *data,
+                                    ihk_os_t os, unsigned long off,
+                                    size_t size)
+{
+	unsigned long pa;
+
+	if (!data->ops->linear_map || !size || off + size < off) {
+		return NULL;
+	}
+
+	pa = ihk_device_map_memory(data, off, size);
+	if ((long)pa <= 0) {
+		return NULL;
+	}
+
+	return __ihk_device_linear_map(data, os, pa, size);
+}
+
+/** \brief Copy a list of scattered ranges of memory of an OS from or
+ *  to user buffers. All segments are checked before any is copied and
+ *  the memory is kept from being released until the last copy is done.
+ *  Returns the number of bytes copied. */
+static long __ihk_device_access_mem(struct ihk_host_linux_device_data *data,
+                                    void __user *arg)
+{
+	struct ihk_device_access_mem_desc desc;
+	struct ihk_mem_seg *segs = NULL;
+	void **vas = NULL;
+	ihk_os_t os;
+	unsigned long total = 0;
+	long ret = 0;
+	int i;
+
+	if (copy_from_user(&desc, arg, sizeof(desc))) {
+		return -EFAULT;
+	}
+
+	if (desc.nr_segs <= 0 ||
+	    desc.nr_segs > IHK_DEVICE_ACCESS_MEM_MAX_SEGS) {
+		return -EINVAL;
+	}
+
+	if (!data->ops->linear_map) {
+		return -EOPNOTSUPP;
+	}
+
+	os = ihk_host_find_os(desc.os_index, data);
+	if (!os) {
+		pr_err("%s: error: no OS exists with id %d\n",
+		       __func__, desc.os_index);
+		return -EINVAL;
+	}
+
+	segs = kmalloc_array(desc.nr_segs, sizeof(*segs), GFP_KERNEL);
+	vas = kmalloc_array(desc.nr_segs, sizeof(*vas), GFP_KERNEL);
+	if (!segs || !vas) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(segs, desc.segs, desc.nr_segs * sizeof(*segs))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < desc.nr_segs; i++) {
+		/* The byte count is returned through ioctl() */
+		total += segs[i].len;
+		if (segs[i].len > INT_MAX || total > INT_MAX) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	__ihk_device_lock_mem(data);
+
+	for (i = 0; i < desc.nr_segs; i++) {
+		vas[i] = ihk_host_device_linear(data, os, segs[i].phys,
+						segs[i].len);
+		if (!vas[i]) {
+			pr_err("%s: error: segment %d (0x%lx, %lu) isn't memory of OS %d\n",
+			       __func__, i, segs[i].phys, segs[i].len,
+			       desc.os_index);
+			ret = -EINVAL;
+			goto out_unlock;
 		}
-		break;
 	}
 
+	for (i = 0; i < desc.nr_segs; i++) {
+		unsigned long left;
+
+		if (desc.write) {
+			left = copy_from_user(vas[i],
+					(void __user *)segs[i].buf,
+					segs[i].len);
+		}
+		else {
+			left = copy_to_user((void __user *)segs[i].buf,
+					vas[i], segs[i].len);
+		}
+
+		ret += segs[i].len - left;
+		if (left) {
+			if (ret == 0) {
+				ret = -EFAULT;
+			}
+			break;
+		}
+
+		cond_resched();
+	}
+
+ out_unlock:
+	__ihk_device_unlock_mem(data);
+ out:
+	kfree(vas);
+	kfree(segs);
 	return ret;
 }
 
+/*
+ * Requests of the device file indexed by their offset from
+ * IHK_DEVICE_CREATE_OS. Access to the device file itself is restricted
+ * by its mode, hence no request needs an additional check for now.
+ */
+typedef long (*ihk_device_ioctl_func_t)(struct ihk_host_linux_device_data *data,
+					unsigned long arg, struct file *file);
+
+struct ihk_device_ioctl_desc {
+	ihk_device_ioctl_func_t func;
+	enum ihk_ioctl_perm perm;
+};
+
+#define IHK_DEVICE_IOCTL_FUNC(name, call)				\
+static long ihk_device_ioctl_##name(struct ihk_host_linux_device_data *data, \
+				    unsigned long arg, struct file *file) \
+{									\
+	return call;							\
+}
+
+static long ihk_device_ioctl_destroy_os(struct ihk_host_linux_device_data *data,
+					unsigned long arg, struct file *file)
+{
+	if (arg > OS_MAX_MINOR || !os_data[arg]) {
+		printk("IHK: error: no OS exists with id %lu\n", arg);
+		return -EINVAL;
+	}
+
+	return __ihk_device_destroy_os(data, os_data[arg]);
+}
+
+IHK_DEVICE_IOCTL_FUNC(get_buildid, __ihk_device_get_buildid(data, arg))
+IHK_DEVICE_IOCTL_FUNC(create_os, __ihk_device_create_os(data, arg))
+IHK_DEVICE_IOCTL_FUNC(reserve_cpu, __ihk_device_reserve_cpu(data, arg))
+IHK_DEVICE_IOCTL_FUNC(release_cpu, __ihk_device_release_cpu(data, arg))
+IHK_DEVICE_IOCTL_FUNC(reserve_mem, __ihk_device_reserve_mem(data, arg))
+#ifdef ENABLE_KRM_WORKAROUND
+IHK_DEVICE_IOCTL_FUNC(reserve_mem_max_ratio,
+		      __ihk_device_reserve_mem_max_ratio(data, arg))
+#endif
+IHK_DEVICE_IOCTL_FUNC(release_mem, __ihk_device_release_mem(data, arg))
+IHK_DEVICE_IOCTL_FUNC(release_mem_partially,
+		      __ihk_device_release_mem_partially(data, arg))
+IHK_DEVICE_IOCTL_FUNC(get_num_cpus, __ihk_device_get_num_cpus(data))
+IHK_DEVICE_IOCTL_FUNC(query_cpu, __ihk_device_query_cpu(data, arg))
+IHK_DEVICE_IOCTL_FUNC(query_mem, __ihk_device_query_mem(data, arg))
+IHK_DEVICE_IOCTL_FUNC(get_kmsg_buf,
+		      __ihk_device_get_kmsg_buf(file, (void __user *)arg))
+IHK_DEVICE_IOCTL_FUNC(read_kmsg_buf,
+		      __ihk_device_read_kmsg_buf(file, (void __user *)arg))
+IHK_DEVICE_IOCTL_FUNC(release_kmsg_buf,
+		      __ihk_device_release_kmsg_buf(file, arg))
+IHK_DEVICE_IOCTL_FUNC(detect_hungup, __ihk_device_detect_hungup(data, arg))
+IHK_DEVICE_IOCTL_FUNC(access_mem,
+		      __ihk_device_access_mem(data, (void __user *)arg))
+IHK_DEVICE_IOCTL_FUNC(create_group, __ihk_device_create_group(data, arg))
+IHK_DEVICE_IOCTL_FUNC(destroy_group, __ihk_device_destroy_group(data, arg))
+IHK_DEVICE_IOCTL_FUNC(query_group, __ihk_device_query_group(data, arg))
+IHK_DEVICE_IOCTL_FUNC(reserve_cpu_group,
+		      __ihk_device_reserve_cpu_group(data, arg))
+IHK_DEVICE_IOCTL_FUNC(release_cpu_group,
+		      __ihk_device_release_cpu_group(data, arg))
+IHK_DEVICE_IOCTL_FUNC(reserve_mem_group,
+		      __ihk_device_reserve_mem_group(data, arg))
+IHK_DEVICE_IOCTL_FUNC(release_mem_group,
+		      __ihk_device_release_mem_group(data, arg))
+IHK_DEVICE_IOCTL_FUNC(release_mem_partially_group,
+		      __ihk_device_release_mem_partially_group(data, arg))
+
+#define IHK_DEVICE_IOCTL(request, name, perm)				\
+	[(request) - IHK_DEVICE_CREATE_OS] = {				\
+		ihk_device_ioctl_##name, IHK_IOCTL_PERM_##perm		\
+	}
+
+static const struct ihk_device_ioctl_desc ihk_device_ioctls[] = {
+	IHK_DEVICE_IOCTL(IHK_DEVICE_CREATE_OS, create_os, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_DESTROY_OS, destroy_os, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RESERVE_CPU, reserve_cpu, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RELEASE_CPU, release_cpu, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RESERVE_MEM, reserve_mem, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RELEASE_MEM, release_mem, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_QUERY_CPU, query_cpu, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_QUERY_MEM, query_mem, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_GET_KMSG_BUF, get_kmsg_buf, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_READ_KMSG_BUF, read_kmsg_buf, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RELEASE_KMSG_BUF, release_kmsg_buf, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_GET_BUILDID, get_buildid, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_GET_NUM_CPUS, get_num_cpus, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RELEASE_MEM_PARTIALLY,
+			 release_mem_partially, ANY),
+#ifdef ENABLE_KRM_WORKAROUND
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RESERVE_MEM_MAX_RATIO,
+			 reserve_mem_max_ratio, ANY),
+#endif
+	IHK_DEVICE_IOCTL(IHK_DEVICE_DETECT_HUNGUP, detect_hungup, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_ACCESS_MEM, access_mem, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_CREATE_GROUP, create_group, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_DESTROY_GROUP, destroy_group, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_QUERY_GROUP, query_group, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RESERVE_CPU_GROUP, reserve_cpu_group, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RELEASE_CPU_GROUP, release_cpu_group, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RESERVE_MEM_GROUP, reserve_mem_group, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RELEASE_MEM_GROUP, release_mem_group, ANY),
+	IHK_DEVICE_IOCTL(IHK_DEVICE_RELEASE_MEM_PARTIALLY_GROUP,
+			 release_mem_partially_group, ANY),
+};
+
+/** \brief ioctl handler for the device file */
+static long ihk_host_device_ioctl(struct file *file, unsigned int request,
+                                  unsigned long arg)
+{
+	long ret;
+	struct ihk_host_linux_device_data *data;
+	const struct ihk_device_ioctl_desc *desc;
+	unsigned int nr = request - IHK_DEVICE_CREATE_OS;
+	
+	data = file->private_data;
+
+	if (request >= IHK_DEVICE_DEBUG_START &&
+	    request <= IHK_DEVICE_DEBUG_END) {
+		return __ihk_device_ioctl_debug_request(data, request, arg);
+	}
+
+	if (nr >= ARRAY_SIZE(ihk_device_ioctls) ||
+	    !ihk_device_ioctls[nr].func) {
+		return -EINVAL;
+	}
+	desc = &ihk_device_ioctls[nr];
+
+	ret = ihk_ioctl_perm(desc->perm);
+	if (ret) {
+		return ret;
+	}
+
+	return desc->func(data, arg, file);
+}
+
 /** \brief read handler for the device file */
 static long ihk_host_device_read(struct file *file, char __user *buf,
                                  size_t size, loff_t *off)
@@ -2042,6 +2682,16 @@ static long ihk_host_device_read(struct file *file, char __user *buf,
 	size_t s;
 	struct ihk_host_linux_device_data *data = file->private_data;
 
+	__ihk_device_lock_mem(data);
+	va = ihk_host_device_linear(data, NULL, *off, size);
+	if (va) {
+		s = size - copy_to_user(buf, va, size);
+		__ihk_device_unlock_mem(data);
+		*off += s;
+		return s;
+	}
+	__ihk_device_unlock_mem(data);
+
 	pa = ihk_device_map_memory(data, *off, size);
 	if ((long)pa <= 0) {
 		return -EINVAL;
@@ -2073,6 +2723,16 @@ static long ihk_host_device_write(struct file *file, const char __user *buf,
 	size_t s;
 	struct ihk_host_linux_device_data *data = file->private_data;
 
+	__ihk_device_lock_mem(data);
+	va = ihk_host_device_linear(data, NULL, *off, size);
+	if (va) {
+		s = size - copy_from_user(va, buf, size);
+		__ihk_device_unlock_mem(data);
+		*off += s;
+		return s;
+	}
+	__ihk_device_unlock_mem(data);
+
 	pa = ihk_device_map_memory(data, *off, size);
 	if ((long)pa <= 0) {
 		return -EINVAL;
@@ -2095,6 +2755,69 @@ static long ihk_host_device_write(struct file *file, const char __user *buf,
 	return s;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+/** \brief readv/preadv handler for the device file. The file range
+ *  is validated once and copied to all user buffers. */
+static ssize_t ihk_host_device_read_iter(struct kiocb *iocb,
+                                         struct iov_iter *to)
+{
+	struct ihk_host_linux_device_data *data = iocb->ki_filp->private_data;
+	size_t size = iov_iter_count(to);
+	size_t s;
+	void *va;
+
+	if (!size) {
+		return 0;
+	}
+
+	__ihk_device_lock_mem(data);
+	va = ihk_host_device_linear(data, NULL, iocb->ki_pos, size);
+	if (!va) {
+		__ihk_device_unlock_mem(data);
+		return -EINVAL;
+	}
+
+	s = copy_to_iter(va, size, to);
+	__ihk_device_unlock_mem(data);
+	if (!s) {
+		return -EFAULT;
+	}
+	iocb->ki_pos += s;
+
+	return s;
+}
+
+/** \brief writev/pwritev handler for the device file */
+static ssize_t ihk_host_device_write_iter(struct kiocb *iocb,
+                                          struct iov_iter *from)
+{
+	struct ihk_host_linux_device_data *data = iocb->ki_filp->private_data;
+	size_t size = iov_iter_count(from);
+	size_t s;
+	void *va;
+
+	if (!size) {
+		return 0;
+	}
+
+	__ihk_device_lock_mem(data);
+	va = ihk_host_device_linear(data, NULL, iocb->ki_pos, size);
+	if (!va) {
+		__ihk_device_unlock_mem(data);
+		return -EINVAL;
+	}
+
+	s = copy_from_iter(va, size, from);
+	__ihk_device_unlock_mem(data);
+	if (!s) {
+		return -EFAULT;
+	}
+	iocb->ki_pos += s;
+
+	return s;
+}
+#endif
+
 struct ihk_host_map_data {
 	int count;
 	unsigned long pa;
@@ -2169,6 +2892,10 @@ static struct file_operations mcd_cdev_ops = {
 	.open = ihk_host_device_open,
 	.read = ihk_host_device_read,
 	.write = ihk_host_device_write,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+	.read_iter = ihk_host_device_read_iter,
+	.write_iter = ihk_host_device_write_iter,
+#endif
 	.mmap = ihk_host_device_mmap,
 	.unlocked_ioctl = ihk_host_device_ioctl,
 	.release = ihk_host_device_release,
@@ -2229,6 +2956,11 @@ static int __init ihk_host_driver_init(void)
 	INIT_LIST_HEAD(&ihk_kmsg_bufs);
 	spin_lock_init(&ihk_kmsg_bufs_lock);
 
+	mutex_lock(&ihk_debug_lock);
+	ihk_debug_update_keys(0, ihk_debug_mask);
+	ihk_debug_keys_ready = 1;
+	mutex_unlock(&ihk_debug_lock);
+
 	printk("IHK Initialized: Device number: Device %x, OS %x\n",
 	       mcd_dev_num, mcos_dev_num);
 
@@ -2354,12 +3086,18 @@ ihk_device_t ihk_register_device(struct ihk_register_device_data *param)
 		dev_data[minor] = NULL;
 		return NULL;
 	}
-	if (IS_ERR(device_create(mcd_class, NULL, data->dev_num, NULL,
-	                         DEV_DEV_NAME "%d", minor))) {
+	data->lindev = device_create(mcd_class, NULL, data->dev_num, data,
+	                             DEV_DEV_NAME "%d", minor);
+	if (IS_ERR(data->lindev)) {
 		dev_data[minor] = NULL;
 		return NULL;
 	}
 
+	if (device_create_file(data->lindev, &dev_attr_dev_stats)) {
+		pr_warn("ihk: creating stats of %s%d failed\n",
+			DEV_DEV_NAME, minor);
+	}
+
 	dev_data[minor] = data;
 	data->minor = minor;
 
@@ -2392,6 +3130,7 @@ int ihk_unregister_device(ihk_device_t ihkdev)
 	spin_unlock_irqrestore(&ihk_kmsg_bufs_lock, flags);
 
 	cdev_del(&data->cdev);
+	device_remove_file(data->lindev, &dev_attr_dev_stats);
 	device_destroy(mcd_class, data->dev_num);
 
 	if (data->ops->exit) {
@@ -2506,6 +3245,11 @@ int ihk_os_issue_interrupt(ihk_os_t os, int cpu, int vector)
 	return __ihk_os_issue_interrupt(os, cpu, vector);
 }
 
+int ihk_os_call_cpus(ihk_os_t os, struct ihk_os_cpu_call *call)
+{
+	return __ihk_os_call_cpus(os, call);
+}
+
 int ihk_os_send_nmi(ihk_os_t os, int mode)
 {
 	return __ihk_os_send_nmi(os, mode);
@@ -2687,6 +3431,37 @@ int ihk_host_os_get_index(ihk_os_t ihk_os)
 	return -1;
 }
 
+int ihk_host_os_get_ikc_master_cpu(ihk_os_t ihk_os)
+{
+	struct ihk_host_linux_os_data *os = ihk_os;
+
+	return os->ikc_master_cpu;
+}
+
+unsigned int ihk_host_os_get_debug_mask(ihk_os_t ihk_os)
+{
+	struct ihk_host_linux_os_data *os = ihk_os;
+
+	return os->debug_mask;
+}
+
+void ihk_host_os_account(ihk_os_t ihk_os, int type, unsigned long long start,
+			 unsigned long nr)
+{
+	struct ihk_host_linux_os_data *os = ihk_os;
+	unsigned long long cycles = get_cycles() - start;
+
+	this_cpu_add(os->cpu_acct->nr[type], nr);
+	this_cpu_add(os->cpu_acct->cycles[type], cycles);
+}
+
+void ihk_host_os_set_mchannel_cpu(ihk_os_t ihk_os, int cpu)
+{
+	struct ihk_host_linux_os_data *os = ihk_os;
+
+	os->mchannel_cpu = cpu;
+}
+
 int ihk_os_set_kernel_call_handlers(ihk_os_t ihk_os,
 	struct ihk_os_kernel_call_handler *handlers)
 {
@@ -2937,12 +3712,18 @@ EXPORT_SYMBOL(ihk_host_print_os_kmsg);
 EXPORT_SYMBOL(ihk_host_os_set_usrdata);
 EXPORT_SYMBOL(ihk_host_os_get_usrdata);
 EXPORT_SYMBOL(ihk_host_os_get_index);
+EXPORT_SYMBOL(ihk_host_os_get_ikc_master_cpu);
+EXPORT_SYMBOL(ihk_host_os_set_mchannel_cpu);
+EXPORT_SYMBOL(ihk_host_os_get_debug_mask);
+EXPORT_SYMBOL(ihk_host_os_account);
+EXPORT_SYMBOL(ihk_debug_keys);
 EXPORT_SYMBOL(ihk_os_to_dev);
 EXPORT_SYMBOL(ihk_device_map_virtual);
 EXPORT_SYMBOL(ihk_device_unmap_virtual);
 EXPORT_SYMBOL(ihk_device_map_memory);
 EXPORT_SYMBOL(ihk_device_unmap_memory);
 EXPORT_SYMBOL(ihk_os_issue_interrupt);
+EXPORT_SYMBOL(ihk_os_call_cpus);
 EXPORT_SYMBOL(ihk_os_send_nmi);
 EXPORT_SYMBOL(ihk_os_register_user_call_handlers);
 EXPORT_SYMBOL(ihk_os_unregister_user_call_handlers);
@@ -13,6 +13,7 @@
 #include <linux/cdev.h>
 #include <ikc/master.h>
 #include <ihk/ihk_debug.h>
+#include <ihk/ihk_host_driver.h>
 
 /** \brief Structure that manages a manycore device in Linux */
 struct ihk_host_linux_device_data {
@@ -37,6 +38,15 @@ struct ihk_host_linux_device_data {
 	struct ihk_device_ops *ops;
 	/** \brief Private pointer given by the IHK-Host device driver */
 	void *priv;
+	/** \brief Linux device of the device file */
+	struct device *lindev;
+};
+
+/** \brief Host CPU time spent on behalf of a kernel on one Linux CPU,
+ *  see ihk_host_os_account() */
+struct ihk_os_cpu_acct {
+	unsigned long nr[IHK_OS_ACCT_NR];
+	unsigned long long cycles[IHK_OS_ACCT_NR];
 };
 
 /** \brief Structure that manages a kernel instance in Linux */
@@ -97,8 +107,18 @@ struct ihk_host_linux_os_data {
 
 	/** \brief IKC master channel between the host and this kernel */
 	struct ihk_ikc_channel_desc *mchannel;
+	/** \brief Linux CPU requested for the master channel,
+	 *  IHK_IKC_MASTER_CPU_AUTO to let the driver choose one */
+	int ikc_master_cpu;
+	/** \brief Linux CPU the master channel is bound to for this boot */
+	int mchannel_cpu;
+	/** \brief Debug categories (IHK_DEBUG_*) enabled for this kernel,
+	 *  protected by ihk_debug_lock */
+	unsigned int debug_mask;
 	/** \brief IKC regular channels between the host and this kernel */
 	struct ihk_ikc_channel_desc **regular_channels;
+	/** \brief Host CPU time charged to this kernel, per Linux CPU */
+	struct ihk_os_cpu_acct __percpu *cpu_acct;
 	/** \brief Lock for listeners */
 	spinlock_t listener_lock;
 	/** \brief Array of the listeners */
@@ -35,7 +35,7 @@
 #define	dkprintf(...) kprintf(__VA_ARGS__)
 #define	ekprintf(...) kprintf(__VA_ARGS__)
 #else
-#define dkprintf(...) do { if (0) printk(__VA_ARGS__); } while (0)
+#define dkprintf(...) ihk_dbg(IHK_DEBUG_MIKC_BIT, __VA_ARGS__)
 #define	ekprintf(...) printk(__VA_ARGS__)
 #endif
 
@@ -57,7 +57,8 @@ struct ihk_ikc_channel_desc *ihk_host_ikc_init_first(ihk_os_t ihk_os,
 	ihk_ikc_system_init(ihk_os);
 	os->ikc_initialized = 1;
 
-	if (ihk_os_wait_for_status(ihk_os, IHK_OS_STATUS_READY, 0, 600) == 0) {
+	/* Sleep until the LWK interrupts us, for up to 60 sec */
+	if (ihk_os_wait_for_status(ihk_os, IHK_OS_STATUS_READY, 1, 600) == 0) {
 		/* XXX: 
 		 * We assume this address is remote, 
 		 * but the local is possible... */
@@ -81,7 +82,9 @@ struct ihk_ikc_channel_desc *ihk_host_ikc_init_first(ihk_os_t ihk_os,
 		ihk_ikc_init_desc(c, ihk_os, 0, rq, wq,
 		                  ihk_ikc_master_channel_packet_handler, c);
 
-		ihk_ikc_channel_set_cpu(c, 0);
+		/* The driver has told the LWK about this CPU at boot */
+		ihk_ikc_channel_set_cpu(c, os->mchannel_cpu);
+		dprintf("MIKC bound to Linux CPU %d\n", os->mchannel_cpu);
 
 		c->recv.qphys = rp;
 		c->send.qphys = wp;
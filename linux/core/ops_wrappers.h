@@ -106,6 +106,24 @@ IHK_OS_OPS_BEGIN(int, get_ikc_map,
 	IHK_OPS_BODY(get_ikc_map, arg);
 }
 
+IHK_OS_OPS_BEGIN(int, set_pwr,
+                 unsigned long arg)
+{
+	IHK_OPS_BODY(set_pwr, arg);
+}
+
+IHK_OS_OPS_BEGIN(int, get_pwr,
+                 unsigned long arg)
+{
+	IHK_OPS_BODY(get_pwr, arg);
+}
+
+IHK_OS_OPS_BEGIN(int, set_debug_mask,
+                 unsigned long arg)
+{
+	IHK_OPS_BODY(set_debug_mask, arg);
+}
+
 IHK_OS_OPS_BEGIN(int, get_buildid,
                  unsigned long arg)
 {
@@ -141,6 +159,27 @@ IHK_OS_OPS_BEGIN(int, query_mem,
 	IHK_OPS_BODY(query_mem, arg);
 }
 
+IHK_OS_OPS_BEGIN(int, set_group,
+                 unsigned long arg)
+{
+	IHK_OPS_BODY(set_group, arg);
+}
+
+IHK_OS_OPS_BEGIN_NOARG(int, get_group)
+{
+	IHK_OPS_BODY_NOARG(get_group);
+}
+
+IHK_OS_OPS_BEGIN(ssize_t, show_stats, char *buf)
+{
+	IHK_OPS_BODY(show_stats, buf);
+}
+
+IHK_OS_OPS_BEGIN_NOARG(void, reset_stats)
+{
+	IHK_OPS_BODY_VOID_NOARG(reset_stats);
+}
+
 IHK_OS_OPS_BEGIN(unsigned long, map_memory,
                  unsigned long rphys, unsigned long size)
 {
@@ -186,6 +225,11 @@ IHK_OS_OPS_BEGIN(int, issue_interrupt, int cpu, int vector)
 	IHK_OPS_BODY(issue_interrupt, cpu, vector);
 }
 
+IHK_OS_OPS_BEGIN(int, call_cpus, struct ihk_os_cpu_call *call)
+{
+	IHK_OPS_BODY(call_cpus, call);
+}
+
 IHK_OS_OPS_BEGIN(int, send_nmi, int mode)
 {
 	IHK_OPS_BODY(send_nmi, mode);
@@ -244,6 +288,12 @@ IHK_DEV_OPS_BEGIN(int, unmap_virtual, void *virtual, int flags)
 	IHK_OPS_BODY(unmap_virtual, virtual, flags);
 }
 
+IHK_DEV_OPS_BEGIN(void *, linear_map, ihk_os_t os,
+                  unsigned long phys, unsigned long size)
+{
+	IHK_OPS_BODY_PTR(linear_map, os, phys, size);
+}
+
 IHK_DEV_OPS_BEGIN(ihk_dma_channel_t, get_dma_channel, int channel)
 {
 	IHK_OPS_BODY_PTR(get_dma_channel, channel);
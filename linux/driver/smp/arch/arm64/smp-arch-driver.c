@@ -36,6 +36,9 @@
 #endif
 #include <linux/psci.h>
 #include <linux/fs.h>
+#include <linux/clocksource.h>
+#include <linux/timekeeping.h>
+#include <linux/workqueue.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
 #include <linux/kallsyms.h>
 #endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0) */
@@ -947,6 +950,169 @@ unsigned long calc_ns_per_tsc(void)
 	return 1000000000000L / freq;
 }
 
+/*
+ * Linux doesn't notify modules of timekeeping updates on arm64, thus the
+ * clock page is re-anchored to Linux time periodically. Stepping to
+ * Linux time at each anchor would make the LWK time go backwards when
+ * the extrapolation has run ahead. Instead the new anchor continues
+ * from where the LWK is, and mult follows the rate of Linux time plus
+ * a slew that makes up the difference over the next period. Only
+ * forward steps are taken, when Linux is ahead by more than the slew
+ * can make up.
+ */
+static unsigned int ihk_clock_update_ms = 1000;
+module_param(ihk_clock_update_ms, uint, 0644);
+MODULE_PARM_DESC(ihk_clock_update_ms, "LWK clock page update period in milliseconds");
+
+/* Largest correction of mult, in parts per million as NTP's slew limit */
+#define SMP_IHK_CLOCK_MAX_SLEW_PPM	500
+
+static struct ihk_smp_clock_page *smp_ihk_clock_page;
+static struct delayed_work smp_ihk_clock_work;
+static unsigned int smp_ihk_clock_freq;
+static u32 smp_ihk_clock_mult;		/* Nominal mult of the frequency */
+static u64 smp_ihk_clock_cval;		/* Counter and Linux monotonic */
+static u64 smp_ihk_clock_ns;		/* time at the last update */
+
+/* Most nanoseconds a slewed mult makes up over cycles */
+static s64 smp_ihk_clock_max_slew(u64 cycles, unsigned int shift)
+{
+	u64 max_adj = (u64)smp_ihk_clock_mult *
+		SMP_IHK_CLOCK_MAX_SLEW_PPM / 1000000;
+
+	return (max_adj * cycles) >> shift;
+}
+
+/* Change of mult making up ns over cycles, within the slew limit */
+static s64 smp_ihk_clock_slew(s64 ns, u64 cycles, unsigned int shift)
+{
+	s64 max_ns = smp_ihk_clock_max_slew(cycles, shift);
+
+	ns = clamp(ns, -max_ns, max_ns);
+	return div64_s64(ns * (1LL << shift), max_t(u64, cycles, 1));
+}
+
+static void smp_ihk_clock_update(struct work_struct *work)
+{
+	struct ihk_smp_clock_page *cp = smp_ihk_clock_page;
+	unsigned int period_ms = ihk_clock_update_ms ? : 1000;
+	struct timespec64 real, mono;
+	unsigned long flags;
+	u64 cval, mono_ns, anchor_ns, frac = 0;
+	u32 mult = smp_ihk_clock_mult;
+	u32 rem;
+
+	/* Readers wait from before cval is taken, so that they don't
+	 * extrapolate the old anchor past cval with a faster mult
+	 */
+	ihk_smp_clock_write_begin(cp);
+
+	local_irq_save(flags);
+	asm volatile(
+"	isb\n"
+"	mrs	%0, cntvct_el0\n"
+	: "=r" (cval)
+	:
+	: "memory");
+	ktime_get_real_ts64(&real);
+	ktime_get_ts64(&mono);
+	local_irq_restore(flags);
+
+	mono_ns = timespec64_to_ns(&mono);
+	anchor_ns = mono_ns;
+
+	if (cp->mode == IHK_SMP_CLOCK_MODE_COUNTER) {
+		u64 cycles = (u64)smp_ihk_clock_freq * period_ms / MSEC_PER_SEC;
+		u64 elapsed = cval - smp_ihk_clock_cval;
+		u64 snsec, lwk_ns;
+		s64 err;
+
+		/* Follow the rate of Linux time over the last period,
+		 * which NTP adjusts
+		 */
+		mult += smp_ihk_clock_slew(mono_ns - smp_ihk_clock_ns -
+					   ((elapsed * smp_ihk_clock_mult) >>
+					    cp->shift),
+					   elapsed, cp->shift);
+
+		/* What the LWK reads at cval with the current anchor */
+		snsec = cp->monotonic_time_snsec +
+			((cval - cp->cycle_last) & cp->mask) * cp->mult;
+		lwk_ns = cp->monotonic_time_sec * NSEC_PER_SEC +
+			(snsec >> cp->shift);
+		err = mono_ns - lwk_ns;
+
+		/* Make up the difference over the next period, step
+		 * forward only if that is too far
+		 */
+		if (err <= smp_ihk_clock_max_slew(cycles, cp->shift)) {
+			anchor_ns = lwk_ns;
+			frac = snsec & ((1ULL << cp->shift) - 1);
+			mult += smp_ihk_clock_slew(err, cycles, cp->shift);
+		}
+	}
+	smp_ihk_clock_cval = cval;
+	smp_ihk_clock_ns = mono_ns;
+
+	cp->cycle_last = cval;
+	cp->mult = mult;
+	cp->monotonic_time_sec = div_u64_rem(anchor_ns, NSEC_PER_SEC, &rem);
+	cp->monotonic_time_snsec = ((u64)rem << cp->shift) + frac;
+	/* Wall time keeps Linux' offset from monotonic time */
+	cp->wall_time_sec = div_u64_rem(timespec64_to_ns(&real) +
+					(anchor_ns - mono_ns),
+					NSEC_PER_SEC, &rem);
+	cp->wall_time_snsec = ((u64)rem << cp->shift) + frac;
+	cp->mode = IHK_SMP_CLOCK_MODE_COUNTER;
+	ihk_smp_clock_write_end(cp);
+
+	schedule_delayed_work(&smp_ihk_clock_work,
+			      msecs_to_jiffies(period_ms));
+}
+
+int smp_ihk_arch_clock_init(struct ihk_smp_clock_page *cp)
+{
+	unsigned int freq;
+	u32 mult, shift;
+
+	asm volatile(
+"	mrs	%0, cntfrq_el0\n"
+	: "=r" (freq)
+	:
+	: "memory");
+
+	if (!freq) {
+		pr_err("%s: error: generic timer frequency unknown\n",
+		       __func__);
+		return -EINVAL;
+	}
+
+	/* Keep the product in 64 bits for twice the update period */
+	clocks_calc_mult_shift(&mult, &shift, freq, NSEC_PER_SEC, 2 *
+			       max(ihk_clock_update_ms / MSEC_PER_SEC, 1U));
+
+	smp_ihk_clock_page = cp;
+	smp_ihk_clock_freq = freq;
+	smp_ihk_clock_mult = mult;
+	cp->mask = ~0UL;
+	cp->mult = mult;
+	cp->shift = shift;
+
+	INIT_DELAYED_WORK(&smp_ihk_clock_work, smp_ihk_clock_update);
+	smp_ihk_clock_update(&smp_ihk_clock_work.work);
+
+	return 0;
+}
+
+void smp_ihk_arch_clock_exit(void)
+{
+	if (!smp_ihk_clock_page)
+		return;
+
+	cancel_delayed_work_sync(&smp_ihk_clock_work);
+	smp_ihk_clock_page = NULL;
+}
+
 #ifdef CONFIG_ARM64_SVE
 unsigned long get_sve_default_vl(void)
 {
@@ -1363,10 +1529,25 @@ enum ihk_os_status smp_ihk_os_query_status(ihk_os_t ihk_os, void *priv)
 	return ret;
 }
 
+/*
+ * All CPUs of the OS for one cross call, which GICv3 turns into
+ * one SGI per affinity cluster with a target list
+ */
+void smp_ihk_arch_os_build_ipi_dests(struct smp_os_data *os)
+{
+	int i;
+
+	cpumask_clear(&os->ipi_mask);
+	for (i = 0; i < os->cpu_info.n_cpus; i++) {
+		cpumask_set_cpu(os->cpu_info.hw_ids[i], &os->ipi_mask);
+	}
+	os->nr_ipi_dests = 0;
+}
+
 int smp_ihk_os_send_nmi(ihk_os_t ihk_os, void *priv, int mode)
 {
 	struct smp_os_data *os = priv;
-	int i, ret;
+	int ret;
 
 	ret = ihk_smp_set_nmi_mode(ihk_os, priv, mode);
 	if (ret) {
@@ -1374,23 +1555,16 @@ int smp_ihk_os_send_nmi(ihk_os_t ihk_os, void *priv, int mode)
 	}
 
 	/* mode == 0,    for MEMDUMP NMI */
-	for (i = 0; i < os->cpu_info.n_cpus; ++i) {
-		int hwid = os->cpu_info.hw_ids[i];
-
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,1,0)
-		ihk___smp_cross_call(cpumask_of(hwid), INTRID_MULTI_NMI);
-#else
-		ihk___smp_cross_call(&cpumask_of_cpu(hwid), INTRID_MULTI_NMI);
-#endif
-		dprintk("send to NMI CPU:%d\n", hwid);
-	}
+	smp_mb();
+	ihk___smp_cross_call(&os->ipi_mask, INTRID_MULTI_NMI);
+	dprintk("send to NMI CPUs:%*pbl\n", cpumask_pr_args(&os->ipi_mask));
 	return 0;
 }
 
 int smp_ihk_os_send_multi_intr(ihk_os_t ihk_os, void *priv, int mode)
 {
 	struct smp_os_data *os = priv;
-	int i, ret;
+	int ret;
 
 	ret = ihk_smp_set_multi_intr_mode(ihk_os, priv, mode);
 	if (ret) {
@@ -1398,16 +1572,9 @@ int smp_ihk_os_send_multi_intr(ihk_os_t ihk_os, void *priv, int mode)
 	}
 
 	/* mode == 1or2, for FREEZER INTR */
-	for (i = 0; i < os->cpu_info.n_cpus; ++i) {
-		int hwid = os->cpu_info.hw_ids[i];
-
-#if KERNEL_VERSION(4, 1, 0) <= LINUX_VERSION_CODE
-		ihk___smp_cross_call(cpumask_of(hwid), INTRID_MULTI_INTR);
-#else
-		ihk___smp_cross_call(&cpumask_of_cpu(hwid), INTRID_MULTI_INTR);
-#endif
-		dprintk("send to INTR CPU:%d\n", hwid);
-	}
+	smp_mb();
+	ihk___smp_cross_call(&os->ipi_mask, INTRID_MULTI_INTR);
+	dprintk("send to INTR CPUs:%*pbl\n", cpumask_pr_args(&os->ipi_mask));
 	return 0;
 }
 
@@ -1642,7 +1809,33 @@ int smp_ihk_os_issue_interrupt(ihk_os_t ihk_os, void *priv,
 	ihk___smp_cross_call(&cpumask_of_cpu(os->cpu_info.hw_ids[cpu]), v);
 #endif
 
-	return -EINVAL;
+	return 0;
+}
+
+/* Interrupt the LWK CPUs in cpus (valid ids) with one cross call */
+int smp_ihk_os_issue_interrupt_cpus(ihk_os_t ihk_os, void *priv,
+				    const int *cpus, int nr_cpus, int v)
+{
+	struct smp_os_data *os = priv;
+	cpumask_var_t mask;
+	int i;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL)) {
+		for (i = 0; i < nr_cpus; i++) {
+			smp_ihk_os_issue_interrupt(ihk_os, priv, cpus[i], v);
+		}
+		return 0;
+	}
+
+	for (i = 0; i < nr_cpus; i++) {
+		cpumask_set_cpu(os->cpu_info.hw_ids[cpus[i]], mask);
+	}
+
+	smp_mb();
+	ihk___smp_cross_call(mask, v);
+	free_cpumask_var(mask);
+
+	return 0;
 }
 
 unsigned long smp_ihk_os_map_memory(ihk_os_t ihk_os, void *priv,
@@ -2637,6 +2830,24 @@ int smp_ihk_arch_get_perf_event_map(struct smp_boot_param *param)
 }
 #endif /* ENABLE_PERF */
 
+/* No frequency or power knobs are passed to the LWK on arm64 */
+void smp_ihk_arch_setup_boot_param_pwr(struct ihk_smp_boot_param_cpu *bp_cpu,
+				       struct ihk_pwr_setting *pwr)
+{
+}
+
+int smp_ihk_arch_os_apply_pwr(ihk_os_t ihk_os, int lwk_cpu,
+			      struct ihk_pwr_setting *pwr)
+{
+	return -EOPNOTSUPP;
+}
+
+int smp_ihk_arch_os_read_pwr_stat(ihk_os_t ihk_os, int lwk_cpu,
+				  struct ihk_pwr_stat *stat)
+{
+	return -EOPNOTSUPP;
+}
+
 void ihk_smp_free_page_tables(pgd_t *pt)
 {
 	printk(KERN_WARNING "%s: function not implemented.\n", __FUNCTION__);
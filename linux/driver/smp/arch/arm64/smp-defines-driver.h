@@ -62,6 +62,9 @@
 
 #define IHK_SMP_CHUNK_BASE_SIZE	(4UL << 20)	/* 4MiB a chunk */
 
+/* IPI of IKC interrupts to the LWK, see ihk_ikc_send_interrupt() */
+#define IHK_SMP_IKC_VECTOR	0x01
+
 #define rdtsc() arch_timer_read_counter()
 
 #endif /* HEADER_SMP_SMP_DEFINES_DRIVER_H */
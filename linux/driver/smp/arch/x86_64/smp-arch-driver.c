@@ -22,6 +22,8 @@
 #include <linux/version.h>
 #include <linux/kallsyms.h>
 #include <linux/mc146818rtc.h>
+#include <linux/pvclock_gtod.h>
+#include <linux/timekeeper_internal.h>
 #include <asm/tlbflush.h>
 #ifdef IHK_IKC_USE_LINUX_WORK_IRQ
 #include <asm/irq_vectors.h>
@@ -74,6 +76,27 @@ static void *trampoline_va;
 
 static int ident_npages_order = 0;
 static unsigned long *ident_page_table_virt;
+/* Physical range identity mapped by ident_page_table and the one it
+ * was sized for at load, they differ when it was limited to 256GB */
+static unsigned long ident_map_size;
+static unsigned long ident_phys_map_size;
+
+/*
+ * Physical range covered by the identity and straight mappings
+ * of the bootstrap page tables: up to the end of RAM, rounded up
+ * to 1GB and including the 32-bit MMIO hole
+ */
+static unsigned long smp_ihk_phys_map_size(void)
+{
+	unsigned long end_pfn = 0;
+	int nid;
+
+	for_each_online_node(nid) {
+		end_pfn = max(end_pfn, node_end_pfn(nid));
+	}
+
+	return ALIGN(max(end_pfn << PAGE_SHIFT, 1UL << 32), 1UL << PUD_SHIFT);
+}
 
 #ifndef IHK_IKC_USE_LINUX_WORK_IRQ
 static int ihk_smp_irq = 0;
@@ -390,6 +413,91 @@ out:
 	return ret;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+static struct ihk_smp_clock_page *smp_ihk_clock_page;
+
+/*
+ * Called by Linux timekeeping with the timekeeper lock held, on every
+ * update of the time bases (including NTP frequency adjustments).
+ */
+static int smp_ihk_clock_update(struct notifier_block *nb,
+				unsigned long unused, void *priv)
+{
+	struct timekeeper *tk = priv;
+	struct ihk_smp_clock_page *cp = smp_ihk_clock_page;
+	u64 snsec;
+
+	ihk_smp_clock_write_begin(cp);
+
+	/* The LWK can only follow Linux while it counts TSC cycles */
+	if (strcmp(tk->tkr_mono.clock->name, "tsc")) {
+		cp->mode = IHK_SMP_CLOCK_MODE_NONE;
+		goto out;
+	}
+
+	cp->mode = IHK_SMP_CLOCK_MODE_COUNTER;
+	cp->cycle_last = tk->tkr_mono.cycle_last;
+	cp->mask = tk->tkr_mono.mask;
+	cp->mult = tk->tkr_mono.mult;
+	cp->shift = tk->tkr_mono.shift;
+
+	cp->wall_time_sec = tk->xtime_sec;
+	cp->wall_time_snsec = tk->tkr_mono.xtime_nsec;
+
+	cp->monotonic_time_sec = tk->xtime_sec + tk->wall_to_monotonic.tv_sec;
+	snsec = tk->tkr_mono.xtime_nsec +
+		((u64)tk->wall_to_monotonic.tv_nsec << tk->tkr_mono.shift);
+	while (snsec >= ((u64)NSEC_PER_SEC << tk->tkr_mono.shift)) {
+		snsec -= ((u64)NSEC_PER_SEC << tk->tkr_mono.shift);
+		cp->monotonic_time_sec++;
+	}
+	cp->monotonic_time_snsec = snsec;
+
+out:
+	ihk_smp_clock_write_end(cp);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block smp_ihk_clock_notifier = {
+	.notifier_call = smp_ihk_clock_update,
+};
+
+int smp_ihk_arch_clock_init(struct ihk_smp_clock_page *cp)
+{
+	int ret;
+
+	smp_ihk_clock_page = cp;
+
+	/* Registration also fills in the page with the current state */
+	ret = pvclock_gtod_register_notifier(&smp_ihk_clock_notifier);
+	if (ret) {
+		pr_err("%s: error: registering pvclock notifier: %d\n",
+		       __func__, ret);
+		smp_ihk_clock_page = NULL;
+	}
+
+	return ret;
+}
+
+void smp_ihk_arch_clock_exit(void)
+{
+	if (!smp_ihk_clock_page)
+		return;
+
+	pvclock_gtod_unregister_notifier(&smp_ihk_clock_notifier);
+	smp_ihk_clock_page = NULL;
+}
+#else
+int smp_ihk_arch_clock_init(struct ihk_smp_clock_page *cp)
+{
+	return -EOPNOTSUPP;
+}
+
+void smp_ihk_arch_clock_exit(void)
+{
+}
+#endif
+
 unsigned long x2apic_is_enabled(void)
 {
 	unsigned long msr;
@@ -464,6 +572,128 @@ int smp_ihk_arch_vmap_area_taken(void)
 }
 #endif
 
+/* Large page PMD of vaddr in a bootstrap page table, NULL if none */
+static pmd_t *smp_ihk_boot_pt_large_pmd(pgd_t *pt, unsigned long vaddr)
+{
+	pgd_t *pgd;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+	p4d_t *p4d;
+#endif
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pt + pgd_index(vaddr);
+	if (!pgd_present(*pgd))
+		return NULL;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+	p4d = p4d_offset(pgd, vaddr);
+	if (!p4d_present(*p4d))
+		return NULL;
+	pud = pud_offset(p4d, vaddr);
+#else
+	pud = pud_offset(pgd, vaddr);
+#endif
+	if (!pud_present(*pud) || pud_large(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, vaddr);
+	if (!pmd_present(*pmd) || !pmd_large(*pmd))
+		return NULL;
+
+	return pmd;
+}
+
+/* Map a 1GB page, the caller checks X86_FEATURE_GBPAGES */
+static int ihk_smp_map_kernel_huge(pgd_t *pt,
+		unsigned long vaddr,
+		phys_addr_t paddr)
+{
+	pgd_t *pgd;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+	p4d_t *p4d;
+#endif
+	pud_t *pud;
+
+	if ((vaddr | paddr) & ((1UL << PUD_SHIFT) - 1))
+		return -EINVAL;
+
+	pgd = pt + pgd_index(vaddr);
+	if (!pgd_present(*pgd)) {
+		pud = (pud_t *)get_zeroed_page(GFP_KERNEL | GFP_DMA32);
+		if (!pud)
+			return -ENOMEM;
+		set_pgd(pgd, __pgd(__pa(pud) | _KERNPG_TABLE));
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+	p4d = p4d_offset(pgd, vaddr);
+	if (!p4d_present(*p4d)) {
+		pud = (pud_t *)get_zeroed_page(GFP_KERNEL | GFP_DMA32);
+		if (!pud)
+			return -ENOMEM;
+		set_p4d(p4d, __p4d(__pa(pud) | _KERNPG_TABLE));
+	}
+	pud = pud_offset(p4d, vaddr);
+#else
+	pud = pud_offset(pgd, vaddr);
+#endif
+	if (pud_present(*pud)) {
+		printk("%s: ERROR: mapping 0x%lx: PUD is busy\n",
+			__FUNCTION__, vaddr);
+		return -EBUSY;
+	}
+
+	set_pud(pud, pfn_pud(paddr >> PAGE_SHIFT, PAGE_KERNEL_LARGE_EXEC));
+	return 0;
+}
+
+/*
+ * Identity and straight mappings do not depend on the image,
+ * so they are built on the first boot only. 1GB pages are used
+ * where the CPU supports them.
+ */
+static int smp_ihk_init_boot_pt(struct smp_os_data *os)
+{
+	unsigned long _phys, _len, _step;
+	int ret;
+
+	os->boot_pt = (pgd_t *)get_zeroed_page(GFP_KERNEL);
+	if (!os->boot_pt) {
+		printk("%s: error: allocating boot PT\n", __FUNCTION__);
+		return -ENOMEM;
+	}
+
+	_len = smp_ihk_phys_map_size();
+	_step = boot_cpu_has(X86_FEATURE_GBPAGES) ?
+		(1UL << PUD_SHIFT) : IHK_SMP_LARGE_PAGE;
+
+	for (_phys = 0; _phys < _len; _phys += _step) {
+		/* Map identity */
+		ret = _step == IHK_SMP_LARGE_PAGE ?
+			ihk_smp_map_kernel(os->boot_pt, _phys, _phys) :
+			ihk_smp_map_kernel_huge(os->boot_pt, _phys, _phys);
+		if (ret < 0) {
+			printk("%s: error: mapping identity\n", __FUNCTION__);
+			return ret;
+		}
+
+		/* Map ST */
+		ret = _step == IHK_SMP_LARGE_PAGE ?
+			ihk_smp_map_kernel(os->boot_pt,
+					   IHK_SMP_MAP_ST_START + _phys, _phys) :
+			ihk_smp_map_kernel_huge(os->boot_pt,
+						IHK_SMP_MAP_ST_START + _phys, _phys);
+		if (ret < 0) {
+			printk("%s: error: mapping straight area\n", __FUNCTION__);
+			return ret;
+		}
+	}
+
+	os->boot_pt_map_size = _len;
+	dprintk("%s: mapped 0x%lx bytes with %s pages\n", __func__, _len,
+		_step == IHK_SMP_LARGE_PAGE ? "2MB" : "1GB");
+	return 0;
+}
+
 int smp_ihk_os_setup_startup(void *priv, unsigned long phys,
                             unsigned long entry)
 {
@@ -474,51 +704,53 @@ int smp_ihk_os_setup_startup(void *priv, unsigned long phys,
 	extern char startup_data_end[];
 	unsigned long startup_p;
 	unsigned long *startup;
+	unsigned long map_size;
+	pmd_t *pmd;
+	int ret;
 
-	os->boot_pt = (pgd_t *)get_zeroed_page(GFP_KERNEL);
-	if (!os->boot_pt) {
-		printk("%s: error: allocating boot PT\n", __FUNCTION__);
-		return -ENOMEM;
+	/* Page tables of the previous boot are kept by shutdown, rebuild
+	 * them when memory was hot-added or removed since */
+	map_size = smp_ihk_phys_map_size();
+	if (os->boot_pt && os->boot_pt_map_size != map_size) {
+		dprintk("%s: mapped range changed from 0x%lx to 0x%lx, rebuilding boot PT\n",
+			__func__, os->boot_pt_map_size, map_size);
+		ihk_smp_free_page_tables(os->boot_pt);
+		os->boot_pt = NULL;
 	}
 
-	/* Map identity (256GB) */
-	_len = 0x4000000000UL;
-	for (_virt = 0, _phys = 0; _virt < _len;
-			_virt += IHK_SMP_LARGE_PAGE, _phys += IHK_SMP_LARGE_PAGE) {
-		if (ihk_smp_map_kernel(os->boot_pt, _virt, _phys) < 0) {
-			printk("%s: error: mapping identity\n", __FUNCTION__);
-			return -ENOMEM;
-		}
+	/* The trampoline's identity mapping is built once at load */
+	if (map_size != ident_phys_map_size) {
+		printk("IHK-SMP: warning: RAM range changed to 0x%lx bytes since load, the trampoline maps 0x%lx bytes\n",
+		       map_size, ident_map_size);
 	}
-
-#if 0
-	/* Map PAGE_OFFSET */
-	for (_virt = PAGE_OFFSET, _phys = 0; _virt < (PAGE_OFFSET + _len);
-			_virt += IHK_SMP_LARGE_PAGE, _phys += IHK_SMP_LARGE_PAGE) {
-		if (ihk_smp_map_kernel(os->boot_pt, _virt, _phys) < 0) {
-			printk("%s: error: mapping Linux area\n", __FUNCTION__);
-			return -ENOMEM;
-		}
+	if (os->bootstrap_mem_end > ident_map_size) {
+		printk("%s: error: bootstrap memory 0x%lx is beyond the identity mapping of the trampoline\n",
+		       __func__, os->bootstrap_mem_end);
+		return -ERANGE;
 	}
-#endif
 
-	/* Map ST */
-	for (_virt = IHK_SMP_MAP_ST_START, _phys = 0; _virt < (IHK_SMP_MAP_ST_START + _len);
-			_virt += IHK_SMP_LARGE_PAGE, _phys += IHK_SMP_LARGE_PAGE) {
-		if (ihk_smp_map_kernel(os->boot_pt, _virt, _phys) < 0) {
-			printk("%s: error: mapping straight area\n", __FUNCTION__);
-			return -ENOMEM;
-		}
+	if (!os->boot_pt) {
+		ret = smp_ihk_init_boot_pt(os);
+		if (ret)
+			goto err;
 	}
 
-	/* Map kernel image */
+	/* Map kernel image, only the large pages which moved are replaced */
 	_len = (4 * IHK_SMP_LARGE_PAGE);
 	for (_virt = IHK_SMP_MAP_KERNEL_START, _phys = phys; 
 			_virt < (IHK_SMP_MAP_KERNEL_START + _len);
 			_virt += IHK_SMP_LARGE_PAGE, _phys += IHK_SMP_LARGE_PAGE) {
+		pmd = smp_ihk_boot_pt_large_pmd(os->boot_pt, _virt);
+		if (pmd) {
+			if (pmd_pfn(*pmd) == (_phys >> PAGE_SHIFT))
+				continue;
+			pmd_clear(pmd);
+		}
+
 		if (ihk_smp_map_kernel(os->boot_pt, _virt, _phys) < 0) {
 			printk("%s: error: mapping kernel image\n", __FUNCTION__);
-			return -ENOMEM;
+			ret = -ENOMEM;
+			goto err;
 		}
 	}
 
@@ -537,39 +769,99 @@ int smp_ihk_os_setup_startup(void *priv, unsigned long phys,
 	os->boot_rip = startup_p;
 
 	return 0;
+
+err:
+	ihk_smp_free_page_tables(os->boot_pt);
+	os->boot_pt = NULL;
+	return ret;
 }
 
-int smp_ihk_os_send_nmi(ihk_os_t ihk_os, void *priv, int mode)
+/*
+ * In x2APIC mode the logical ID of a CPU is derived from its APIC ID:
+ * the cluster in bits 31:16 and one of 16 bits within the cluster in
+ * bits 15:0, so one logical destination reaches any CPUs of a cluster.
+ */
+#define IHK_X2APIC_CLUSTER(ldr)		((ldr) >> 16)
+#define IHK_X2APIC_LDR(apicid) \
+	((((unsigned int)(apicid) >> 4) << 16) | (1U << ((apicid) & 0xf)))
+
+/* Merge apicid into the last destination of dests if in the same cluster */
+static int smp_ihk_x2apic_add_dest(unsigned int *dests, int nr_dests,
+				   int apicid)
 {
-	struct smp_os_data *os = priv;
-	int i, ret;
+	unsigned int ldr = IHK_X2APIC_LDR(apicid);
 
-	ret = ihk_smp_set_nmi_mode(ihk_os, priv, mode);
-	if (ret) {
-		return ret;
+	if (nr_dests > 0 &&
+	    IHK_X2APIC_CLUSTER(dests[nr_dests - 1]) == IHK_X2APIC_CLUSTER(ldr)) {
+		dests[nr_dests - 1] |= ldr;
+		return nr_dests;
 	}
 
+	dests[nr_dests] = ldr;
+	return nr_dests + 1;
+}
+
+void smp_ihk_arch_os_build_ipi_dests(struct smp_os_data *os)
+{
+	int i;
+
+	os->nr_ipi_dests = 0;
 	for (i = 0; i < os->cpu_info.n_cpus; i++) {
+		os->nr_ipi_dests = smp_ihk_x2apic_add_dest(os->ipi_dests,
+				os->nr_ipi_dests, os->cpu_info.hw_ids[i]);
+	}
+
+	dprintk("%s: %d CPUs in %d x2APIC destinations\n",
+		__func__, os->cpu_info.n_cpus, os->nr_ipi_dests);
+}
 
+/*
+ * Send vector v, or an NMI for NMI_VECTOR, to all CPUs of the OS,
+ * with one ICR write per cluster on x2APIC
+ */
+static void smp_ihk_os_send_ipi_all(struct smp_os_data *os, int v)
+{
+	unsigned long flags;
+	int i;
+
+	local_irq_save(flags);
 #ifdef CONFIG_X86_X2APIC
-		if (x2apic_is_enabled()) {
-			safe_apic_wait_icr_idle();
-			apic_icr_write(APIC_DM_NMI, os->cpu_info.hw_ids[i]);
+	if (x2apic_is_enabled()) {
+		unsigned int icr = APIC_DEST_LOGICAL |
+			(v == NMI_VECTOR ? APIC_DM_NMI : APIC_DM_FIXED | v);
+
+		for (i = 0; i < os->nr_ipi_dests; i++) {
+			native_x2apic_icr_write(icr, os->ipi_dests[i]);
 		}
-		else 		
+		goto out;
+	}
 #endif
-		{
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,6,0)
-			___default_send_IPI_dest_field(
-				os->cpu_info.hw_ids[i],
-				NMI_VECTOR, APIC_DEST_PHYSICAL);
+	for (i = 0; i < os->cpu_info.n_cpus; i++) {
+#if KERNEL_VERSION(4, 6, 0) <= LINUX_VERSION_CODE
+		___default_send_IPI_dest_field(os->cpu_info.hw_ids[i],
+					       v, APIC_DEST_PHYSICAL);
 #else
-			__default_send_IPI_dest_field(
-				os->cpu_info.hw_ids[i],
-				NMI_VECTOR, APIC_DEST_PHYSICAL);
+		__default_send_IPI_dest_field(os->cpu_info.hw_ids[i],
+					      v, APIC_DEST_PHYSICAL);
 #endif
-		}
 	}
+#ifdef CONFIG_X86_X2APIC
+ out:
+#endif
+	local_irq_restore(flags);
+}
+
+int smp_ihk_os_send_nmi(ihk_os_t ihk_os, void *priv, int mode)
+{
+	struct smp_os_data *os = priv;
+	int ret;
+
+	ret = ihk_smp_set_nmi_mode(ihk_os, priv, mode);
+	if (ret) {
+		return ret;
+	}
+
+	smp_ihk_os_send_ipi_all(os, NMI_VECTOR);
 	return 0;
 }
 
@@ -577,37 +869,14 @@ int smp_ihk_os_send_multi_intr(ihk_os_t ihk_os, void *priv, int mode)
 {
 	const int MULT_INTR_VECTOR = 242;
 	struct smp_os_data *os = priv;
-	int i, ret;
-	unsigned long flags;
+	int ret;
 
 	ret = ihk_smp_set_multi_intr_mode(ihk_os, priv, mode);
 	if (ret) {
 		return ret;
 	}
 
-	local_irq_save(flags);
-	for (i = 0; i < os->cpu_info.n_cpus; i++) {
-#ifdef CONFIG_X86_X2APIC
-		if (x2apic_is_enabled()) {
-			native_x2apic_icr_write(MULT_INTR_VECTOR,
-						os->cpu_info.hw_ids[i]);
-		}
-		else
-#endif
-		{
-#if KERNEL_VERSION(4, 6, 0) <= LINUX_VERSION_CODE
-			___default_send_IPI_dest_field(os->cpu_info.hw_ids[i],
-							MULT_INTR_VECTOR,
-							APIC_DEST_PHYSICAL);
-#else
-			__default_send_IPI_dest_field(os->cpu_info.hw_ids[i],
-							MULT_INTR_VECTOR,
-							APIC_DEST_PHYSICAL);
-#endif
-		}
-	}
-	local_irq_restore(flags);
-
+	smp_ihk_os_send_ipi_all(os, MULT_INTR_VECTOR);
 	return 0;
 }
 
@@ -964,7 +1233,58 @@ int smp_ihk_os_issue_interrupt(ihk_os_t ihk_os, void *priv,
 	}
 	local_irq_restore(flags);
 
-	return -EINVAL;
+	return 0;
+}
+
+/*
+ * Interrupt the LWK CPUs in cpus (valid ids) in one go, CPUs of
+ * the same x2APIC cluster next to each other share one ICR write
+ */
+int smp_ihk_os_issue_interrupt_cpus(ihk_os_t ihk_os, void *priv,
+				    const int *cpus, int nr_cpus, int v)
+{
+	struct smp_os_data *os = priv;
+	unsigned long flags;
+	int i;
+
+	local_irq_save(flags);
+#ifdef CONFIG_X86_X2APIC
+	if (x2apic_is_enabled()) {
+		unsigned int dests[2];
+		int nr_dests = 0;
+
+		for (i = 0; i < nr_cpus; i++) {
+			nr_dests = smp_ihk_x2apic_add_dest(dests, nr_dests,
+					os->cpu_info.hw_ids[cpus[i]]);
+			if (nr_dests == 2) {
+				native_x2apic_icr_write(APIC_DEST_LOGICAL | v,
+							dests[0]);
+				dests[0] = dests[1];
+				nr_dests = 1;
+			}
+		}
+		if (nr_dests) {
+			native_x2apic_icr_write(APIC_DEST_LOGICAL | v,
+						dests[0]);
+		}
+		goto out;
+	}
+#endif
+	for (i = 0; i < nr_cpus; i++) {
+		int apicid = os->cpu_info.hw_ids[cpus[i]];
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,6,0)
+		___default_send_IPI_dest_field(apicid, v, APIC_DEST_PHYSICAL);
+#else
+		__default_send_IPI_dest_field(apicid, v, APIC_DEST_PHYSICAL);
+#endif
+	}
+#ifdef CONFIG_X86_X2APIC
+ out:
+#endif
+	local_irq_restore(flags);
+
+	return 0;
 }
 
 unsigned long smp_ihk_os_map_memory(ihk_os_t ihk_os, void *priv,
@@ -1039,71 +1359,75 @@ static void ihk_smp_irq_flow_handler(unsigned int irq, struct irq_desc *desc)
 
 static int smp_ihk_init_ident_page_table(void)
 {
-	int ident_npages = 0;
-	int i, j, k;
-	unsigned long maxmem = 0, *p, physaddr;
+	int ident_npages, nr_pud_pages, nr_pmd_pages;
+	int i, j;
+	unsigned long maxmem, *p, physaddr;
 	struct page *ident_pages;
+	int gbpages = boot_cpu_has(X86_FEATURE_GBPAGES);
 
-	/* 256GB */
-	maxmem = (unsigned long)256 * (1024 * 1024 * 1024);
+	maxmem = smp_ihk_phys_map_size();
+	ident_phys_map_size = maxmem;
 
-	ident_npages = (maxmem + (1UL << PUD_SHIFT) - 1) >> PUD_SHIFT;
-	ident_npages_order = fls(ident_npages + 2) - 1;
-	if ((2 << ident_npages_order) != ident_npages + 2) {
-		ident_npages_order++;
+	/*
+	 * The tables have to be physically contiguous below 4GB,
+	 * keep the previous 256GB limit when only 2MB pages are available
+	 */
+	if (!gbpages && maxmem > (256UL << PUD_SHIFT)) {
+		printk("IHK-SMP: warning: no 1GB page support, "
+		       "identity mapping limited to 256GB\n");
+		maxmem = 256UL << PUD_SHIFT;
 	}
 
-	printk("IHK-SMP: page table pages = %d, ident_npages_order = %d\n",
-	       ident_npages, ident_npages_order);
+	nr_pud_pages = (maxmem + (1UL << PTL4_SHIFT) - 1) >> PTL4_SHIFT;
+	nr_pmd_pages = gbpages ? 0 : maxmem >> PUD_SHIFT;
+	ident_npages = 1 + nr_pud_pages + nr_pmd_pages;
+	ident_npages_order = get_order((unsigned long)ident_npages * PAGE_SIZE);
+
+	printk("IHK-SMP: page table pages = %d, ident_npages_order = %d, "
+	       "%s pages for 0x%lx bytes\n",
+	       ident_npages, ident_npages_order,
+	       gbpages ? "1GB" : "2MB", maxmem);
 
 	ident_pages = alloc_pages(GFP_DMA32 | GFP_KERNEL, ident_npages_order);
 	if (!ident_pages) {
 		printk("IHK-SMP: error: allocating identity page tables\n");
+		ident_npages_order = 0;
 		return ENOMEM;
 	}
 
 	ident_page_table = page_to_phys(ident_pages);
 	ident_page_table_virt = pfn_to_kaddr(page_to_pfn(ident_pages));
 
-	memset(ident_page_table_virt, 0, ident_npages);
+	memset(ident_page_table_virt, 0, PAGE_SIZE << ident_npages_order);
 
-	/* First level : We consider only < 512 GB of memory */
-	ident_page_table_virt[0] = (ident_page_table + PAGE_SIZE) | 0x63;
+	/* First level, one entry per 512GB */
+	for (i = 0; i < nr_pud_pages; i++) {
+		ident_page_table_virt[i] =
+			(ident_page_table + PAGE_SIZE * (1 + i)) | 0x63;
+	}
 
-	/* Second level */
+	/* Second level, 1GB pages or pointers to the third level */
 	p = ident_page_table_virt + (PAGE_SIZE / sizeof(*p));
-
-	for (i = 0; i < PTRS_PER_PUD; i++) {
-		if (((unsigned long)i << PUD_SHIFT) < maxmem) {
-		    *p = (ident_page_table + PAGE_SIZE * (2 + i)) | 0x63;
+	for (i = 0; i < (maxmem >> PUD_SHIFT); i++) {
+		physaddr = (unsigned long)i << PUD_SHIFT;
+		if (gbpages) {
+			p[i] = physaddr | 0xe3;
 		}
 		else {
-			break;
+			p[i] = (ident_page_table +
+				PAGE_SIZE * (1 + nr_pud_pages + i)) | 0x63;
 		}
-		p++;
 	}
 
-	if (i != ident_npages) {
-		printk("Something wrong for memory map. : %d vs %d\n",
-		       i, ident_npages);
-	}
-
-	/* Third level */
-	p = ident_page_table_virt + (PAGE_SIZE * 2 / sizeof(*p));
-	for (j = 0; j < ident_npages; j++) {
-		for (k = 0; k < PTRS_PER_PMD; k++) {
-			physaddr = ((unsigned long)j << PUD_SHIFT) |
-			            ((unsigned long)k << PMD_SHIFT);
-			if (physaddr < maxmem) {
-				*p = physaddr | 0xe3;
-				p++;
-			}
-			else {
-				break;
-			}
-		}
+	/* Third level, 2MB pages */
+	p = ident_page_table_virt +
+		(PAGE_SIZE * (1 + nr_pud_pages) / sizeof(*p));
+	for (j = 0; j < nr_pmd_pages * PTRS_PER_PMD; j++) {
+		physaddr = (unsigned long)j << PMD_SHIFT;
+		p[j] = physaddr | 0xe3;
 	}
 
+	ident_map_size = maxmem;
 	printk("IHK-SMP: identity page tables allocated\n");
 	return 0;
 }
@@ -1844,6 +2168,103 @@ int smp_ihk_arch_get_perf_event_map(struct smp_boot_param *param)
 }
 #endif /* ENABLE_PERF */
 
+void smp_ihk_arch_setup_boot_param_pwr(struct ihk_smp_boot_param_cpu *bp_cpu,
+				       struct ihk_pwr_setting *pwr)
+{
+	bp_cpu->pwr.min_perf = pwr->min_perf;
+	bp_cpu->pwr.max_perf = pwr->max_perf;
+	bp_cpu->pwr.epp = pwr->epp;
+	bp_cpu->pwr.epb = pwr->epb;
+	bp_cpu->pwr.turbo = pwr->turbo;
+	bp_cpu->pwr.cstate_limit = pwr->cstate_limit;
+}
+
+struct smp_ihk_pwr_target {
+	ihk_os_t ihk_os;
+	int lwk_cpu;
+};
+
+/* MSR accesses are carried out by the LWK CPU through IKC */
+static int smp_ihk_pwr_rdmsr(void *arg, unsigned int msr, unsigned long *val)
+{
+	struct smp_ihk_pwr_target *target = arg;
+	struct ihk_os_cpu_register desc = { .addr = msr };
+	int ret;
+
+	ret = ihk_os_read_cpu_register(target->ihk_os, target->lwk_cpu,
+				       &desc);
+	if (ret)
+		return ret;
+
+	*val = desc.val;
+	return 0;
+}
+
+static int smp_ihk_pwr_wrmsr(void *arg, unsigned int msr, unsigned long val)
+{
+	struct smp_ihk_pwr_target *target = arg;
+	struct ihk_os_cpu_register desc = { .addr = msr, .val = val };
+
+	return ihk_os_write_cpu_register(target->ihk_os, target->lwk_cpu,
+					 &desc);
+}
+
+int smp_ihk_arch_os_apply_pwr(ihk_os_t ihk_os, int lwk_cpu,
+			      struct ihk_pwr_setting *pwr)
+{
+	struct smp_ihk_pwr_target target = {
+		.ihk_os = ihk_os,
+		.lwk_cpu = lwk_cpu,
+	};
+	struct ihk_smp_boot_param_cpu bp_cpu;
+	unsigned int features = 0;
+	int ret;
+
+	/* LWK CPUs are of the same model as the boot CPU */
+	if (boot_cpu_has(X86_FEATURE_HWP))
+		features |= IHK_SMP_PWR_FEAT_HWP;
+#ifdef X86_FEATURE_HWP_EPP
+	if (boot_cpu_has(X86_FEATURE_HWP_EPP))
+		features |= IHK_SMP_PWR_FEAT_HWP_EPP;
+#endif
+	if (boot_cpu_has(X86_FEATURE_EPB))
+		features |= IHK_SMP_PWR_FEAT_EPB;
+
+	smp_ihk_arch_setup_boot_param_pwr(&bp_cpu, pwr);
+	ret = ihk_smp_pwr_apply(&bp_cpu.pwr, features,
+				smp_ihk_pwr_rdmsr, smp_ihk_pwr_wrmsr, &target);
+	if (ret == IHK_SMP_PWR_CSTATE_LOCKED) {
+		pr_err("%s: error: C-state limit is locked by the BIOS\n",
+		       __func__);
+		ret = -EPERM;
+	}
+
+	return ret;
+}
+
+int smp_ihk_arch_os_read_pwr_stat(ihk_os_t ihk_os, int lwk_cpu,
+				  struct ihk_pwr_stat *stat)
+{
+	struct smp_ihk_pwr_target target = {
+		.ihk_os = ihk_os,
+		.lwk_cpu = lwk_cpu,
+	};
+	int ret;
+
+	if (!boot_cpu_has(X86_FEATURE_APERFMPERF))
+		return -EOPNOTSUPP;
+
+	ret = smp_ihk_pwr_rdmsr(&target, IHK_MSR_TSC, &stat->tsc);
+	if (ret)
+		return ret;
+
+	ret = smp_ihk_pwr_rdmsr(&target, IHK_MSR_APERF, &stat->aperf);
+	if (ret)
+		return ret;
+
+	return smp_ihk_pwr_rdmsr(&target, IHK_MSR_MPERF, &stat->mperf);
+}
+
 void ihk_smp_free_page_tables(pgd_t *pt)
 {
 	pgd_t *pgd;
@@ -1884,6 +2305,9 @@ void ihk_smp_free_page_tables(pgd_t *pt)
 				if (pud_none(*pud) || !pud_present(*pud))
 					continue;
 
+				if (pud_large(*pud))
+					continue;
+
 				for (pmd_i = 0; pmd_i < PTRS_PER_PMD; ++pmd_i) {
 					pmd = ((pmd_t *)pud_page_vaddr(*pud)) + pmd_i;
 
@@ -24,4 +24,7 @@
 
 #define IHK_SMP_CHUNK_BASE_SIZE	4194304
 
+/* Vector of IKC interrupts to the LWK, see ihk_ikc_send_interrupt() */
+#define IHK_SMP_IKC_VECTOR	0xd1
+
 #endif /* HEADER_SMP_SMP_DEFINES_DRIVER_H */
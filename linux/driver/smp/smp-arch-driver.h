@@ -40,6 +40,9 @@ int smp_ihk_os_setup_startup(void *priv, unsigned long entry,
 int smp_ihk_os_dump(ihk_os_t ihk_os, void *priv, dumpargs_t *args);
 enum ihk_os_status smp_ihk_os_query_status(ihk_os_t ihk_os, void *priv);
 int smp_ihk_os_issue_interrupt(ihk_os_t ihk_os, void *priv, int cpu, int v);
+int smp_ihk_os_issue_interrupt_cpus(ihk_os_t ihk_os, void *priv,
+				    const int *cpus, int nr_cpus, int v);
+void smp_ihk_arch_os_build_ipi_dests(struct smp_os_data *os);
 unsigned long smp_ihk_os_map_memory(ihk_os_t ihk_os, void *priv,
                                     unsigned long remote_phys,
                                     unsigned long size);
@@ -57,10 +60,18 @@ int ihk_smp_arch_symbols_init(void);
 int smp_ihk_os_check_ikc_map(ihk_os_t ihk_os);
 int ihk_smp_reset_cpu(int hw_id);
 void smp_ihk_arch_exit(void);
+int smp_ihk_arch_clock_init(struct ihk_smp_clock_page *cp);
+void smp_ihk_arch_clock_exit(void);
 int smp_ihk_arch_vmap_area_taken(void);
 int smp_ihk_os_send_multi_intr(ihk_os_t ihk_os, void *priv, int mode);
 int smp_ihk_os_send_nmi(ihk_os_t ihk_os, void *priv, int mode);
 int smp_ihk_arch_get_perf_event_map(struct smp_boot_param *param);
+void smp_ihk_arch_setup_boot_param_pwr(struct ihk_smp_boot_param_cpu *bp_cpu,
+				       struct ihk_pwr_setting *pwr);
+int smp_ihk_arch_os_apply_pwr(ihk_os_t ihk_os, int lwk_cpu,
+			      struct ihk_pwr_setting *pwr);
+int smp_ihk_arch_os_read_pwr_stat(ihk_os_t ihk_os, int lwk_cpu,
+				  struct ihk_pwr_stat *stat);
 
 void ihk_smp_free_page_tables(pgd_t *pt);
 int ihk_smp_map_kernel(pgd_t *pt, unsigned long vaddr, phys_addr_t paddr);
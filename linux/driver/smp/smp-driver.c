@@ -24,9 +24,17 @@
 #include <linux/slab_def.h>
 #include <linux/kallsyms.h>
 #include <linux/list_sort.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
 #include <linux/swap.h>
 #include <linux/time.h>
+#include <linux/timex.h>
 #include <linux/hugetlb.h>
+#include <linux/memory.h>
+#include <linux/cacheinfo.h>
+#include <linux/debugfs.h>
+#include <linux/crc32.h>
+#include <linux/kthread.h>
 #include <asm/hw_irq.h>
 #include <asm/pgtable.h>
 #if LINUX_VERSION_CODE == KERNEL_VERSION(2,6,32)
@@ -83,6 +91,18 @@ static unsigned int ihk_cores = 0;
 module_param(ihk_cores, uint, 0644);
 MODULE_PARM_DESC(ihk_cores, "IHK reserved CPU cores");
 
+static int ihk_handover = 0;
+module_param(ihk_handover, int, 0644);
+MODULE_PARM_DESC(ihk_handover, "Keep reserved CPUs and memory for the next module on unload");
+
+static unsigned long ihk_handover_phys = 0;
+module_param(ihk_handover_phys, ulong, 0444);
+MODULE_PARM_DESC(ihk_handover_phys, "Handover area left by the previous module");
+
+static unsigned int ihk_load_threads = 4;
+module_param(ihk_load_threads, uint, 0644);
+MODULE_PARM_DESC(ihk_load_threads, "Threads loading a large segment of the LWK image");
+
 //#define BUILTIN_COM_VECTOR	0xf1
 
 #define BUILTIN_DEV_STATUS_READY	0
@@ -93,9 +113,40 @@ unsigned long trampoline_phys;
 
 unsigned long ident_page_table;
 
+/* Linux-synchronized clock page, shared by all LWK instances */
+static struct ihk_smp_clock_page *ihk_smp_clock_page;
+
 static struct list_head ihk_mem_free_chunks;
 struct list_head ihk_mem_used_chunks;
 
+/*
+ * Index of ihk_mem_used_chunks for ihk_smp_map_virtual(): the ranges
+ * sorted by address, looked up with binary search under RCU. Writers
+ * serialize on ihk_mem_used_index_lock, which also covers their
+ * changes to ihk_mem_used_chunks, and publish a new copy.
+ */
+struct ihk_mem_used_range {
+	unsigned long addr;
+	unsigned long end;
+	ihk_os_t os;
+};
+
+struct ihk_mem_used_index {
+	int nr;
+	int max;
+	struct ihk_mem_used_range ranges[];
+};
+
+static struct ihk_mem_used_index __rcu *ihk_mem_used_index;
+static DEFINE_MUTEX(ihk_mem_used_index_lock);
+
+/*
+ * Held for reading while the device file copies from or to memory of
+ * OS instances, which may sleep, and for writing by the writers of
+ * ihk_mem_used_chunks so that no chunk is released under a copy.
+ */
+static DECLARE_RWSEM(ihk_mem_access_sem);
+
 static struct vmap_area *lwk_va;
 static int (*ihk_ioremap_page_range)(unsigned long addr, unsigned long end,
 				     phys_addr_t phys_addr, pgprot_t prot);
@@ -135,6 +186,9 @@ extern int smp_ihk_unmap_memory(ihk_device_t ihk_dev, void *priv,
 extern int smp_ihk_os_send_nmi(ihk_os_t ihk_os, void *priv, int mode);
 struct hstate *smp_ihk_hstates;
 unsigned int *smp_ihk_default_hstate_idx;
+/* Optional, used to describe the host topology to the LWK */
+static struct cpu_cacheinfo *(*ihk_get_cpu_cacheinfo)(unsigned int cpu);
+static bool (*ihk_node_is_toptier)(int node);
 
 /* ----------------------------------------------- */
 
@@ -162,6 +216,283 @@ struct chunk {
 	int numa_id;
 };
 
+/*
+ * Reservation groups. CPUs carry their group in ihk_smp_cpus[].group.
+ * Memory chunks aren't tagged, a group holds a per-NUMA-node budget of
+ * the free chunks instead: what was reserved into it, less what its
+ * OS instances have been assigned (the used chunks tagged with the
+ * group). The device-wide pool (group 0) may only use the free memory
+ * not set aside for the other groups. ihk_smp_group_lock serializes
+ * reservation, release and assignment against group changes.
+ */
+struct ihk_smp_group {
+	char name[IHK_GROUP_NAME_MAX];	/* Empty if the slot is free */
+	unsigned long *mem;		/* Reserved bytes per NUMA node */
+	int nr_os;			/* OS instances bound to the group */
+};
+
+static struct ihk_smp_group ihk_smp_groups[IHK_MAX_GROUPS];
+static DEFINE_MUTEX(ihk_smp_group_lock);
+
+static int ihk_smp_group_valid(int group)
+{
+	return group == 0 ||
+		(group > 0 && group < IHK_MAX_GROUPS &&
+		 ihk_smp_groups[group].name[0]);
+}
+
+/*
+ * Statistics of lifecycle operations, per NUMA node for the device
+ * and per OS instance. Reset by writing 0 to the stats file.
+ */
+enum {
+	IHK_SMP_DEV_STAT_RESERVE_MEM,
+	IHK_SMP_DEV_STAT_RELEASE_MEM,
+	IHK_SMP_DEV_STAT_RESERVE_CPU,
+	IHK_SMP_DEV_STAT_RELEASE_CPU,
+	IHK_SMP_DEV_STAT_NR
+};
+
+static const char * const ihk_smp_dev_stat_names[IHK_SMP_DEV_STAT_NR] = {
+	"reserve_mem", "release_mem", "reserve_cpu", "release_cpu"
+};
+
+static const char * const ihk_smp_os_stat_names[IHK_SMP_OS_STAT_NR] = {
+	"load", "boot", "shutdown"
+};
+
+/* Indexed by op * nr_node_ids + NUMA id */
+static struct ihk_smp_op_stat *ihk_smp_dev_stats;
+static DEFINE_SPINLOCK(ihk_smp_stats_lock);
+
+static void ihk_smp_stat_add(struct ihk_smp_op_stat *stat, ktime_t start,
+			     int ret, unsigned long amount)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	unsigned long flags;
+
+	spin_lock_irqsave(&ihk_smp_stats_lock, flags);
+	if (!stat->count || ns < stat->min_ns) {
+		stat->min_ns = ns;
+	}
+	if (ns > stat->max_ns) {
+		stat->max_ns = ns;
+	}
+	stat->count++;
+	if (ret) {
+		stat->errors++;
+	}
+	stat->amount += amount;
+	stat->last_ns = ns;
+	stat->total_ns += ns;
+	spin_unlock_irqrestore(&ihk_smp_stats_lock, flags);
+}
+
+static void ihk_smp_dev_stat_add(int op, int numa_id, ktime_t start,
+				 int ret, unsigned long amount)
+{
+	if (!ihk_smp_dev_stats || numa_id < 0 || numa_id >= nr_node_ids) {
+		return;
+	}
+
+	ihk_smp_stat_add(&ihk_smp_dev_stats[op * nr_node_ids + numa_id],
+			 start, ret, amount);
+}
+
+/* Room kept at the end of the page for the truncation note */
+#define IHK_SMP_STAT_TRUNC_LEN	48
+
+/*
+ * Append one line to buf. A line which doesn't fit in the page is
+ * counted in *dropped instead of being cut in the middle.
+ */
+static int ihk_smp_stat_format(char *buf, int len, const char *name,
+			       int numa_id, struct ihk_smp_op_stat *stat,
+			       int *dropped)
+{
+	struct ihk_smp_op_stat copy;
+	unsigned long flags;
+	char line[160];
+	int n = 0;
+
+	spin_lock_irqsave(&ihk_smp_stats_lock, flags);
+	copy = *stat;
+	spin_unlock_irqrestore(&ihk_smp_stats_lock, flags);
+
+	if (!copy.count) {
+		return len;
+	}
+
+	n += scnprintf(line + n, sizeof(line) - n, "%s ", name);
+	if (numa_id >= 0) {
+		n += scnprintf(line + n, sizeof(line) - n, "%d ", numa_id);
+	}
+	n += scnprintf(line + n, sizeof(line) - n,
+		       "%lu %lu %lu %llu %llu %llu %llu\n",
+		       copy.count, copy.errors, copy.amount,
+		       copy.last_ns, copy.min_ns, copy.max_ns,
+		       copy.total_ns);
+
+	if (*dropped || len + n > PAGE_SIZE - IHK_SMP_STAT_TRUNC_LEN) {
+		(*dropped)++;
+		return len;
+	}
+
+	memcpy(buf + len, line, n);
+	return len + n;
+}
+
+static int ihk_smp_stat_format_dropped(char *buf, int len, int dropped)
+{
+	if (!dropped) {
+		return len;
+	}
+
+	return len + scnprintf(buf + len, PAGE_SIZE - len,
+			       "# truncated, %d lines not shown\n",
+			       dropped);
+}
+
+static ssize_t smp_ihk_show_stats(ihk_device_t ihk_dev, char *buf)
+{
+	int op, numa_id, len;
+	int dropped = 0;
+
+	if (!ihk_smp_dev_stats) {
+		return -ENOMEM;
+	}
+
+	len = scnprintf(buf, PAGE_SIZE, "op node count errors amount "
+			"last_ns min_ns max_ns total_ns\n");
+	for (op = 0; op < IHK_SMP_DEV_STAT_NR; op++) {
+		for (numa_id = 0; numa_id < nr_node_ids; numa_id++) {
+			len = ihk_smp_stat_format(buf, len,
+				ihk_smp_dev_stat_names[op], numa_id,
+				&ihk_smp_dev_stats[op * nr_node_ids + numa_id],
+				&dropped);
+		}
+	}
+
+	return ihk_smp_stat_format_dropped(buf, len, dropped);
+}
+
+static void smp_ihk_reset_stats(ihk_device_t ihk_dev)
+{
+	unsigned long flags;
+
+	if (!ihk_smp_dev_stats) {
+		return;
+	}
+
+	spin_lock_irqsave(&ihk_smp_stats_lock, flags);
+	memset(ihk_smp_dev_stats, 0, sizeof(*ihk_smp_dev_stats) *
+	       IHK_SMP_DEV_STAT_NR * nr_node_ids);
+	spin_unlock_irqrestore(&ihk_smp_stats_lock, flags);
+}
+
+static ssize_t smp_ihk_os_show_stats(ihk_os_t ihk_os, void *priv, char *buf)
+{
+	struct smp_os_data *os = priv;
+	int op, len;
+	int dropped = 0;
+
+	len = scnprintf(buf, PAGE_SIZE, "op count errors amount "
+			"last_ns min_ns max_ns total_ns\n");
+	for (op = 0; op < IHK_SMP_OS_STAT_NR; op++) {
+		len = ihk_smp_stat_format(buf, len, ihk_smp_os_stat_names[op],
+					  -1, &os->stats[op], &dropped);
+	}
+
+	return ihk_smp_stat_format_dropped(buf, len, dropped);
+}
+
+static void smp_ihk_os_reset_stats(ihk_os_t ihk_os, void *priv)
+{
+	struct smp_os_data *os = priv;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ihk_smp_stats_lock, flags);
+	memset(os->stats, 0, sizeof(os->stats));
+	spin_unlock_irqrestore(&ihk_smp_stats_lock, flags);
+}
+
+static unsigned long ihk_smp_free_mem_on_node(int numa_id)
+{
+	struct chunk *mem_chunk;
+	unsigned long size = 0;
+
+	list_for_each_entry(mem_chunk, &ihk_mem_free_chunks, chain) {
+		if (mem_chunk->numa_id == numa_id) {
+			size += mem_chunk->size;
+		}
+	}
+
+	return size;
+}
+
+static unsigned long ihk_smp_group_mem_used(int group, int numa_id)
+{
+	struct ihk_os_mem_chunk *os_mem_chunk;
+	unsigned long size = 0;
+
+	mutex_lock(&ihk_mem_used_index_lock);
+	list_for_each_entry(os_mem_chunk, &ihk_mem_used_chunks, list) {
+		if (os_mem_chunk->group == group &&
+		    (numa_id < 0 || os_mem_chunk->numa_id == numa_id)) {
+			size += os_mem_chunk->size;
+		}
+	}
+	mutex_unlock(&ihk_mem_used_index_lock);
+
+	return size;
+}
+
+/* Budget of a group not yet assigned to its OS instances */
+static unsigned long ihk_smp_group_mem_unused(int group, int numa_id)
+{
+	unsigned long used;
+
+	if (!ihk_smp_groups[group].mem ||
+	    numa_id < 0 || numa_id >= nr_node_ids) {
+		return 0;
+	}
+
+	used = ihk_smp_group_mem_used(group, numa_id);
+	if (used >= ihk_smp_groups[group].mem[numa_id]) {
+		return 0;
+	}
+
+	return ihk_smp_groups[group].mem[numa_id] - used;
+}
+
+/** \brief Free memory on a NUMA node a group may use, i.e. assign to
+ *  its OS instances or release to Linux */
+static unsigned long ihk_smp_group_mem_avail(int group, int numa_id)
+{
+	unsigned long free = ihk_smp_free_mem_on_node(numa_id);
+	unsigned long others = 0;
+	int i;
+
+	if (group > 0) {
+		return min(free, ihk_smp_group_mem_unused(group, numa_id));
+	}
+
+	for (i = 1; i < IHK_MAX_GROUPS; i++) {
+		others += ihk_smp_group_mem_unused(i, numa_id);
+	}
+
+	return free > others ? free - others : 0;
+}
+
+/* Take bytes released to Linux off the budget of a group */
+static void ihk_smp_group_mem_debit(int group, int numa_id,
+				    unsigned long bytes)
+{
+	unsigned long *mem = &ihk_smp_groups[group].mem[numa_id];
+
+	*mem = *mem > bytes ? *mem - bytes : 0;
+}
+
 /* ----------------------------------------------- */
 static unsigned long dump_page_set_addr;
 static unsigned long dump_bootstrap_mem_start;
@@ -187,20 +518,161 @@ static int truncate_snprintf(char *str, size_t size,
 	return n;
 }
 
-void *ihk_smp_map_virtual(unsigned long phys, unsigned long size)
+static void ihk_smp_mem_index_free(struct ihk_mem_used_index *index)
 {
-	struct ihk_os_mem_chunk *os_mem_chunk = NULL;
+	if (is_vmalloc_addr(index)) {
+		vfree(index);
+	}
+	else {
+		kfree(index);
+	}
+}
+
+static int ihk_smp_mem_range_cmp(const void *a, const void *b)
+{
+	const struct ihk_mem_used_range *ra = a;
+	const struct ihk_mem_used_range *rb = b;
+
+	if (ra->addr < rb->addr)
+		return -1;
+	return ra->addr > rb->addr;
+}
+
+/** \brief Start changing ihk_mem_used_chunks. Returns the index to be
+ *  published by ihk_smp_mem_index_end() with room for nr_new more
+ *  chunks, or NULL if it couldn't be allocated. */
+static struct ihk_mem_used_index *ihk_smp_mem_index_begin(int nr_new)
+{
+	struct ihk_os_mem_chunk *os_mem_chunk;
+	struct ihk_mem_used_index *index;
+	size_t size;
+	int nr = nr_new;
+
+	down_write(&ihk_mem_access_sem);
+	mutex_lock(&ihk_mem_used_index_lock);
+
+	list_for_each_entry(os_mem_chunk, &ihk_mem_used_chunks, list) {
+		nr++;
+	}
+
+	size = sizeof(*index) + nr * sizeof(struct ihk_mem_used_range);
+	index = kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (!index) {
+		index = vmalloc(size);
+	}
+	if (index) {
+		index->max = nr;
+	}
+
+	return index;
+}
+
+/** \brief Publish ihk_mem_used_chunks as changed since
+ *  ihk_smp_mem_index_begin(). Without a new index, which is only
+ *  allowed when chunks were removed, the removed ranges are emptied
+ *  in place. */
+static void ihk_smp_mem_index_end(struct ihk_mem_used_index *index)
+{
+	struct ihk_mem_used_index *old;
+	struct ihk_os_mem_chunk *os_mem_chunk;
+	int i;
+
+	old = rcu_dereference_protected(ihk_mem_used_index,
+			lockdep_is_held(&ihk_mem_used_index_lock));
+
+	if (!index) {
+		for (i = 0; old && i < old->nr; i++) {
+			struct ihk_mem_used_range *range = &old->ranges[i];
+			int found = 0;
+
+			list_for_each_entry(os_mem_chunk,
+					    &ihk_mem_used_chunks, list) {
+				if (os_mem_chunk->addr == range->addr &&
+				    os_mem_chunk->addr + os_mem_chunk->size ==
+				    range->end) {
+					found = 1;
+					break;
+				}
+			}
 
-	/* look up address among used chunks */
+			if (!found) {
+				WRITE_ONCE(range->end, range->addr);
+			}
+		}
+		goto out;
+	}
+
+	index->nr = 0;
 	list_for_each_entry(os_mem_chunk, &ihk_mem_used_chunks, list) {
-		if (phys >= os_mem_chunk->addr &&
-		    (phys + size) <= (os_mem_chunk->addr + os_mem_chunk->size)) {
-			return (phys_to_virt(os_mem_chunk->addr) +
-			        (phys - os_mem_chunk->addr));
+		if (WARN_ON_ONCE(index->nr == index->max)) {
+			break;
 		}
+		index->ranges[index->nr].addr = os_mem_chunk->addr;
+		index->ranges[index->nr].end = os_mem_chunk->addr +
+			os_mem_chunk->size;
+		index->ranges[index->nr].os = os_mem_chunk->os;
+		index->nr++;
 	}
-	
-	return 0;
+	sort(index->ranges, index->nr, sizeof(struct ihk_mem_used_range),
+	     ihk_smp_mem_range_cmp, NULL);
+
+	rcu_assign_pointer(ihk_mem_used_index, index);
+	if (old) {
+		synchronize_rcu();
+		ihk_smp_mem_index_free(old);
+	}
+ out:
+	mutex_unlock(&ihk_mem_used_index_lock);
+	up_write(&ihk_mem_access_sem);
+}
+
+/* Linear map address of [phys, phys + size) if it lies in a chunk of
+ * os, or of any OS if os is NULL */
+static void *__ihk_smp_map_virtual(unsigned long phys, unsigned long size,
+				   ihk_os_t os)
+{
+	struct ihk_mem_used_index *index;
+	struct ihk_mem_used_range *range;
+	void *virt = NULL;
+	int lo, hi, mid;
+
+	rcu_read_lock();
+	index = rcu_dereference(ihk_mem_used_index);
+	if (!index) {
+		goto out;
+	}
+
+	/* Find the last range starting at or below phys */
+	lo = 0;
+	hi = index->nr;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (index->ranges[mid].addr <= phys) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if (lo > 0) {
+		unsigned long end;
+
+		range = &index->ranges[lo - 1];
+		end = READ_ONCE(range->end);
+		if (phys < end && phys + size <= end &&
+		    (!os || range->os == os)) {
+			virt = phys_to_virt(phys);
+		}
+	}
+ out:
+	rcu_read_unlock();
+	return virt;
+}
+
+void *ihk_smp_map_virtual(unsigned long phys, unsigned long size)
+{
+	return __ihk_smp_map_virtual(phys, size, NULL);
 }
 
 void ihk_smp_unmap_virtual(void *virt)
@@ -490,58 +962,532 @@ static tof_smmu_get_ipa_cq_t tofu_smmu_get_ipa = NULL;
 static tof_smmu_release_ipa_cq_t tofu_smmu_release_ipa = NULL;
 #endif
 
-/** \brief Boot a kernel. */
-static int smp_ihk_os_boot(ihk_os_t ihk_os, void *priv, int flag)
+/*
+ * Pick the Linux CPU the master channel of an OS is bound to.
+ * Without an explicit request, instances are spread over the IKC
+ * target CPUs of the OS (or over all online CPUs if no IKC map was
+ * given) by OS index, so that their control traffic does not all
+ * end up on CPU 0.
+ */
+static int smp_ihk_os_select_ikc_master_cpu(ihk_os_t ihk_os,
+					    struct smp_os_data *os)
 {
-	struct ihk_host_linux_os_data *ihk_core_os = (struct ihk_host_linux_os_data *)ihk_os;
-	struct smp_os_data *os = priv;
-	struct builtin_device_data *dev = os->dev;
-	unsigned long flags;
-	struct timespec now;
-	int param_size, param_pages_order = 0;
-	struct page *param_pages;
-	int dump_size, dump_pages_order = 0;
-	struct page *dump_pages;
-	struct ihk_os_mem_chunk *os_mem_chunk;
-	int nr_memory_chunks = 0;
-	int numa_id, linux_numa_id, nr_numa_nodes;
-	struct ihk_smp_boot_param_cpu *bp_cpu;
-	struct ihk_smp_boot_param_numa_node *bp_numa_node;
-	struct ihk_smp_boot_param_memory_chunk *bp_mem_chunk;
-	int lwk_cpu;
-	int *ihk_smp_boot_numa_distance;
-	int i, j;
-	unsigned long buffer_size, map_end, index;
-	struct ihk_dump_page *dump_page;
-	int ret;
+	int cpu = ihk_host_os_get_ikc_master_cpu(ihk_os);
+	int index = ihk_host_os_get_index(ihk_os);
+	cpumask_var_t candidates;
+	int lwk_cpu, nr_candidates;
 
-	spin_lock_irqsave(&dev->lock, flags);
-	if (dev->status != BUILTIN_DEV_STATUS_READY) {
-		pr_err("IHK-SMP: error: "
-		       "Device has already booted / is booting OS.\n");
-		ret = -EBUSY;
-		spin_unlock_irqrestore(&dev->lock, flags);
-		goto out;
+	if (cpu != IHK_IKC_MASTER_CPU_AUTO) {
+		if (cpu_online(cpu))
+			return cpu;
+
+		pr_warn("IHK-SMP: requested master channel CPU %d is offline, "
+			"selecting one automatically\n", cpu);
 	}
-	spin_unlock_irqrestore(&dev->lock, flags);
 
-	if (os->status == BUILTIN_OS_STATUS_BOOTING) {
-		pr_err("IHK-SMP: error: "
-		       "Device has already booted / is booting OS.\n");
-		ret = -EBUSY;
-		goto out;
+	if (!zalloc_cpumask_var(&candidates, GFP_KERNEL))
+		return 0;
+
+	if (os->cpu_ikc_mapped) {
+		for (lwk_cpu = 0; lwk_cpu < os->nr_cpus; ++lwk_cpu)
+			cpumask_set_cpu(os->cpu_ikc_map[lwk_cpu], candidates);
 	}
+	else {
+		cpumask_copy(candidates, cpu_online_mask);
+	}
+	cpumask_and(candidates, candidates, cpu_online_mask);
 
-	/* Compute size including CPUs, NUMA nodes and memory chunks */
-	param_size = (sizeof(*os->param));
-	param_size += os->nr_cpus * sizeof(struct ihk_smp_boot_param_cpu);
+	cpu = 0;
+	nr_candidates = cpumask_weight(candidates);
+	if (nr_candidates > 0) {
+		index = (index < 0 ? 0 : index) % nr_candidates;
+		for_each_cpu(cpu, candidates) {
+			if (index-- == 0)
+				break;
+		}
+	}
 
-	/* NUMA nodes */
-	nr_numa_nodes = hweight64(os->numa_mask);
-	param_size += (nr_numa_nodes * sizeof(struct ihk_smp_boot_param_numa_node));
+	free_cpumask_var(candidates);
+	return cpu;
+}
 
-	/* NUMA distances */
-	param_size += nr_numa_nodes * nr_numa_nodes * sizeof(int);
+/* Last level cache of an online cpu, NULL if unknown */
+static struct cacheinfo *smp_ihk_llc(int cpu)
+{
+	struct cpu_cacheinfo *cci;
+	struct cacheinfo *llc = NULL;
+	int i;
+
+	if (!ihk_get_cpu_cacheinfo || !cpu_online(cpu))
+		return NULL;
+
+	cci = ihk_get_cpu_cacheinfo(cpu);
+	if (!cci || !cci->info_list)
+		return NULL;
+
+	for (i = 0; i < cci->num_leaves; i++) {
+		if (cci->info_list[i].type == CACHE_TYPE_INST)
+			continue;
+		if (!llc || cci->info_list[i].level > llc->level)
+			llc = &cci->info_list[i];
+	}
+
+	if (!llc || cpumask_empty(&llc->shared_cpu_map))
+		return NULL;
+
+	return llc;
+}
+
+/*
+ * Record the LLC of cpu for it and its siblings before it's offlined.
+ * Linux drops offline CPUs from the cacheinfo, which would leave the
+ * reserved CPUs without an LLC and change it for their online siblings.
+ */
+static void smp_ihk_llc_snapshot(int cpu)
+{
+	struct cacheinfo *llc = smp_ihk_llc(cpu);
+	int first, sibling;
+
+	if (!llc)
+		return;
+
+	first = cpumask_first(&llc->shared_cpu_map);
+	for_each_cpu(sibling, &llc->shared_cpu_map) {
+		if (sibling >= SMP_MAX_CPUS)
+			continue;
+		if (ihk_smp_cpus[sibling].llc_cpu < 0 ||
+		    first < ihk_smp_cpus[sibling].llc_cpu)
+			ihk_smp_cpus[sibling].llc_cpu = first;
+	}
+}
+
+/*
+ * Lowest CPU sharing the last level cache with cpu, including the ones
+ * offlined since, -1 if unknown
+ */
+static int smp_ihk_llc_cpu(int cpu)
+{
+	struct cacheinfo *llc = smp_ihk_llc(cpu);
+	int llc_cpu = llc ? cpumask_first(&llc->shared_cpu_map) : -1;
+
+	if (cpu < SMP_MAX_CPUS && ihk_smp_cpus[cpu].llc_cpu >= 0 &&
+	    (llc_cpu < 0 || ihk_smp_cpus[cpu].llc_cpu < llc_cpu))
+		llc_cpu = ihk_smp_cpus[cpu].llc_cpu;
+
+	return llc_cpu;
+}
+
+/* Memory tier of a node, 0 is the top tier */
+static int smp_ihk_node_tier(int nid)
+{
+	if (ihk_node_is_toptier)
+		return ihk_node_is_toptier(nid) ? 0 : 1;
+
+	/* Memory only nodes are HBM, PMEM or CXL attached on the
+	 * kernels without memory tiers */
+	return node_state(nid, N_CPU) ? 0 : 1;
+}
+
+/*
+ * Fill in the host topology following the LWK NUMA distances, i.e.
+ * all Linux NUMA nodes, their distances and the Linux CPUs
+ */
+static void smp_ihk_setup_host_topology(struct smp_os_data *os, void *p)
+{
+	struct ihk_smp_boot_param_host_node *bp_host_node = p;
+	struct ihk_smp_boot_param_linux_cpu *bp_linux_cpu;
+	int *distance;
+	int nid, i, cpu;
+
+	for (nid = 0; nid < nr_node_ids; nid++, bp_host_node++) {
+		bp_host_node->flags = 0;
+		bp_host_node->lwk_numa_id = -1;
+		bp_host_node->tier = -1;
+
+		if (!node_online(nid))
+			continue;
+
+		bp_host_node->flags = IHK_SMP_HOST_NODE_ONLINE;
+		if (node_state(nid, N_CPU))
+			bp_host_node->flags |= IHK_SMP_HOST_NODE_CPU;
+		if (node_state(nid, N_MEMORY))
+			bp_host_node->flags |= IHK_SMP_HOST_NODE_MEMORY;
+		bp_host_node->tier = smp_ihk_node_tier(nid);
+
+		for (i = 0; i < os->nr_numa_nodes; i++) {
+			if (os->numa_mapping[i] == nid) {
+				bp_host_node->lwk_numa_id = i;
+				break;
+			}
+		}
+	}
+
+	distance = (int *)bp_host_node;
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		for (i = 0; i < nr_node_ids; i++) {
+			*distance++ = (node_online(nid) && node_online(i)) ?
+				node_distance(nid, i) : -1;
+		}
+	}
+
+	bp_linux_cpu = (struct ihk_smp_boot_param_linux_cpu *)distance;
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++, bp_linux_cpu++) {
+		if (!cpu_possible(cpu)) {
+			bp_linux_cpu->numa_id = -1;
+			bp_linux_cpu->llc_cpu = -1;
+			continue;
+		}
+
+		bp_linux_cpu->numa_id = cpu_to_node(cpu);
+		bp_linux_cpu->llc_cpu = smp_ihk_llc_cpu(cpu);
+	}
+}
+
+/*
+ * Read-only ELF core view of the memory of an OS instance, served as
+ * debugfs ihk_smp/mcos<N>.kcore. The program headers describe the
+ * kernel image mapping and the memory chunks assigned to the OS, the
+ * VMCOREINFO note carries the layout. The headers are a snapshot taken
+ * at open, the contents are read through the linear map.
+ */
+static struct dentry *ihk_smp_debugfs_dir;
+
+#define SMP_KCORE_NOTE_NAME	"VMCOREINFO"
+#define SMP_KCORE_NOTE_SIZE	512
+
+struct smp_kcore_seg {
+	loff_t offset;
+	unsigned long phys;
+	unsigned long size;
+};
+
+struct smp_kcore {
+	char *hdr;
+	size_t hdr_size;
+	int nr_segs;
+	struct smp_kcore_seg segs[];
+};
+
+/** \brief Physical address of IHK_SMP_MAP_KERNEL_START */
+static unsigned long smp_ihk_kernel_phys(struct smp_os_data *os)
+{
+	return (os->bootstrap_mem_start + IHK_SMP_LARGE_PAGE * 2 - 1) &
+		IHK_SMP_LARGE_PAGE_MASK;
+}
+
+static int smp_ihk_kcore_open(struct inode *inode, struct file *file)
+{
+	struct smp_os_data *os = inode->i_private;
+	struct ihk_os_mem_chunk *os_mem_chunk;
+	struct smp_kcore *kc = NULL;
+	struct elfhdr *ehdr;
+	struct elf_phdr *phdr;
+	struct elf_note *nhdr;
+	unsigned long kernel_phys, kernel_size;
+	size_t note_off, hdr_size, desc_size, size;
+	loff_t offset;
+	char *desc;
+	int nr_segs, i, ret = 0;
+
+	if (!capable(CAP_SYS_RAWIO)) {
+		return -EPERM;
+	}
+
+	mutex_lock(&ihk_mem_used_index_lock);
+
+	kernel_phys = smp_ihk_kernel_phys(os);
+	if (!os->bootstrap_mem_end || kernel_phys >= os->bootstrap_mem_end) {
+		ret = -ENODEV;
+		goto out;
+	}
+	kernel_size = min_t(unsigned long, MODULES_END - IHK_SMP_MAP_KERNEL_START,
+			    os->bootstrap_mem_end - kernel_phys);
+
+	/* The kernel image, followed by the chunks */
+	nr_segs = 1;
+	list_for_each_entry(os_mem_chunk, &ihk_mem_used_chunks, list) {
+		if (os_mem_chunk->os == os->ihk_os) {
+			nr_segs++;
+		}
+	}
+
+	/* The headers follow the segment table in the same allocation */
+	note_off = sizeof(*ehdr) + sizeof(*phdr) * (nr_segs + 1);
+	hdr_size = PAGE_ALIGN(note_off + sizeof(*nhdr) +
+			      ALIGN(sizeof(SMP_KCORE_NOTE_NAME), 4) +
+			      SMP_KCORE_NOTE_SIZE);
+	size = sizeof(*kc) + sizeof(kc->segs[0]) * nr_segs + hdr_size;
+	kc = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (!kc) {
+		kc = vzalloc(size);
+	}
+	if (!kc) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	kc->hdr = (char *)&kc->segs[nr_segs];
+	kc->hdr_size = hdr_size;
+
+	kc->segs[0].phys = kernel_phys;
+	kc->segs[0].size = kernel_size;
+	i = 1;
+	list_for_each_entry(os_mem_chunk, &ihk_mem_used_chunks, list) {
+		if (os_mem_chunk->os != os->ihk_os) {
+			continue;
+		}
+		kc->segs[i].phys = os_mem_chunk->addr;
+		kc->segs[i].size = os_mem_chunk->size;
+		i++;
+	}
+	kc->nr_segs = nr_segs;
+
+	ehdr = (struct elfhdr *)kc->hdr;
+	memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+	ehdr->e_ident[EI_CLASS] = ELF_CLASS;
+	ehdr->e_ident[EI_DATA] = ELF_DATA;
+	ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr->e_ident[EI_OSABI] = ELF_OSABI;
+	ehdr->e_type = ET_CORE;
+	ehdr->e_machine = ELF_ARCH;
+	ehdr->e_version = EV_CURRENT;
+	ehdr->e_phoff = sizeof(*ehdr);
+	ehdr->e_ehsize = sizeof(*ehdr);
+	ehdr->e_phentsize = sizeof(*phdr);
+	ehdr->e_phnum = nr_segs + 1;
+
+	/* Layout of the LWK, see smp_ihk_os_vtop() */
+	nhdr = (struct elf_note *)(kc->hdr + note_off);
+	nhdr->n_namesz = sizeof(SMP_KCORE_NOTE_NAME);
+	nhdr->n_type = 0;
+	memcpy(nhdr + 1, SMP_KCORE_NOTE_NAME, sizeof(SMP_KCORE_NOTE_NAME));
+	desc = (char *)(nhdr + 1) + ALIGN(sizeof(SMP_KCORE_NOTE_NAME), 4);
+	desc_size = scnprintf(desc, SMP_KCORE_NOTE_SIZE,
+			      "PAGESIZE=%lu\n"
+			      "KERNELOFFSET=0\n"
+			      "IHK_KERNEL_START=0x%lx\n"
+			      "IHK_KERNEL_END=0x%lx\n"
+			      "IHK_KERNEL_PHYS=0x%lx\n"
+			      "IHK_PAGE_OFFSET=0x%lx\n"
+			      "IHK_BOOTSTRAP_MEM=0x%lx-0x%lx\n"
+			      "IHK_NR_CHUNKS=%d\n",
+			      PAGE_SIZE,
+			      (unsigned long)IHK_SMP_MAP_KERNEL_START,
+			      (unsigned long)IHK_SMP_MAP_KERNEL_START + kernel_size,
+			      kernel_phys, (unsigned long)PAGE_OFFSET,
+			      os->bootstrap_mem_start, os->bootstrap_mem_end,
+			      nr_segs - 1);
+	nhdr->n_descsz = desc_size;
+
+	phdr = (struct elf_phdr *)(ehdr + 1);
+	phdr->p_type = PT_NOTE;
+	phdr->p_offset = note_off;
+	phdr->p_filesz = sizeof(*nhdr) +
+		ALIGN(sizeof(SMP_KCORE_NOTE_NAME), 4) + ALIGN(desc_size, 4);
+
+	offset = kc->hdr_size;
+	for (i = 0; i < nr_segs; i++) {
+		phdr++;
+		phdr->p_type = PT_LOAD;
+		phdr->p_flags = PF_R | PF_W | PF_X;
+		phdr->p_offset = offset;
+		phdr->p_vaddr = i ? (unsigned long)phys_to_virt(kc->segs[i].phys) :
+			IHK_SMP_MAP_KERNEL_START;
+		phdr->p_paddr = kc->segs[i].phys;
+		phdr->p_filesz = phdr->p_memsz = kc->segs[i].size;
+		phdr->p_align = PAGE_SIZE;
+
+		kc->segs[i].offset = offset;
+		offset += PAGE_ALIGN(kc->segs[i].size);
+	}
+
+	file->private_data = kc;
+ out:
+	mutex_unlock(&ihk_mem_used_index_lock);
+	return ret;
+}
+
+static int smp_ihk_kcore_release(struct inode *inode, struct file *file)
+{
+	struct smp_kcore *kc = file->private_data;
+
+	if (is_vmalloc_addr(kc)) {
+		vfree(kc);
+	}
+	else {
+		kfree(kc);
+	}
+	return 0;
+}
+
+static ssize_t smp_ihk_kcore_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct smp_kcore *kc = file->private_data;
+	loff_t pos = *ppos;
+	size_t done = 0;
+	int ret = 0;
+	int i;
+
+	while (done < count) {
+		struct smp_kcore_seg *seg = NULL;
+		size_t len = count - done;
+		unsigned long off;
+		void *va;
+
+		if (pos < kc->hdr_size) {
+			len = min_t(size_t, len, kc->hdr_size - pos);
+			if (copy_to_user(buf + done, kc->hdr + pos, len)) {
+				return done ? done : -EFAULT;
+			}
+			goto next;
+		}
+
+		/* The segments were taken at open, keep chunks from being
+		 * released between the check of the range and the copy
+		 */
+		down_read(&ihk_mem_access_sem);
+
+		for (i = 0; i < kc->nr_segs; i++) {
+			if (pos >= kc->segs[i].offset &&
+			    pos < kc->segs[i].offset +
+			    PAGE_ALIGN(kc->segs[i].size)) {
+				seg = &kc->segs[i];
+				break;
+			}
+		}
+		if (!seg) {
+			up_read(&ihk_mem_access_sem);
+			break;
+		}
+
+		/* One page at a time, the OS might release chunks meanwhile */
+		off = pos - seg->offset;
+		len = min_t(size_t, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		if (off >= seg->size) {
+			if (clear_user(buf + done, len)) {
+				ret = -EFAULT;
+			}
+			goto unlock;
+		}
+		len = min_t(size_t, len, seg->size - off);
+
+		va = ihk_smp_map_virtual(seg->phys + off, len);
+		if (!va) {
+			ret = -EIO;
+			goto unlock;
+		}
+		if (copy_to_user(buf + done, va, len)) {
+			ret = -EFAULT;
+		}
+ unlock:
+		up_read(&ihk_mem_access_sem);
+		if (ret) {
+			return done ? done : ret;
+		}
+ next:
+		done += len;
+		pos += len;
+		*ppos = pos;
+
+		if (fatal_signal_pending(current)) {
+			break;
+		}
+		cond_resched();
+	}
+
+	return done;
+}
+
+static const struct file_operations smp_ihk_kcore_fops = {
+	.owner = THIS_MODULE,
+	.open = smp_ihk_kcore_open,
+	.release = smp_ihk_kcore_release,
+	.read = smp_ihk_kcore_read,
+	.llseek = default_llseek,
+};
+
+static void smp_ihk_kcore_create(struct smp_os_data *os)
+{
+	char name[32];
+
+	if (!ihk_smp_debugfs_dir || os->kcore_dentry) {
+		return;
+	}
+
+	snprintf(name, sizeof(name), "mcos%d.kcore",
+		 ihk_host_os_get_index(os->ihk_os));
+	os->kcore_dentry = debugfs_create_file(name, 0400, ihk_smp_debugfs_dir,
+					       os, &smp_ihk_kcore_fops);
+	if (IS_ERR(os->kcore_dentry)) {
+		pr_warn("%s: warning: creating %s failed\n", __func__, name);
+		os->kcore_dentry = NULL;
+	}
+}
+
+static void smp_ihk_kcore_remove(struct smp_os_data *os)
+{
+	debugfs_remove(os->kcore_dentry);
+	os->kcore_dentry = NULL;
+}
+
+/** \brief Boot a kernel. */
+static int __smp_ihk_os_boot(ihk_os_t ihk_os, void *priv, int flag)
+{
+	struct ihk_host_linux_os_data *ihk_core_os = (struct ihk_host_linux_os_data *)ihk_os;
+	struct smp_os_data *os = priv;
+	struct builtin_device_data *dev = os->dev;
+	unsigned long flags;
+	struct timespec now;
+	int param_size, param_pages_order = 0;
+	struct page *param_pages;
+	int dump_size, dump_pages_order = 0;
+	struct page *dump_pages;
+	struct ihk_os_mem_chunk *os_mem_chunk;
+	int nr_memory_chunks = 0;
+	int numa_id, linux_numa_id, nr_numa_nodes;
+	struct ihk_smp_boot_param_cpu *bp_cpu;
+	struct ihk_smp_boot_param_numa_node *bp_numa_node;
+	struct ihk_smp_boot_param_memory_chunk *bp_mem_chunk;
+	int lwk_cpu;
+	int *ihk_smp_boot_numa_distance;
+	int i, j;
+	unsigned long buffer_size, map_end, index;
+	struct ihk_dump_page *dump_page;
+	int ret;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (dev->status != BUILTIN_DEV_STATUS_READY) {
+		pr_err("IHK-SMP: error: "
+		       "Device has already booted / is booting OS.\n");
+		ret = -EBUSY;
+		spin_unlock_irqrestore(&dev->lock, flags);
+		goto out;
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	if (os->status == BUILTIN_OS_STATUS_BOOTING) {
+		pr_err("IHK-SMP: error: "
+		       "Device has already booted / is booting OS.\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	/* Compute size including CPUs, NUMA nodes and memory chunks */
+	param_size = (sizeof(*os->param));
+	param_size += os->nr_cpus * sizeof(struct ihk_smp_boot_param_cpu);
+
+	/* NUMA nodes */
+	nr_numa_nodes = hweight64(os->numa_mask);
+	param_size += (nr_numa_nodes * sizeof(struct ihk_smp_boot_param_numa_node));
+
+	/* NUMA distances */
+	param_size += nr_numa_nodes * nr_numa_nodes * sizeof(int);
+
+	/* Host topology */
+	param_size += nr_node_ids *
+		sizeof(struct ihk_smp_boot_param_host_node);
+	param_size += nr_node_ids * nr_node_ids * sizeof(int);
+	param_size += nr_cpu_ids * sizeof(struct ihk_smp_boot_param_linux_cpu);
 
 	os->numa_mapping = kmalloc(nr_numa_nodes * sizeof(int), GFP_KERNEL);
 	if (!os->numa_mapping) {
@@ -559,7 +1505,7 @@ static int smp_ihk_os_boot(ihk_os_t ihk_os, void *priv, int flag)
 				(sizeof(os->numa_mask) * 8), linux_numa_id + 1)) {
 
 		os->numa_mapping[numa_id] = linux_numa_id;
-		dprintf("IHK-SMP: OS: %p, NUMA: %d => Linux NUMA: %d\n",
+		dprintk("IHK-SMP: OS: %p, NUMA: %d => Linux NUMA: %d\n",
 				os, numa_id, linux_numa_id);
 
 		++numa_id;
@@ -583,7 +1529,7 @@ static int smp_ihk_os_boot(ihk_os_t ihk_os, void *priv, int flag)
 	param_size += (nr_memory_chunks *
 			sizeof(struct ihk_smp_boot_param_memory_chunk));
 
-	dprintf("IHK-SMP: %d memory chunks from %d NUMA nodes\n",
+	dprintk("IHK-SMP: %d memory chunks from %d NUMA nodes\n",
 		nr_memory_chunks, nr_numa_nodes);
 
 	/* Allocate boot parameter pages */
@@ -609,6 +1555,7 @@ static int smp_ihk_os_boot(ihk_os_t ihk_os, void *priv, int flag)
 	os->param->nr_linux_cpus = nr_cpu_ids;
 	os->param->nr_numa_nodes = nr_numa_nodes;
 	os->param->nr_memory_chunks = nr_memory_chunks;
+	os->param->nr_host_numa_nodes = nr_node_ids;
 	os->param->osnum = ihk_host_os_get_index(ihk_os);
 	os->param->linux_default_huge_page_shift =
 		huge_page_order(&smp_ihk_hstates[*smp_ihk_default_hstate_idx])
@@ -635,8 +1582,10 @@ bp_cpu->numa_id = linux_numa_2_lwk_numa(os,
 		bp_cpu->linux_cpu_id = os->cpu_mapping[lwk_cpu];
 		bp_cpu->ikc_cpu = ihk_smp_cpus[lwk_cpu_2_linux_cpu(os, lwk_cpu)].ikc_map_cpu;
 		os->cpu_ikc_map[lwk_cpu] = bp_cpu->ikc_cpu;
+		smp_ihk_arch_setup_boot_param_pwr(bp_cpu,
+				&os->cpu_pwr[os->cpu_mapping[lwk_cpu]]);
 
-		dprintf("IHK-SMP: OS: %p, Linux NUMA: %d, LWK CPU: %d,"
+		dprintk("IHK-SMP: OS: %p, Linux NUMA: %d, LWK CPU: %d,"
 				" CPU APIC: %d, IKC CPU: %d\n",
 				os, cpu_to_node(os->cpu_mapping[lwk_cpu]), lwk_cpu,
 				bp_cpu->hw_id, bp_cpu->ikc_cpu);
@@ -657,7 +1606,7 @@ bp_cpu->numa_id = linux_numa_2_lwk_numa(os,
 		bp_numa_node->type = IHK_SMP_MEMORY_TYPE_DRAM;
 		bp_numa_node->linux_numa_id = linux_numa_id;
 
-		dprintf("IHK-SMP: OS: %p, NUMA: %d => Linux NUMA: %d\n",
+		dprintk("IHK-SMP: OS: %p, NUMA: %d => Linux NUMA: %d\n",
 				os, numa_id, linux_numa_id);
 
 		++bp_numa_node;
@@ -717,7 +1666,7 @@ bp_cpu->numa_id = linux_numa_2_lwk_numa(os,
 #ifdef ENABLE_FUGAKU_HACKS
 						if (0)
 #endif
-						dprintf("%s: chunk 0x%lx:%lu TNI %d, CQ %d,"
+						dprintk("%s: chunk 0x%lx:%lu TNI %d, CQ %d,"
 								" DMA addr: 0x%lx (offset: %lu)\n",
 								__func__,
 								os_mem_chunk->addr,
@@ -750,6 +1699,8 @@ bp_cpu->numa_id = linux_numa_2_lwk_numa(os,
 		}
 	}
 
+	smp_ihk_setup_host_topology(os, ihk_smp_boot_numa_distance);
+
 	set_dev_status(dev, BUILTIN_DEV_STATUS_BOOTING);
 
 	__build_os_info(os);
@@ -759,6 +1710,7 @@ bp_cpu->numa_id = linux_numa_2_lwk_numa(os,
 		goto revert_dev_status;
 	}
 	os->boot_cpu = os->cpu_info.hw_ids[0];
+	smp_ihk_arch_os_build_ipi_dests(os);
 
 	set_os_status(os, BUILTIN_OS_STATUS_BOOTING);
 
@@ -781,9 +1733,17 @@ bp_cpu->numa_id = linux_numa_2_lwk_numa(os,
 	os->param->boot_tsc = rdtsc();
 	os->param->boot_sec = now.tv_sec;
 	os->param->boot_nsec = now.tv_nsec;
+	os->param->clock_page = ihk_smp_clock_page ?
+		virt_to_phys(ihk_smp_clock_page) : 0;
 
+	os->param->ikc_master_cpu = smp_ihk_os_select_ikc_master_cpu(ihk_os, os);
+	ihk_host_os_set_mchannel_cpu(ihk_os, os->param->ikc_master_cpu);
+	pr_info("IHK-SMP: OS %d: master channel on Linux CPU %d\n",
+		os->param->osnum, os->param->ikc_master_cpu);
 
-	dprintf("boot cpu : %d, %lx, %lx, %lx, %lx\n",
+	os->param->debug_mask = ihk_host_os_get_debug_mask(ihk_os);
+
+	dprintk("boot cpu : %d, %lx, %lx, %lx, %lx\n",
 	        os->boot_cpu, os->mem_start, os->mem_end, os->cpu_hw_ids_map.set[0],
 	        os->param->dma_address
 	);
@@ -847,11 +1807,26 @@ bp_cpu->numa_id = linux_numa_2_lwk_numa(os,
 	} else {
 		os->param->dump_page_set.count = 0;
 		os->param->dump_page_set.page_size = 0;
-		dprintf("IHK-SMP: error: allocating dump_page_set(size:%ld)\n",buffer_size);
+		dprintk("IHK-SMP: error: allocating dump_page_set(size:%ld)\n",buffer_size);
 	}
 
 	os->param->dump_page_set.completion_flag = IHK_DUMP_PAGE_SET_INCOMPLETE;
 
+	/* Mailboxes of smp_ihk_os_call_cpus(), optional */
+	os->call_area_order = get_order(sizeof(*os->call_area) +
+			os->nr_cpus * sizeof(struct ihk_smp_call_mbox));
+	os->call_area = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
+						 os->call_area_order);
+	if (os->call_area) {
+		os->call_area->nr_mboxes = os->nr_cpus;
+		os->param->call_area = virt_to_phys(os->call_area);
+	}
+	else {
+		pr_warn("%s: warning: allocating call mailboxes\n", __func__);
+	}
+
+	smp_ihk_kcore_create(os);
+
 	printk("IHK-SMP: booting OS 0x%lx, calling smp_wakeup_secondary_cpu() \n", 
 		(unsigned long)ihk_os);
 	udelay(300);
@@ -878,6 +1853,18 @@ bp_cpu->numa_id = linux_numa_2_lwk_numa(os,
 	return ret;
 }
 
+static int smp_ihk_os_boot(ihk_os_t ihk_os, void *priv, int flag)
+{
+	struct smp_os_data *os = priv;
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = __smp_ihk_os_boot(ihk_os, priv, flag);
+	ihk_smp_stat_add(&os->stats[IHK_SMP_OS_STAT_BOOT], start, ret,
+			 ret ? 0 : os->cpu_info.n_cpus);
+	return ret;
+}
+
 
 static int smp_ihk_os_map_lwk(unsigned long phys)
 {
@@ -940,68 +1927,204 @@ static int smp_ihk_os_vtop(ihk_os_t ihk_os,
 
 	/* Part of LWK kernel image? (E.g., global variables) */
 	if (virt > IHK_SMP_MAP_KERNEL_START && virt < MODULES_END) {
-		unsigned long base_phys = (os->bootstrap_mem_start +
-				IHK_SMP_LARGE_PAGE * 2 - 1) & IHK_SMP_LARGE_PAGE_MASK;
+		unsigned long base_phys = smp_ihk_kernel_phys(os);
 
 		*phys = base_phys + (virt - IHK_SMP_MAP_KERNEL_START);
-		dprintf("%s: 0x%lx -> 0x%lx (IHK_SMP_MAP_KERNEL_START)\n",
+		dprintk("%s: 0x%lx -> 0x%lx (IHK_SMP_MAP_KERNEL_START)\n",
 			__func__, virt, *phys);
 	}
 	else {
 		*phys = virt_to_phys((void *)virt);
-		dprintf("%s: 0x%lx -> 0x%lx (dynamic)\n",
+		dprintk("%s: 0x%lx -> 0x%lx (dynamic)\n",
 			__func__, virt, *phys);
 	}
 
 	return 0;
 }
 
-static int smp_ihk_os_load_file(ihk_os_t ihk_os, void *priv, const char *fn)
+/*
+ * Size of one read of the LWK image and minimum size of a part of
+ * a segment loaded by its own thread
+ */
+#define IHK_SMP_LOAD_IO_SIZE		(4UL << 20)
+#define IHK_SMP_LOAD_SLICE_MIN		(32UL << 20)
+
+struct ihk_smp_load_slice {
+	struct file *file;
+	char *virt;		/* Destination in the linear map */
+	loff_t pos;		/* File offset of virt */
+	unsigned long filesz;	/* Bytes read from the file */
+	unsigned long memsz;	/* Bytes filled, the rest is zeroed */
+	long ret;
+	struct completion done;
+};
+
+static long ihk_smp_load_slice(struct ihk_smp_load_slice *slice)
 {
-	int ret;
-	struct smp_os_data *os = priv;
-	struct file *file = NULL;
-	loff_t pos = 0;
+	unsigned long off = 0;
+	loff_t pos = slice->pos;
+	size_t len;
 	long r;
-	unsigned long phys;
-	unsigned long offset;
-	unsigned long maxoffset;
-	unsigned long flags;
-	Elf64_Ehdr *elf64 = NULL;
-	Elf64_Phdr *elf64p;
-	int i;
-	unsigned long entry;
-	struct ihk_os_mem_chunk *os_mem_chunk_iter;
-	struct ihk_os_mem_chunk *os_mem_chunk = NULL;
-	os->bootstrap_mem_start = 0;
-	os->bootstrap_mem_end = 0;
-
-	/* Update bootstrap_numa_id with the lowest NUMA id if not set */
-	/* TODO: add IHK API to set bootstrap_numa_id */
-	if (os->bootstrap_numa_id == -1) {
-		int min_numa_id = -1;
-
-		list_for_each_entry(os_mem_chunk_iter, &ihk_mem_used_chunks, list) {
-			if (min_numa_id != -1 &&
-					min_numa_id <= os_mem_chunk_iter->numa_id) {
-				continue;
-			}
 
-			min_numa_id = os_mem_chunk_iter->numa_id;
+	while (off < slice->filesz) {
+		len = min(slice->filesz - off, IHK_SMP_LOAD_IO_SIZE);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+		r = kernel_read(slice->file, slice->virt + off, len, &pos);
+#else
+		r = kernel_read(slice->file, pos, slice->virt + off, len);
+		if (r > 0)
+			pos += r;
+#endif
+		if (r <= 0) {
+			pr_err("kernel_read failed: %ld\n", r);
+			return r ? r : -EIO;
 		}
+		off += r;
+		cond_resched();
+	}
 
-		os->bootstrap_numa_id = min_numa_id;
+	while (off < slice->memsz) {
+		len = min(slice->memsz - off, IHK_SMP_LOAD_IO_SIZE);
+		memset(slice->virt + off, '\0', len);
+		off += len;
+		cond_resched();
 	}
 
-	/* Find the bootstrap memory chunk for image and page table */
-	list_for_each_entry(os_mem_chunk_iter, &ihk_mem_used_chunks, list) {
-		if (os_mem_chunk_iter->os != ihk_os ||
-				os_mem_chunk_iter->numa_id != os->bootstrap_numa_id) {
-			continue;
-		}
+	smp_ihk_arch_dcache_flush(slice->virt, slice->memsz);
+	return 0;
+}
 
-		/* Find the largest memory chunk on the bootstrap NUMA node */
-		if ((os->bootstrap_mem_end - os->bootstrap_mem_start) <
+static int ihk_smp_load_thread(void *arg)
+{
+	struct ihk_smp_load_slice *slice = arg;
+
+	slice->ret = ihk_smp_load_slice(slice);
+	complete(&slice->done);
+	return 0;
+}
+
+/*
+ * Load a segment of the image to phys through the linear map.
+ * Large segments are split into large page aligned slices loaded
+ * in parallel by threads on the NUMA node of the memory.
+ */
+static int ihk_smp_load_segment(struct file *file, int numa_id,
+				unsigned long phys, loff_t pos,
+				unsigned long filesz, unsigned long memsz)
+{
+	struct ihk_smp_load_slice *slices;
+	struct task_struct *task;
+	unsigned long slice_size, off;
+	int nr_slices, i, ret = 0;
+	char *virt;
+
+	virt = ihk_smp_map_virtual(phys, memsz);
+	if (!virt) {
+		return -EFAULT;
+	}
+
+	nr_slices = min_t(unsigned long, ihk_load_threads,
+			  memsz / IHK_SMP_LOAD_SLICE_MIN);
+	if (nr_slices < 1) {
+		nr_slices = 1;
+	}
+	slice_size = ALIGN(DIV_ROUND_UP(memsz, nr_slices), IHK_SMP_LARGE_PAGE);
+
+	slices = kcalloc(nr_slices, sizeof(*slices), GFP_KERNEL);
+	if (!slices) {
+		return -ENOMEM;
+	}
+
+	for (i = 0, off = 0; i < nr_slices; i++, off += slice_size) {
+		struct ihk_smp_load_slice *slice = &slices[i];
+
+		slice->file = file;
+		slice->virt = virt + off;
+		slice->pos = pos + off;
+		slice->memsz = off < memsz ? min(slice_size, memsz - off) : 0;
+		slice->filesz = off < filesz ?
+			min(slice->memsz, filesz - off) : 0;
+		init_completion(&slice->done);
+
+		/* The last slice is loaded by the caller */
+		task = NULL;
+		if (i < nr_slices - 1) {
+			task = kthread_create_on_node(ihk_smp_load_thread,
+						      slice, numa_id,
+						      "ihk_load/%d", i);
+		}
+
+		if (IS_ERR_OR_NULL(task)) {
+			ihk_smp_load_thread(slice);
+			continue;
+		}
+
+		if (numa_id >= 0 &&
+		    cpumask_intersects(cpumask_of_node(numa_id),
+				       cpu_online_mask)) {
+			set_cpus_allowed_ptr(task, cpumask_of_node(numa_id));
+		}
+		wake_up_process(task);
+	}
+
+	for (i = 0; i < nr_slices; i++) {
+		wait_for_completion(&slices[i].done);
+		if (slices[i].ret && !ret) {
+			ret = slices[i].ret;
+		}
+	}
+
+	kfree(slices);
+	return ret;
+}
+
+static int smp_ihk_os_load_file(ihk_os_t ihk_os, void *priv, const char *fn)
+{
+	int ret;
+	struct smp_os_data *os = priv;
+	struct file *file = NULL;
+	loff_t pos = 0;
+	long r;
+	unsigned long phys = 0;
+	unsigned long offset;
+	unsigned long maxoffset = 0;
+	ktime_t start = ktime_get();
+	unsigned long flags;
+	Elf64_Ehdr *elf64 = NULL;
+	Elf64_Phdr *elf64p;
+	int i;
+	unsigned long entry;
+	struct ihk_os_mem_chunk *os_mem_chunk_iter;
+	struct ihk_os_mem_chunk *os_mem_chunk = NULL;
+	os->bootstrap_mem_start = 0;
+	os->bootstrap_mem_end = 0;
+
+	/* Update bootstrap_numa_id with the lowest NUMA id if not set */
+	/* TODO: add IHK API to set bootstrap_numa_id */
+	if (os->bootstrap_numa_id == -1) {
+		int min_numa_id = -1;
+
+		list_for_each_entry(os_mem_chunk_iter, &ihk_mem_used_chunks, list) {
+			if (min_numa_id != -1 &&
+					min_numa_id <= os_mem_chunk_iter->numa_id) {
+				continue;
+			}
+
+			min_numa_id = os_mem_chunk_iter->numa_id;
+		}
+
+		os->bootstrap_numa_id = min_numa_id;
+	}
+
+	/* Find the bootstrap memory chunk for image and page table */
+	list_for_each_entry(os_mem_chunk_iter, &ihk_mem_used_chunks, list) {
+		if (os_mem_chunk_iter->os != ihk_os ||
+				os_mem_chunk_iter->numa_id != os->bootstrap_numa_id) {
+			continue;
+		}
+
+		/* Find the largest memory chunk on the bootstrap NUMA node */
+		if ((os->bootstrap_mem_end - os->bootstrap_mem_start) <
 				os_mem_chunk_iter->size) {
 			os_mem_chunk = os_mem_chunk_iter;
 			os->bootstrap_mem_start = os_mem_chunk->addr;
@@ -1083,10 +2206,7 @@ static int smp_ihk_os_load_file(ihk_os_t ihk_os, void *priv, const char *fn)
 	entry = smp_ihk_adjust_entry(entry, phys);
 
 	for(i = 0; i < elf64->e_phnum; i++){
-		unsigned long end;
-		unsigned long size;
-		char *buf;
-		unsigned long pphys;
+		unsigned long filesz;
 		unsigned long psize;
 
 		if (elf64p[i].p_type != PT_LOAD)
@@ -1095,60 +2215,24 @@ static int smp_ihk_os_load_file(ihk_os_t ihk_os, void *priv, const char *fn)
 			continue;
 
 		offset = elf64p[i].p_vaddr - (IHK_SMP_MAP_KERNEL_START -phys);
-		pphys = offset;
 		psize = (elf64p[i].p_memsz + PAGE_SIZE - 1) & PAGE_MASK;
-		size = elf64p[i].p_filesz;
-		pos = elf64p[i].p_offset;
-		end = pos + size;
-		while(pos < end){
-			long l = end - pos;
-
-			if (l > PAGE_SIZE)
-				l = PAGE_SIZE;
-
-			if (offset + PAGE_SIZE > os->bootstrap_mem_end) {
-				printk("builtin: OS is too big to load.\n");
-				ret = -E2BIG;
-				goto revert_state;
-			}
+		filesz = min_t(unsigned long, elf64p[i].p_filesz, psize);
 
-			buf = ihk_smp_map_virtual(offset, PAGE_SIZE);
-			if (!buf) {
-				ret = -EFAULT;
-				goto revert_state;
-			}
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
-			r = kernel_read(file, buf, l, &pos);
-#else
-			r = kernel_read(file, pos, buf, l);
-			pos += r;
-#endif
-			if (r > 0 && r != PAGE_SIZE) {
-				memset(buf + r, '\0', PAGE_SIZE - r);
-			}
-			ihk_smp_unmap_virtual(buf);
-			if (r <= 0) {
-				pr_err("kernel_read failed: %ld\n", r);
-				ret = (int)r;
-				goto revert_state;
-			}
-			offset += PAGE_SIZE;
+		/* The last page holds the ELF header */
+		if (offset + psize > os->bootstrap_mem_end - PAGE_SIZE) {
+			printk("builtin: OS is too big to load.\n");
+			ret = -E2BIG;
+			goto revert_state;
 		}
 
-		for (size = (size + PAGE_SIZE - 1) & PAGE_MASK;
-				size < psize; size += PAGE_SIZE) {
-
-			if (offset + PAGE_SIZE > os->bootstrap_mem_end) {
-				printk("builtin: OS is too big to load.\n");
-				ret = -E2BIG;
-				goto revert_state;
-			}
-
-			buf = ihk_smp_map_virtual(offset, PAGE_SIZE);
-			memset(buf, '\0', PAGE_SIZE);
-			ihk_smp_unmap_virtual(buf);
-			offset += PAGE_SIZE;
+		ret = ihk_smp_load_segment(file, os->bootstrap_numa_id, offset,
+					   elf64p[i].p_offset, filesz, psize);
+		if (ret) {
+			pr_err("%s: error: loading segment %d (%d)\n",
+			       __func__, i, ret);
+			goto revert_state;
 		}
+		offset += psize;
 
 		if (offset > maxoffset)
 			maxoffset = offset;
@@ -1177,6 +2261,8 @@ static int smp_ihk_os_load_file(ihk_os_t ihk_os, void *priv, const char *fn)
 	}
 	set_os_status(os, BUILTIN_OS_STATUS_INITIAL);
  out:
+	ihk_smp_stat_add(&os->stats[IHK_SMP_OS_STAT_LOAD], start, ret,
+			 ret ? 0 : maxoffset - phys);
 	return ret;
 }
 
@@ -1215,7 +2301,7 @@ static int smp_ihk_os_load_mem(ihk_os_t ihk_os, void *priv, const char *buf,
 	for (; size > 0; ) {
 		virt = ihk_smp_map_virtual(phys, PAGE_SIZE);
 		if (!virt) {
-			dprintf("builtin: Failed to map %lx\n", phys);
+			dprintk("builtin: Failed to map %lx\n", phys);
 
 			set_os_status(os, BUILTIN_OS_STATUS_INITIAL);
 
@@ -1226,7 +2312,7 @@ static int smp_ihk_os_load_mem(ihk_os_t ihk_os, void *priv, const char *buf,
 		} else {
 			to_read = size;
 		}
-		dprintf("memcpy(%p[%lx], buf + %lx, %lx)\n",
+		dprintk("memcpy(%p[%lx], buf + %lx, %lx)\n",
 		        virt, phys, offset, to_read);
 		memcpy(virt, buf + offset, to_read);
 
@@ -1245,6 +2331,49 @@ static int smp_ihk_os_load_mem(ihk_os_t ihk_os, void *priv, const char *buf,
 	return 0;
 }
 
+/*
+ * Physical ranges of ZONE_MOVABLE memory blocks that were offlined for
+ * IHK (see __ihk_smp_reserve_mem_blocks()). The chunks carved out of a
+ * range are not given back to the buddy allocator one by one, the whole
+ * range is onlined again once all of it has been released.
+ */
+struct ihk_offlined_range {
+	struct list_head list;
+	unsigned long addr;
+	unsigned long size;
+	int numa_id;
+	/* Bytes released so far */
+	unsigned long released;
+};
+
+static LIST_HEAD(ihk_offlined_ranges);
+
+static struct ihk_offlined_range *__ihk_smp_find_offlined_range(
+		unsigned long addr)
+{
+	struct ihk_offlined_range *range;
+
+	list_for_each_entry(range, &ihk_offlined_ranges, list) {
+		if (addr >= range->addr && addr < range->addr + range->size) {
+			return range;
+		}
+	}
+
+	return NULL;
+}
+
+/* Chunks from different offlined ranges, or from an offlined range
+ * and the buddy allocator, must not be merged */
+static int mem_chunks_mergeable(struct chunk *a, struct chunk *b)
+{
+	if (list_empty(&ihk_offlined_ranges)) {
+		return 1;
+	}
+
+	return __ihk_smp_find_offlined_range(a->addr) ==
+		__ihk_smp_find_offlined_range(b->addr);
+}
+
 static void add_free_mem_chunk(struct chunk *chunk)
 {
 	struct chunk *chunk_iter;
@@ -1267,7 +2396,7 @@ static void add_free_mem_chunk(struct chunk *chunk)
 		list_add_tail(&chunk->chain, &ihk_mem_free_chunks);
 	}
 
-	dprintf("IHK-SMP: free mem chunk 0x%lx - 0x%lx added\n",
+	dprintk("IHK-SMP: free mem chunk 0x%lx - 0x%lx added\n",
 	        chunk->addr, chunk->addr + chunk->size);
 }
 
@@ -1281,8 +2410,9 @@ rerun:
 
 		if (mem_chunk != mem_chunk_next &&
 		    mem_chunk_next->addr == mem_chunk->addr + mem_chunk->size &&
-		    mem_chunk_next->numa_id == mem_chunk->numa_id) {
-			dprintf("IHK-SMP: free 0x%lx - 0x%lx and 0x%lx - 0x%lx merged\n",
+		    mem_chunk_next->numa_id == mem_chunk->numa_id &&
+		    mem_chunks_mergeable(mem_chunk, mem_chunk_next)) {
+			dprintk("IHK-SMP: free 0x%lx - 0x%lx and 0x%lx - 0x%lx merged\n",
 			        mem_chunk->addr,
 			        mem_chunk->addr + mem_chunk->size,
 			        mem_chunk_next->addr,
@@ -1339,13 +2469,14 @@ static int smp_ihk_os_unmap_lwk(void)
 	return 0;
 }
 
-static int smp_ihk_os_shutdown(ihk_os_t ihk_os, void *priv, int flag)
+static int __smp_ihk_os_shutdown(ihk_os_t ihk_os, void *priv, int flag)
 {
 	struct smp_os_data *os = priv;
 	struct builtin_device_data *dev = os->dev;
 	int i, ret = 0;
 	struct ihk_os_mem_chunk *os_mem_chunk = NULL;
 	struct ihk_os_mem_chunk *next_chunk = NULL;
+	struct ihk_mem_used_index *index;
 	struct chunk *mem_chunk;
 
 	switch (os->status) {
@@ -1367,6 +2498,8 @@ static int smp_ihk_os_shutdown(ihk_os_t ihk_os, void *priv, int flag)
 	}
 	set_os_status(os, BUILTIN_OS_STATUS_SHUTDOWN);
 
+	smp_ihk_kcore_remove(os);
+
 	/* Reset CPU cores used by this OS */
 	for (i = 0; i < SMP_MAX_CPUS; ++i) {
 		if (ihk_smp_cpus[i].os != ihk_os)
@@ -1385,13 +2518,12 @@ static int smp_ihk_os_shutdown(ihk_os_t ihk_os, void *priv, int flag)
 		printk("%s: ERROR: smp_ihk_os_unmap_lwk failed (%d)\n", __FUNCTION__, ret);
 	}
 
-	/* Free bootstrap page tables */
-	if (os->boot_pt) {
-		ihk_smp_free_page_tables(os->boot_pt);
-		os->boot_pt = NULL;
-	}
+	/* Bootstrap page tables are kept for the next boot and freed
+	 * in smp_ihk_destroy_os()
+	 */
 
 	/* Drop memory chunk used by this OS */
+	index = ihk_smp_mem_index_begin(0);
 	list_for_each_entry_safe(os_mem_chunk, next_chunk,
 			&ihk_mem_used_chunks, list) {
 
@@ -1425,7 +2557,7 @@ static int smp_ihk_os_shutdown(ihk_os_t ihk_os, void *priv, int flag)
 #ifdef ENABLE_FUGAKU_HACKS
 					if (0)
 #endif
-					dprintf("%s: chunk 0x%lx:%lu TNI %d, CQ %d,"
+					dprintk("%s: chunk 0x%lx:%lu TNI %d, CQ %d,"
 							" DMA addr: 0x%lx released\n",
 							__func__,
 							os_mem_chunk->addr,
@@ -1441,15 +2573,29 @@ static int smp_ihk_os_shutdown(ihk_os_t ihk_os, void *priv, int flag)
 
 		kfree(os_mem_chunk);
 	}
+	ihk_smp_mem_index_end(index);
 
 	if (os->numa_mapping) {
 		kfree(os->numa_mapping);
 		os->numa_mapping = NULL;
 	}
 
+	mutex_lock(&os->call_lock);
+	if (os->call_area) {
+		free_pages((unsigned long)os->call_area, os->call_area_order);
+		os->call_area = NULL;
+	}
+	mutex_unlock(&os->call_lock);
+
 	if (os->param) {
-		free_pages((unsigned long)os->param, os->param_pages_order);
+		void *param = os->param;
+		unsigned long flags;
+
+		/* Serialized with smp_ihk_os_set_debug_mask() */
+		spin_lock_irqsave(&os->lock, flags);
 		os->param = NULL;
+		spin_unlock_irqrestore(&os->lock, flags);
+		free_pages((unsigned long)param, os->param_pages_order);
 	}
 
 	set_os_status(os, BUILTIN_OS_STATUS_INITIAL);
@@ -1460,6 +2606,19 @@ static int smp_ihk_os_shutdown(ihk_os_t ihk_os, void *priv, int flag)
 	return ret;
 }
 
+static int smp_ihk_os_shutdown(ihk_os_t ihk_os, void *priv, int flag)
+{
+	struct smp_os_data *os = priv;
+	int nr_cpus = os->cpu_info.n_cpus;
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = __smp_ihk_os_shutdown(ihk_os, priv, flag);
+	ihk_smp_stat_add(&os->stats[IHK_SMP_OS_STAT_SHUTDOWN], start, ret,
+			 ret ? 0 : nr_cpus);
+	return ret;
+}
+
 
 static int smp_ihk_os_alloc_resource(ihk_os_t ihk_os, void *priv,
                                      struct ihk_resource *resource)
@@ -1476,6 +2635,9 @@ static int smp_ihk_os_alloc_resource(ihk_os_t ihk_os, void *priv,
 	os->status = BUILTIN_OS_STATUS_LOADING;
 	spin_unlock_irqrestore(&os->lock, flags);
 
+	/* Draw only from the CPUs and memory of the group of the OS */
+	mutex_lock(&ihk_smp_group_lock);
+
 	/* Assign CPU cores */
 	if (resource->cpu_cores) {
 		int ihk_smp_nr_avail_cpus = 0;
@@ -1483,21 +2645,25 @@ static int smp_ihk_os_alloc_resource(ihk_os_t ihk_os, void *priv,
 
 		/* Check the number of available CPUs */
 		for (i = 0; i < SMP_MAX_CPUS; i++) {
-			if (ihk_smp_cpus[i].status == IHK_SMP_CPU_AVAILABLE) {
+			if (ihk_smp_cpus[i].status == IHK_SMP_CPU_AVAILABLE &&
+			    ihk_smp_cpus[i].group == os->group) {
 				++ihk_smp_nr_avail_cpus;
 			}
 		}
 
 		if (resource->cpu_cores > ihk_smp_nr_avail_cpus) {
-			printk("IHK-SMP: error: %d CPUs requested, but only %d available\n",
-			       resource->cpu_cores, ihk_smp_nr_avail_cpus);
-			return -EINVAL;
+			printk("IHK-SMP: error: %d CPUs requested, but only %d available in group %d\n",
+			       resource->cpu_cores, ihk_smp_nr_avail_cpus,
+			       os->group);
+			ret = -EINVAL;
+			goto out;
 		}
 
 		/* Assign cores */
 		for (i = 0; i < SMP_MAX_CPUS &&
 			ihk_smp_nr_allocated_cpus < resource->cpu_cores; i++) {
-			if (ihk_smp_cpus[i].status != IHK_SMP_CPU_AVAILABLE) {
+			if (ihk_smp_cpus[i].status != IHK_SMP_CPU_AVAILABLE ||
+			    ihk_smp_cpus[i].group != os->group) {
 				continue;
 			}
 
@@ -1515,27 +2681,53 @@ static int smp_ihk_os_alloc_resource(ihk_os_t ihk_os, void *priv,
 	/* Assign memory */
 	if (resource->mem_size) {
 		struct ihk_os_mem_chunk *os_mem_chunk;
+		struct ihk_mem_used_index *index;
 		struct chunk *mem_chunk_leftover;
 		struct chunk *mem_chunk_iter;
+		nodemask_t nodes_avail;
+		int node;
+
+		/* Nodes on which the group has the budget, checked before
+		 * ihk_smp_mem_index_begin() which excludes the check
+		 */
+		nodes_clear(nodes_avail);
+		for_each_online_node(node) {
+			if (ihk_smp_group_mem_avail(os->group, node) >=
+			    resource->mem_size) {
+				node_set(node, nodes_avail);
+			}
+		}
+
 		os_mem_chunk = kmalloc(sizeof(struct ihk_os_mem_chunk),
 		                       GFP_KERNEL);
 
 		if (!os_mem_chunk) {
 			printk("IHK-DMP: error: allocating os_mem_chunk\n");
-			return -ENOMEM;
+			ret = -ENOMEM;
+			goto error_drop_cores;
 		}
 
 		os_mem_chunk->addr = 0;
 		INIT_LIST_HEAD(&os_mem_chunk->list);
 
+		index = ihk_smp_mem_index_begin(1);
+		if (!index) {
+			ihk_smp_mem_index_end(NULL);
+			kfree(os_mem_chunk);
+			ret = -ENOMEM;
+			goto error_drop_cores;
+		}
+
 		list_for_each_entry(mem_chunk_iter, &ihk_mem_free_chunks,
 		                    chain) {
-			if (mem_chunk_iter->size >= resource->mem_size) {
+			if (mem_chunk_iter->size >= resource->mem_size &&
+			    node_isset(mem_chunk_iter->numa_id, nodes_avail)) {
 
 				os_mem_chunk->addr = mem_chunk_iter->addr;
 				os_mem_chunk->size = resource->mem_size;
 				os_mem_chunk->os = ihk_os;
 				os_mem_chunk->numa_id = mem_chunk_iter->numa_id;
+				os_mem_chunk->group = os->group;
 
 				list_del(&mem_chunk_iter->chain);
 				break;
@@ -1543,12 +2735,16 @@ static int smp_ihk_os_alloc_resource(ihk_os_t ihk_os, void *priv,
 		}
 
 		if (!os_mem_chunk->addr) {
-			printk("IHK-SMP: error: not enough memory\n");
+			printk("IHK-SMP: error: not enough memory in group %d\n",
+			       os->group);
+			ihk_smp_mem_index_end(index);
+			kfree(os_mem_chunk);
 			ret = -ENOMEM;
 			goto error_drop_cores;
 		}
 
 		list_add(&os_mem_chunk->list, &ihk_mem_used_chunks);
+		ihk_smp_mem_index_end(index);
 		resource->mem_start = os_mem_chunk->addr;
 
 		/* Split if there is any leftover */
@@ -1568,10 +2764,11 @@ static int smp_ihk_os_alloc_resource(ihk_os_t ihk_os, void *priv,
 		os->mem_start = resource->mem_start;
 		os->mem_end = os->mem_start + resource->mem_size;
 
-		dprintf("IHK-SMP: memory 0x%lx - 0x%lx allocated.\n",
+		dprintk("IHK-SMP: memory 0x%lx - 0x%lx allocated.\n",
 		        os->mem_start, os->mem_end);
 	}
 
+	mutex_unlock(&ihk_smp_group_lock);
 	set_os_status(os, BUILTIN_OS_STATUS_INITIAL);
 	return 0;
 
@@ -1588,7 +2785,9 @@ error_drop_cores:
 		ihk_smp_cpus[i].status = IHK_SMP_CPU_AVAILABLE;
 		ihk_smp_cpus[i].os = (ihk_os_t)0;
 	}
-
+ out:
+	mutex_unlock(&ihk_smp_group_lock);
+	set_os_status(os, BUILTIN_OS_STATUS_INITIAL);
 	return ret;
 }
 
@@ -1678,14 +2877,39 @@ int ihk_smp_set_nmi_mode(ihk_os_t ihk_os, void *priv, int mode)
 	return 0;
 }
 
+/*
+ * Woken up on IKC interrupts. The LWK sends one to the master channel
+ * CPU when it becomes ready, so that the boot path can sleep.
+ */
+static DECLARE_WAIT_QUEUE_HEAD(smp_ihk_os_status_wq);
+
+/* Also re-check without interrupts, e.g. for a panic during boot */
+#define SMP_IHK_OS_STATUS_RECHECK	HZ
+
+/* timeout is in 100 ms units in both modes */
 static int smp_ihk_os_wait_for_status(ihk_os_t ihk_os, void *priv,
                                       enum ihk_os_status status,
                                       int sleepable, int timeout)
 {
 	enum ihk_os_status s;
 	if (sleepable) {
-		/* TODO: Enable notification of status change, and wait */
-		return -1;
+		unsigned long deadline = jiffies +
+			msecs_to_jiffies(timeout * 100);
+		long left;
+
+		while ((s = smp_ihk_os_query_status(ihk_os, priv)),
+		       s != status && s < IHK_OS_STATUS_SHUTDOWN) {
+			left = (long)(deadline - jiffies);
+			if (left <= 0)
+				break;
+
+			wait_event_timeout(smp_ihk_os_status_wq,
+				smp_ihk_os_query_status(ihk_os, priv) != s,
+				min_t(long, left, SMP_IHK_OS_STATUS_RECHECK));
+			dprintk("%s: waiting for: %d, status: %d\n",
+				__func__, status, s);
+		}
+		return s == status ? 0 : -1;
 	} else {
 		/* Polling */
 		while ((s = smp_ihk_os_query_status(ihk_os, priv)),
@@ -1700,6 +2924,127 @@ static int smp_ihk_os_wait_for_status(ihk_os_t ihk_os, void *priv,
 	}
 }
 
+/*
+ * Calls to a set of LWK CPUs through the mailboxes of struct
+ * ihk_smp_call_area. The done fields tell which targets have completed,
+ * pending only makes the last one wake us up with an IKC interrupt.
+ */
+#define SMP_IHK_OS_CALL_RECHECK		msecs_to_jiffies(10)
+
+static int smp_ihk_os_call_cpus_done(struct smp_os_data *os,
+				     struct ihk_os_cpu_call *call,
+				     unsigned long seq)
+{
+	int i;
+
+	if (os->status != BUILTIN_OS_STATUS_BOOTING) {
+		return 1;
+	}
+
+	for (i = 0; i < call->nr_cpus; i++) {
+		if (os->call_area->mbox[call->cpus[i]].done != seq) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int smp_ihk_os_call_cpus(ihk_os_t ihk_os, void *priv,
+				struct ihk_os_cpu_call *call)
+{
+	struct smp_os_data *os = priv;
+	struct ihk_smp_call_area *area;
+	struct ihk_smp_call_mbox *mbox;
+	DECLARE_BITMAP(targets, SMP_MAX_CPUS);
+	unsigned long seq, deadline;
+	long left;
+	int i, ret = 0;
+
+	BUILD_BUG_ON(IHK_OS_CPU_CALL_NR_ARGS != IHK_SMP_CALL_NR_ARGS);
+	BUILD_BUG_ON(IHK_OS_CPU_CALL_NOP != IHK_SMP_CALL_NOP);
+
+	if (!call->cpus || call->nr_cpus <= 0) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&os->call_lock);
+
+	area = os->call_area;
+	if (!area || os->status != BUILTIN_OS_STATUS_BOOTING) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	bitmap_zero(targets, SMP_MAX_CPUS);
+	for (i = 0; i < call->nr_cpus; i++) {
+		int cpu = call->cpus[i];
+
+		if (cpu < 0 || cpu >= area->nr_mboxes ||
+		    test_and_set_bit(cpu, targets)) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	/* An earlier call that timed out may still be running */
+	for (i = 0; i < area->nr_mboxes; i++) {
+		if (area->mbox[i].done != area->mbox[i].seq) {
+			ret = -EBUSY;
+			goto out;
+		}
+	}
+
+	seq = ++os->call_seq;
+	area->pending = call->nr_cpus;
+	for (i = 0; i < call->nr_cpus; i++) {
+		mbox = &area->mbox[call->cpus[i]];
+		mbox->req = call->req;
+		memcpy(mbox->args, call->args, sizeof(mbox->args));
+		mbox->ret = 0;
+	}
+	smp_wmb();
+	for (i = 0; i < call->nr_cpus; i++) {
+		area->mbox[call->cpus[i]].seq = seq;
+	}
+	smp_mb();
+
+	smp_ihk_os_issue_interrupt_cpus(ihk_os, priv, call->cpus,
+					call->nr_cpus, IHK_SMP_IKC_VECTOR);
+
+	deadline = jiffies + msecs_to_jiffies(call->timeout_ms);
+	while (!smp_ihk_os_call_cpus_done(os, call, seq)) {
+		left = (long)(deadline - jiffies);
+		if (left <= 0) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		wait_event_timeout(smp_ihk_os_status_wq,
+			smp_ihk_os_call_cpus_done(os, call, seq),
+			min_t(long, left, SMP_IHK_OS_CALL_RECHECK));
+	}
+
+	if (!ret && os->status != BUILTIN_OS_STATUS_BOOTING) {
+		ret = -ENODEV;
+	}
+	smp_rmb();
+
+	if (call->rets) {
+		for (i = 0; i < call->nr_cpus; i++) {
+			mbox = &area->mbox[call->cpus[i]];
+			call->rets[i] = (mbox->done == seq) ? mbox->ret :
+				-ETIMEDOUT;
+		}
+	}
+
+	dprintk("%s: req: %d, nr_cpus: %d, ret: %d\n",
+		__func__, call->req, call->nr_cpus, ret);
+ out:
+	mutex_unlock(&os->call_lock);
+	return ret;
+}
+
 static int smp_ihk_os_get_special_addr(ihk_os_t ihk_os, void *priv,
                                        enum ihk_special_addr_type type,
                                        unsigned long *addr,
@@ -1809,10 +3154,19 @@ irqreturn_t smp_ihk_irq_call_handlers(int irq, void *data)
 	struct ihk_host_interrupt_handler *h;
 	int found = 0;
 
+	/* Pairs with the status check in wait_event_timeout() */
+	smp_mb();
+	if (waitqueue_active(&smp_ihk_os_status_wq)) {
+		wake_up(&smp_ihk_os_status_wq);
+	}
+
 	/* XXX: Linear search? */
 	list_for_each_entry(h, &builtin_interrupt_handlers, list) {
 		if (h->func) {
+			unsigned long long start = get_cycles();
+
 			h->func(h->os, h->os_priv, h->priv);
+			ihk_host_os_account(h->os, IHK_OS_ACCT_IRQ, start, 1);
 			found = 1;
 		}
 	}
@@ -1936,6 +3290,7 @@ static int smp_ihk_os_assign_cpu(ihk_os_t ihk_os, void *priv, unsigned long arg)
 	}
 
 	/* Check if cores to be assigned are available */
+	mutex_lock(&ihk_smp_group_lock);
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,0,0)
 	for_each_cpu(cpu, &cpus_to_assign) {
 #else
@@ -1943,12 +3298,23 @@ static int smp_ihk_os_assign_cpu(ihk_os_t ihk_os, void *priv, unsigned long arg)
 #endif
 		if (ihk_smp_cpus[cpu].status != IHK_SMP_CPU_AVAILABLE) {
 			printk("IHK-SMP: error: CPU core %d is not available for assignment\n", cpu);
+			mutex_unlock(&ihk_smp_group_lock);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		if (ihk_smp_cpus[cpu].group != os->group) {
+			pr_err("IHK-SMP: error: CPU %d is in group %d, OS %p draws from group %d\n",
+			       cpu, ihk_smp_cpus[cpu].group, ihk_os,
+			       os->group);
+			mutex_unlock(&ihk_smp_group_lock);
 			ret = -EINVAL;
 			goto out;
 		}
 	}
 
 	ret = __assign_cpus(ihk_os, os, req_cpus, req.num_cpus);
+	mutex_unlock(&ihk_smp_group_lock);
 	if (ret) {
 		pr_err("%s: error: assigning CPUs: %s\n", __func__, req_string);
 		goto out;
@@ -2412,33 +3778,260 @@ out:
 	return ret;
 }
 
-static int smp_ihk_os_get_buildid(ihk_os_t ihk_os, void *priv, unsigned long arg)
+static int smp_ihk_os_pwr_running(ihk_os_t ihk_os, void *priv)
 {
-	char buildid[] = BUILDID;
-	if (copy_to_user((void*)arg, buildid, sizeof(buildid))) {
-		return -EFAULT;
+	enum ihk_os_status status = smp_ihk_os_query_status(ihk_os, priv);
+
+	return status == IHK_OS_STATUS_READY ||
+		status == IHK_OS_STATUS_RUNNING;
+}
+
+static int smp_ihk_os_set_debug_mask(ihk_os_t ihk_os, void *priv,
+				     unsigned long arg)
+{
+	struct smp_os_data *os = priv;
+	unsigned long flags;
+
+	/* Taken from the OS data at boot when not running */
+	spin_lock_irqsave(&os->lock, flags);
+	if (os->param) {
+		os->param->debug_mask = arg;
 	}
+	spin_unlock_irqrestore(&os->lock, flags);
+
 	return 0;
 }
 
-static int __smp_ihk_os_assign_mem(ihk_os_t ihk_os, struct smp_os_data *os,
-		 size_t mem_size, int numa_id)
+static int smp_ihk_pwr_knob_valid(int val, int max)
 {
-	int ret = 0;
-	struct ihk_os_mem_chunk *os_mem_chunk = NULL;
-	struct ihk_os_mem_chunk *os_mem_chunk_tba_iter;
-	struct ihk_os_mem_chunk *os_mem_chunk_tba_next = NULL;
-	struct ihk_os_mem_chunk *os_mem_chunk_iter;
-	struct ihk_os_mem_chunk *os_mem_chunk_next = NULL;
-	struct chunk *mem_chunk_leftover;
-	struct chunk *mem_chunk_iter;
-	struct chunk *mem_chunk_max;
-	struct chunk *mem_chunk_match;
-	size_t mem_size_left = mem_size;
-	size_t want = mem_size;
-	struct list_head to_be_assigned_chunks;
+	return val == IHK_PWR_KEEP || val == IHK_PWR_RESET ||
+		(val >= 0 && val <= max);
+}
 
-	INIT_LIST_HEAD(&to_be_assigned_chunks);
+/* Stored value of a knob after a request */
+static void smp_ihk_pwr_knob_update(int *knob, int val)
+{
+	if (val == IHK_PWR_RESET)
+		*knob = IHK_PWR_KEEP;
+	else if (val != IHK_PWR_KEEP)
+		*knob = val;
+}
+
+/* Turn IHK_PWR_RESET into IHK_PWR_KEEP, for applying to a running OS */
+static void smp_ihk_pwr_drop_reset(struct ihk_pwr_setting *setting)
+{
+	int *knobs[] = {
+		&setting->min_perf, &setting->max_perf, &setting->epp,
+		&setting->epb, &setting->turbo, &setting->cstate_limit,
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(knobs); i++) {
+		if (*knobs[i] == IHK_PWR_RESET)
+			*knobs[i] = IHK_PWR_KEEP;
+	}
+}
+
+static int smp_ihk_os_set_pwr(ihk_os_t ihk_os, void *priv, unsigned long arg)
+{
+	struct smp_os_data *os = priv;
+	struct ihk_pwr_req req;
+	struct ihk_pwr_setting *pwr;
+	int *cpus = NULL;
+	int i, lwk_cpu, ret = 0;
+
+	if (copy_from_user(&req, (void *)arg, sizeof(req))) {
+		pr_err("%s: error: copying request\n", __func__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (req.num_cpus <= 0 || req.num_cpus > SMP_MAX_CPUS) {
+		pr_err("%s: error: invalid number of CPUs: %d\n",
+		       __func__, req.num_cpus);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!smp_ihk_pwr_knob_valid(req.setting.epp, 255) ||
+	    !smp_ihk_pwr_knob_valid(req.setting.epb, 15) ||
+	    !smp_ihk_pwr_knob_valid(req.setting.turbo, 1) ||
+	    !smp_ihk_pwr_knob_valid(req.setting.min_perf, 255) ||
+	    !smp_ihk_pwr_knob_valid(req.setting.max_perf, 255) ||
+	    !smp_ihk_pwr_knob_valid(req.setting.cstate_limit, 15)) {
+		pr_err("%s: error: invalid setting\n", __func__);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	cpus = kmalloc(sizeof(int) * req.num_cpus, GFP_KERNEL);
+	if (!cpus) {
+		pr_err("%s: error: allocating request cpus\n", __func__);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(cpus, req.cpus, sizeof(int) * req.num_cpus)) {
+		pr_err("%s: error: copying request cpus\n", __func__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < req.num_cpus; i++) {
+		if (cpus[i] < 0 || cpus[i] >= SMP_MAX_CPUS ||
+		    ihk_smp_cpus[cpus[i]].os != ihk_os) {
+			pr_err("%s: error: CPU %d is not assigned to the OS\n",
+			       __func__, cpus[i]);
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < req.num_cpus; i++) {
+		pwr = &os->cpu_pwr[cpus[i]];
+
+		smp_ihk_pwr_knob_update(&pwr->min_perf, req.setting.min_perf);
+		smp_ihk_pwr_knob_update(&pwr->max_perf, req.setting.max_perf);
+		smp_ihk_pwr_knob_update(&pwr->epp, req.setting.epp);
+		smp_ihk_pwr_knob_update(&pwr->epb, req.setting.epb);
+		smp_ihk_pwr_knob_update(&pwr->turbo, req.setting.turbo);
+		smp_ihk_pwr_knob_update(&pwr->cstate_limit,
+					req.setting.cstate_limit);
+	}
+
+	/* Settings are picked up at boot time otherwise */
+	if (!smp_ihk_os_pwr_running(ihk_os, priv))
+		goto out;
+
+	/* What the firmware set can't be restored on a running OS */
+	smp_ihk_pwr_drop_reset(&req.setting);
+
+	for (i = 0; i < req.num_cpus; i++) {
+		lwk_cpu = linux_cpu_2_lwk_cpu(os, cpus[i]);
+		if (lwk_cpu < 0)
+			continue;
+
+		ret = smp_ihk_arch_os_apply_pwr(ihk_os, lwk_cpu, &req.setting);
+		if (ret) {
+			pr_err("%s: error: applying to CPU %d: %d\n",
+			       __func__, cpus[i], ret);
+			goto out;
+		}
+	}
+
+out:
+	kfree(cpus);
+	return ret;
+}
+
+static int smp_ihk_os_get_pwr(ihk_os_t ihk_os, void *priv, unsigned long arg)
+{
+	struct smp_os_data *os = priv;
+	struct ihk_pwr_stat_req req;
+	struct ihk_pwr_stat *stats = NULL;
+	int i, lwk_cpu, running, ret = 0;
+
+	if (copy_from_user(&req, (void *)arg, sizeof(req))) {
+		pr_err("%s: error: copying request\n", __func__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (req.num_cpus <= 0 || req.num_cpus > SMP_MAX_CPUS) {
+		pr_err("%s: error: invalid number of CPUs: %d\n",
+		       __func__, req.num_cpus);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	stats = kmalloc(sizeof(*stats) * req.num_cpus, GFP_KERNEL);
+	if (!stats) {
+		pr_err("%s: error: allocating stats\n", __func__);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(stats, req.stats, sizeof(*stats) * req.num_cpus)) {
+		pr_err("%s: error: copying stats\n", __func__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	running = smp_ihk_os_pwr_running(ihk_os, priv);
+
+	for (i = 0; i < req.num_cpus; i++) {
+		int cpu = stats[i].cpu;
+
+		if (cpu < 0 || cpu >= SMP_MAX_CPUS ||
+		    ihk_smp_cpus[cpu].os != ihk_os) {
+			pr_err("%s: error: CPU %d is not assigned to the OS\n",
+			       __func__, cpu);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		stats[i].setting = os->cpu_pwr[cpu];
+		stats[i].running = 0;
+		stats[i].tsc = stats[i].aperf = stats[i].mperf = 0;
+
+		lwk_cpu = linux_cpu_2_lwk_cpu(os, cpu);
+		if (!running || lwk_cpu < 0)
+			continue;
+
+		ret = smp_ihk_arch_os_read_pwr_stat(ihk_os, lwk_cpu,
+						    &stats[i]);
+		if (ret == -EOPNOTSUPP) {
+			ret = 0;
+			continue;
+		}
+		if (ret) {
+			pr_err("%s: error: reading counters of CPU %d: %d\n",
+			       __func__, cpu, ret);
+			goto out;
+		}
+		stats[i].running = 1;
+	}
+
+	if (copy_to_user(req.stats, stats, sizeof(*stats) * req.num_cpus)) {
+		pr_err("%s: error: copying stats to user-space\n", __func__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+out:
+	kfree(stats);
+	return ret;
+}
+
+static int smp_ihk_os_get_buildid(ihk_os_t ihk_os, void *priv, unsigned long arg)
+{
+	char buildid[] = BUILDID;
+	if (copy_to_user((void*)arg, buildid, sizeof(buildid))) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+static int __smp_ihk_os_assign_mem(ihk_os_t ihk_os, struct smp_os_data *os,
+		 size_t mem_size, int numa_id)
+{
+	int ret = 0;
+	struct ihk_os_mem_chunk *os_mem_chunk = NULL;
+	struct ihk_os_mem_chunk *os_mem_chunk_tba_iter;
+	struct ihk_os_mem_chunk *os_mem_chunk_tba_next = NULL;
+	struct ihk_os_mem_chunk *os_mem_chunk_iter;
+	struct ihk_os_mem_chunk *os_mem_chunk_next = NULL;
+	struct chunk *mem_chunk_leftover;
+	struct chunk *mem_chunk_iter;
+	struct chunk *mem_chunk_max;
+	struct chunk *mem_chunk_match;
+	size_t mem_size_left = mem_size;
+	size_t want = mem_size;
+	struct list_head to_be_assigned_chunks;
+	struct ihk_mem_used_index *index;
+	int nr_chunks = 0;
+
+	INIT_LIST_HEAD(&to_be_assigned_chunks);
 
 	while (mem_size_left) {
 		mem_size = mem_size_left;
@@ -2519,6 +4112,7 @@ static int __smp_ihk_os_assign_mem(ihk_os_t ihk_os, struct smp_os_data *os,
 
 		os_mem_chunk->os = ihk_os;
 		os_mem_chunk->numa_id = numa_id;
+		os_mem_chunk->group = os->group;
 
 		/* Exact match? */
 		if (mem_chunk_match) {
@@ -2584,6 +4178,19 @@ static int __smp_ihk_os_assign_mem(ihk_os_t ihk_os, struct smp_os_data *os,
 		goto out;
 	}
 
+	list_for_each_entry(os_mem_chunk_tba_iter, &to_be_assigned_chunks,
+			    list) {
+		nr_chunks++;
+	}
+
+	index = ihk_smp_mem_index_begin(nr_chunks);
+	if (!index) {
+		ihk_smp_mem_index_end(NULL);
+		printk(KERN_ERR "IHK-SMP: error: allocating chunk index\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	/* We got all pieces we need, add them to the OS instance */
 	list_for_each_entry_safe(os_mem_chunk_tba_iter, os_mem_chunk_tba_next,
 			&to_be_assigned_chunks, list) {
@@ -2604,14 +4211,14 @@ static int __smp_ihk_os_assign_mem(ihk_os_t ihk_os, struct smp_os_data *os,
 		/* Add in front of next */
 		if (os_mem_chunk_next) {
 			list_add_tail(&os_mem_chunk->list, &os_mem_chunk_next->list);
-			dprintf("IHK-SMP: memory 0x%lx - 0x%lx (len: %lu) @ NUMA node %d assigned to %p [in front of 0x%lx]\n",
+			dprintk("IHK-SMP: memory 0x%lx - 0x%lx (len: %lu) @ NUMA node %d assigned to %p [in front of 0x%lx]\n",
 					os_mem_chunk->addr, os_mem_chunk->addr + os_mem_chunk->size,
 					os_mem_chunk->size, numa_id, ihk_os, os_mem_chunk_next->addr);
 		}
 		/* Add to the end */
 		else {
 			list_add_tail(&os_mem_chunk->list, &ihk_mem_used_chunks);
-			dprintf("IHK-SMP: memory 0x%lx - 0x%lx (len: %lu) @ NUMA node %d assigned to %p [tail]\n",
+			dprintk("IHK-SMP: memory 0x%lx - 0x%lx (len: %lu) @ NUMA node %d assigned to %p [tail]\n",
 					os_mem_chunk->addr, os_mem_chunk->addr + os_mem_chunk->size,
 					os_mem_chunk->size, numa_id, ihk_os);
 		}
@@ -2630,6 +4237,7 @@ static int __smp_ihk_os_assign_mem(ihk_os_t ihk_os, struct smp_os_data *os,
 			   os_mem_chunk->addr, os_mem_chunk->addr + os_mem_chunk->size,
 			   os_mem_chunk->size, numa_id, ihk_os);
 	}
+	ihk_smp_mem_index_end(index);
 
 	ret = 0;
 
@@ -2719,15 +4327,36 @@ static int smp_ihk_os_assign_mem(ihk_os_t ihk_os, void *priv, unsigned long arg)
 		goto out;
 	}
 
+	mutex_lock(&ihk_smp_group_lock);
 	for (i = 0; i < req.num_chunks; i++) {
-		ret = __smp_ihk_os_assign_mem(ihk_os, os, req_sizes[i],
-				req_numa_ids[i]);
+		size_t size = req_sizes[i];
+		unsigned long avail;
+
+		/* Draw only from the memory of the group of the OS */
+		avail = ihk_smp_group_mem_avail(os->group, req_numa_ids[i]);
+		if (size == IHK_SMP_MEM_ALL) {
+			if (avail < ihk_smp_free_mem_on_node(req_numa_ids[i])) {
+				size = avail;
+			}
+		}
+		else if (size > avail) {
+			pr_err("IHK-SMP: os_assign_mem: error: %lu bytes requested, %lu available in group %d @ NUMA node %d\n",
+			       size, avail, os->group, req_numa_ids[i]);
+			ret = -ENOMEM;
+		}
+
+		if (!ret && size) {
+			ret = __smp_ihk_os_assign_mem(ihk_os, os, size,
+						      req_numa_ids[i]);
+		}
 		if (ret != 0) {
 			printk("IHK-SMP: os_assign_mem: error: assigning memory chunk\n");
+			mutex_unlock(&ihk_smp_group_lock);
 			failed_index = i;
 			goto out;
 		}
 	}
+	mutex_unlock(&ihk_smp_group_lock);
 
 out:
 	/* Release all when failed */
@@ -2745,8 +4374,10 @@ static int _smp_ihk_os_release_mem(ihk_os_t ihk_os, size_t size, int numa_id)
 	int ret;
 	struct ihk_os_mem_chunk *os_mem_chunk = NULL;
 	struct ihk_os_mem_chunk *next_chunk = NULL;
+	struct ihk_mem_used_index *index;
 	struct chunk *mem_chunk;
 
+	index = ihk_smp_mem_index_begin(0);
 	list_for_each_entry_safe(os_mem_chunk, next_chunk,
 				 &ihk_mem_used_chunks, list) {
 
@@ -2784,7 +4415,7 @@ static int _smp_ihk_os_release_mem(ihk_os_t ihk_os, size_t size, int numa_id)
 #ifdef ENABLE_FUGAKU_HACKS
 					if (0)
 #endif
-					dprintf("%s: chunk 0x%lx:%lu TNI %d, CQ %d,"
+					dprintk("%s: chunk 0x%lx:%lu TNI %d, CQ %d,"
 							" DMA addr: 0x%lx released\n",
 							__func__,
 							os_mem_chunk->addr,
@@ -2806,6 +4437,7 @@ static int _smp_ihk_os_release_mem(ihk_os_t ihk_os, size_t size, int numa_id)
 
 	ret = -EINVAL;
  out:
+	ihk_smp_mem_index_end(index);
 	return ret;
 }
 
@@ -2999,6 +4631,77 @@ out:
 	return ret;
 }
 
+/** \brief Bind an OS instance to the reservation group its CPUs and
+ *  memory are to be assigned from. Only allowed while nothing is
+ *  assigned to it. */
+static int smp_ihk_os_set_group(ihk_os_t ihk_os, void *priv,
+				unsigned long arg)
+{
+	int ret = 0;
+	int group = (int)arg;
+	struct smp_os_data *os = priv;
+	struct ihk_os_mem_chunk *os_mem_chunk;
+	unsigned long flags;
+
+	if (group < 0 || group >= IHK_MAX_GROUPS) {
+		pr_err("%s: error: invalid group %d\n", __func__, group);
+		return -EINVAL;
+	}
+
+	mutex_lock(&ihk_smp_group_lock);
+
+	spin_lock_irqsave(&os->lock, flags);
+	if (os->status != BUILTIN_OS_STATUS_INITIAL) {
+		ret = -EBUSY;
+	}
+	spin_unlock_irqrestore(&os->lock, flags);
+	if (ret) {
+		pr_err("%s: error: os status: %d\n", __func__, os->status);
+		goto out;
+	}
+
+	if (!ihk_smp_group_valid(group)) {
+		pr_err("%s: error: group %d doesn't exist\n", __func__, group);
+		ret = -ENOENT;
+		goto out;
+	}
+
+	if (os->nr_cpus) {
+		ret = -EBUSY;
+	}
+
+	mutex_lock(&ihk_mem_used_index_lock);
+	list_for_each_entry(os_mem_chunk, &ihk_mem_used_chunks, list) {
+		if (os_mem_chunk->os == ihk_os) {
+			ret = -EBUSY;
+			break;
+		}
+	}
+	mutex_unlock(&ihk_mem_used_index_lock);
+
+	if (ret) {
+		pr_err("%s: error: CPUs or memory are assigned to OS %p\n",
+		       __func__, ihk_os);
+		goto out;
+	}
+
+	ihk_smp_groups[os->group].nr_os--;
+	os->group = group;
+	ihk_smp_groups[group].nr_os++;
+
+	pr_info("IHK-SMP: OS %p draws from group %d\n", ihk_os, group);
+out:
+	mutex_unlock(&ihk_smp_group_lock);
+	return ret;
+}
+
+static int smp_ihk_os_get_group(ihk_os_t ihk_os, void *priv)
+{
+	struct smp_os_data *os = priv;
+
+	return os->group;
+}
+
 static int smp_ihk_os_freeze(ihk_os_t ihk_os, void *priv)
 {
 	smp_ihk_os_send_multi_intr(ihk_os, priv, 1);
@@ -3124,6 +4827,7 @@ static struct ihk_os_ops smp_ihk_os_ops = {
 	.set_kargs = smp_ihk_os_set_kargs,
 	.dump = smp_ihk_os_dump,
 	.issue_interrupt = smp_ihk_os_issue_interrupt,
+	.call_cpus = smp_ihk_os_call_cpus,
 	.send_multi_intr = smp_ihk_os_send_multi_intr,
 	.send_nmi = smp_ihk_os_send_nmi,
 	.map_memory = smp_ihk_os_map_memory,
@@ -3138,16 +4842,23 @@ static struct ihk_os_ops smp_ihk_os_ops = {
 	.release_cpu = smp_ihk_os_release_cpu,
 	.set_ikc_map = smp_ihk_os_set_ikc_map,
 	.get_ikc_map = smp_ihk_os_get_ikc_map,
+	.set_pwr = smp_ihk_os_set_pwr,
+	.get_pwr = smp_ihk_os_get_pwr,
+	.set_debug_mask = smp_ihk_os_set_debug_mask,
 	.get_buildid = smp_ihk_os_get_buildid,
 	.get_num_cpus = smp_ihk_os_get_num_cpus,
 	.query_cpu = smp_ihk_os_query_cpu,
 	.assign_mem = smp_ihk_os_assign_mem,
 	.release_mem = smp_ihk_os_release_mem,
 	.query_mem = smp_ihk_os_query_mem,
+	.set_group = smp_ihk_os_set_group,
+	.get_group = smp_ihk_os_get_group,
 	.freeze = smp_ihk_os_freeze,
 	.thaw = smp_ihk_os_thaw,
 	.panic_notifier = smp_ihk_os_panic_notifier,
 	.vtop = smp_ihk_os_vtop,
+	.show_stats = smp_ihk_os_show_stats,
+	.reset_stats = smp_ihk_os_reset_stats,
 };
 
 static struct ihk_register_os_data builtin_os_reg_data = {
@@ -3162,6 +4873,7 @@ static int smp_ihk_create_os(ihk_device_t ihk_dev, void *priv,
 {
 	struct builtin_device_data *data = priv;
 	struct smp_os_data *os;
+	int i;
 
 	if (!priv || !regdata) {
 		return -EFAULT;
@@ -3177,13 +4889,29 @@ static int smp_ihk_create_os(ihk_device_t ihk_dev, void *priv,
 	}
 
 	spin_lock_init(&os->lock);
+	mutex_init(&os->call_lock);
 	os->dev = data;
+	os->ihk_os = ihk_os;
 	regdata->priv = os;
 	/* Put the image into the smallest NUMA id if value is -1,
 	 * use the designated NUMA node otherwise */
 	os->bootstrap_numa_id = -1;
 	os->boot_pt = NULL;
 
+	for (i = 0; i < SMP_MAX_CPUS; i++) {
+		os->cpu_pwr[i].min_perf = IHK_PWR_KEEP;
+		os->cpu_pwr[i].max_perf = IHK_PWR_KEEP;
+		os->cpu_pwr[i].epp = IHK_PWR_KEEP;
+		os->cpu_pwr[i].epb = IHK_PWR_KEEP;
+		os->cpu_pwr[i].turbo = IHK_PWR_KEEP;
+		os->cpu_pwr[i].cstate_limit = IHK_PWR_KEEP;
+	}
+
+	/* Draw from the device-wide pool until IHK_OS_SET_GROUP */
+	mutex_lock(&ihk_smp_group_lock);
+	ihk_smp_groups[0].nr_os++;
+	mutex_unlock(&ihk_smp_group_lock);
+
 	return 0;
 }
 
@@ -3191,6 +4919,14 @@ static int smp_ihk_destroy_os(ihk_device_t ihk_dev, void *ihk_dev_priv,
 							  ihk_os_t ihk_os, void *ihk_os_priv)
 {
 	struct smp_os_data *smp_os = ihk_os_priv;
+
+	mutex_lock(&ihk_smp_group_lock);
+	ihk_smp_groups[smp_os->group].nr_os--;
+	mutex_unlock(&ihk_smp_group_lock);
+
+	if (smp_os->boot_pt) {
+		ihk_smp_free_page_tables(smp_os->boot_pt);
+	}
 	kfree(smp_os);
 	return 0;
 }
@@ -3224,6 +4960,24 @@ static void *smp_ihk_map_virtual(ihk_device_t ihk_dev, void *priv,
 	}
 }
 
+/* LWK memory is in the linear map already, just check it's assigned */
+static void *smp_ihk_linear_map(ihk_device_t ihk_dev, void *priv,
+                                ihk_os_t ihk_os, unsigned long phys,
+                                unsigned long size)
+{
+	return __ihk_smp_map_virtual(phys, size, ihk_os);
+}
+
+static void smp_ihk_lock_mem(ihk_device_t ihk_dev, void *priv)
+{
+	down_read(&ihk_mem_access_sem);
+}
+
+static void smp_ihk_unlock_mem(ihk_device_t ihk_dev, void *priv)
+{
+	up_read(&ihk_mem_access_sem);
+}
+
 static int smp_ihk_unmap_virtual(ihk_device_t ihk_dev, void *priv,
                                  void *virt, unsigned long size)
 {
@@ -3248,47 +5002,197 @@ static long smp_ihk_debug_request(ihk_device_t ihk_dev, void *priv,
 	return -EINVAL;
 }
 
-static int __smp_ihk_free_mem_from_list(struct list_head *list)
+static struct bus_type *ihk_memory_subsys;
+static unsigned long (*ihk_memory_block_size_bytes)(void);
+static void (*ihk_lock_device_hotplug)(void);
+static void (*ihk_unlock_device_hotplug)(void);
+
+static int __ihk_smp_mem_hotplug_init(void)
 {
-	struct chunk *mem_chunk;
-	struct chunk *mem_chunk_next;
-	unsigned long size_left;
-	unsigned long va;
+	if (ihk_memory_subsys) {
+		return 0;
+	}
 
-	/* Drop all memory for now.. */
-	list_for_each_entry_safe(mem_chunk,
-			mem_chunk_next, list, chain) {
-		unsigned long pa = mem_chunk->addr;
-#ifdef IHK_DEBUG
-		unsigned long size = mem_chunk->size;
-#endif
+	ihk_memory_block_size_bytes =
+		(void *)kallsyms_lookup_name("memory_block_size_bytes");
+	ihk_lock_device_hotplug =
+		(void *)kallsyms_lookup_name("lock_device_hotplug");
+	ihk_unlock_device_hotplug =
+		(void *)kallsyms_lookup_name("unlock_device_hotplug");
+	if (!ihk_memory_block_size_bytes || !ihk_lock_device_hotplug ||
+	    !ihk_unlock_device_hotplug) {
+		pr_err("IHK-SMP: error: memory hotplug isn't available\n");
+		return -ENOSYS;
+	}
 
-		list_del(&mem_chunk->chain);
+	/* Set last, it tells the lookup is done */
+	ihk_memory_subsys = (void *)kallsyms_lookup_name("memory_subsys");
+	if (!ihk_memory_subsys) {
+		pr_err("IHK-SMP: error: memory_subsys not found\n");
+		return -ENOSYS;
+	}
 
-		va = (unsigned long)phys_to_virt(pa);
-		size_left = mem_chunk->size;
-		while (size_left > 0) {
-			int order;
-			size_t order_size;
-			struct page *page = virt_to_page(va);
+	return 0;
+}
 
-			if (!PageCompound(page)) {
-				free_page(va);
-				size_left -= PAGE_SIZE;
-				va += PAGE_SIZE;
-				continue;
-			}
+/*
+ * Offline or online the memory block starting at addr in the same way
+ * as writing to /sys/devices/system/memory/memoryN/online does.
+ * Returns 1 when the block is already in the requested state.
+ */
+static int __ihk_smp_set_mem_block_online(unsigned long addr, int online)
+{
+	struct device *dev;
+	int ret;
 
-			if (!PageHead(page)) {
-				printk(KERN_DEBUG "%s: WARNING: page is compound but not head, skipping..\n",
-					__FUNCTION__);
-				size_left -= PAGE_SIZE;
-				va += PAGE_SIZE;
-				continue;
-			}
+	dev = subsys_find_device_by_id(ihk_memory_subsys,
+			addr / ihk_memory_block_size_bytes(), NULL);
+	if (!dev) {
+		return -ENODEV;
+	}
 
-			order = compound_order(page);
-			order_size = (PAGE_SIZE << order);
+	ihk_lock_device_hotplug();
+	if (online) {
+		ret = dev->offline ? device_online(dev) : 1;
+	}
+	else {
+		ret = device_offline(dev);
+	}
+	ihk_unlock_device_hotplug();
+
+	put_device(dev);
+	return ret;
+}
+
+/* Returns 1 if the memory block starting at addr is offline, 0 if not */
+static int __ihk_smp_mem_block_offline(unsigned long addr)
+{
+	struct device *dev;
+	int ret;
+
+	dev = subsys_find_device_by_id(ihk_memory_subsys,
+			addr / ihk_memory_block_size_bytes(), NULL);
+	if (!dev) {
+		return -ENODEV;
+	}
+
+	ihk_lock_device_hotplug();
+	ret = dev->offline ? 1 : 0;
+	ihk_unlock_device_hotplug();
+
+	put_device(dev);
+	return ret;
+}
+
+static void __ihk_smp_online_mem_blocks(unsigned long start,
+				       unsigned long size)
+{
+	unsigned long block_size = ihk_memory_block_size_bytes();
+	unsigned long addr;
+	int ret;
+
+	for (addr = start; addr < start + size; addr += block_size) {
+		ret = __ihk_smp_set_mem_block_online(addr, 1);
+		if (ret < 0) {
+			pr_err("IHK-SMP: error: onlining memory block 0x%lx: %d\n",
+			       addr, ret);
+		}
+	}
+}
+
+static void __ihk_smp_online_range(struct ihk_offlined_range *range)
+{
+	__ihk_smp_online_mem_blocks(range->addr, range->size);
+
+	pr_info("IHK-SMP: memory blocks 0x%lx - 0x%lx @ NUMA node: %d"
+		" are onlined\n",
+		range->addr, range->addr + range->size, range->numa_id);
+
+	list_del(&range->list);
+	kfree(range);
+}
+
+/* Returns 0 if the chunk was part of an offlined range */
+static int __ihk_smp_release_offlined_chunk(struct chunk *mem_chunk)
+{
+	struct ihk_offlined_range *range;
+
+	range = __ihk_smp_find_offlined_range(mem_chunk->addr);
+	if (!range) {
+		return -ENOENT;
+	}
+
+	range->released += mem_chunk->size;
+	if (range->released < range->size) {
+		mdprintk("%s: 0x%lx - 0x%lx: %lu of %lu bytes released\n",
+			__func__, range->addr, range->addr + range->size,
+			range->released, range->size);
+		return 0;
+	}
+
+	__ihk_smp_online_range(range);
+	return 0;
+}
+
+/* Online what is left offlined, e.g. chunks leaked by a failed boot */
+static void __ihk_smp_online_all_ranges(void)
+{
+	struct ihk_offlined_range *range, *next;
+
+	list_for_each_entry_safe(range, next, &ihk_offlined_ranges, list) {
+		pr_warn("IHK-SMP: warning: %lu bytes of 0x%lx - 0x%lx"
+			" weren't released\n",
+			range->size - range->released,
+			range->addr, range->addr + range->size);
+		__ihk_smp_online_range(range);
+	}
+}
+
+static int __smp_ihk_free_mem_from_list(struct list_head *list)
+{
+	struct chunk *mem_chunk;
+	struct chunk *mem_chunk_next;
+	unsigned long size_left;
+	unsigned long va;
+
+	/* Drop all memory for now.. */
+	list_for_each_entry_safe(mem_chunk,
+			mem_chunk_next, list, chain) {
+		unsigned long pa = mem_chunk->addr;
+#ifdef IHK_DEBUG
+		unsigned long size = mem_chunk->size;
+#endif
+
+		list_del(&mem_chunk->chain);
+
+		if (!__ihk_smp_release_offlined_chunk(mem_chunk)) {
+			continue;
+		}
+
+		va = (unsigned long)phys_to_virt(pa);
+		size_left = mem_chunk->size;
+		while (size_left > 0) {
+			int order;
+			size_t order_size;
+			struct page *page = virt_to_page(va);
+
+			if (!PageCompound(page)) {
+				free_page(va);
+				size_left -= PAGE_SIZE;
+				va += PAGE_SIZE;
+				continue;
+			}
+
+			if (!PageHead(page)) {
+				printk(KERN_DEBUG "%s: WARNING: page is compound but not head, skipping..\n",
+					__FUNCTION__);
+				size_left -= PAGE_SIZE;
+				va += PAGE_SIZE;
+				continue;
+			}
+
+			order = compound_order(page);
+			order_size = (PAGE_SIZE << order);
 
 			free_pages(va, order);
 			pr_debug("0x%lx, page order: %d freed\n", va, order);
@@ -3298,13 +5202,13 @@ static int __smp_ihk_free_mem_from_list(struct list_head *list)
 				va += order_size;
 			}
 			else {
-				dprintk("%s: order_size - size_left: %lu\n",
+				mdprintk("%s: order_size - size_left: %lu\n",
 					__FUNCTION__, order_size - size_left);
 				size_left = 0;
 			}
 		}
 
-		dprintf("IHK-SMP: 0x%lx - 0x%lx freed\n", pa, pa + size);
+		mdprintk("IHK-SMP: 0x%lx - 0x%lx freed\n", pa, pa + size);
 	}
 
 	return 0;
@@ -3321,7 +5225,7 @@ static int __smp_ihk_free_mem_from_rbtree(struct rb_root *root)
 	while (node) {
 		mem_chunk = container_of(node, struct chunk, node);
 
-		dprintf("IHK-SMP: 0x%lx - 0x%lx freed\n",
+		mdprintk("IHK-SMP: 0x%lx - 0x%lx freed\n",
 			mem_chunk->addr, mem_chunk->addr + mem_chunk->size);
 
 		rb_erase(node, root);
@@ -3344,7 +5248,8 @@ void __mem_chunk_insert(struct rb_root *root, struct chunk *chunk)
 		parent = *iter;
 
 		/* Is ichunk contigous from the left? */
-		if (ichunk->addr + ichunk->size == chunk->addr) {
+		if (ichunk->addr + ichunk->size == chunk->addr &&
+		    mem_chunks_mergeable(ichunk, chunk)) {
 			struct rb_node *right;
 			/* Extend it to the right */
 			ichunk->size += chunk->size;
@@ -3355,7 +5260,8 @@ void __mem_chunk_insert(struct rb_root *root, struct chunk *chunk)
 				struct chunk *right_chunk =
 					container_of(right, struct chunk, node);
 
-				if (ichunk->addr + ichunk->size == right_chunk->addr) {
+				if (ichunk->addr + ichunk->size == right_chunk->addr &&
+				    mem_chunks_mergeable(ichunk, right_chunk)) {
 					ichunk->size += right_chunk->size;
 					rb_erase(right, root);
 				}
@@ -3365,7 +5271,8 @@ void __mem_chunk_insert(struct rb_root *root, struct chunk *chunk)
 		}
 
 		/* Is ichunk contigous from the right? */
-		if (chunk->addr + chunk->size == ichunk->addr) {
+		if (chunk->addr + chunk->size == ichunk->addr &&
+		    mem_chunks_mergeable(chunk, ichunk)) {
 			struct rb_node *left;
 			/* Extend it to the left */
 			ichunk->addr -= chunk->size;
@@ -3377,7 +5284,8 @@ void __mem_chunk_insert(struct rb_root *root, struct chunk *chunk)
 				struct chunk *left_chunk =
 					container_of(left, struct chunk, node);
 
-				if (left_chunk->addr + left_chunk->size == ichunk->addr) {
+				if (left_chunk->addr + left_chunk->size == ichunk->addr &&
+				    mem_chunks_mergeable(left_chunk, ichunk)) {
 					ichunk->addr -= left_chunk->size;
 					ichunk->size += left_chunk->size;
 					rb_erase(left, root);
@@ -3433,18 +5341,187 @@ static void sort_pagelists(struct zone *zone)
 	}
 }
 
+/* Hand contiguous offlined blocks to IHK as one chunk */
+static int __ihk_smp_add_offlined_range(unsigned long addr, unsigned long size,
+					int numa_id)
+{
+	struct ihk_offlined_range *range;
+	struct chunk *p;
+
+	range = kzalloc(sizeof(*range), GFP_KERNEL);
+	if (!range) {
+		pr_err("IHK-SMP: error: allocating offlined range\n");
+		__ihk_smp_online_mem_blocks(addr, size);
+		return -ENOMEM;
+	}
+
+	range->addr = addr;
+	range->size = size;
+	range->numa_id = numa_id;
+	list_add_tail(&range->list, &ihk_offlined_ranges);
+
+	/* The linear mapping is kept while the memory is offline */
+	p = (struct chunk *)phys_to_virt(addr);
+	p->addr = addr;
+	p->size = size;
+	p->numa_id = numa_id;
+	INIT_LIST_HEAD(&p->chain);
+	add_free_mem_chunk(p);
+
+	printk(KERN_INFO "IHK-SMP: chunk 0x%lx - 0x%lx"
+	       " (len: %lu) @ NUMA node: %d is available (offlined)\n",
+	       p->addr, p->addr + p->size, p->size, p->numa_id);
+	return 0;
+}
+
+static int __ihk_smp_mem_block_in_zone(struct zone *zone, unsigned long pfn,
+				       unsigned long nr_pages)
+{
+	unsigned long last_pfn = pfn + nr_pages - 1;
+
+	return pfn_valid(pfn) && pfn_valid(last_pfn) &&
+		page_zone(pfn_to_page(pfn)) == zone &&
+		page_zone(pfn_to_page(last_pfn)) == zone;
+}
+
+/*
+ * Reserve memory by offlining whole memory blocks of ZONE_MOVABLE on
+ * the node instead of collecting pages from the buddy allocator. It
+ * leaves the page cache of the other zones alone and yields chunks as
+ * large as the blocks are contiguous. The blocks aren't removed because
+ * the chunk headers and the accesses to LWK memory go through the
+ * linear mapping and the memmap.
+ */
+static int __ihk_smp_reserve_mem_blocks(size_t ihk_mem, int numa_id,
+					int max_size_ratio_all,
+					int timeout, size_t *reserved)
+{
+	struct zone *zone;
+	unsigned long block_size, nr_block_pages;
+	unsigned long pfn, end_pfn;
+	unsigned long range_start = 0, range_end = 0;
+	size_t want, allocated = 0;
+	unsigned long res_start = get_seconds();
+	int ret;
+
+	*reserved = 0;
+	ret = __ihk_smp_mem_hotplug_init();
+	if (ret) {
+		goto out;
+	}
+
+	if (!node_online(numa_id)) {
+		pr_err("IHK-SMP: error: NUMA node %d isn't online\n",
+		       numa_id);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	zone = &NODE_DATA(numa_id)->node_zones[ZONE_MOVABLE];
+	if (!populated_zone(zone)) {
+		pr_err("IHK-SMP: error: NUMA node %d has no movable memory\n",
+		       numa_id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	block_size = ihk_memory_block_size_bytes();
+	nr_block_pages = block_size >> PAGE_SHIFT;
+
+	if (ihk_mem == IHK_SMP_MEM_ALL) {
+		want = ((size_t)zone->present_pages << PAGE_SHIFT) *
+			max_size_ratio_all / 100;
+	}
+	else {
+		want = ALIGN(ihk_mem, block_size);
+	}
+
+	pr_info("IHK-SMP: offlining %lu bytes in %lu-byte blocks @ NUMA %d\n",
+		want, block_size, numa_id);
+
+	end_pfn = zone_end_pfn(zone);
+	for (pfn = ALIGN(zone->zone_start_pfn, nr_block_pages);
+	     pfn + nr_block_pages <= end_pfn && allocated < want;
+	     pfn += nr_block_pages) {
+		unsigned long addr = PFN_PHYS(pfn);
+
+		if (timeout > 0 && get_seconds() - res_start > timeout) {
+			pr_info("%s: timeout (%d secs) reached @ NUMA %d\n",
+				__func__, timeout, numa_id);
+			break;
+		}
+
+		if (!__ihk_smp_mem_block_in_zone(zone, pfn, nr_block_pages)) {
+			continue;
+		}
+
+		/* Fails when the block has pages that can't be migrated,
+		 * returns 1 when someone else has offlined it */
+		ret = __ihk_smp_set_mem_block_online(addr, 0);
+		if (ret) {
+			mdprintk("%s: memory block 0x%lx not offlined: %d\n",
+				__func__, addr, ret);
+			continue;
+		}
+
+		if (addr != range_end) {
+			if (range_end > range_start &&
+			    __ihk_smp_add_offlined_range(range_start,
+					range_end - range_start, numa_id)) {
+				allocated -= range_end - range_start;
+			}
+			range_start = addr;
+		}
+		range_end = addr + block_size;
+		allocated += block_size;
+	}
+
+	if (range_end > range_start &&
+	    __ihk_smp_add_offlined_range(range_start,
+				range_end - range_start, numa_id)) {
+		allocated -= range_end - range_start;
+	}
+
+	pr_info("%s: want: %ld, offlined: %ld (time: %lu secs) @ NUMA %d\n",
+		__func__, want, allocated,
+		(get_seconds() - res_start), numa_id);
+
+	*reserved = allocated;
+	ret = allocated ? 0 : -ENOMEM;
+ out:
+	return ret;
+}
+
 #define RESERVE_MEM_FAILED_ATTEMPTS 1
 #define USE_TRY_TO_FREE_PAGES
 #define USE_TRY_TO_FREE_PAGES_TIME_LIMIT 2
 
+/*
+ * Reclaim for a reservation is confined to the zones of the target
+ * node and to what can be dropped without I/O, i.e. clean page cache,
+ * up to ihk_reclaim_max_mb per request. Slab isn't shrunk since the
+ * filesystem shrinkers give up without __GFP_FS.
+ */
+static unsigned long ihk_reclaim_max_mb = 1024;
+module_param(ihk_reclaim_max_mb, ulong, 0644);
+MODULE_PARM_DESC(ihk_reclaim_max_mb, "Page cache reclaimed on the target node per memory reservation in MBs, 0 for none");
+
+static int ihk_reclaim_compact = 1;
+module_param(ihk_reclaim_compact, int, 0644);
+MODULE_PARM_DESC(ihk_reclaim_compact, "Compact (migrate movable pages on) the target node before falling back to smaller chunks");
+
 #ifdef ENABLE_KRM_WORKAROUND
 static unsigned long reserve_mem_max_ratio = 95;
 #endif
 
+/*
+ * Reserve memory on a node into ihk_mem_free_chunks, *reserved is set
+ * to the bytes added there
+ */
 static int __ihk_smp_reserve_mem(size_t ihk_mem, int numa_id,
 				 int min_chunk_size,
 				 int max_size_ratio_all,
-				 int timeout)
+				 int timeout, size_t *reserved)
 {
 	int order = get_order(IHK_SMP_CHUNK_BASE_SIZE);
 	size_t want = ihk_mem;
@@ -3461,7 +5538,14 @@ static int __ihk_smp_reserve_mem(size_t ihk_mem, int numa_id,
 	unsigned long (*__try_to_free_pages)(struct zonelist *zonelist, int order,
 				gfp_t gfp_mask, nodemask_t *nodemask) = NULL;
 	int try_free_pages_secs = 0;
+	unsigned long reclaimed_pages = 0;
+	unsigned long reclaim_max_pages =
+		ihk_reclaim_max_mb << (20 - PAGE_SHIFT);
 #endif // USE_TRY_TO_FREE_PAGES
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 9, 0)
+	void (*__compact_node)(int nid) = NULL;
+	int compacted = 0;
+#endif
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,19,0)
 	void (*__drain_all_pages)(struct zone *) = NULL;
 #else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3,19,0) */
@@ -3480,6 +5564,7 @@ static int __ihk_smp_reserve_mem(size_t ihk_mem, int numa_id,
 #endif
 	int atomic_pages_freed_per_order = 0;
 
+	*reserved = 0;
 	if (order_limit < 0 || order_limit > MAX_ORDER) {
 		pr_err("IHK-SMP: error: invalid order_limit (%d)\n",
 		       order_limit);
@@ -3497,13 +5582,19 @@ static int __ihk_smp_reserve_mem(size_t ihk_mem, int numa_id,
 	memset(&nodemask, 0, sizeof(nodemask));
 	__node_set(numa_id, &nodemask);
 
-	dprintk(KERN_INFO "IHK-SMP: __ihk_smp_reserve_mem: %lu bytes\n", ihk_mem);
+	mdprintk(KERN_INFO "IHK-SMP: __ihk_smp_reserve_mem: %lu bytes\n", ihk_mem);
 
 #ifdef USE_TRY_TO_FREE_PAGES
 	__try_to_free_pages = (unsigned long (*)
 			(struct zonelist *, int, gfp_t, nodemask_t *))
 			kallsyms_lookup_name("try_to_free_pages");
 #endif // USE_TRY_TO_FREE_PAGES
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 9, 0)
+	if (ihk_reclaim_compact) {
+		__compact_node = (void (*)(int))
+			kallsyms_lookup_name("compact_node");
+	}
+#endif
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,19,0)
 	__drain_all_pages = (void (*)(struct zone *))
 			kallsyms_lookup_name("drain_all_pages");
@@ -3550,7 +5641,7 @@ static int __ihk_smp_reserve_mem(size_t ihk_mem, int numa_id,
 		if (slab_mutexp && slab_cachesp) {
 			struct kmem_cache *s;
 
-			dprintk("%s: shrinking slab caches\n", __FUNCTION__);
+			mdprintk("%s: shrinking slab caches\n", __FUNCTION__);
 			mutex_lock(slab_mutexp);
 			list_for_each_entry(s, slab_cachesp, list) {
 				kmem_cache_shrink(s);
@@ -3573,7 +5664,7 @@ static int __ihk_smp_reserve_mem(size_t ihk_mem, int numa_id,
 			if (!populated_zone(zone)) {
 				continue;
 			}
-			dprintk("%s: sorting node %d zone %d\n",
+			mdprintk("%s: sorting node %d zone %d\n",
 				__FUNCTION__, numa_id, i);
 			sort_pagelists(zone);
 		}
@@ -3583,7 +5674,7 @@ static int __ihk_smp_reserve_mem(size_t ihk_mem, int numa_id,
 		want = (ihk_mem + ((PAGE_SIZE << order) - 1))
 			& ~((PAGE_SIZE << order) - 1);
 	}
-	dprintk("%s: ihk_mem: %lu, want: %lu\n", __FUNCTION__, ihk_mem, want);
+	mdprintk("%s: ihk_mem: %lu, want: %lu\n", __FUNCTION__, ihk_mem, want);
 	allocated = 0;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
 	available = __sum_zone_node_page_state(numa_id, NR_FREE_PAGES)
@@ -3706,21 +5797,26 @@ retry:
 #ifdef USE_TRY_TO_FREE_PAGES
 
 			/*
-			 * Don't stress NUMA node 0, unless it is the only one
+			 * Reclaim on the target node only. Without __GFP_IO
+			 * and __GFP_FS nothing is written back or swapped out
+			 * and the filesystem shrinkers skip their caches, so
+			 * only clean page cache is dropped.
 			 */
-			if ((num_online_nodes() > 1 && numa_id > 0) &&
-					(__try_to_free_pages &&
-					 failed_free_attempts < RESERVE_MEM_FAILED_ATTEMPTS) &&
-					 (try_free_pages_secs <
-						USE_TRY_TO_FREE_PAGES_TIME_LIMIT) && order > 0) {
+			if (__try_to_free_pages &&
+					failed_free_attempts < RESERVE_MEM_FAILED_ATTEMPTS &&
+					reclaimed_pages < reclaim_max_pages &&
+					(try_free_pages_secs <
+					 USE_TRY_TO_FREE_PAGES_TIME_LIMIT) && order > 0) {
 
 				try_free_pages_start_sec = get_seconds();
 				freed_pages = __try_to_free_pages(
-						node_zonelist(numa_id, GFP_KERNEL),
+						node_zonelist(numa_id, GFP_NOIO),
 						order,
-						GFP_KERNEL, NULL);
+						GFP_NOIO | __GFP_THISNODE,
+						&nodemask);
 				try_free_pages_secs +=
 					(get_seconds() - try_free_pages_start_sec);
+				reclaimed_pages += freed_pages;
 
 				if (freed_pages <= 1)
 					++failed_free_attempts;
@@ -3732,6 +5828,22 @@ retry:
 			}
 #endif // USE_TRY_TO_FREE_PAGES
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 9, 0)
+			/*
+			 * Migrate movable pages of the node to build larger
+			 * free areas. A full pass over the node is expensive,
+			 * so do it once per request and within the timeout.
+			 */
+			if (__compact_node && !compacted && order > 0 &&
+					(get_seconds() - res_start) < timeout) {
+				compacted = 1;
+				__compact_node(numa_id);
+				mdprintk("%s: compacted NUMA %d for order %d\n",
+					 __func__, numa_id, order);
+				goto retry;
+			}
+#endif
+
 			/*
 			 * We ran out of memory using the current order of compound
 			 * pages, decrease order and try to grab smaller pieces.
@@ -3745,7 +5857,7 @@ retry:
 				--order;
 				failed_free_attempts = 0;
 #ifndef ENABLE_FUGAKU_HACKS
-				dprintk("%s: order decreased to %d\n", __FUNCTION__, order);
+				mdprintk("%s: order decreased to %d\n", __FUNCTION__, order);
 #else
 				printk("%s: order decreased to %d\n", __FUNCTION__, order);
 #endif
@@ -3792,7 +5904,7 @@ pre_out:
 		__mem_chunk_insert(&tmp_chunks, p);
 	}
 
-	dprintk("%s: allocated internally: %lu\n", __FUNCTION__, allocated);
+	mdprintk("%s: allocated internally: %lu\n", __FUNCTION__, allocated);
 
 	/* Move the largest chunks to free list until we meet the required size */
 	allocated = 0;
@@ -3818,7 +5930,7 @@ pre_out:
 			struct chunk *__p = (struct chunk *)phys_to_virt(p->addr);
 			*__p = *p;
 			p = __p;
-			dprintk("%s: moved chunk structure to front of 0x%lx\n",
+			mdprintk("%s: moved chunk structure to front of 0x%lx\n",
 				__FUNCTION__, p->addr);
 		}
 
@@ -3884,6 +5996,7 @@ pre_out:
 	pr_err("%s: want: %ld, allocated: %ld (time: %lu secs) @ NUMA %d\n",
 			__func__, want, allocated,
 			(get_seconds() - res_start), numa_id);
+	*reserved = allocated;
 
 #ifdef ENABLE_KRM_WORKAROUND
 fake_alloc:
@@ -3904,12 +6017,16 @@ out:
 	return ret;
 }
 
-static void __ihk_smp_release_chunk(struct chunk *mem_chunk)
+static void __ihk_smp_free_chunk(struct chunk *mem_chunk)
 {
 	unsigned long size_left;
 	unsigned long va;
 	unsigned long pa = mem_chunk->addr;
 
+	if (!__ihk_smp_release_offlined_chunk(mem_chunk)) {
+		return;
+	}
+
 	va = (unsigned long)phys_to_virt(pa);
 	size_left = mem_chunk->size;
 	while (size_left > 0) {
@@ -3943,13 +6060,24 @@ static void __ihk_smp_release_chunk(struct chunk *mem_chunk)
 			va += order_size;
 		}
 		else {
-			dprintk("%s: order_size - size_left: %lu\n",
+			mdprintk("%s: order_size - size_left: %lu\n",
 				__func__, order_size - size_left);
 			size_left = 0;
 		}
 	}
 }
 
+static void __ihk_smp_release_chunk(struct chunk *mem_chunk)
+{
+	unsigned long size = mem_chunk->size;
+	int numa_id = mem_chunk->numa_id;
+	ktime_t start = ktime_get();
+
+	__ihk_smp_free_chunk(mem_chunk);
+	ihk_smp_dev_stat_add(IHK_SMP_DEV_STAT_RELEASE_MEM, numa_id, start,
+			     0, size);
+}
+
 static int __ihk_smp_release_mem(size_t ihk_mem, int numa_id)
 {
 	int ret;
@@ -4021,14 +6149,18 @@ static struct chunk *move_chunk_header(struct chunk *old, struct chunk *new)
  * (2) RM calculates the amount to trim for each node
  * (3) RM calls the following function to do the trim
  */
-static int __ihk_smp_release_mem_partially(size_t ihk_mem, int numa_id)
+static int __ihk_smp_release_mem_partially(size_t ihk_mem, int numa_id,
+					   size_t *released)
 {
 	int ret = -1;
 	struct chunk *mem_chunk;
 	size_t size_left = ihk_mem;
+	size_t chunk_size;
 	unsigned long va;
 	struct rb_root tmp_chunks = RB_ROOT;
 
+	*released = 0;
+
 	pr_info("IHK-SMP: partial release size: %ld, numa_id: %d\n",
 		ihk_mem, numa_id);
 
@@ -4051,6 +6183,11 @@ static int __ihk_smp_release_mem_partially(size_t ihk_mem, int numa_id)
 			if (q->numa_id != numa_id)
 				continue;
 
+			/* Offlined blocks are released as a whole */
+			if (q->size > size_left &&
+			    __ihk_smp_find_offlined_range(q->addr))
+				continue;
+
 			if (q->size < min) {
 				mem_chunk = q;
 				min = mem_chunk->size;
@@ -4064,18 +6201,21 @@ static int __ihk_smp_release_mem_partially(size_t ihk_mem, int numa_id)
 
 		/* Release the whole chunk */
 		if (mem_chunk->size <= size_left) {
-			list_del(&mem_chunk->chain);
-			__ihk_smp_release_chunk(mem_chunk);
-			size_left -= mem_chunk->size;
 			pr_info("IHK-SMP: chunk 0x%lx - 0x%lx"
 				" (len: %ld) @ NUMA node: %d is released\n",
 				mem_chunk->addr,
 				mem_chunk->addr + mem_chunk->size,
 				mem_chunk->size, mem_chunk->numa_id);
+			/* The header goes away with the chunk */
+			chunk_size = mem_chunk->size;
+			list_del(&mem_chunk->chain);
+			__ihk_smp_release_chunk(mem_chunk);
+			size_left -= chunk_size;
+			*released += chunk_size;
 			goto next_chunk;
 		}
 
-		dprintk("%s: size_left: %ld\n", __func__, size_left);
+		mdprintk("%s: size_left: %ld\n", __func__, size_left);
 		pr_info("IHK-SMP: shrinking chunk 0x%lx - 0x%lx"
 			" (len: %ld) @ NUMA node: %d...\n",
 			mem_chunk->addr, mem_chunk->addr + mem_chunk->size,
@@ -4110,7 +6250,7 @@ static int __ihk_smp_release_mem_partially(size_t ihk_mem, int numa_id)
 			order = compound_order(page);
 			order_size = (PAGE_SIZE << order);
 
-			dprintk(KERN_INFO "%s: order_size: %ld, size_left: %ld\n",
+			mdprintk(KERN_INFO "%s: order_size: %ld, size_left: %ld\n",
 			       __func__, order_size, size_left);
 
 			/* Don't split compound pages */
@@ -4147,6 +6287,7 @@ next_compound:
 				}
 				mem_chunk->addr += size_taken;
 				mem_chunk->size -= size_taken;
+				*released += size_taken;
 				pr_info("IHK-SMP: chunk is shrunk to 0x%lx - 0x%lx"
 				       " (len: %ld, NUMA node: %d)\n",
 				       mem_chunk->addr,
@@ -4209,7 +6350,8 @@ static int smp_ihk_online_cpu(int cpu_id)
 	return _smp_ihk_write_cpu_sys_file(cpu_id, "1");
 }
 
-static int smp_ihk_reserve_cpu(ihk_device_t ihk_dev, unsigned long arg)
+static int __smp_ihk_reserve_cpu(ihk_device_t ihk_dev, unsigned long arg,
+				 int group)
 {
 	int ret;
 	int cpu;
@@ -4234,6 +6376,12 @@ static int smp_ihk_reserve_cpu(ihk_device_t ihk_dev, unsigned long arg)
 		return 0;
 	}
 
+	if (!ihk_smp_group_valid(group)) {
+		pr_err("%s: error: group %d doesn't exist\n",
+		       __func__, group);
+		return -ENOENT;
+	}
+
 	req_cpus = kmalloc(sizeof(int) * req.num_cpus, GFP_KERNEL);
 	if (!req_cpus) {
 		pr_err("%s: error: allocating request cpus\n", __func__);
@@ -4337,10 +6485,16 @@ static int smp_ihk_reserve_cpu(ihk_device_t ihk_dev, unsigned long arg)
 
 	/* Offline CPU cores */
 	for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+		ktime_t start;
+
 		if (ihk_smp_cpus[cpu].status != IHK_SMP_CPU_TO_OFFLINE)
 			continue;
 
+		start = ktime_get();
+		smp_ihk_llc_snapshot(cpu);
 		if ((ret = smp_ihk_offline_cpu(cpu)) != 0) {
+			ihk_smp_dev_stat_add(IHK_SMP_DEV_STAT_RESERVE_CPU,
+					     cpu_to_node(cpu), start, ret, 0);
 			goto err_during_offline;
 		}
 
@@ -4349,6 +6503,8 @@ static int smp_ihk_reserve_cpu(ihk_device_t ihk_dev, unsigned long arg)
 		ihk_smp_cpus[cpu].os = (ihk_os_t)0;
 		
 		ret = ihk_smp_reset_cpu(ihk_smp_cpus[cpu].hw_id);
+		ihk_smp_dev_stat_add(IHK_SMP_DEV_STAT_RESERVE_CPU,
+				     cpu_to_node(cpu), start, 0, 1);
 
 		dprintk(KERN_INFO "IHK-SMP: CPU %d offlined successfully, HWID: %d\n",
 		       ihk_smp_cpus[cpu].id, ihk_smp_cpus[cpu].hw_id);
@@ -4359,6 +6515,7 @@ static int smp_ihk_reserve_cpu(ihk_device_t ihk_dev, unsigned long arg)
 		if (ihk_smp_cpus[cpu].status != IHK_SMP_CPU_OFFLINED)
 			continue;
 		ihk_smp_cpus[cpu].status = IHK_SMP_CPU_AVAILABLE;
+		ihk_smp_cpus[cpu].group = group;
 
 		dprintk(KERN_INFO "IHK-SMP: CPU %d reserved successfully, HWID: %d\n",
 		       ihk_smp_cpus[cpu].id, ihk_smp_cpus[cpu].hw_id);
@@ -4390,7 +6547,8 @@ out:
 	return ret;
 }
 
-static int smp_ihk_release_cpu(ihk_device_t ihk_dev, unsigned long arg)
+static int __smp_ihk_release_cpu(ihk_device_t ihk_dev, unsigned long arg,
+				 int group)
 {
 	int ret;
 	int cpu;
@@ -4473,6 +6631,13 @@ static int smp_ihk_release_cpu(ihk_device_t ihk_dev, unsigned long arg)
 			goto err;
 		}
 
+		if (ihk_smp_cpus[cpu].group != group) {
+			pr_err("%s: error: CPU %d is in group %d\n",
+			       __func__, cpu, ihk_smp_cpus[cpu].group);
+			ret = -EINVAL;
+			goto err;
+		}
+
 		ihk_smp_cpus[cpu].id = cpu;
 		ihk_smp_cpus[cpu].hw_id = ihk_smp_get_hw_id(cpu);
 		ihk_smp_cpus[cpu].status = IHK_SMP_CPU_TO_ONLINE;
@@ -4484,15 +6649,22 @@ static int smp_ihk_release_cpu(ihk_device_t ihk_dev, unsigned long arg)
 
 	/* Online CPU cores */
 	for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+		ktime_t start;
+
 		if (ihk_smp_cpus[cpu].status != IHK_SMP_CPU_TO_ONLINE)
 			continue;
 
-		if ((ret = smp_ihk_online_cpu(cpu)) != 0) {
+		start = ktime_get();
+		ret = smp_ihk_online_cpu(cpu);
+		ihk_smp_dev_stat_add(IHK_SMP_DEV_STAT_RELEASE_CPU,
+				     cpu_to_node(cpu), start, ret, ret ? 0 : 1);
+		if (ret != 0) {
 			goto err;
 		}
 
 		ihk_smp_cpus[cpu].status = IHK_SMP_CPU_ONLINE;
 		ihk_smp_cpus[cpu].os = (ihk_os_t)0;
+		ihk_smp_cpus[cpu].group = 0;
 
 		dprintk("IHK-SMP: CPU %d onlined successfully, HWID: %d\n",
 		       ihk_smp_cpus[cpu].id, ihk_smp_cpus[cpu].hw_id);
@@ -4613,7 +6785,8 @@ static int smp_ihk_reserve_mem_max_ratio(ihk_device_t ihk_dev,
 }
 #endif
 
-static int smp_ihk_reserve_mem(ihk_device_t ihk_dev, unsigned long arg)
+static int __smp_ihk_reserve_mem(ihk_device_t ihk_dev, unsigned long arg,
+				 int group)
 {
 	size_t mem_size;
 	int numa_id;
@@ -4680,15 +6853,43 @@ static int smp_ihk_reserve_mem(ihk_device_t ihk_dev, unsigned long arg)
 		goto out;
 	}
 
+	if (group && !ihk_smp_group_valid(group)) {
+		pr_err("%s: error: group %d doesn't exist\n",
+		       __func__, group);
+		ret = -ENOENT;
+		goto out;
+	}
+
 	/* Do the reservation */
 	for (i = 0; i < req.num_chunks; i++) {
+		size_t reserved;
+		ktime_t start;
+
 		mem_size = req_sizes[i];
 		numa_id = req_numa_ids[i];
+		start = ktime_get();
+
+		if (req.offline_blocks) {
+			ret = __ihk_smp_reserve_mem_blocks(mem_size, numa_id,
+						req.max_size_ratio_all,
+						req.timeout, &reserved);
+		}
+		else {
+			ret = __ihk_smp_reserve_mem(mem_size, numa_id,
+						    req.min_chunk_size,
+						    req.max_size_ratio_all,
+						    req.timeout, &reserved);
+		}
+		ihk_smp_dev_stat_add(IHK_SMP_DEV_STAT_RESERVE_MEM, numa_id,
+				     start, ret, reserved);
+
+		/* Chunks returned concurrently by shutdown or release
+		 * of an OS aren't the group's, credit only these
+		 */
+		if (group) {
+			ihk_smp_groups[group].mem[numa_id] += reserved;
+		}
 
-		ret = __ihk_smp_reserve_mem(mem_size, numa_id,
-					    req.min_chunk_size,
-					    req.max_size_ratio_all,
-					    req.timeout);
 		if (ret != 0) {
 			printk("IHK-SMP: reserve_mem: error: reserving memory\n");
 			break;
@@ -4701,127 +6902,612 @@ out:
 	return ret;
 }
 
-static int smp_ihk_release_mem(ihk_device_t ihk_dev, unsigned long arg)
-{
-	int ret = 0, i, ret_internal;
-	struct ihk_mem_req req;
-	size_t *req_sizes = NULL;
-	int *req_numa_ids = NULL;
+static int __smp_ihk_release_mem(ihk_device_t ihk_dev, unsigned long arg,
+				 int group)
+{
+	int ret = 0, i, ret_internal;
+	struct ihk_mem_req req;
+	size_t *req_sizes = NULL;
+	int *req_numa_ids = NULL;
+
+	ret_internal = copy_from_user(&req, (void *)arg, sizeof(req));
+	ARCHDRV_CHKANDJUMP(ret_internal != 0, "copy_from_user failed", -EFAULT);
+
+	if (validate_mem_req(&req)) {
+		pr_err("%s: invalid request\n", __func__);
+		ret = -EINVAL;
+		goto fn_fail;
+	}
+
+	if (req.num_chunks == 0) {
+		ret = 0;
+		goto fn_fail;
+	}
+
+	req_sizes = kmalloc(sizeof(size_t) * req.num_chunks, GFP_KERNEL);
+	ARCHDRV_CHKANDJUMP(req_sizes == NULL, "kmalloc failed", -EINVAL);
+
+	req_numa_ids = kmalloc(sizeof(int) * req.num_chunks, GFP_KERNEL);
+	ARCHDRV_CHKANDJUMP(req_numa_ids == NULL, "kmalloc failed", -EINVAL);
+
+	ret_internal = copy_from_user(req_sizes, req.sizes,
+			sizeof(size_t) * req.num_chunks);
+	ARCHDRV_CHKANDJUMP(ret_internal != 0, "copy_from_user failed", -EFAULT);
+
+	ret_internal = copy_from_user(req_numa_ids, req.numa_ids,
+			sizeof(int) * req.num_chunks);
+	ARCHDRV_CHKANDJUMP(ret_internal != 0, "copy_from_user failed", -EFAULT);
+
+	ARCHDRV_CHKANDJUMP(!ihk_smp_group_valid(group),
+			   "group doesn't exist", -ENOENT);
+
+	/* Do release */
+	for (i = 0; i < req.num_chunks; i++) {
+		unsigned long avail = ihk_smp_group_mem_avail(group,
+							      req_numa_ids[i]);
+
+		/* Everything available to the group on the node. For group 0
+		 * that leaves the shares of the other groups reserved.
+		 * Offlined blocks larger than what is left over stay
+		 * reserved as well, so a short release isn't an error.
+		 */
+		if (req_sizes[i] == IHK_SMP_MEM_ALL) {
+			size_t released;
+
+			if (!avail) {
+				continue;
+			}
+
+			__ihk_smp_release_mem_partially(avail, req_numa_ids[i],
+							&released);
+			if (group) {
+				ihk_smp_group_mem_debit(group, req_numa_ids[i],
+							released);
+			}
+			continue;
+		}
+
+		if (req_sizes[i] > avail) {
+			pr_err("%s: error: %lu bytes @ NUMA node %d aren't available in group %d\n",
+			       __func__, req_sizes[i], req_numa_ids[i],
+			       group);
+			ret = -EBUSY;
+			goto fn_fail;
+		}
+
+		ret = __ihk_smp_release_mem(req_sizes[i],
+					    req_numa_ids[i]);
+		if (ret) {
+			pr_err("%s: error: __ihk_smp_release_mem returned %d\n",
+			       __func__, ret);
+			goto fn_fail;
+		}
+
+		if (group) {
+			ihk_smp_group_mem_debit(group, req_numa_ids[i],
+						req_sizes[i]);
+		}
+	}
+
+ fn_fail:
+	kfree(req_sizes);
+	kfree(req_numa_ids);
+	return ret;
+}
+
+static int __smp_ihk_release_mem_partially(ihk_device_t ihk_dev,
+					   unsigned long arg, int group)
+{
+	int ret, i;
+	struct ihk_mem_req req;
+	size_t *req_sizes = NULL;
+	int *req_numa_ids = NULL;
+
+	ret = copy_from_user(&req, (void *)arg, sizeof(req));
+	if (ret) {
+		pr_err("%s: copy_from_user struct ihk_mem_req\n", __func__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (validate_mem_req(&req)) {
+		pr_err("%s: invalid request\n", __func__);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	req_sizes = kmalloc(sizeof(size_t) * req.num_chunks, GFP_KERNEL);
+	if (!req_sizes) {
+		pr_err("%s: allocating req_sizes\n", __func__);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	req_numa_ids = kmalloc(sizeof(int) * req.num_chunks, GFP_KERNEL);
+	if (!req_numa_ids) {
+		pr_err("%s: allocating req_num_ids\n", __func__);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = copy_from_user(req_sizes, req.sizes,
+			     sizeof(size_t) * req.num_chunks);
+	if (ret) {
+		pr_err("%s: copy_from_user req_sizes\n", __func__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = copy_from_user(req_numa_ids, req.numa_ids,
+			     sizeof(int) * req.num_chunks);
+	if (ret) {
+		pr_err("%s: copy_from_user req_numa_ids\n", __func__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (!ihk_smp_group_valid(group)) {
+		pr_err("%s: group %d doesn't exist\n", __func__, group);
+		ret = -ENOENT;
+		goto out;
+	}
+
+	/* Do release */
+	for (i = 0; i < req.num_chunks; i++) {
+		if (req_sizes[i] > 0) {
+			size_t released;
+
+			if (req_sizes[i] >
+			    ihk_smp_group_mem_avail(group,
+						    req_numa_ids[i])) {
+				pr_err("%s: %lu bytes @ NUMA node %d aren't available in group %d\n",
+				       __func__, req_sizes[i],
+				       req_numa_ids[i], group);
+				ret = -EBUSY;
+				goto out;
+			}
+
+			ret = __ihk_smp_release_mem_partially(req_sizes[i],
+							      req_numa_ids[i],
+							      &released);
+
+			/* Chunks returned concurrently by shutdown or release
+			 * of an OS don't count, debit only these
+			 */
+			if (group) {
+				ihk_smp_group_mem_debit(group,
+							req_numa_ids[i],
+							released);
+			}
+
+			if (ret) {
+				pr_err("%s: __ihk_smp_release_mem_partially returned %d\n",
+				       __func__, ret);
+				ret = -EINVAL;
+				goto out;
+			}
+		}
+	}
+
+	ret = 0;
+out:
+	kfree(req_sizes);
+	kfree(req_numa_ids);
+	return ret;
+}
+
+/*
+ * Reservation and release of CPUs and memory, serialized with the
+ * changes of the reservation groups
+ */
+static int smp_ihk_reserve_cpu(ihk_device_t ihk_dev, unsigned long arg)
+{
+	int ret;
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_reserve_cpu(ihk_dev, arg, 0);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int smp_ihk_release_cpu(ihk_device_t ihk_dev, unsigned long arg)
+{
+	int ret;
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_release_cpu(ihk_dev, arg, 0);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int smp_ihk_reserve_mem(ihk_device_t ihk_dev, unsigned long arg)
+{
+	int ret;
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_reserve_mem(ihk_dev, arg, 0);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int smp_ihk_release_mem(ihk_device_t ihk_dev, unsigned long arg)
+{
+	int ret;
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_release_mem(ihk_dev, arg, 0);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int smp_ihk_release_mem_partially(ihk_device_t ihk_dev,
+					 unsigned long arg)
+{
+	int ret;
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_release_mem_partially(ihk_dev, arg, 0);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+/*
+ * Same with the group carried next to the request. The plain requests
+ * above always work on the device-wide pool, i.e. group 0.
+ */
+static int smp_ihk_reserve_cpu_group(ihk_device_t ihk_dev, unsigned long arg)
+{
+	struct ihk_cpu_group_req __user *greq = (void __user *)arg;
+	int group;
+	int ret;
+
+	if (get_user(group, &greq->group)) {
+		pr_err("%s: error: copying group\n", __func__);
+		return -EFAULT;
+	}
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_reserve_cpu(ihk_dev, (unsigned long)&greq->req, group);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int smp_ihk_release_cpu_group(ihk_device_t ihk_dev, unsigned long arg)
+{
+	struct ihk_cpu_group_req __user *greq = (void __user *)arg;
+	int group;
+	int ret;
+
+	if (get_user(group, &greq->group)) {
+		pr_err("%s: error: copying group\n", __func__);
+		return -EFAULT;
+	}
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_release_cpu(ihk_dev, (unsigned long)&greq->req, group);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int smp_ihk_reserve_mem_group(ihk_device_t ihk_dev, unsigned long arg)
+{
+	struct ihk_mem_group_req __user *greq = (void __user *)arg;
+	int group;
+	int ret;
+
+	if (get_user(group, &greq->group)) {
+		pr_err("%s: error: copying group\n", __func__);
+		return -EFAULT;
+	}
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_reserve_mem(ihk_dev, (unsigned long)&greq->req, group);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int smp_ihk_release_mem_group(ihk_device_t ihk_dev, unsigned long arg)
+{
+	struct ihk_mem_group_req __user *greq = (void __user *)arg;
+	int group;
+	int ret;
+
+	if (get_user(group, &greq->group)) {
+		pr_err("%s: error: copying group\n", __func__);
+		return -EFAULT;
+	}
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_release_mem(ihk_dev, (unsigned long)&greq->req, group);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int smp_ihk_release_mem_partially_group(ihk_device_t ihk_dev,
+					       unsigned long arg)
+{
+	struct ihk_mem_group_req __user *greq = (void __user *)arg;
+	int group;
+	int ret;
+
+	if (get_user(group, &greq->group)) {
+		pr_err("%s: error: copying group\n", __func__);
+		return -EFAULT;
+	}
+
+	mutex_lock(&ihk_smp_group_lock);
+	ret = __smp_ihk_release_mem_partially(ihk_dev,
+					      (unsigned long)&greq->req, group);
+	mutex_unlock(&ihk_smp_group_lock);
+
+	return ret;
+}
+
+static int ihk_smp_group_lookup(const char *name)
+{
+	int group;
+
+	for (group = 1; group < IHK_MAX_GROUPS; group++) {
+		if (ihk_smp_groups[group].name[0] &&
+		    !strncmp(ihk_smp_groups[group].name, name,
+			     IHK_GROUP_NAME_MAX)) {
+			return group;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int smp_ihk_create_group(ihk_device_t ihk_dev, unsigned long arg)
+{
+	int ret;
+	int group;
+	struct ihk_group_info info;
+	unsigned long *mem;
+
+	if (copy_from_user(&info, (void *)arg, sizeof(info))) {
+		pr_err("%s: error: copying request\n", __func__);
+		return -EFAULT;
+	}
+
+	info.name[IHK_GROUP_NAME_MAX - 1] = '\0';
+	if (!info.name[0]) {
+		pr_err("%s: error: group name is empty\n", __func__);
+		return -EINVAL;
+	}
+
+	mem = kcalloc(nr_node_ids, sizeof(*mem), GFP_KERNEL);
+	if (!mem) {
+		pr_err("%s: error: allocating memory budget\n", __func__);
+		return -ENOMEM;
+	}
+
+	mutex_lock(&ihk_smp_group_lock);
+	if (ihk_smp_group_lookup(info.name) > 0) {
+		pr_err("%s: error: group %s exists\n", __func__, info.name);
+		ret = -EEXIST;
+		goto out;
+	}
+
+	for (group = 1; group < IHK_MAX_GROUPS; group++) {
+		if (!ihk_smp_groups[group].name[0])
+			break;
+	}
+
+	if (group == IHK_MAX_GROUPS) {
+		pr_err("%s: error: too many groups\n", __func__);
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	memcpy(ihk_smp_groups[group].name, info.name, IHK_GROUP_NAME_MAX);
+	ihk_smp_groups[group].mem = mem;
+	ihk_smp_groups[group].nr_os = 0;
+	mem = NULL;
+
+	pr_info("IHK-SMP: group %d (%s) created\n", group, info.name);
+	ret = group;
+out:
+	mutex_unlock(&ihk_smp_group_lock);
+	kfree(mem);
+	return ret;
+}
+
+/** \brief Release all CPUs and memory of a group to Linux and remove
+ *  it. Fails if any of them is in use by an OS instance. CPUs that
+ *  can't be onlined and memory that can't be released are moved to
+ *  the device-wide pool, the group is removed anyway and the error of
+ *  the first such CPU is returned. */
+static int smp_ihk_destroy_group(ihk_device_t ihk_dev, unsigned long arg)
+{
+	int ret;
+	int err = 0;
+	int cpu;
+	int numa_id;
+	int group = (int)arg;
+	size_t released;
+	struct ihk_smp_group *g;
+
+	if (group <= 0 || group >= IHK_MAX_GROUPS) {
+		pr_err("%s: error: invalid group %d\n", __func__, group);
+		return -EINVAL;
+	}
 
-	ret_internal = copy_from_user(&req, (void *)arg, sizeof(req));
-	ARCHDRV_CHKANDJUMP(ret_internal != 0, "copy_from_user failed", -EFAULT);
+	mutex_lock(&ihk_smp_group_lock);
+	g = &ihk_smp_groups[group];
 
-	if (validate_mem_req(&req)) {
-		pr_err("%s: invalid request\n", __func__);
-		ret = -EINVAL;
-		goto fn_fail;
+	if (!ihk_smp_group_valid(group)) {
+		pr_err("%s: error: group %d doesn't exist\n", __func__, group);
+		ret = -ENOENT;
+		goto out;
 	}
 
-	if (req.num_chunks == 0) {
-		ret = 0;
-		goto fn_fail;
+	if (g->nr_os) {
+		pr_err("%s: error: %d OS instance(s) draw from group %s\n",
+		       __func__, g->nr_os, g->name);
+		ret = -EBUSY;
+		goto out;
 	}
 
-	req_sizes = kmalloc(sizeof(size_t) * req.num_chunks, GFP_KERNEL);
-	ARCHDRV_CHKANDJUMP(req_sizes == NULL, "kmalloc failed", -EINVAL);
+	if (ihk_smp_group_mem_used(group, -1)) {
+		pr_err("%s: error: memory of group %s is in use\n",
+		       __func__, g->name);
+		ret = -EBUSY;
+		goto out;
+	}
 
-	req_numa_ids = kmalloc(sizeof(int) * req.num_chunks, GFP_KERNEL);
-	ARCHDRV_CHKANDJUMP(req_numa_ids == NULL, "kmalloc failed", -EINVAL);
+	for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		if (ihk_smp_cpus[cpu].group == group &&
+		    ihk_smp_cpus[cpu].status != IHK_SMP_CPU_AVAILABLE) {
+			pr_err("%s: error: CPU %d of group %s is in use\n",
+			       __func__, cpu, g->name);
+			ret = -EBUSY;
+			goto out;
+		}
+	}
 
-	ret_internal = copy_from_user(req_sizes, req.sizes,
-			sizeof(size_t) * req.num_chunks);
-	ARCHDRV_CHKANDJUMP(ret_internal != 0, "copy_from_user failed", -EFAULT);
+	for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		ktime_t start;
 
-	ret_internal = copy_from_user(req_numa_ids, req.numa_ids,
-			sizeof(int) * req.num_chunks);
-	ARCHDRV_CHKANDJUMP(ret_internal != 0, "copy_from_user failed", -EFAULT);
+		if (ihk_smp_cpus[cpu].group != group)
+			continue;
 
-	/* Do release */
-	for (i = 0; i < req.num_chunks; i++) {
-		ret = __ihk_smp_release_mem(req_sizes[i],
-					    req_numa_ids[i]);
+		start = ktime_get();
+		ret = smp_ihk_online_cpu(cpu);
+		ihk_smp_dev_stat_add(IHK_SMP_DEV_STAT_RELEASE_CPU,
+				     cpu_to_node(cpu), start, ret, ret ? 0 : 1);
+		ihk_smp_cpus[cpu].group = 0;
 		if (ret) {
-			pr_err("%s: error: __ihk_smp_release_mem returned %d\n",
-			       __func__, ret);
-			goto fn_fail;
+			pr_err("%s: error: onlining CPU %d, it's kept reserved\n",
+			       __func__, cpu);
+			if (!err) {
+				err = ret;
+			}
+			continue;
 		}
+
+		ihk_smp_cpus[cpu].status = IHK_SMP_CPU_ONLINE;
+		ihk_smp_cpus[cpu].os = (ihk_os_t)0;
 	}
 
- fn_fail:
-	kfree(req_sizes);
-	kfree(req_numa_ids);
+	for (numa_id = 0; numa_id < nr_node_ids; numa_id++) {
+		if (!g->mem[numa_id])
+			continue;
+
+		/* What can't be released is left to the device-wide pool */
+		if (__ihk_smp_release_mem_partially(g->mem[numa_id],
+						    numa_id, &released)) {
+			pr_warn("%s: WARNING: memory of group %s @ NUMA node %d is partially kept reserved\n",
+				__func__, g->name, numa_id);
+		}
+		g->mem[numa_id] = 0;
+	}
+
+	pr_info("IHK-SMP: group %d (%s) destroyed\n", group, g->name);
+
+	kfree(g->mem);
+	memset(g, 0, sizeof(*g));
+	ret = err;
+out:
+	mutex_unlock(&ihk_smp_group_lock);
 	return ret;
 }
 
-static int smp_ihk_release_mem_partially(ihk_device_t ihk_dev,
-					 unsigned long arg)
+static int smp_ihk_query_group(ihk_device_t ihk_dev, unsigned long arg)
 {
-	int ret, i;
-	struct ihk_mem_req req;
-	size_t *req_sizes = NULL;
-	int *req_numa_ids = NULL;
+	int ret;
+	int cpu;
+	int numa_id;
+	int num_cpus = 0;
+	int *cpus = NULL;
+	struct ihk_group_info info;
 
-	ret = copy_from_user(&req, (void *)arg, sizeof(req));
-	if (ret) {
-		pr_err("%s: copy_from_user struct ihk_mem_req\n", __func__);
-		ret = -EFAULT;
-		goto out;
+	if (copy_from_user(&info, (void *)arg, sizeof(info))) {
+		pr_err("%s: error: copying request\n", __func__);
+		return -EFAULT;
 	}
 
-	if (validate_mem_req(&req)) {
+	if (info.num_cpus < 0 || info.num_cpus > SMP_MAX_CPUS ||
+	    (info.num_cpus > 0 && !info.cpus)) {
 		pr_err("%s: invalid request\n", __func__);
-		ret = -EINVAL;
-		goto out;
+		return -EINVAL;
 	}
 
-	req_sizes = kmalloc(sizeof(size_t) * req.num_chunks, GFP_KERNEL);
-	if (!req_sizes) {
-		pr_err("%s: allocating req_sizes\n", __func__);
-		ret = -ENOMEM;
-		goto out;
+	if (info.num_cpus > 0) {
+		cpus = kmalloc_array(info.num_cpus, sizeof(int), GFP_KERNEL);
+		if (!cpus) {
+			pr_err("%s: error: allocating cpus\n", __func__);
+			return -ENOMEM;
+		}
 	}
 
-	req_numa_ids = kmalloc(sizeof(int) * req.num_chunks, GFP_KERNEL);
-	if (!req_numa_ids) {
-		pr_err("%s: allocating req_num_ids\n", __func__);
-		ret = -ENOMEM;
-		goto out;
+	mutex_lock(&ihk_smp_group_lock);
+	if (info.id == IHK_GROUP_BY_NAME) {
+		info.name[IHK_GROUP_NAME_MAX - 1] = '\0';
+		info.id = ihk_smp_group_lookup(info.name);
 	}
 
-	ret = copy_from_user(req_sizes, req.sizes,
-			     sizeof(size_t) * req.num_chunks);
-	if (ret) {
-		pr_err("%s: copy_from_user req_sizes\n", __func__);
-		ret = -EFAULT;
+	if (!ihk_smp_group_valid(info.id)) {
+		ret = -ENOENT;
 		goto out;
 	}
 
-	ret = copy_from_user(req_numa_ids, req.numa_ids,
-			     sizeof(int) * req.num_chunks);
-	if (ret) {
-		pr_err("%s: copy_from_user req_numa_ids\n", __func__);
+	memcpy(info.name, ihk_smp_groups[info.id].name, IHK_GROUP_NAME_MAX);
+	info.num_cpus_assigned = 0;
+	info.num_os = ihk_smp_groups[info.id].nr_os;
+
+	for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		if (ihk_smp_cpus[cpu].group != info.id ||
+		    (ihk_smp_cpus[cpu].status != IHK_SMP_CPU_AVAILABLE &&
+		     ihk_smp_cpus[cpu].status != IHK_SMP_CPU_ASSIGNED))
+			continue;
+
+		if (num_cpus < info.num_cpus) {
+			cpus[num_cpus] = cpu;
+		}
+		num_cpus++;
+
+		if (ihk_smp_cpus[cpu].status == IHK_SMP_CPU_ASSIGNED) {
+			info.num_cpus_assigned++;
+		}
+	}
+
+	info.mem_assigned = ihk_smp_group_mem_used(info.id, -1);
+	info.mem_reserved = info.mem_assigned;
+	for (numa_id = 0; numa_id < nr_node_ids; numa_id++) {
+		info.mem_reserved += ihk_smp_group_mem_avail(info.id, numa_id);
+	}
+	mutex_unlock(&ihk_smp_group_lock);
+
+	if (cpus && copy_to_user(info.cpus, cpus,
+				 sizeof(int) * min(num_cpus, info.num_cpus))) {
+		pr_err("%s: error: copying cpus\n", __func__);
 		ret = -EFAULT;
-		goto out;
+		goto out_free;
 	}
 
-	/* Do release */
-	for (i = 0; i < req.num_chunks; i++) {
-		if (req_sizes[i] > 0) {
-			ret = __ihk_smp_release_mem_partially(req_sizes[i],
-							      req_numa_ids[i]);
-			if (ret) {
-				pr_err("%s: __ihk_smp_release_mem_partially returned %d\n",
-				       __func__, ret);
-				ret = -EINVAL;
-				goto out;
-			}
-		}
+	info.num_cpus = num_cpus;
+	if (copy_to_user((void *)arg, &info, sizeof(info))) {
+		pr_err("%s: error: copying result\n", __func__);
+		ret = -EFAULT;
+		goto out_free;
 	}
 
 	ret = 0;
+	goto out_free;
 out:
-	kfree(req_sizes);
-	kfree(req_numa_ids);
+	mutex_unlock(&ihk_smp_group_lock);
+out_free:
+	kfree(cpus);
 	return ret;
 }
 
@@ -5268,6 +7954,293 @@ void smp_ihk_ikc_irq_work_func(struct irq_work *work)
 #endif // IHK_IKC_USE_LINUX_WORK_IRQ
 
 
+/*
+ * Handover of reservations across module reload. With ihk_handover set,
+ * smp_ihk_exit() keeps the reserved CPUs offline and the reserved memory
+ * allocated, and records them in pages which are left allocated as well.
+ * The next module is loaded with ihk_handover_phys pointing to them.
+ */
+#define IHK_SMP_HANDOVER_MAGIC		0x49484b48	/* "IHKH" */
+#define IHK_SMP_HANDOVER_VERSION	2
+
+enum ihk_smp_handover_type {
+	IHK_SMP_HANDOVER_CPU,
+	IHK_SMP_HANDOVER_CHUNK,
+	IHK_SMP_HANDOVER_RANGE,
+};
+
+struct ihk_smp_handover_ent {
+	int type;
+	int numa_id;
+	unsigned long addr;	/* Linux CPU id for IHK_SMP_HANDOVER_CPU */
+	unsigned long size;
+	unsigned long released;
+};
+
+struct ihk_smp_handover {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int order;
+	unsigned int nr_ents;
+	/* Layout the module which wrote it was built with, the chunk
+	 * headers are adopted in place */
+	unsigned int ent_size;
+	unsigned int chunk_size;
+	u32 crc;
+	struct ihk_smp_handover_ent ents[];
+};
+
+static int smp_ihk_handover_save(void)
+{
+	struct ihk_smp_handover *h;
+	struct ihk_smp_handover_ent *ent;
+	struct ihk_offlined_range *range, *next;
+	struct chunk *mem_chunk;
+	struct page *pages;
+	int cpu, nr_ents = 0;
+	unsigned int order;
+
+	if (!list_empty(&ihk_mem_used_chunks)) {
+		pr_warn("IHK-SMP: warning: memory is in use, no handover\n");
+		return -EBUSY;
+	}
+
+	for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+		if (ihk_smp_cpus[cpu].status == IHK_SMP_CPU_ASSIGNED) {
+			pr_warn("IHK-SMP: warning: CPU %d is assigned, no handover\n",
+				cpu);
+			return -EBUSY;
+		}
+		if (ihk_smp_cpus[cpu].status == IHK_SMP_CPU_AVAILABLE) {
+			nr_ents++;
+		}
+	}
+	list_for_each_entry(mem_chunk, &ihk_mem_free_chunks, chain) {
+		nr_ents++;
+	}
+	list_for_each_entry(range, &ihk_offlined_ranges, list) {
+		nr_ents++;
+	}
+
+	order = get_order(sizeof(*h) + nr_ents * sizeof(*ent));
+	pages = alloc_pages(GFP_KERNEL, order);
+	if (!pages) {
+		pr_err("IHK-SMP: error: allocating handover area\n");
+		return -ENOMEM;
+	}
+
+	h = page_address(pages);
+	h->magic = IHK_SMP_HANDOVER_MAGIC;
+	h->version = IHK_SMP_HANDOVER_VERSION;
+	h->order = order;
+	h->nr_ents = nr_ents;
+	h->ent_size = sizeof(*ent);
+	h->chunk_size = sizeof(struct chunk);
+	ent = h->ents;
+
+	/* Ranges first so that the chunks find them on adoption */
+	list_for_each_entry(range, &ihk_offlined_ranges, list) {
+		ent->type = IHK_SMP_HANDOVER_RANGE;
+		ent->numa_id = range->numa_id;
+		ent->addr = range->addr;
+		ent->size = range->size;
+		ent->released = range->released;
+		ent++;
+	}
+
+	for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+		if (ihk_smp_cpus[cpu].status != IHK_SMP_CPU_AVAILABLE)
+			continue;
+		ent->type = IHK_SMP_HANDOVER_CPU;
+		ent->numa_id = cpu_to_node(cpu);
+		ent->addr = cpu;
+		ent->size = 0;
+		ent->released = 0;
+		ent++;
+	}
+
+	list_for_each_entry(mem_chunk, &ihk_mem_free_chunks, chain) {
+		ent->type = IHK_SMP_HANDOVER_CHUNK;
+		ent->numa_id = mem_chunk->numa_id;
+		ent->addr = mem_chunk->addr;
+		ent->size = mem_chunk->size;
+		ent->released = 0;
+		ent++;
+	}
+
+	h->crc = crc32_le(~0, (void *)h->ents, nr_ents * sizeof(*ent));
+
+	/* What the reservations themselves need is left in place */
+	INIT_LIST_HEAD(&ihk_mem_free_chunks);
+	list_for_each_entry_safe(range, next, &ihk_offlined_ranges, list) {
+		list_del(&range->list);
+		kfree(range);
+	}
+	for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+		if (ihk_smp_cpus[cpu].status == IHK_SMP_CPU_AVAILABLE) {
+			ihk_smp_cpus[cpu].status = IHK_SMP_CPU_NONE;
+		}
+	}
+
+	pr_info("IHK-SMP: reservations handed over, load the next module "
+		"with ihk_handover_phys=0x%lx\n",
+		(unsigned long)page_to_phys(pages));
+
+	return 0;
+}
+
+static int smp_ihk_handover_adopt_ent(struct ihk_smp_handover_ent *ent)
+{
+	struct ihk_offlined_range *range;
+	struct chunk *mem_chunk;
+	unsigned long addr, block_size;
+	int cpu;
+
+	switch (ent->type) {
+	case IHK_SMP_HANDOVER_RANGE:
+		/* Whole memory blocks, still offline and not adopted yet */
+		if (__ihk_smp_mem_hotplug_init()) {
+			goto bad_range;
+		}
+		block_size = ihk_memory_block_size_bytes();
+		if (!ent->size || ent->addr + ent->size < ent->addr ||
+		    ent->addr % block_size || ent->size % block_size ||
+		    ent->released > ent->size ||
+		    ent->numa_id < 0 || ent->numa_id >= nr_node_ids ||
+		    !pfn_valid(PHYS_PFN(ent->addr)) ||
+		    !pfn_valid(PHYS_PFN(ent->addr + ent->size - 1))) {
+			goto bad_range;
+		}
+		list_for_each_entry(range, &ihk_offlined_ranges, list) {
+			if (ent->addr < range->addr + range->size &&
+			    range->addr < ent->addr + ent->size) {
+				goto bad_range;
+			}
+		}
+		for (addr = ent->addr; addr < ent->addr + ent->size;
+		     addr += block_size) {
+			if (__ihk_smp_mem_block_offline(addr) != 1) {
+				goto bad_range;
+			}
+		}
+
+		range = kmalloc(sizeof(*range), GFP_KERNEL);
+		if (!range) {
+			return -ENOMEM;
+		}
+		range->addr = ent->addr;
+		range->size = ent->size;
+		range->numa_id = ent->numa_id;
+		range->released = ent->released;
+		list_add_tail(&range->list, &ihk_offlined_ranges);
+		return 0;
+
+	case IHK_SMP_HANDOVER_CPU:
+		cpu = ent->addr;
+		if (cpu >= nr_cpu_ids || cpu >= SMP_MAX_CPUS ||
+		    !cpu_present(cpu) || cpu_online(cpu) ||
+		    ihk_smp_cpus[cpu].status != IHK_SMP_CPU_NONE) {
+			pr_err("IHK-SMP: error: CPU %d can't be adopted\n", cpu);
+			return -EINVAL;
+		}
+		ihk_smp_cpus[cpu].id = cpu;
+		ihk_smp_cpus[cpu].hw_id = ihk_smp_get_hw_id(cpu);
+		ihk_smp_cpus[cpu].status = IHK_SMP_CPU_AVAILABLE;
+		ihk_smp_cpus[cpu].os = (ihk_os_t)0;
+		return 0;
+
+	case IHK_SMP_HANDOVER_CHUNK:
+		/* The header at the start of the chunk must still describe it */
+		if (!ent->size || !PAGE_ALIGNED(ent->addr) ||
+		    !pfn_valid(PHYS_PFN(ent->addr)) ||
+		    !pfn_valid(PHYS_PFN(ent->addr + ent->size - 1))) {
+			goto bad_chunk;
+		}
+		if (!__ihk_smp_find_offlined_range(ent->addr) &&
+		    PageBuddy(pfn_to_page(PHYS_PFN(ent->addr)))) {
+			goto bad_chunk;
+		}
+		/* Offline memory belongs to a range which was adopted */
+		if (!__ihk_smp_find_offlined_range(ent->addr) &&
+		    !__ihk_smp_mem_hotplug_init() &&
+		    __ihk_smp_mem_block_offline(ent->addr -
+				ent->addr % ihk_memory_block_size_bytes()) == 1) {
+			goto bad_chunk;
+		}
+		mem_chunk = phys_to_virt(ent->addr);
+		if (mem_chunk->addr != ent->addr ||
+		    mem_chunk->size != ent->size ||
+		    mem_chunk->numa_id != ent->numa_id) {
+			goto bad_chunk;
+		}
+		add_free_mem_chunk(mem_chunk);
+		return 0;
+
+	bad_chunk:
+		pr_err("IHK-SMP: error: chunk 0x%lx - 0x%lx can't be adopted\n",
+		       ent->addr, ent->addr + ent->size);
+		return -EINVAL;
+
+	bad_range:
+		pr_err("IHK-SMP: error: offlined range 0x%lx - 0x%lx can't be adopted\n",
+		       ent->addr, ent->addr + ent->size);
+		return -EINVAL;
+	}
+
+	return -EINVAL;
+}
+
+static void smp_ihk_handover_adopt(unsigned long phys)
+{
+	struct ihk_smp_handover *h;
+	unsigned long cpus = 0, chunks = 0, bytes = 0;
+	int i, ret;
+
+	if (!PAGE_ALIGNED(phys) || !pfn_valid(PHYS_PFN(phys))) {
+		pr_err("IHK-SMP: error: invalid handover area 0x%lx\n", phys);
+		return;
+	}
+
+	h = phys_to_virt(phys);
+	if (h->magic != IHK_SMP_HANDOVER_MAGIC ||
+	    h->version != IHK_SMP_HANDOVER_VERSION ||
+	    h->ent_size != sizeof(h->ents[0]) ||
+	    h->chunk_size != sizeof(struct chunk) ||
+	    h->order >= MAX_ORDER ||
+	    sizeof(*h) + (unsigned long)h->nr_ents * sizeof(h->ents[0]) >
+	    (PAGE_SIZE << h->order) ||
+	    crc32_le(~0, (void *)h->ents, h->nr_ents * sizeof(h->ents[0])) !=
+	    h->crc) {
+		pr_err("IHK-SMP: error: no valid handover at 0x%lx, "
+		       "reservations of the previous module are lost\n", phys);
+		return;
+	}
+
+	/*
+	 * An entry which doesn't validate stays with the previous module,
+	 * i.e. the CPU stays offline and the memory allocated
+	 */
+	for (i = 0; i < h->nr_ents; i++) {
+		ret = smp_ihk_handover_adopt_ent(&h->ents[i]);
+		if (ret) {
+			continue;
+		}
+
+		if (h->ents[i].type == IHK_SMP_HANDOVER_CPU) {
+			cpus++;
+		}
+		else if (h->ents[i].type == IHK_SMP_HANDOVER_CHUNK) {
+			chunks++;
+			bytes += h->ents[i].size;
+		}
+	}
+
+	pr_info("IHK-SMP: adopted %lu CPUs and %lu bytes in %lu chunks "
+		"from the previous module\n", cpus, bytes, chunks);
+
+	__free_pages(virt_to_page(h), h->order);
+}
+
 static int smp_ihk_init(ihk_device_t ihk_dev, void *priv)
 {
 	int ret;
@@ -5285,6 +8258,9 @@ static int smp_ihk_init(ihk_device_t ihk_dev, void *priv)
 	}
 
 	memset(ihk_smp_cpus, 0, sizeof(ihk_smp_cpus));
+	for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		ihk_smp_cpus[cpu].llc_cpu = -1;
+	}
 
 #if KERNEL_VERSION(4, 0, 0) <= LINUX_VERSION_CODE
 	for_each_cpu(cpu, cpu_online_mask) {
@@ -5295,6 +8271,30 @@ static int smp_ihk_init(ihk_device_t ihk_dev, void *priv)
 	}
 
 	ret = smp_ihk_arch_init();
+	if (ret) {
+		return ret;
+	}
+
+	/* Not fatal, only the device stats are unavailable */
+	ihk_smp_dev_stats = kcalloc(IHK_SMP_DEV_STAT_NR * nr_node_ids,
+				    sizeof(*ihk_smp_dev_stats), GFP_KERNEL);
+	if (!ihk_smp_dev_stats) {
+		pr_warn("IHK-SMP: warning: allocating stats\n");
+	}
+
+	if (ihk_handover_phys) {
+		smp_ihk_handover_adopt(ihk_handover_phys);
+		ihk_handover_phys = 0;
+	}
+
+	/* Not fatal, the LWK falls back to the boot time snapshot */
+	ihk_smp_clock_page = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!ihk_smp_clock_page) {
+		pr_warn("IHK-SMP: warning: allocating clock page\n");
+	}
+	else if (smp_ihk_arch_clock_init(ihk_smp_clock_page)) {
+		pr_warn("IHK-SMP: warning: Linux time isn't shared with LWK\n");
+	}
 
 #ifdef ENABLE_KRM_WORKAROUND
 	memset(__fake_chunk_per_node, 0, sizeof(__fake_chunk_per_node));
@@ -5307,8 +8307,22 @@ static int smp_ihk_exit(ihk_device_t ihk_dev, void *priv)
 {
 	int cpu, ret = 0;
 
+	if (ihk_smp_clock_page) {
+		smp_ihk_arch_clock_exit();
+		free_page((unsigned long)ihk_smp_clock_page);
+		ihk_smp_clock_page = NULL;
+	}
+
 	smp_ihk_arch_exit();
 
+	/* Falls back to releasing everything if the handover fails */
+	if (ihk_handover && !smp_ihk_handover_save()) {
+		free_info();
+		kfree(ihk_smp_dev_stats);
+		ihk_smp_dev_stats = NULL;
+		return 0;
+	}
+
 	/* Re-enable CPU cores */
 	for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
 		if ((ihk_smp_cpus[cpu].status == IHK_SMP_CPU_ONLINE) ||
@@ -5328,8 +8342,11 @@ static int smp_ihk_exit(ihk_device_t ihk_dev, void *priv)
 
 	/* Free memory */
 	__smp_ihk_free_mem_from_list(&ihk_mem_free_chunks);
+	__ihk_smp_online_all_ranges();
 
 	free_info();
+	kfree(ihk_smp_dev_stats);
+	ihk_smp_dev_stats = NULL;
 
 	return ret;
 }
@@ -5343,6 +8360,9 @@ static struct ihk_device_ops smp_ihk_device_ops = {
 	.unmap_memory = smp_ihk_unmap_memory,
 	.map_virtual = smp_ihk_map_virtual,
 	.unmap_virtual = smp_ihk_unmap_virtual,
+	.linear_map = smp_ihk_linear_map,
+	.lock_mem = smp_ihk_lock_mem,
+	.unlock_mem = smp_ihk_unlock_mem,
 	.debug_request = smp_ihk_debug_request,
 	.get_dma_channel = smp_ihk_get_dma_channel,
 	.reserve_cpu = smp_ihk_reserve_cpu,
@@ -5353,9 +8373,19 @@ static struct ihk_device_ops smp_ihk_device_ops = {
 #endif
 	.release_mem = smp_ihk_release_mem,
 	.release_mem_partially = smp_ihk_release_mem_partially,
+	.reserve_cpu_group = smp_ihk_reserve_cpu_group,
+	.release_cpu_group = smp_ihk_release_cpu_group,
+	.reserve_mem_group = smp_ihk_reserve_mem_group,
+	.release_mem_group = smp_ihk_release_mem_group,
+	.release_mem_partially_group = smp_ihk_release_mem_partially_group,
 	.get_num_cpus = smp_ihk_get_num_cpus,
 	.query_cpu = smp_ihk_query_cpu,
 	.query_mem = smp_ihk_query_mem,
+	.create_group = smp_ihk_create_group,
+	.destroy_group = smp_ihk_destroy_group,
+	.query_group = smp_ihk_query_group,
+	.show_stats = smp_ihk_show_stats,
+	.reset_stats = smp_ihk_reset_stats,
 	.get_cpu_topology = smp_ihk_get_cpu_topology,
 	.get_node_topology = smp_ihk_get_node_topology,
 	.linux_cpu_to_hw_id = smp_ihk_linux_cpu_to_hw_id,
@@ -5440,6 +8470,11 @@ static int ihk_smp_symbols_init(void)
 	if (WARN_ON(!smp_ihk_default_hstate_idx))
 		goto err;
 
+	/* Not fatal, the LWK is told LLC or tiers are unknown */
+	ihk_get_cpu_cacheinfo =
+		(void *)kallsyms_lookup_name("get_cpu_cacheinfo");
+	ihk_node_is_toptier = (void *)kallsyms_lookup_name("node_is_toptier");
+
 
 	ret = 0;
 err:
@@ -5470,6 +8505,12 @@ static int __init smp_module_init(void)
 
 	builtin_data.ihk_dev = ihkd;
 
+	/* debugfs is optional, go on without the kcore files */
+	ihk_smp_debugfs_dir = debugfs_create_dir("ihk_smp", NULL);
+	if (IS_ERR(ihk_smp_debugfs_dir)) {
+		ihk_smp_debugfs_dir = NULL;
+	}
+
 	return 0;
 }
 
@@ -5477,6 +8518,8 @@ static void __exit smp_module_exit(void)
 {
 	printk(KERN_INFO "IHK-SMP: finalizing...\n");
 	ihk_unregister_device(builtin_data.ihk_dev);
+	debugfs_remove_recursive(ihk_smp_debugfs_dir);
+	ihk_smp_mem_index_free(rcu_dereference_protected(ihk_mem_used_index, 1));
 }
 
 module_init(smp_module_init);
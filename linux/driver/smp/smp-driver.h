@@ -18,18 +18,23 @@
 #include <linux/slab.h>
 #include <linux/irq.h>
 #include <linux/version.h>
+#include <linux/mutex.h>
 #include <ihk/ihk_host_driver.h>
+#include <ihk/misc/debug.h>
 #include <bootparam.h>
 
 #ifdef IHK_DEBUG
 #define dprintk(...) do { if (1) { printk(KERN_DEBUG __VA_ARGS__); } } while (0)
+#define mdprintk(...) do { if (1) { printk(KERN_DEBUG __VA_ARGS__); } } while (0)
 #define eprintk(...) do { if (1) { printk(KERN_ERR __VA_ARGS__); } } while (0)
 #else
 #ifndef ENABLE_FUGAKU_DEBUG
-#define dprintk(...) do { if (0) { printk(KERN_DEBUG __VA_ARGS__); } } while (0)
+#define dprintk(...) ihk_dbg(IHK_DEBUG_SMP_BIT, __VA_ARGS__)
 #else
 #define dprintk(...) do { if (1) { printk(KERN_ERR __VA_ARGS__); } } while (0)
 #endif
+/* Memory reservation and release */
+#define mdprintk(...) ihk_dbg(IHK_DEBUG_MEM_BIT, __VA_ARGS__)
 #define eprintk(...) do { if (1) { printk(KERN_ERR __VA_ARGS__); } } while (0)
 #endif
 
@@ -62,6 +67,30 @@ struct ihk_smp_cpu {
 	int status;
 	ihk_os_t os;
 	int ikc_map_cpu;
+	/* Reservation group, 0 for the device-wide pool */
+	int group;
+	/* Lowest CPU sharing the LLC as seen before offlining, -1 if
+	 * unknown
+	 */
+	int llc_cpu;
+};
+
+/* Duration of a lifecycle operation and what it handled */
+struct ihk_smp_op_stat {
+	unsigned long count;
+	unsigned long errors;
+	unsigned long amount;	/* Bytes or CPUs */
+	u64 last_ns;
+	u64 min_ns;
+	u64 max_ns;
+	u64 total_ns;
+};
+
+enum {
+	IHK_SMP_OS_STAT_LOAD,
+	IHK_SMP_OS_STAT_BOOT,
+	IHK_SMP_OS_STAT_SHUTDOWN,
+	IHK_SMP_OS_STAT_NR
 };
 
 /** \brief BUILTIN driver-specific OS structure */
@@ -91,6 +120,8 @@ struct smp_os_data {
 	/** \brief Entry point address of this OS instance */
 	unsigned long boot_rip;
 	pgd_t *boot_pt;
+	/** \brief Physical range identity and straight mapped by boot_pt */
+	unsigned long boot_pt_map_size;
 
 	/** \brief IHK Memory information */
 	struct ihk_mem_info mem_info;
@@ -100,6 +131,12 @@ struct smp_os_data {
 	struct ihk_cpu_info cpu_info;
 	/** \brief hardware ID map of the CPU cores */
 	int cpu_hw_ids[SMP_MAX_CPUS];
+	/* Interrupt destinations covering all CPUs, built at boot by
+	 * smp_ihk_arch_os_build_ipi_dests(): x2APIC cluster destinations
+	 * on x86, a CPU mask turned into SGI target lists on arm64 */
+	unsigned int ipi_dests[SMP_MAX_CPUS];
+	int nr_ipi_dests;
+	struct cpumask ipi_mask;
 
 	/** \brief Kernel command-line parameter.
 	 *
@@ -119,6 +156,16 @@ struct smp_os_data {
 	int cpu_ikc_mapped;
 	int nr_cpus;
 
+	/* Power settings per Linux CPU, passed in boot_param and
+	 * updated by IHK_OS_SET_PWR */
+	struct ihk_pwr_setting cpu_pwr[SMP_MAX_CPUS];
+
+	/* Reservation group CPUs and memory are drawn from */
+	int group;
+
+	/* Load, boot and shutdown, shown in /sys/class/mcos/mcos<N>/stats */
+	struct ihk_smp_op_stat stats[IHK_SMP_OS_STAT_NR];
+
 	/** \brief Boot parameter for the kernel
 	 *
 	 * This structure is directly accessed (read and written)
@@ -128,6 +175,18 @@ struct smp_os_data {
 
 	/** \brief Status of the kernel */
 	int status;
+
+	/** \brief OS instance this structure belongs to */
+	ihk_os_t ihk_os;
+	/** \brief ELF core view of the LWK memory in debugfs */
+	struct dentry *kcore_dentry;
+
+	/** \brief Mailboxes of ihk_os_call_cpus(), shared with the kernel */
+	struct ihk_smp_call_area *call_area;
+	int call_area_order;
+	/** \brief Serializes the calls and protects call_area */
+	struct mutex call_lock;
+	unsigned long call_seq;
 };
 
 /* ihk_os_mem_chunk represents a memory range which is used by
@@ -142,6 +201,8 @@ struct ihk_os_mem_chunk {
 #endif
 	ihk_os_t os;
 	int numa_id;
+	/* Reservation group of the OS at the time of assignment */
+	int group;
 };
 
 extern struct ihk_smp_cpu ihk_smp_cpus[SMP_MAX_CPUS];
@@ -168,6 +229,19 @@ extern struct list_head node_topology_list;
 
 extern struct rb_root *ihk_vmap_area_root;
 
+/* Seqcount writer side of struct ihk_smp_clock_page, see bootparam.h */
+static inline void ihk_smp_clock_write_begin(struct ihk_smp_clock_page *cp)
+{
+	cp->seq++;
+	smp_wmb();
+}
+
+static inline void ihk_smp_clock_write_end(struct ihk_smp_clock_page *cp)
+{
+	smp_wmb();
+	cp->seq++;
+}
+
 #ifdef IHK_IKC_USE_LINUX_WORK_IRQ
 void smp_ihk_ikc_irq_work_func(struct irq_work *work);
 extern struct llist_head *ihk__raised_list;
@@ -28,4 +28,24 @@ struct ihk_kmsg_buf {
 	char str[IHK_KMSG_SIZE];
 };
 
+/* Debug message categories. Each one can be switched on and off at
+ * run time, per OS instance, with "ihkosctl <os> set debug" or
+ * /sys/class/mcos/mcos<os>/debug_mask. The mask is handed to the LWK
+ * in the boot parameters and the LWK checks it on every message.
+ */
+#define IHK_DEBUG_IKC_BIT	0	/* IKC queues and channels */
+#define IHK_DEBUG_MIKC_BIT	1	/* IKC master channel */
+#define IHK_DEBUG_SMP_BIT	2	/* SMP driver: boot, CPUs, interrupts */
+#define IHK_DEBUG_MEM_BIT	3	/* Memory reservation and release */
+#define IHK_DEBUG_NR		4
+
+#define IHK_DEBUG_IKC		(1U << IHK_DEBUG_IKC_BIT)
+#define IHK_DEBUG_MIKC		(1U << IHK_DEBUG_MIKC_BIT)
+#define IHK_DEBUG_SMP		(1U << IHK_DEBUG_SMP_BIT)
+#define IHK_DEBUG_MEM		(1U << IHK_DEBUG_MEM_BIT)
+#define IHK_DEBUG_ALL		((1U << IHK_DEBUG_NR) - 1)
+
+/* Indexed by the bit numbers above */
+#define IHK_DEBUG_NAMES		{ "ikc", "mikc", "smp", "mem" }
+
 #endif /* !defined(IHK_DEBUG_H_INCLUDED) */
@@ -47,6 +47,7 @@ typedef void *ihk_os_t;
 struct ihk_resource;
 
 struct ihk_host_interrupt_handler;
+struct ihk_os_cpu_call;
 struct ihk_mem_info;
 struct ihk_cpu_info;
 struct ihk_dma_request;
@@ -202,6 +203,10 @@ struct ihk_os_ops {
 	 **/
 	int (*issue_interrupt)(ihk_os_t, void *, int cpu, int vector);
 
+	/** \brief Run a request on a set of CPUs of a kernel and wait for
+	 *  all of them, see ihk_os_call_cpus() */
+	int (*call_cpus)(ihk_os_t, void *, struct ihk_os_cpu_call *call);
+
 	/** \brief Send interrupt to a kernel
 	 *
 	 *  \param mode   0 : reserved
@@ -302,6 +307,27 @@ struct ihk_os_ops {
 	**/
 	int (*get_ikc_map)(ihk_os_t, void *, unsigned long arg);
 
+	/** \brief Set frequency and power management knobs of CPU cores.
+	*
+	* \return Success or failure.
+	* \param struct ihk_pwr_req in user space.
+	**/
+	int (*set_pwr)(ihk_os_t, void *, unsigned long arg);
+
+	/** \brief Query power settings and APERF/MPERF of CPU cores.
+	*
+	* \return Success or failure.
+	* \param struct ihk_pwr_stat_req in user space.
+	**/
+	int (*get_pwr)(ihk_os_t, void *, unsigned long arg);
+
+	/** \brief Pass the debug categories (IHK_DEBUG_*) to the kernel.
+	*
+	* \return Success or failure.
+	* \param New mask, effective immediately if the kernel is running.
+	**/
+	int (*set_debug_mask)(ihk_os_t, void *, unsigned long arg);
+
 	/** \brief Get build-id.
 	*
 	* \return Success or failure.
@@ -343,6 +369,19 @@ struct ihk_os_ops {
 	 **/
 	int (*query_mem)(ihk_os_t, void *, unsigned long arg);
 
+	/** \brief Bind the OS instance to a reservation group
+	 *
+	 *  \return Success or failure.
+	 *  \param Group id, 0 for the device-wide pool
+	 **/
+	int (*set_group)(ihk_os_t, void *, unsigned long arg);
+
+	/** \brief Get the reservation group of the OS instance
+	 *
+	 *  \return Group id on success, negative errno on failure.
+	 **/
+	int (*get_group)(ihk_os_t ihk_os, void *priv);
+
 	/** \brief Freeze CPU
 	 *
 	 *  \return Success or failure.
@@ -362,6 +401,17 @@ struct ihk_os_ops {
 	/** \brief Virtual to physical translation
 	 **/
 	int (*vtop)(ihk_os_t, void *priv, unsigned long virt, unsigned long *phys);
+
+	/** \brief Format statistics of lifecycle operations (load, boot,
+	 *  shutdown) into a buffer of PAGE_SIZE bytes
+	 *
+	 *  \return Length of the text on success, negative errno on failure.
+	 **/
+	ssize_t (*show_stats)(ihk_os_t, void *priv, char *buf);
+
+	/** \brief Reset statistics of lifecycle operations
+	 **/
+	void (*reset_stats)(ihk_os_t, void *priv);
 };
 
 struct ihk_register_os_data;
@@ -486,6 +536,72 @@ struct ihk_device_ops {
 	 */
 	int (*query_mem)(ihk_device_t, unsigned long arg);
 
+	/**
+	 * \brief Create a reservation group
+	 *
+	 * \param arg     struct ihk_group_info with the name
+	 * \return The id of the group on success, negative errno on failure.
+	 */
+	int (*create_group)(ihk_device_t, unsigned long arg);
+
+	/**
+	 * \brief Release the CPUs and memory of a group and remove it
+	 *
+	 * \param arg     Group id
+	 */
+	int (*destroy_group)(ihk_device_t, unsigned long arg);
+
+	/**
+	 * \brief Query a reservation group
+	 *
+	 * \param arg     struct ihk_group_info with the id or name
+	 */
+	int (*query_group)(ihk_device_t, unsigned long arg);
+
+	/**
+	 * \brief Reserve CPU cores into a reservation group
+	 *
+	 * \param arg     struct ihk_cpu_group_req
+	 */
+	int (*reserve_cpu_group)(ihk_device_t, unsigned long arg);
+
+	/**
+	 * \brief Release CPU cores of a reservation group
+	 *
+	 * \param arg     struct ihk_cpu_group_req
+	 */
+	int (*release_cpu_group)(ihk_device_t, unsigned long arg);
+
+	/**
+	 * \brief Reserve memory into a reservation group
+	 *
+	 * \param arg     struct ihk_mem_group_req
+	 */
+	int (*reserve_mem_group)(ihk_device_t, unsigned long arg);
+
+	/**
+	 * \brief Release memory of a reservation group
+	 *
+	 * \param arg     struct ihk_mem_group_req
+	 */
+	int (*release_mem_group)(ihk_device_t, unsigned long arg);
+
+	int (*release_mem_partially_group)(ihk_device_t, unsigned long arg);
+
+	/**
+	 * \brief Format statistics of lifecycle operations
+	 *
+	 * Reserving and releasing CPUs and memory, per NUMA node.
+	 * \param buf     Buffer of PAGE_SIZE bytes
+	 * \return Length of the text on success, negative errno on failure.
+	 */
+	ssize_t (*show_stats)(ihk_device_t, char *buf);
+
+	/**
+	 * \brief Reset statistics of lifecycle operations
+	 */
+	void (*reset_stats)(ihk_device_t);
+
 	/**
 	 * \brief Map a physical memory area to the host physical memory
 	 *
@@ -529,6 +645,28 @@ struct ihk_device_ops {
 	int (*unmap_virtual)(ihk_device_t, void *, void *virt,
 	                     unsigned long size);
 
+	/**
+	 * \brief Get the address of memory assigned to an OS instance
+	 *        in the kernel linear map, for reading and writing it
+	 *        from the device file. Called between lock_mem() and
+	 *        unlock_mem(), the address is valid until the latter.
+	 *
+	 * \param os OS instance the region must belong to, NULL for any
+	 * \param pa Host physical address
+	 * \param size Size of the memory region
+	 * \return Kernel virtual address, NULL if the whole region isn't
+	 *         memory of the OS.
+	 */
+	void *(*linear_map)(ihk_device_t, void *, ihk_os_t os,
+	                    unsigned long pa, unsigned long size);
+
+	/**
+	 * \brief Keep the memory assigned to OS instances from being
+	 *        released until unlock_mem(). It may sleep.
+	 */
+	void (*lock_mem)(ihk_device_t, void *);
+	void (*unlock_mem)(ihk_device_t, void *);
+
 	/**
 	 * \brief Handle an ioctl request with the request number
 	 *  in the debug region.
@@ -762,6 +900,24 @@ struct ihk_resource {
 	int cores[0];
 };
 
+#define IHK_OS_CPU_CALL_NR_ARGS	4
+/* Request handled by IHK itself, does nothing */
+#define IHK_OS_CPU_CALL_NOP	0
+
+/** \brief Request run on a set of CPUs of an OS instance */
+struct ihk_os_cpu_call {
+	/** \brief Request number, registered by the kernel */
+	int req;
+	unsigned long args[IHK_OS_CPU_CALL_NR_ARGS];
+	/** \brief Target CPUs (kernel CPU ids) */
+	const int *cpus;
+	int nr_cpus;
+	/** \brief Return value for each of cpus, NULL if not needed */
+	long *rets;
+	/** \brief Maximum time to wait in milliseconds */
+	unsigned long timeout_ms;
+};
+
 /** \brief Desciptor of the interrupt handlers */
 struct ihk_host_interrupt_handler {
 	/** \brief List head. Internal use. */
@@ -823,6 +979,18 @@ int ihk_os_unmap_memory(ihk_os_t os, unsigned long pa, unsigned long size);
  */
 int ihk_os_issue_interrupt(ihk_os_t os, int cpu, int vector);
 
+/**
+ * \brief Post a request to each of the CPUs of call, interrupt them at
+ * once and wait for all of them to complete it. Calls to an OS instance
+ * are serialized. May sleep.
+ *
+ * \param call   Request, targets and return values
+ * Returns 0 if all CPUs completed the request, -ETIMEDOUT if some of
+ * them did not in time, -EBUSY if some are still running an earlier
+ * request that timed out.
+ */
+int ihk_os_call_cpus(ihk_os_t os, struct ihk_os_cpu_call *call);
+
 /**
  * \brief Send NMI to the OS instance
  *
@@ -884,6 +1052,51 @@ void *ihk_host_os_get_usrdata(ihk_os_t);
  */
 int ihk_host_os_get_index(ihk_os_t);
 
+/**
+ * \brief Get the Linux CPU requested for the master channel,
+ * IHK_IKC_MASTER_CPU_AUTO if the driver should choose one.
+ *
+ * \param os     OS instance
+ */
+int ihk_host_os_get_ikc_master_cpu(ihk_os_t);
+
+/**
+ * \brief Get the debug categories (IHK_DEBUG_*) enabled for the OS.
+ *
+ * \param os     OS instance
+ */
+unsigned int ihk_host_os_get_debug_mask(ihk_os_t);
+
+/** \brief Classes of host CPU time charged to an OS instance. IKC
+ *  reception called from an interrupt handler counts in both. */
+enum ihk_os_acct_type {
+	IHK_OS_ACCT_IRQ,	/* Interrupt handlers */
+	IHK_OS_ACCT_IKC,	/* IKC reception, nr counts packets */
+	IHK_OS_ACCT_WORK,	/* Deferred work items */
+	IHK_OS_ACCT_NR,
+};
+
+/**
+ * \brief Charge the cycles since start (get_cycles()) and nr events
+ * to the OS on the current Linux CPU. Callable from any context.
+ *
+ * \param os     OS instance
+ * \param type   IHK_OS_ACCT_*
+ * \param start  get_cycles() at the beginning of the handler
+ * \param nr     Number of events handled
+ */
+void ihk_host_os_account(ihk_os_t os, int type, unsigned long long start,
+			 unsigned long nr);
+
+/**
+ * \brief Set the Linux CPU the master channel is bound to. Called by
+ * the driver at boot, before the kernel is started.
+ *
+ * \param os     OS instance
+ * \param cpu    Linux CPU id
+ */
+void ihk_host_os_set_mchannel_cpu(ihk_os_t os, int cpu);
+
 /**
  * \brief Descriptor of the handler for a ioctl request to the OS device file.
  */
@@ -32,6 +32,15 @@
 #define IHK_DEVICE_RESERVE_MEM_MAX_RATIO        0x11290e
 #endif
 #define IHK_DEVICE_DETECT_HUNGUP      0x11290f
+#define IHK_DEVICE_ACCESS_MEM         0x112910
+#define IHK_DEVICE_CREATE_GROUP       0x112911
+#define IHK_DEVICE_DESTROY_GROUP      0x112912
+#define IHK_DEVICE_QUERY_GROUP        0x112913
+#define IHK_DEVICE_RESERVE_CPU_GROUP  0x112914
+#define IHK_DEVICE_RELEASE_CPU_GROUP  0x112915
+#define IHK_DEVICE_RESERVE_MEM_GROUP  0x112916
+#define IHK_DEVICE_RELEASE_MEM_GROUP  0x112917
+#define IHK_DEVICE_RELEASE_MEM_PARTIALLY_GROUP  0x112918
 
 #define IHK_DEVICE_DEBUG_START        0x122900
 #define IHK_DEVICE_DEBUG_END          0x1229ff
@@ -71,6 +80,14 @@
 #define IHK_OS_GET_BUILDID            0x112a37
 #define IHK_OS_GET_NUM_CPUS           0x112a38
 #define IHK_OS_READ_KADDR             0x112a39
+#define IHK_OS_SET_IKC_MASTER_CPU     0x112a3a
+#define IHK_OS_GET_IKC_MASTER_CPU     0x112a3b
+#define IHK_OS_SET_PWR                0x112a3c
+#define IHK_OS_GET_PWR                0x112a3d
+#define IHK_OS_SET_DEBUG_MASK         0x112a3e
+#define IHK_OS_GET_DEBUG_MASK         0x112a3f
+#define IHK_OS_SET_GROUP              0x112a40
+#define IHK_OS_GET_GROUP              0x112a41
 
 #define IHK_OS_DEBUG_START            0x122a00
 #define IHK_OS_DEBUG_END              0x122aff
@@ -151,6 +168,11 @@ struct ihk_mem_req {
 	 * than this seconds for the current order
 	 */
 	int timeout;
+
+	/* Take whole memory blocks of ZONE_MOVABLE by offlining them
+	 * instead of allocating pages from the buddy allocator
+	 */
+	int offline_blocks;
 };
 
 struct ihk_ikc_req {
@@ -159,6 +181,39 @@ struct ihk_ikc_req {
 	int num_cpus;
 };
 
+/* Reservation groups. CPUs and memory reserved into a group can only be
+ * assigned to the OS instances bound to it and are released to Linux
+ * as a whole when the group is destroyed. Group 0 is the device-wide
+ * pool holding what is reserved without a group.
+ */
+#define IHK_MAX_GROUPS		16
+#define IHK_GROUP_NAME_MAX	32
+#define IHK_GROUP_BY_NAME	(-1)
+
+/* Requests of the *_GROUP device ioctls. The plain ones keep taking
+ * struct ihk_cpu_req and struct ihk_mem_req and work on group 0.
+ */
+struct ihk_cpu_group_req {
+	struct ihk_cpu_req req;
+	int group;
+};
+
+struct ihk_mem_group_req {
+	struct ihk_mem_req req;
+	int group;
+};
+
+struct ihk_group_info {
+	int id;			/* IN/OUT, IHK_GROUP_BY_NAME to look up name */
+	char name[IHK_GROUP_NAME_MAX];
+	int *cpus;		/* OUT: CPUs reserved into the group */
+	int num_cpus;		/* IN: size of cpus, OUT: number of CPUs */
+	int num_cpus_assigned;	/* OUT: CPUs assigned to OS instances */
+	int num_os;		/* OUT: OS instances bound to the group */
+	unsigned long mem_reserved;	/* OUT: bytes reserved into the group */
+	unsigned long mem_assigned;	/* OUT: bytes assigned to OS instances */
+};
+
 /* Used by IHK-core and ihklib */
 struct ihk_os_ioctl_eventfd_desc {
 	int fd;
@@ -175,6 +230,62 @@ struct ihk_os_read_kaddr_desc {
 	int flags;
 };
 
+/* Let the driver pick the master channel CPU of an OS instance */
+#define IHK_IKC_MASTER_CPU_AUTO	(-1)
+
+/* Power settings of LWK CPUs (x86). IHK_PWR_KEEP leaves a knob
+ * as set by the firmware or by the previous request. IHK_PWR_RESET
+ * drops the value stored by previous requests, so that the next boot
+ * leaves the knob as set by the firmware; a running OS isn't changed.
+ */
+#define IHK_PWR_KEEP	(-1)
+#define IHK_PWR_RESET	(-2)
+
+struct ihk_pwr_setting {
+	int min_perf;		/* HWP minimum performance */
+	int max_perf;		/* HWP maximum performance or P-state ratio */
+	int epp;		/* HWP energy-performance preference, 0-255 */
+	int epb;		/* Energy-performance bias, 0-15 */
+	int turbo;		/* 0: disabled, 1: enabled */
+	int cstate_limit;	/* C-state limit of MSR_PKG_CST_CONFIG_CONTROL */
+};
+
+struct ihk_pwr_req {
+	int *cpus;		/* Linux CPU ids assigned to the OS */
+	int num_cpus;
+	struct ihk_pwr_setting setting;
+};
+
+struct ihk_pwr_stat {
+	int cpu;		/* Linux CPU id */
+	int running;		/* Counters are valid */
+	struct ihk_pwr_setting setting;
+	unsigned long tsc;
+	unsigned long aperf;
+	unsigned long mperf;
+};
+
+struct ihk_pwr_stat_req {
+	struct ihk_pwr_stat *stats;
+	int num_cpus;
+};
+
+/* Segments of LWK memory read or written by one IHK_DEVICE_ACCESS_MEM */
+#define IHK_DEVICE_ACCESS_MEM_MAX_SEGS	1024
+
+struct ihk_mem_seg {
+	unsigned long phys;	/* Physical address in memory of an OS */
+	unsigned long len;
+	void *buf;		/* User buffer */
+};
+
+struct ihk_device_access_mem_desc {
+	int os_index;		/* OS owning the memory of all segments */
+	struct ihk_mem_seg *segs;
+	int nr_segs;
+	int write;		/* 0: LWK memory to buf, 1: buf to LWK memory */
+};
+
 /* Used by IHK-core and ihklib */
 struct ihk_device_get_kmsg_buf_desc {
 	int os_index; /* IN: OS index */
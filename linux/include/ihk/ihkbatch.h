@@ -0,0 +1,53 @@
+/**
+ * \file ihkbatch.h
+ *  License details are found in the file LICENSE.
+ * \brief
+ *  Batch (script) mode shared by ihkconfig and ihkosctl
+ */
+#ifndef IHKBATCH_H_INCLUDED
+#define IHKBATCH_H_INCLUDED
+
+/** \brief Action that can be used in a script */
+struct ihkbatch_cmd {
+	const char *name;
+	/* Exactly one of them is set */
+	int (*func)(int fd);
+	int (*func_with_index)(int index);
+	/* Variable set to the return value when it is non-negative,
+	 * e.g. the index of the created OS instance */
+	const char *result_var;
+};
+
+struct ihkbatch_opts {
+	/* NULL or "-" for stdin */
+	const char *script;
+	/* Continue with the next step when a step fails */
+	int keep_going;
+	/* Report the elapsed time of each step on stderr */
+	int timing;
+};
+
+/**
+ * \brief Parse "-f (script|-) [-k] [-t]" following the index argument.
+ * Returns 1 if batch mode is requested, 0 if not, -1 on error.
+ */
+int ihkbatch_parse_opts(int argc, char **argv, struct ihkbatch_opts *opts);
+
+/**
+ * \brief Run a script. Each line is handed to the handler of the action
+ * named by its first word with (argc, argv) laid out as on the command
+ * line, i.e. argv[1] is the index and argv[2] the action. All steps
+ * work on that index, there is no switching to another device or OS.
+ *
+ * \param index_var  Variable predefined to the index, e.g. "DEV"
+ * \param fd         Device file shared by all steps
+ * \param argcp      Where the handlers take their argc from
+ * \param argvp      Where the handlers take their argv from
+ * Returns 0 if all steps succeeded, 1 otherwise.
+ */
+int ihkbatch_run(const struct ihkbatch_opts *opts, char *prog, char *index,
+		 const char *index_var, int fd,
+		 const struct ihkbatch_cmd *cmds,
+		 int *argcp, char ***argvp);
+
+#endif
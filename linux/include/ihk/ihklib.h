@@ -71,6 +71,7 @@ enum ihk_reserve_mem_conf_keys {
 	IHK_RESERVE_MEM_MIN_CHUNK_SIZE,
 	IHK_RESERVE_MEM_MAX_SIZE_RATIO_ALL,
 	IHK_RESERVE_MEM_TIMEOUT,
+	IHK_RESERVE_MEM_OFFLINE_BLOCKS,
 };
 
 extern int loglevel;
@@ -87,6 +88,27 @@ int ihk_reserve_mem_str(int dev_index, const char *envp, int num_env);
 int ihk_get_num_reserved_mem_chunks(int index);
 int ihk_query_mem(int index, struct ihk_mem_chunk* mem_chunks, int _num_mem_chunks);
 int ihk_release_mem(int index, struct ihk_mem_chunk* mem_chunks, int num_mem_chunks);
+/* Reservation groups, see ihk_host_user.h for the structure.
+ * The *_group variants reserve into and release from a group, the
+ * others work on the device-wide pool (group 0).
+ */
+struct ihk_group_info;
+int ihk_reserve_cpu_group(int index, int group, int *cpus, int num_cpus);
+int ihk_release_cpu_group(int index, int group, int *cpus, int num_cpus);
+int ihk_reserve_mem_group(int index, int group,
+			  struct ihk_mem_chunk *mem_chunks,
+			  int num_mem_chunks);
+int ihk_release_mem_group(int index, int group,
+			  struct ihk_mem_chunk *mem_chunks,
+			  int num_mem_chunks);
+int ihk_create_group(int index, const char *name);
+int ihk_destroy_group(int index, int group);
+int ihk_query_group(int index, struct ihk_group_info *info);
+/* See ihk_host_user.h for the structure. All segments must be memory
+ * of OS os_index. Returns the bytes copied */
+struct ihk_mem_seg;
+long ihk_access_mem(int index, int os_index, struct ihk_mem_seg *segs,
+		    int nr_segs, int write);
 int ihk_create_os(int index);
 int ihk_get_num_os_instances(int index);
 int ihk_get_os_instances(int index, int *indices, int _num_os_instances);
@@ -99,6 +121,19 @@ int ihk_os_release_cpu(int index, int* cpus, int num_cpus);
 int ihk_os_set_ikc_map(int index, struct ihk_ikc_cpu_map *map, int num_cpus);
 int ihk_os_set_ikc_map_str(int os_index, const char *envp, int num_env);
 int ihk_os_get_ikc_map(int index, struct ihk_ikc_cpu_map *map, int num_cpus);
+int ihk_os_set_ikc_master_cpu(int index, int cpu);
+int ihk_os_get_ikc_master_cpu(int index, int *cpu);
+/* See ihk_host_user.h for the structures */
+struct ihk_pwr_setting;
+struct ihk_pwr_stat;
+int ihk_os_set_pwr(int index, int *cpus, int num_cpus,
+		   struct ihk_pwr_setting *setting);
+int ihk_os_get_pwr(int index, struct ihk_pwr_stat *stats, int num_cpus);
+/* IHK_DEBUG_* categories, see ihk_debug.h */
+int ihk_os_set_debug_mask(int index, unsigned int mask);
+int ihk_os_get_debug_mask(int index);
+int ihk_os_set_group(int index, int group);
+int ihk_os_get_group(int index);
 int ihk_os_assign_mem(int index, struct ihk_mem_chunk *mem_chunks, int num_mem_chunks);
 int ihk_os_get_num_assigned_mem_chunks(int index);
 int ihk_os_query_mem(int index, struct ihk_mem_chunk* mem_chunks, int _num_mem_chunks);
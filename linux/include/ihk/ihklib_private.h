@@ -93,6 +93,11 @@ struct ihklib_reserve_mem_conf {
 	 * than this seconds for the current order
 	 */
 	int timeout;
+
+	/* 1: Offline whole memory blocks of ZONE_MOVABLE and reserve
+	 *    them as is instead of allocating from the buddy allocator
+	 */
+	int offline_blocks;
 };
 
 extern struct ihklib_reserve_mem_conf reserve_mem_conf;
@@ -114,6 +119,10 @@ char *ikc_req2str(struct ihk_ikc_req *req);
 
 int _ihk_reserve_cpu_str(int dev_index, char *list, char *err_msg);
 int _ihk_reserve_mem_str(int dev_index, char *list, char *err_msg);
+int _ihk_reserve_cpu_str_group(int dev_index, int group, char *list,
+			       char *err_msg);
+int _ihk_reserve_mem_str_group(int dev_index, int group, char *list,
+			       char *err_msg);
 
 #endif /* !defined(__KERNEL__) */
 
@@ -0,0 +1,31 @@
+/**
+ * \file ihkuncore.h
+ *  License details are found in the file LICENSE.
+ * \brief
+ *  Memory bandwidth and interconnect traffic of the sockets an OS
+ *  instance runs on, sampled with the uncore PMUs of Linux perf
+ */
+#ifndef IHKUNCORE_H_INCLUDED
+#define IHKUNCORE_H_INCLUDED
+
+#define IHKUNCORE_MAX_USER_EVENTS 16
+
+struct ihkuncore_opts {
+	/* Sampling interval in milliseconds */
+	unsigned int interval_ms;
+	/* Number of samples, 0 to sample until interrupted */
+	int count;
+	/* Report the sockets without LWK CPUs or memory as well */
+	int all_sockets;
+	/* Additional events, "(read|write|link)=pmu/terms/[*bytes]" */
+	const char *user_events[IHKUNCORE_MAX_USER_EVENTS];
+	int nr_user_events;
+};
+
+/**
+ * \brief Sample until opts->count samples are printed or SIGINT
+ * is received. Returns 0 on success, negative errno otherwise.
+ */
+int ihkuncore_run(int os_index, const struct ihkuncore_opts *opts);
+
+#endif
@@ -26,6 +26,40 @@
 #define dprint_var_x8(var)   dprintf(#var " = %lx\n", var)
 #define dprint_var_p(var)    dprintf(#var " = %p\n", var)
 
+#ifdef __KERNEL__
+#include <linux/version.h>
+#include <linux/jump_label.h>
+#include <ihk/ihk_debug.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+#define ihk_debug_key_t			struct static_key_false
+#define IHK_DEBUG_KEY_INIT		STATIC_KEY_FALSE_INIT
+#define ihk_debug_key_enabled(key)	static_branch_unlikely(key)
+#define ihk_debug_key_inc(key)		static_branch_inc(key)
+#define ihk_debug_key_dec(key)		static_branch_dec(key)
+#else
+#define ihk_debug_key_t			struct static_key
+#define IHK_DEBUG_KEY_INIT		STATIC_KEY_INIT_FALSE
+#define ihk_debug_key_enabled(key)	static_key_false(key)
+#define ihk_debug_key_inc(key)		static_key_slow_inc(key)
+#define ihk_debug_key_dec(key)		static_key_slow_dec(key)
+#endif
+
+/* One key per IHK_DEBUG_*_BIT, counting the OS instances that enable
+ * the category plus the debug_mask parameter of ihk.ko. A disabled
+ * category costs a patched-out jump. */
+extern ihk_debug_key_t ihk_debug_keys[IHK_DEBUG_NR];
+
+#define ihk_debug_enabled(bit)	ihk_debug_key_enabled(&ihk_debug_keys[bit])
+
+#define ihk_dbg(bit, ...)						\
+	do {								\
+		if (ihk_debug_enabled(bit)) {				\
+			printk(KERN_DEBUG __VA_ARGS__);			\
+		}							\
+	} while (0)
+#endif /* __KERNEL__ */
+
 #define dprint_func_enter    dprintf("==> %s\n", __FUNCTION__);
 #define dprint_func_leave    dprintf("<== %s\n", __FUNCTION__);
 
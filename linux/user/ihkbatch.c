@@ -0,0 +1,525 @@
+/**
+ * \file ihkbatch.c
+ *  License details are found in the file LICENSE.
+ * \brief
+ *  Runs a sequence of ihkconfig / ihkosctl actions in one process
+ *
+ *  Script syntax, one step per line:
+ *    # comment
+ *    NAME=value           sets a variable
+ *    onerror stop|continue
+ *    echo words...        prints the (expanded) words to stdout
+ *    action args...       same as on the command line
+ *  $NAME and ${NAME} are replaced with the variable, or with the
+ *  environment variable of that name. Words can be quoted with '...'
+ *  (no expansion) or "...".
+ *
+ *  A script stays in the scope of the tool running it: the device for
+ *  ihkconfig, one OS instance for ihkosctl. Actions are looked up in
+ *  that tool's table only and the steps taking an index get the one of
+ *  the command line, so a full bring-up is an ihkconfig script that
+ *  reserves and creates, followed by an ihkosctl script of the new OS.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <ihk/ihkbatch.h>
+
+#define IHKBATCH_MAX_ARGS 64
+
+struct ihkbatch_var {
+	struct ihkbatch_var *next;
+	char *name;
+	char *value;
+};
+
+struct ihkbatch_buf {
+	char *s;
+	size_t len;
+	size_t size;
+};
+
+static struct ihkbatch_var *ihkbatch_vars;
+
+static struct ihkbatch_var *var_find(const char *name, size_t len)
+{
+	struct ihkbatch_var *v;
+
+	for (v = ihkbatch_vars; v; v = v->next) {
+		if (strlen(v->name) == len && !strncmp(v->name, name, len)) {
+			return v;
+		}
+	}
+
+	return NULL;
+}
+
+static int var_set(const char *name, size_t len, const char *value)
+{
+	struct ihkbatch_var *v;
+	char *dup;
+
+	dup = strdup(value);
+	if (!dup) {
+		return -ENOMEM;
+	}
+
+	v = var_find(name, len);
+	if (v) {
+		free(v->value);
+		v->value = dup;
+		return 0;
+	}
+
+	v = calloc(1, sizeof(*v));
+	if (!v) {
+		free(dup);
+		return -ENOMEM;
+	}
+
+	v->name = strndup(name, len);
+	if (!v->name) {
+		free(dup);
+		free(v);
+		return -ENOMEM;
+	}
+
+	v->value = dup;
+	v->next = ihkbatch_vars;
+	ihkbatch_vars = v;
+	return 0;
+}
+
+static void var_free_all(void)
+{
+	struct ihkbatch_var *v, *next;
+
+	for (v = ihkbatch_vars; v; v = next) {
+		next = v->next;
+		free(v->name);
+		free(v->value);
+		free(v);
+	}
+	ihkbatch_vars = NULL;
+}
+
+static const char *var_get(const char *name, size_t len)
+{
+	struct ihkbatch_var *v;
+	char env[256];
+
+	v = var_find(name, len);
+	if (v) {
+		return v->value;
+	}
+
+	if (len >= sizeof(env)) {
+		return NULL;
+	}
+	memcpy(env, name, len);
+	env[len] = '\0';
+
+	return getenv(env);
+}
+
+static int is_name_char(int c, int first)
+{
+	return c == '_' || isalpha(c) || (!first && isdigit(c));
+}
+
+static int buf_append(struct ihkbatch_buf *b, const char *s, size_t len)
+{
+	if (b->len + len + 1 > b->size) {
+		size_t size = b->size ? b->size : 64;
+		char *n;
+
+		while (b->len + len + 1 > size) {
+			size *= 2;
+		}
+
+		n = realloc(b->s, size);
+		if (!n) {
+			return -ENOMEM;
+		}
+		b->s = n;
+		b->size = size;
+	}
+
+	memcpy(b->s + b->len, s, len);
+	b->len += len;
+	b->s[b->len] = '\0';
+	return 0;
+}
+
+/*
+ * Split a line into words, expanding variables and removing quotes.
+ * The words are allocated and must be freed by the caller.
+ */
+static int tokenize(const char *line, char **words, int max_words,
+		    const char *where)
+{
+	struct ihkbatch_buf b = { 0 };
+	const char *p = line;
+	int nr_words = 0;
+	int in_word = 0;
+	char quote = 0;
+	int ret = 0;
+
+	for (;;) {
+		unsigned char c = *p;
+
+		if (c == '\0' || c == '\n' ||
+		    (!quote && (isspace(c) || (c == '#' && !in_word)))) {
+			if (quote && (c == '\0' || c == '\n')) {
+				fprintf(stderr, "%s: error: unterminated quote\n",
+					where);
+				ret = -EINVAL;
+				goto out;
+			}
+
+			if (in_word) {
+				if (nr_words == max_words) {
+					fprintf(stderr, "%s: error: too many words\n",
+						where);
+					ret = -E2BIG;
+					goto out;
+				}
+				words[nr_words++] = b.s ? b.s : strdup("");
+				memset(&b, 0, sizeof(b));
+				in_word = 0;
+			}
+
+			if (c == '\0' || c == '\n' || c == '#') {
+				break;
+			}
+			p++;
+			continue;
+		}
+
+		in_word = 1;
+
+		if (c == '\'' || c == '"') {
+			if (!quote) {
+				quote = c;
+				p++;
+				/* Keep "" as an empty word */
+				ret = buf_append(&b, "", 0);
+				if (ret) {
+					goto out;
+				}
+				continue;
+			}
+			if (quote == c) {
+				quote = 0;
+				p++;
+				continue;
+			}
+		}
+
+		if (c == '\\' && quote != '\'' && p[1] != '\0') {
+			ret = buf_append(&b, p + 1, 1);
+			if (ret) {
+				goto out;
+			}
+			p += 2;
+			continue;
+		}
+
+		if (c == '$' && quote != '\'') {
+			const char *name = p + 1;
+			const char *value;
+			size_t len = 0;
+			int braces = (*name == '{');
+
+			if (braces) {
+				name++;
+			}
+			while (is_name_char((unsigned char)name[len], len == 0)) {
+				len++;
+			}
+
+			if (len == 0 || (braces && name[len] != '}')) {
+				fprintf(stderr, "%s: error: bad variable reference\n",
+					where);
+				ret = -EINVAL;
+				goto out;
+			}
+
+			value = var_get(name, len);
+			if (!value) {
+				fprintf(stderr, "%s: error: %.*s is not set\n",
+					where, (int)len, name);
+				ret = -ENOENT;
+				goto out;
+			}
+
+			ret = buf_append(&b, value, strlen(value));
+			if (ret) {
+				goto out;
+			}
+			p = name + len + braces;
+			continue;
+		}
+
+		ret = buf_append(&b, p, 1);
+		if (ret) {
+			goto out;
+		}
+		p++;
+	}
+
+	ret = nr_words;
+ out:
+	if (ret < 0) {
+		while (nr_words > 0) {
+			free(words[--nr_words]);
+		}
+	}
+	free(b.s);
+	return ret;
+}
+
+static const struct ihkbatch_cmd *find_cmd(const struct ihkbatch_cmd *cmds,
+					   const char *name)
+{
+	for (; cmds->name; cmds++) {
+		if (!strcmp(cmds->name, name)) {
+			return cmds;
+		}
+	}
+
+	return NULL;
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+		(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+int ihkbatch_parse_opts(int argc, char **argv, struct ihkbatch_opts *opts)
+{
+	int opt;
+
+	memset(opts, 0, sizeof(*opts));
+
+	if (argc < 3 || argv[2][0] != '-') {
+		return 0;
+	}
+
+	optind = 2;
+	while ((opt = getopt(argc, argv, "+f:kt")) != -1) {
+		switch (opt) {
+		case 'f':
+			opts->script = optarg;
+			break;
+		case 'k':
+			opts->keep_going = 1;
+			break;
+		case 't':
+			opts->timing = 1;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (!opts->script || optind != argc) {
+		return -1;
+	}
+
+	return 1;
+}
+
+int ihkbatch_run(const struct ihkbatch_opts *opts, char *prog, char *index,
+		 const char *index_var, int fd,
+		 const struct ihkbatch_cmd *cmds,
+		 int *argcp, char ***argvp)
+{
+	FILE *fp;
+	const char *script_name;
+	char *line = NULL;
+	size_t line_size = 0;
+	char *words[IHKBATCH_MAX_ARGS];
+	char *argv[IHKBATCH_MAX_ARGS + 3];
+	char where[PATH_MAX + 32];
+	int keep_going = opts->keep_going;
+	int lineno = 0, nr_steps = 0, nr_failed = 0;
+	struct timespec start, step_start;
+	int ret = 0;
+
+	if (!opts->script || !strcmp(opts->script, "-")) {
+		fp = stdin;
+		script_name = "<stdin>";
+	}
+	else {
+		fp = fopen(opts->script, "r");
+		if (!fp) {
+			fprintf(stderr, "error: opening %s: %s\n",
+				opts->script, strerror(errno));
+			return 1;
+		}
+		script_name = opts->script;
+	}
+
+	if (var_set(index_var, strlen(index_var), index)) {
+		ret = 1;
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (getline(&line, &line_size, fp) != -1) {
+		const struct ihkbatch_cmd *cmd;
+		int nr_words, i, r, failed;
+		char *eq;
+
+		lineno++;
+		snprintf(where, sizeof(where), "%s:%d", script_name, lineno);
+
+		nr_words = tokenize(line, words, IHKBATCH_MAX_ARGS, where);
+		if (nr_words < 0) {
+			nr_failed++;
+			if (!keep_going) {
+				break;
+			}
+			continue;
+		}
+		if (nr_words == 0) {
+			continue;
+		}
+
+		failed = 0;
+
+		/* NAME=value */
+		eq = strchr(words[0], '=');
+		if (eq && nr_words == 1 && eq > words[0]) {
+			char *c;
+
+			for (c = words[0]; c < eq; c++) {
+				if (!is_name_char((unsigned char)*c, c == words[0])) {
+					break;
+				}
+			}
+			if (c == eq) {
+				if (var_set(words[0], eq - words[0], eq + 1)) {
+					failed = 1;
+				}
+				goto next;
+			}
+		}
+
+		if (!strcmp(words[0], "echo")) {
+			for (i = 1; i < nr_words; i++) {
+				printf("%s%s", i > 1 ? " " : "", words[i]);
+			}
+			printf("\n");
+			fflush(stdout);
+			goto next;
+		}
+
+		if (!strcmp(words[0], "onerror")) {
+			if (nr_words == 2 && !strcmp(words[1], "stop")) {
+				keep_going = 0;
+			}
+			else if (nr_words == 2 && !strcmp(words[1], "continue")) {
+				keep_going = 1;
+			}
+			else {
+				fprintf(stderr, "%s: error: onerror stop|continue\n",
+					where);
+				failed = 1;
+			}
+			goto next;
+		}
+
+		cmd = find_cmd(cmds, words[0]);
+		if (!cmd) {
+			fprintf(stderr, "%s: error: unknown action: %s\n",
+				where, words[0]);
+			failed = 1;
+			goto next;
+		}
+
+		/* Lay out the arguments as the handlers expect them */
+		argv[0] = prog;
+		argv[1] = index;
+		for (i = 0; i < nr_words; i++) {
+			argv[i + 2] = words[i];
+		}
+		argv[nr_words + 2] = NULL;
+		*argcp = nr_words + 2;
+		*argvp = argv;
+		optind = 0;
+
+		nr_steps++;
+		clock_gettime(CLOCK_MONOTONIC, &step_start);
+		fflush(stdout);
+
+		if (cmd->func) {
+			r = cmd->func(fd);
+		}
+		else {
+			r = cmd->func_with_index(atoi(index));
+		}
+
+		fflush(stdout);
+		if (cmd->result_var) {
+			failed = (r < 0);
+			if (!failed) {
+				char val[16];
+
+				snprintf(val, sizeof(val), "%d", r);
+				var_set(cmd->result_var,
+					strlen(cmd->result_var), val);
+			}
+		}
+		else {
+			failed = (r != 0);
+		}
+
+		if (opts->timing) {
+			fprintf(stderr, "%s: %s: %s (%d), %.3f ms\n",
+				where, words[0], failed ? "failed" : "ok",
+				r, elapsed_ms(&step_start));
+		}
+		else if (failed) {
+			fprintf(stderr, "%s: %s failed (%d)\n",
+				where, words[0], r);
+		}
+ next:
+		for (i = 0; i < nr_words; i++) {
+			free(words[i]);
+		}
+
+		if (failed) {
+			nr_failed++;
+			if (!keep_going) {
+				break;
+			}
+		}
+	}
+
+	if (opts->timing) {
+		fprintf(stderr, "%s: %d step(s), %d failed, %.3f ms\n",
+			script_name, nr_steps, nr_failed, elapsed_ms(&start));
+	}
+
+	ret = nr_failed ? 1 : 0;
+ out:
+	free(line);
+	var_free_all();
+	if (fp != stdin) {
+		fclose(fp);
+	}
+	return ret;
+}
@@ -20,10 +20,14 @@
 #include <dirent.h>
 #include <ihk/ihklib.h>
 #include <ihk/ihklib_private.h>
+#include <ihk/ihkbatch.h>
 
 int __argc;
 char **__argv;
 
+/* Reservation group of do_reserve() and do_release(), set by do_group() */
+static int ihkconfig_group;
+
 //#define DEBUG_PRINT
 
 #ifdef DEBUG_PRINT
@@ -53,6 +57,10 @@ static int usage(char **arg)
 	else
 		cmd = arg[0];
 	fprintf(stderr, "Usage: %s (dev #) (action)\n", cmd);
+	fprintf(stderr, "       %s (dev #) -f (script|-) [-k] [-t]\n", cmd);
+	fprintf(stderr, "        script: actions below, one per line, on this device only;\n");
+	fprintf(stderr, "        assign, load, kargs and boot of the OS made by create\n");
+	fprintf(stderr, "        go into an ihkosctl script of that OS\n");
 	fprintf(stderr, "action:\n");
 	fprintf(stderr, "    create\n");
 	fprintf(stderr, "    destroy\n");
@@ -68,6 +76,11 @@ static int usage(char **arg)
 	fprintf(stderr, "    query cpu|mem\n");
 	fprintf(stderr, "    get os_instances\n");
 	fprintf(stderr, "    get buildid\n");
+	fprintf(stderr, "    create_group (name)\n");
+	fprintf(stderr, "    destroy_group (group)\n");
+	fprintf(stderr, "    query_group (group)\n");
+	fprintf(stderr, "    group (group) reserve|release cpu|mem [resources]\n");
+	fprintf(stderr, "        group: id or name, 0 for the device-wide pool\n");
 	return 0;
 }
 
@@ -194,7 +207,7 @@ static int do_clear_kmsg_write(int fd)
 static int do_create(int fd)
 {
 	int r = ioctl(fd, IHK_DEVICE_CREATE_OS, 0);
-	if (r != 0) {
+	if (r < 0) {
 		fprintf(stderr, "error: creating OS instance\n");
 	}
 	dprintf("ret = %d\n", r);
@@ -237,7 +250,8 @@ static int do_reserve(int index)
 	}
 
 	if (!strcmp(__argv[3], "cpu")) {
-		ret = _ihk_reserve_cpu_str(index, __argv[4], NULL);
+		ret = _ihk_reserve_cpu_str_group(index, ihkconfig_group,
+						 __argv[4], NULL);
 		if (ret) {
 			eprintf("%s: error: reserving CPUs: %s\n",
 				__func__, __argv[4]);
@@ -245,7 +259,8 @@ static int do_reserve(int index)
 		}
 	}
 	else if (!strcmp(__argv[3], "mem")) {
-		ret = _ihk_reserve_mem_str(index, __argv[4], NULL);
+		ret = _ihk_reserve_mem_str_group(index, ihkconfig_group,
+						 __argv[4], NULL);
 		if (ret) {
 			eprintf("%s: error: reserving memory: %s\n",
 				__func__, __argv[4]);
@@ -263,7 +278,7 @@ static int do_reserve(int index)
 
 static int do_release(int fd)
 {
-	int ret, cnt;
+	int ret, cnt, i;
 	struct ihk_cpu_req req_cpu = { 0 };
 	struct ihk_mem_req req_mem = { 0 };
 
@@ -286,7 +301,14 @@ static int do_release(int fd)
 		IHKCONFIG_CHKANDJUMP(ret < 0,
 				"parse provided cpulist string", -1);
 
-		ret = ioctl(fd, IHK_DEVICE_RELEASE_CPU, &req_cpu);
+		if (ihkconfig_group) {
+			struct ihk_cpu_group_req greq = {
+				.req = req_cpu, .group = ihkconfig_group };
+
+			ret = ioctl(fd, IHK_DEVICE_RELEASE_CPU_GROUP, &greq);
+		} else {
+			ret = ioctl(fd, IHK_DEVICE_RELEASE_CPU, &req_cpu);
+		}
 		if (ret != 0) {
 			fprintf(stderr, "error: releasing CPUs: %s\n", __argv[4]);
 		}
@@ -294,6 +316,11 @@ static int do_release(int fd)
 	else if (!strcmp(__argv[3], "mem")) {
 		if (!strcmp(__argv[4], "all")) {
 			/* Special case for releasing all memory */
+			if (ihkconfig_group) {
+				fprintf(stderr, "error: use destroy_group to release all memory of a group\n");
+				ret = -EINVAL;
+				goto fn_fail;
+			}
 
 			/* to get num of mem_chunks */
 			ret = ioctl(fd, IHK_DEVICE_QUERY_MEM, &req_mem);
@@ -314,6 +341,13 @@ static int do_release(int fd)
 			if (ret != 0) {
 				fprintf(stderr, "error: querying memory\n");
 			}
+
+			/* Let the driver release, per NUMA node of the
+			 * chunks, what isn't held for the groups
+			 */
+			for (i = 0; i < cnt; i++) {
+				req_mem.sizes[i] = (size_t)-1;
+			}
 		}
 		else {
 			/* Parse memory list */
@@ -334,7 +368,14 @@ static int do_release(int fd)
 					"parse provided memlist string", -1);
 		}
 
-		ret = ioctl(fd, IHK_DEVICE_RELEASE_MEM, &req_mem);
+		if (ihkconfig_group) {
+			struct ihk_mem_group_req greq = {
+				.req = req_mem, .group = ihkconfig_group };
+
+			ret = ioctl(fd, IHK_DEVICE_RELEASE_MEM_GROUP, &greq);
+		} else {
+			ret = ioctl(fd, IHK_DEVICE_RELEASE_MEM, &req_mem);
+		}
 		if (ret != 0) {
 			fprintf(stderr, "error: releasing memory: %s\n", __argv[4]);
 		}
@@ -530,6 +571,185 @@ static int do_get(int index)
 	}
 }
 
+/* Group id, or the id of the group with that name */
+static int group_str2id(int index, const char *str)
+{
+	struct ihk_group_info info = { 0 };
+	char *endp;
+	int id, ret;
+
+	id = strtol(str, &endp, 0);
+	if (*str != '\0' && *endp == '\0') {
+		return id;
+	}
+
+	info.id = IHK_GROUP_BY_NAME;
+	strncpy(info.name, str, IHK_GROUP_NAME_MAX - 1);
+
+	ret = ihk_query_group(index, &info);
+	if (ret) {
+		fprintf(stderr, "error: group %s: %s\n", str, strerror(-ret));
+		return ret;
+	}
+
+	return info.id;
+}
+
+static int do_create_group(int index)
+{
+	int ret;
+
+	if (__argc < 4) {
+		usage(__argv);
+		return -1;
+	}
+
+	ret = ihk_create_group(index, __argv[3]);
+	if (ret < 0) {
+		fprintf(stderr, "error: creating group %s: %s\n",
+			__argv[3], strerror(-ret));
+		return ret;
+	}
+
+	printf("%d\n", ret);
+	return ret;
+}
+
+static int do_destroy_group(int index)
+{
+	int ret;
+	int id;
+
+	if (__argc < 4) {
+		usage(__argv);
+		return -1;
+	}
+
+	id = group_str2id(index, __argv[3]);
+	if (id < 0) {
+		return id;
+	}
+
+	ret = ihk_destroy_group(index, id);
+	if (ret) {
+		fprintf(stderr, "error: destroying group %s: %s\n",
+			__argv[3], strerror(-ret));
+	}
+
+	return ret;
+}
+
+static int do_query_group(int index)
+{
+	int ret;
+	struct ihk_group_info info = { 0 };
+	struct ihk_cpu_req req_cpu = { 0 };
+	char *cpus = NULL;
+
+	if (__argc < 4) {
+		usage(__argv);
+		return -1;
+	}
+
+	info.id = group_str2id(index, __argv[3]);
+	if (info.id < 0) {
+		return info.id;
+	}
+
+	/* Get the number of CPUs first */
+	ret = ihk_query_group(index, &info);
+	IHKCONFIG_CHKANDJUMP(ret != 0, "ihk_query_group", ret);
+
+	if (info.num_cpus > 0) {
+		info.cpus = calloc(sizeof(int), info.num_cpus);
+		IHKCONFIG_CHKANDJUMP(!info.cpus,
+				"allocate request space", -ENOMEM);
+
+		ret = ihk_query_group(index, &info);
+		IHKCONFIG_CHKANDJUMP(ret != 0, "ihk_query_group", ret);
+	}
+
+	req_cpu.cpus = info.cpus;
+	req_cpu.num_cpus = info.num_cpus;
+	cpus = cpu_req2str(&req_cpu);
+	IHKCONFIG_CHKANDJUMP(!cpus, "build result string", -ENOMEM);
+
+	printf("id: %d\n", info.id);
+	printf("name: %s\n", info.name);
+	printf("cpus: %s\n", cpus);
+	printf("cpus assigned: %d\n", info.num_cpus_assigned);
+	printf("mem reserved: %lu\n", info.mem_reserved);
+	printf("mem assigned: %lu\n", info.mem_assigned);
+	printf("os instances: %d\n", info.num_os);
+
+ fn_exit:
+	free(info.cpus);
+	free(cpus);
+	return ret;
+ fn_fail:
+	goto fn_exit;
+}
+
+/* "group (group) reserve|release cpu|mem (resources)" */
+static int do_group(int index)
+{
+	int ret;
+	int fd;
+	int id;
+	char fn[128];
+	char *argv[6];
+	char **saved_argv = __argv;
+	int saved_argc = __argc;
+
+	if (__argc < 7) {
+		usage(__argv);
+		return -1;
+	}
+
+	id = group_str2id(index, __argv[3]);
+	if (id < 0) {
+		return id;
+	}
+
+	ihkconfig_group = id;
+
+	/* Lay out the arguments as for "reserve" and "release" */
+	argv[0] = __argv[0];
+	argv[1] = __argv[1];
+	argv[2] = __argv[4];
+	argv[3] = __argv[5];
+	argv[4] = __argv[6];
+	argv[5] = NULL;
+	__argv = argv;
+	__argc = 5;
+
+	if (!strcmp(argv[2], "reserve")) {
+		ret = do_reserve(index);
+	}
+	else if (!strcmp(argv[2], "release")) {
+		sprintf(fn, "/dev/mcd%d", index);
+
+		fd = open(fn, O_RDWR);
+		if (fd < 0) {
+			perror("open");
+			ret = -errno;
+		}
+		else {
+			ret = do_release(fd);
+			close(fd);
+		}
+	}
+	else {
+		usage(saved_argv);
+		ret = -EINVAL;
+	}
+
+	__argv = saved_argv;
+	__argc = saved_argc;
+	ihkconfig_group = 0;
+	return ret;
+}
+
 #ifdef ENABLE_KRM_WORKAROUND
 static int do_reserve_mem_max_ratio(int fd)
 {
@@ -551,12 +771,59 @@ static int do_reserve_mem_max_ratio(int fd)
 }
 #endif
 
+static const struct ihkbatch_cmd batch_cmds[] = {
+	{ .name = "get", .func_with_index = do_get },
+	{ .name = "reserve", .func_with_index = do_reserve },
+	/* The index of the new OS instance is available as $OS */
+	{ .name = "create", .func = do_create, .result_var = "OS" },
+	{ .name = "destroy", .func = do_destroy },
+	{ .name = "scratch", .func = do_scratch },
+	{ .name = "sbox", .func = do_sbox },
+	{ .name = "read", .func = do_read },
+	{ .name = "mmap", .func = do_mmap },
+	{ .name = "ioctl", .func = do_ioctl },
+	{ .name = "clear_kmsg", .func = do_clear_kmsg },
+	{ .name = "clear_kmsg_write", .func = do_clear_kmsg_write },
+#ifdef ENABLE_KRM_WORKAROUND
+	{ .name = "reserve_mem_max_ratio", .func = do_reserve_mem_max_ratio },
+#endif
+	{ .name = "release", .func = do_release },
+	{ .name = "query", .func = do_query },
+	/* The id of the new group is available as $GROUP */
+	{ .name = "create_group", .func_with_index = do_create_group,
+	  .result_var = "GROUP" },
+	{ .name = "destroy_group", .func_with_index = do_destroy_group },
+	{ .name = "query_group", .func_with_index = do_query_group },
+	{ .name = "group", .func_with_index = do_group },
+	{ NULL }
+};
+
+static int do_batch(struct ihkbatch_opts *opts)
+{
+	int fd, r;
+	char fn[128];
+
+	sprintf(fn, "/dev/mcd%d", atoi(__argv[1]));
+
+	fd = open(fn, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+
+	r = ihkbatch_run(opts, __argv[0], __argv[1], "DEV", fd, batch_cmds,
+			 &__argc, &__argv);
+	close(fd);
+	return r;
+}
+
 #define HANDLER_WITH_INDEX(name) if (!strcmp(argv[2], #name)) { int r = do_##name(atoi(argv[1])); return r; }
 #define HANDLER(name) if (!strcmp(argv[2], #name)) { int r = do_##name(fd); close(fd); return r; }
 int main(int argc, char **argv)
 {
 	int fd;
 	char fn[128];
+	struct ihkbatch_opts batch_opts;
 
 	__argc = argc;
 	__argv = argv;
@@ -566,8 +833,20 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	switch (ihkbatch_parse_opts(argc, argv, &batch_opts)) {
+	case 1:
+		return do_batch(&batch_opts);
+	case -1:
+		usage(argv);
+		return 1;
+	}
+
 	HANDLER_WITH_INDEX(get)
 	else HANDLER_WITH_INDEX(reserve)
+	else HANDLER_WITH_INDEX(create_group)
+	else HANDLER_WITH_INDEX(destroy_group)
+	else HANDLER_WITH_INDEX(query_group)
+	else HANDLER_WITH_INDEX(group)
 
 	sprintf(fn, "/dev/mcd%d", atoi(argv[1]));
 
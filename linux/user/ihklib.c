@@ -99,6 +99,7 @@ struct ihklib_reserve_mem_conf reserve_mem_conf = {
 	.max_size_ratio_all = 98,
 #endif
 	.timeout = 30,
+	.offline_blocks = 0,
 };
 
 static const struct ihklib_reserve_mem_conf reserve_mem_conf_default = {
@@ -112,6 +113,7 @@ static const struct ihklib_reserve_mem_conf reserve_mem_conf_default = {
 	.max_size_ratio_all = 98,
 #endif
 	.timeout = 30,
+	.offline_blocks = 0,
 };
 
 static int snprintf_realloc(char **str, size_t *size,
@@ -886,7 +888,39 @@ int ihklib_device_open(int index)
 	return ret;
 }
 
+/* Group 0 goes through the plain request so that it works with drivers
+ * without reservation groups
+ */
+static int ihklib_cpu_req_ioctl(int fd, unsigned long request,
+				unsigned long group_request,
+				struct ihk_cpu_req *req, int group)
+{
+	struct ihk_cpu_group_req greq = { .req = *req, .group = group };
+
+	if (!group) {
+		return ioctl(fd, request, req);
+	}
+	return ioctl(fd, group_request, &greq);
+}
+
+static int ihklib_mem_req_ioctl(int fd, unsigned long request,
+				unsigned long group_request,
+				struct ihk_mem_req *req, int group)
+{
+	struct ihk_mem_group_req greq = { .req = *req, .group = group };
+
+	if (!group) {
+		return ioctl(fd, request, req);
+	}
+	return ioctl(fd, group_request, &greq);
+}
+
 int ihk_reserve_cpu(int index, int* cpus, int num_cpus)
+{
+	return ihk_reserve_cpu_group(index, 0, cpus, num_cpus);
+}
+
+int ihk_reserve_cpu_group(int index, int group, int *cpus, int num_cpus)
 {
 	int ret;
 	struct ihk_cpu_req req = { 0 };
@@ -1004,7 +1038,8 @@ int ihk_reserve_cpu(int index, int* cpus, int num_cpus)
 		goto out;
 	}
 
-	ret = ioctl(fd, IHK_DEVICE_RESERVE_CPU, &req);
+	ret = ihklib_cpu_req_ioctl(fd, IHK_DEVICE_RESERVE_CPU,
+				   IHK_DEVICE_RESERVE_CPU_GROUP, &req, group);
 	if (ret) {
 		ret = -errno;
 		dprintf("%s: IHK_DEVICE_RESERVE_CPU returned %d\n",
@@ -1115,6 +1150,11 @@ int ihk_query_cpu(int index, int *cpus, int num_cpus)
 }
 
 int ihk_release_cpu(int index, int* cpus, int num_cpus)
+{
+	return ihk_release_cpu_group(index, 0, cpus, num_cpus);
+}
+
+int ihk_release_cpu_group(int index, int group, int *cpus, int num_cpus)
 {
 	int ret;
 	struct ihk_cpu_req req = { 0 };
@@ -1154,7 +1194,8 @@ int ihk_release_cpu(int index, int* cpus, int num_cpus)
 		goto out;
 	}
 
-	ret = ioctl(fd, IHK_DEVICE_RELEASE_CPU, &req);
+	ret = ihklib_cpu_req_ioctl(fd, IHK_DEVICE_RELEASE_CPU,
+				   IHK_DEVICE_RELEASE_CPU_GROUP, &req, group);
 	if (ret) {
 		ret = -errno;
 		dprintf("%s: IHK_DEVICE_RELEASE_CPU returned %d\n",
@@ -1182,6 +1223,119 @@ void dump_reserve_mem_conf(void)
 	       __func__, reserve_mem_conf.max_size_ratio_all);
 	printk("%s: IHK_RESERVE_MEM_TIMEOUT=%d\n",
 	       __func__, reserve_mem_conf.timeout);
+	printk("%s: IHK_RESERVE_MEM_OFFLINE_BLOCKS=%d\n",
+	       __func__, reserve_mem_conf.offline_blocks);
+}
+
+int ihk_create_group(int index, const char *name)
+{
+	int ret;
+	struct ihk_group_info info = { 0 };
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	if (name == NULL) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (name[0] == '\0' || strlen(name) >= IHK_GROUP_NAME_MAX) {
+		dprintf("%s: invalid name: %s\n", __func__, name);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	strncpy(info.name, name, IHK_GROUP_NAME_MAX - 1);
+
+	if ((fd = ihklib_device_open(index)) < 0) {
+		dprintf("%s: error: ihklib_device_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_DEVICE_CREATE_GROUP, &info);
+	if (ret < 0) {
+		ret = -errno;
+		dprintf("%s: IHK_DEVICE_CREATE_GROUP returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_destroy_group(int index, int group)
+{
+	int ret;
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	if ((fd = ihklib_device_open(index)) < 0) {
+		dprintf("%s: error: ihklib_device_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_DEVICE_DESTROY_GROUP, group);
+	if (ret) {
+		ret = -errno;
+		dprintf("%s: IHK_DEVICE_DESTROY_GROUP returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_query_group(int index, struct ihk_group_info *info)
+{
+	int ret;
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	ret = ihklib_device_readable(index);
+	if (ret) {
+		goto out;
+	}
+
+	if (info == NULL || (info->num_cpus > 0 && info->cpus == NULL)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if ((fd = ihklib_device_open(index)) < 0) {
+		dprintf("%s: error: ihklib_device_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_DEVICE_QUERY_GROUP, info);
+	if (ret) {
+		ret = -errno;
+		dprintf("%s: IHK_DEVICE_QUERY_GROUP returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
 }
 
 int ihk_reserve_mem_conf(int index, int key, void *value)
@@ -1236,6 +1390,11 @@ int ihk_reserve_mem_conf(int index, int key, void *value)
 		dprintk("%s: IHK_RESERVE_MEM_TIMEOUT=%d\n",
 			__func__, reserve_mem_conf.timeout);
 		break;
+	case IHK_RESERVE_MEM_OFFLINE_BLOCKS:
+		reserve_mem_conf.offline_blocks = *((int *)value);
+		dprintk("%s: IHK_RESERVE_MEM_OFFLINE_BLOCKS=%d\n",
+			__func__, reserve_mem_conf.offline_blocks);
+		break;
 	default:
 		ret = -EINVAL;
 		goto out;
@@ -1248,6 +1407,13 @@ int ihk_reserve_mem_conf(int index, int key, void *value)
 
 int ihk_reserve_mem(int index, struct ihk_mem_chunk *mem_chunks,
 		    int num_mem_chunks)
+{
+	return ihk_reserve_mem_group(index, 0, mem_chunks, num_mem_chunks);
+}
+
+int ihk_reserve_mem_group(int index, int group,
+			  struct ihk_mem_chunk *mem_chunks,
+			  int num_mem_chunks)
 {
 	int ret;
 	int i;
@@ -1364,6 +1530,7 @@ int ihk_reserve_mem(int index, struct ihk_mem_chunk *mem_chunks,
 	req.min_chunk_size = reserve_mem_conf.min_chunk_size;
 	req.max_size_ratio_all = reserve_mem_conf.max_size_ratio_all;
 	req.timeout = reserve_mem_conf.timeout;
+	req.offline_blocks = reserve_mem_conf.offline_blocks;
 
 	fd = ihklib_device_open(index);
 	if (fd < 0) {
@@ -1373,7 +1540,8 @@ int ihk_reserve_mem(int index, struct ihk_mem_chunk *mem_chunks,
 		goto out;
 	}
 
-	ret = ioctl(fd, IHK_DEVICE_RESERVE_MEM, &req);
+	ret = ihklib_mem_req_ioctl(fd, IHK_DEVICE_RESERVE_MEM,
+				   IHK_DEVICE_RESERVE_MEM_GROUP, &req, group);
 	if (ret != 0) {
 		ret = -errno;
 		dprintf("%s: IHK_DEVICE_RESERVE_MEM returned %d\n",
@@ -1626,7 +1794,10 @@ int ihk_reserve_mem(int index, struct ihk_mem_chunk *mem_chunks,
 			goto out;
 		}
 
-		ret = ioctl(fd, IHK_DEVICE_RELEASE_MEM_PARTIALLY, &req);
+		ret = ihklib_mem_req_ioctl(fd,
+					   IHK_DEVICE_RELEASE_MEM_PARTIALLY,
+					   IHK_DEVICE_RELEASE_MEM_PARTIALLY_GROUP,
+					   &req, group);
 		if (ret != 0) {
 			ret = -errno;
 			dprintf("%s: IHK_DEVICE_RELEASE_MEM_PARTIALLY returned %d\n",
@@ -1648,7 +1819,8 @@ out:
 #ifdef WITH_KRM
 	free(nodeids);
 #endif
-	if (release) {
+	/* A group keeps what it got, it's released by destroying it */
+	if (release && !group) {
 		struct ihk_mem_chunk mem_chunks[1] = {
 			{ .size = -1UL, .numa_node_number = 0 }
 		};
@@ -1798,6 +1970,13 @@ int ihk_query_mem(int index, struct ihk_mem_chunk* mem_chunks, int _num_mem_chun
 }
 
 int ihk_release_mem(int index, struct ihk_mem_chunk* mem_chunks, int num_mem_chunks)
+{
+	return ihk_release_mem_group(index, 0, mem_chunks, num_mem_chunks);
+}
+
+int ihk_release_mem_group(int index, int group,
+			  struct ihk_mem_chunk *mem_chunks,
+			  int num_mem_chunks)
 {
 	int ret, i;
 	struct ihk_mem_req req = { 0 };
@@ -1834,7 +2013,16 @@ int ihk_release_mem(int index, struct ihk_mem_chunk* mem_chunks, int num_mem_chu
 	}
 
 	if (mem_chunks[0].size == IHK_SMP_MEM_ALL) {
-		/* Special case for releasing all memory */
+		/* Special case for releasing all memory, of the device-wide
+		 * pool only since a group is released by destroying it.
+		 * The NUMA nodes are taken from the reserved chunks and the
+		 * driver releases what isn't held for the groups.
+		 */
+		if (group) {
+			ret = -EINVAL;
+			goto out;
+		}
+
 		num_mem_chunks = ihk_get_num_reserved_mem_chunks(index);
 
 		query_mem_chunks = calloc(num_mem_chunks,
@@ -1873,7 +2061,8 @@ int ihk_release_mem(int index, struct ihk_mem_chunk* mem_chunks, int num_mem_chu
 	}
 
 	for (i = 0; i < num_mem_chunks; i++) {
-		req.sizes[i] = (size_t)mem_chunks[i].size;
+		req.sizes[i] = query_mem_chunks ? (size_t)IHK_SMP_MEM_ALL :
+			(size_t)mem_chunks[i].size;
 		req.numa_ids[i] = mem_chunks[i].numa_node_number;
 	}
 	req.num_chunks = num_mem_chunks;
@@ -1885,7 +2074,8 @@ int ihk_release_mem(int index, struct ihk_mem_chunk* mem_chunks, int num_mem_chu
 		goto out;
 	}
 
-	ret = ioctl(fd, IHK_DEVICE_RELEASE_MEM, &req);
+	ret = ihklib_mem_req_ioctl(fd, IHK_DEVICE_RELEASE_MEM,
+				   IHK_DEVICE_RELEASE_MEM_GROUP, &req, group);
 	if (ret) {
 		ret = -errno;
 		dprintf("%s: error: IHK_OS_RELEASE_MEM returned %d\n",
@@ -1903,6 +2093,48 @@ int ihk_release_mem(int index, struct ihk_mem_chunk* mem_chunks, int num_mem_chu
 	return ret;
 }
 
+long ihk_access_mem(int index, int os_index, struct ihk_mem_seg *segs,
+		    int nr_segs, int write)
+{
+	long ret;
+	struct ihk_device_access_mem_desc desc = {
+		.os_index = os_index,
+		.segs = segs,
+		.nr_segs = nr_segs,
+		.write = write,
+	};
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	if (segs == NULL || nr_segs <= 0 ||
+	    nr_segs > IHK_DEVICE_ACCESS_MEM_MAX_SEGS) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if ((fd = ihklib_device_open(index)) < 0) {
+		dprintf("%s: error: ihklib_device_open returned %d\n",
+			__func__, fd);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_DEVICE_ACCESS_MEM, &desc);
+	if (ret < 0) {
+		ret = -errno;
+		dprintf("%s: IHK_DEVICE_ACCESS_MEM returned %ld\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
 /* Create OS and return OS index */
 int ihk_create_os(int index)
 {
@@ -2475,6 +2707,315 @@ int ihk_os_get_ikc_map(int index, struct ihk_ikc_cpu_map *map, int num_cpus)
 	return ret;
 }
 
+int ihk_os_set_ikc_master_cpu(int index, int cpu)
+{
+	int ret;
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	if (cpu < 0 && cpu != IHK_IKC_MASTER_CPU_AUTO) {
+		dprintf("%s: error: invalid cpu (%d)\n", __func__, cpu);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if ((fd = ihklib_os_open(index)) < 0) {
+		dprintf("%s: error: ihklib_os_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_OS_SET_IKC_MASTER_CPU, cpu);
+	if (ret) {
+		ret = -errno;
+		dprintf("%s: IHK_OS_SET_IKC_MASTER_CPU returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_os_get_ikc_master_cpu(int index, int *cpu)
+{
+	int ret;
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	ret = ihklib_os_readable(index);
+	if (ret) {
+		goto out;
+	}
+
+	if (cpu == NULL) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if ((fd = ihklib_os_open(index)) < 0) {
+		dprintf("%s: error: ihklib_os_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_OS_GET_IKC_MASTER_CPU, cpu);
+	if (ret) {
+		ret = -errno;
+		dprintf("%s: IHK_OS_GET_IKC_MASTER_CPU returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_os_set_pwr(int index, int *cpus, int num_cpus,
+		   struct ihk_pwr_setting *setting)
+{
+	int ret;
+	struct ihk_pwr_req req = { 0 };
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	if (cpus == NULL || setting == NULL) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (num_cpus <= 0) {
+		dprintf("%s: error: invalid num_cpus (%d)\n",
+			__func__, num_cpus);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if ((fd = ihklib_os_open(index)) < 0) {
+		dprintf("%s: error: ihklib_os_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	req.cpus = cpus;
+	req.num_cpus = num_cpus;
+	req.setting = *setting;
+
+	ret = ioctl(fd, IHK_OS_SET_PWR, &req);
+	if (ret) {
+		ret = -errno;
+		dprintf("%s: IHK_OS_SET_PWR returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_os_get_pwr(int index, struct ihk_pwr_stat *stats, int num_cpus)
+{
+	int ret;
+	struct ihk_pwr_stat_req req = { 0 };
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	ret = ihklib_os_readable(index);
+	if (ret) {
+		goto out;
+	}
+
+	if (stats == NULL) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (num_cpus <= 0) {
+		dprintf("%s: error: invalid num_cpus (%d)\n",
+			__func__, num_cpus);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if ((fd = ihklib_os_open(index)) < 0) {
+		dprintf("%s: error: ihklib_os_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	req.stats = stats;
+	req.num_cpus = num_cpus;
+
+	ret = ioctl(fd, IHK_OS_GET_PWR, &req);
+	if (ret) {
+		ret = -errno;
+		dprintf("%s: IHK_OS_GET_PWR returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_os_set_debug_mask(int index, unsigned int mask)
+{
+	int ret;
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	if (mask & ~IHK_DEBUG_ALL) {
+		dprintf("%s: error: invalid mask (0x%x)\n", __func__, mask);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if ((fd = ihklib_os_open(index)) < 0) {
+		dprintf("%s: error: ihklib_os_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_OS_SET_DEBUG_MASK, mask);
+	if (ret) {
+		ret = -errno;
+		dprintf("%s: IHK_OS_SET_DEBUG_MASK returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_os_get_debug_mask(int index)
+{
+	int ret;
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	ret = ihklib_os_readable(index);
+	if (ret) {
+		goto out;
+	}
+
+	if ((fd = ihklib_os_open(index)) < 0) {
+		dprintf("%s: error: ihklib_os_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_OS_GET_DEBUG_MASK);
+	if (ret < 0) {
+		ret = -errno;
+		dprintf("%s: IHK_OS_GET_DEBUG_MASK returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_os_set_group(int index, int group)
+{
+	int ret;
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	if (group < 0 || group >= IHK_MAX_GROUPS) {
+		dprintf("%s: invalid group: %d\n", __func__, group);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if ((fd = ihklib_os_open(index)) < 0) {
+		dprintf("%s: error: ihklib_os_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_OS_SET_GROUP, group);
+	if (ret) {
+		ret = -errno;
+		dprintf("%s: IHK_OS_SET_GROUP returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
+int ihk_os_get_group(int index)
+{
+	int ret;
+	int fd = -1;
+
+	dprintk("%s: enter\n", __func__);
+
+	ret = ihklib_os_readable(index);
+	if (ret) {
+		goto out;
+	}
+
+	if ((fd = ihklib_os_open(index)) < 0) {
+		dprintf("%s: error: ihklib_os_open\n",
+			__func__);
+		ret = fd;
+		goto out;
+	}
+
+	ret = ioctl(fd, IHK_OS_GET_GROUP);
+	if (ret < 0) {
+		ret = -errno;
+		dprintf("%s: IHK_OS_GET_GROUP returned %d\n",
+			__func__, -ret);
+		goto out;
+	}
+
+ out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+}
+
 int ihk_os_assign_mem(int index, struct ihk_mem_chunk *mem_chunks, int num_mem_chunks)
 {
 	int ret, i;
@@ -4235,6 +4776,12 @@ int ihk_set_loglevel(enum IHKLIB_LOGLEVEL level)
 }
 
 int _ihk_reserve_cpu_str(int dev_index, char *list, char *err_msg)
+{
+	return _ihk_reserve_cpu_str_group(dev_index, 0, list, err_msg);
+}
+
+int _ihk_reserve_cpu_str_group(int dev_index, int group, char *list,
+			       char *err_msg)
 {
 	int ret;
 	int num_cpus;
@@ -4258,7 +4805,7 @@ int _ihk_reserve_cpu_str(int dev_index, char *list, char *err_msg)
 		goto out;
 	}
 
-	ret = ihk_reserve_cpu(dev_index, cpus, num_cpus);
+	ret = ihk_reserve_cpu_group(dev_index, group, cpus, num_cpus);
 	if (ret) {
 		if (err_msg) {
 			sprintf(err_msg,
@@ -4273,6 +4820,12 @@ int _ihk_reserve_cpu_str(int dev_index, char *list, char *err_msg)
 }
 
 int _ihk_reserve_mem_str(int dev_index, char *list, char *err_msg)
+{
+	return _ihk_reserve_mem_str_group(dev_index, 0, list, err_msg);
+}
+
+int _ihk_reserve_mem_str_group(int dev_index, int group, char *list,
+			       char *err_msg)
 {
 	int ret;
 	int num_mems;
@@ -4304,7 +4857,7 @@ int _ihk_reserve_mem_str(int dev_index, char *list, char *err_msg)
 			mems[i].numa_node_number);
 	}
 
-	ret = ihk_reserve_mem(dev_index, mems, num_mems);
+	ret = ihk_reserve_mem_group(dev_index, group, mems, num_mems);
 	if (ret) {
 		if (err_msg) {
 			sprintf(err_msg,
@@ -4783,6 +5336,7 @@ int ihk_reserve_mem_conf_str(int dev_index, const char *envp, int num_env)
 		RESERVE_MEM_CONF_PARSE(IHK_RESERVE_MEM_MIN_CHUNK_SIZE);
 		RESERVE_MEM_CONF_PARSE(IHK_RESERVE_MEM_MAX_SIZE_RATIO_ALL);
 		RESERVE_MEM_CONF_PARSE(IHK_RESERVE_MEM_TIMEOUT);
+		RESERVE_MEM_CONF_PARSE(IHK_RESERVE_MEM_OFFLINE_BLOCKS);
 	}
 
 	ret = 0;
@@ -5080,6 +5634,7 @@ int ihk_create_os_str(int dev_index, int *_os_index,
 		else RESERVE_MEM_CONF_PARSE(IHK_RESERVE_MEM_MIN_CHUNK_SIZE)
 		else RESERVE_MEM_CONF_PARSE(IHK_RESERVE_MEM_MAX_SIZE_RATIO_ALL)
 		else RESERVE_MEM_CONF_PARSE(IHK_RESERVE_MEM_TIMEOUT)
+		else RESERVE_MEM_CONF_PARSE(IHK_RESERVE_MEM_OFFLINE_BLOCKS)
 	}
 
 	/* those are mandaroty settings. os_assign_{cpu,me}_all will complain
@@ -7,20 +7,33 @@
  * 	Copyright (C) 2017  Masamichi Takagi
  **/
 
-/**  
+/**
  *  Kill (and restart) ihkmond when destroying /dev/mcosX without notifying mcudevd by eventfd
  *  to clean-up fd and eventfd
  **/
 
+/**
+ *  All OS instances are served by a single epoll loop which waits for
+ *  udev events, the kmsg and status eventfds of each instance and one
+ *  timerfd per instance, used for waiting for /dev/mcosX to appear and
+ *  for the hungup detection interval afterwards.
+ *
+ *  Log lines are delivered to journald (native protocol) or to syslogd
+ *  (/dev/log) in batches with sendmmsg(). When the receiver can't keep
+ *  up, delivery is suspended until the socket becomes writable again,
+ *  instead of being paced by sleeping after each line.
+ **/
+
+#define _GNU_SOURCE /* sendmmsg() */
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
-#include <pthread.h>
 #include <syslog.h>
 #include <libudev.h>
 #include <sys/epoll.h>
@@ -28,6 +41,10 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <config.h>
 #include <ihk/ihklib.h>
 #include <ihk/ihklib_private.h>
@@ -60,20 +77,92 @@
 #define IHKMOND_NUM_FILEBUF_SLOTS 64
 #define IHKMOND_TMP "/tmp/ihkmond"
 
-struct thr_args {
-	pthread_t thread;
-	pthread_mutex_t lock;
-	int mcos_added;
-	pthread_cond_t cond_mcos_added; /* Cond for add event */
-	int ret; /* Return value */
+/* Same as OS_MAX_MINOR of IHK-core */
+#define IHKMOND_MAX_NUM_OS_INSTANCES 64
+#define IHKMOND_MAX_EVENTS 64
+
+/* Polling for /dev/mcosX after the udev add event */
+#define IHKMOND_ADD_RETRY_MS 10
+#define IHKMOND_ADD_TIMEOUT_MS (10 * 1000)
+
+/* Maximum number of log lines passed to one sendmmsg() */
+#define IHKMOND_LOG_BATCH 256
+/* Bound of the lines waiting for a full receiver, the oldest are
+ * dropped beyond it. Same as what the spool files hold.
+ */
+#define IHKMOND_MAX_PENDING \
+	(IHKMOND_NUM_FILEBUF_SLOTS * IHKMOND_SIZE_FILEBUF_SLOT)
+#define IHKMOND_LOG_HDR_SIZE 256
+#define IHKMOND_JOURNAL_SOCKET "/run/systemd/journal/socket"
+#define IHKMOND_SYSLOG_SOCKET "/dev/log"
+
+enum ihkmond_fd_type {
+	IHKMOND_FD_UDEV,
+	IHKMOND_FD_SINK,
+	IHKMOND_FD_KMSG,
+	IHKMOND_FD_STATUS,
+	IHKMOND_FD_TIMER,
+};
 
-	int dev_index; /* device index */
-	int os_index; /* OS index */
-	int facility; /* facility field for syslog */
-	char* logid; /* id field for syslog */
-	int interval; /* Polling interval */
+struct mcos;
 
-	int evfd_mcos_removed; /* Remove event */
+/* epoll_event.data.ptr points to this */
+struct ihkmond_fd {
+	int fd;
+	enum ihkmond_fd_type type;
+	struct mcos *mcos;
+};
+
+enum mcos_state {
+	MCOS_NONE,	/* No /dev/mcosX */
+	MCOS_ADDING,	/* Add event received, waiting for /dev/mcosX */
+	MCOS_ACTIVE,	/* Monitored */
+};
+
+struct mcos {
+	int os_index;
+	enum mcos_state state;
+	int add_wait_ms;
+
+	void *kmsg_handle; /* Referenced kmsg_buf, NULL if none */
+	struct ihkmond_fd evfd_kmsg;
+	struct ihkmond_fd evfd_status;
+	struct ihkmond_fd timer;
+
+	/* kmsg spooled to IHKMOND_TMP until panic, hungup or destroy */
+	FILE *fps[IHKMOND_NUM_FILEBUF_SLOTS];
+	int sizes[IHKMOND_NUM_FILEBUF_SLOTS];
+	int prod; /* Producer pointer */
+
+	/* Log lines waiting for delivery */
+	char *out_buf;
+	size_t out_len;
+	size_t out_off;
+	unsigned long out_dropped; /* Lines dropped while the receiver was full */
+
+	char hdr[IHKMOND_LOG_HDR_SIZE];
+	int hdr_len;
+};
+
+struct ihkmond {
+	int epfd;
+	int dev_index;
+	int enable_kmsg;
+	int mon_interval;
+	int facility;
+	const char *logid;
+
+	struct udev *udev;
+	struct udev_monitor *mon_mcos;
+	struct ihkmond_fd udev_fd;
+
+	/* Log receiver, fd is -1 when syslog() is used instead */
+	struct ihkmond_fd sink;
+	int sink_journal;
+	int sink_blocked;
+
+	char *kmsg_buf;
+	struct mcos *mcos[IHKMOND_MAX_NUM_OS_INSTANCES];
 };
 
 struct facility_list {
@@ -107,62 +196,55 @@ static ssize_t reap_event(int evfd) {
 	return ret;
 }
 
-static void* detect_hungup(void* _arg) {
-	struct thr_args *arg = (struct thr_args *)_arg;
-	int devfd = -1, epfd = -1;
+static int epoll_add(struct ihkmond *md, struct ihkmond_fd *f,
+		     uint32_t events)
+{
 	struct epoll_event event;
-	struct epoll_event events[1];
-	int ret = 0, ret_lib;
-	int i;
-	char fn[32];
-	struct stat st;
 
-	epfd = epoll_create(1);
-	CHKANDJUMP(epfd == -1, 255, "epoll_create failed\n");
-	
-	memset(&event, 0, sizeof(struct epoll_event));
-	event.events = EPOLLIN;
-	event.data.fd = arg->evfd_mcos_removed;
-	ret_lib = epoll_ctl(epfd, EPOLL_CTL_ADD, arg->evfd_mcos_removed, &event);
-	CHKANDJUMP(ret_lib != 0, -EINVAL, "epoll_ctl failed\n");
-
- wait_for_add:
-	dprintf("wait_for_add,os_index=%d\n", arg->os_index);
-
-	ret_lib = pthread_mutex_lock(&arg->lock);
-	CHKANDJUMP(ret_lib != 0, 255, "pthread_mutex_lock failed\n");
-	while (arg->mcos_added == 0) {
-		ret_lib = pthread_cond_wait(&arg->cond_mcos_added, &arg->lock);
-	}
-	arg->mcos_added = 0;
-	pthread_mutex_unlock(&arg->lock);
-
-	i = 0;
-	snprintf(fn, sizeof(fn), "/dev/mcos%d", arg->os_index);
-	while (stat(fn, &st) == -1) {
-		CHKANDJUMP(errno != ENOENT, -errno,
-			"/dev/mcosX access failed\n");
-		usleep(200);
-		i++;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = f;
+	return epoll_ctl(md->epfd, EPOLL_CTL_ADD, f->fd, &event);
+}
 
-		/* about 10s timeout check */
-		CHKANDJUMP(50 * 1000 < i, -ETIMEDOUT,
-			"/dev/mcosX create timeout\n");
+static void epoll_del_and_close(struct ihkmond *md, struct ihkmond_fd *f)
+{
+	if (f->fd < 0) {
+		return;
 	}
+	epoll_ctl(md->epfd, EPOLL_CTL_DEL, f->fd, NULL);
+	close(f->fd);
+	f->fd = -1;
+}
 
- next:
-	dprintf("next\n");
+/* Arm (ms > 0) or disarm (ms == 0) the timer */
+static int timer_arm(int fd, long ms, int periodic)
+{
+	struct itimerspec its;
 
-	devfd = ihklib_device_open(arg->os_index);
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000;
+	if (periodic) {
+		its.it_interval = its.it_value;
+	}
+	return timerfd_settime(fd, 0, &its, NULL);
+}
+
+static void detect_hungup(struct ihkmond *md, struct mcos *mcos)
+{
+	int devfd;
+	int ret_lib;
+
+	devfd = ihklib_device_open(md->dev_index);
 	if (devfd < 0) {
 		dprintf("%s: error: ihklib_device_open failed with %d\n",
-			__func__, errno);
-		ret = devfd;
-		goto out;
+			__func__, devfd);
+		return;
 	}
 
 	ret_lib = ioctl(devfd, IHK_DEVICE_DETECT_HUNGUP,
-			(unsigned long)arg->dev_index);
+			(unsigned long)mcos->os_index);
 	if(ret_lib == -1) {
 		if(errno == EAGAIN) { /* OS is booting */
 			dprintf("%s: ioctl IHK_DEVICE_DETECT_HUNGUP returned EAGAIN\n", __FUNCTION__);
@@ -173,101 +255,84 @@ static void* detect_hungup(void* _arg) {
 		dprintf("%s: ioctl IHK_DEVICE_DETECT_HUNGUP returned %d\n", __FUNCTION__, ret_lib);
 	}
 	close(devfd);
-	devfd = -1;
+}
 
-	do {
-		int nfd = epoll_wait(epfd, events, 1, arg->interval * 1000);
-		if (nfd < 0 && errno == EINTR)
-			continue;
-		CHKANDJUMP(nfd < 0, -EINVAL, "epoll_wait failed\n");
-		if (nfd == 0) {
-			goto next;
-		}
-		for (i = 0; i < nfd; i++) {
-			if (events[i].data.fd == arg->evfd_mcos_removed) {
-				dprintf("mcos remove event detected\n");
-				ret = reap_event(events[i].data.fd);
-				if (ret) {
-					dprintf("%s: warning: reap_event failed with %d\n",
-						__func__, ret);
-				}
-				goto wait_for_add;
-			}
-		}
-	} while (1);
+/* Fetch kmsg into md->kmsg_buf, returns the number of bytes */
+static ssize_t read_kmsg(struct ihkmond *md, struct mcos *mcos, int shift)
+{
+	ssize_t ret;
+	int devfd = -1;
+	ssize_t nread;
+	struct ihk_device_read_kmsg_buf_desc desc = {
+		.handle = mcos->kmsg_handle, .shift = shift,
+		.buf = md->kmsg_buf };
+
+	devfd = ihklib_device_open(md->dev_index);
+	CHKANDJUMP(devfd < 0, devfd, "ihklib_device_open returned %d\n",
+		   devfd);
+
+	nread = ioctl(devfd, IHK_DEVICE_READ_KMSG_BUF, (unsigned long)&desc);
+	CHKANDJUMP(nread < 0 || nread > IHK_KMSG_SIZE, nread, "ioctl failed\n");
+	md->kmsg_buf[nread] = 0;
 
-out:
+	ret = nread;
+ out:
 	if (devfd >= 0) {
 		close(devfd);
 	}
-	if (epfd >= 0) {
-		close(epfd);
-	}
-	arg->ret = ret;
-	return NULL;
+	return ret;
 }
 
 #ifdef ENABLE_KMSG_REDIRECT
-static int printk_kmsg(int dev_index, void *handle)
+/*
+ * Each line goes through its own open of /dev/kmsg. Writes are rate
+ * limited per open file (10 records per 5 seconds unless
+ * printk.devkmsg=on), so a descriptor kept across lines would drop
+ * most of a burst silently.
+ */
+static int printk_kmsg(struct ihkmond *md, struct mcos *mcos)
 {
 	int ret;
-	int devfd = -1;
 	ssize_t nread;
-	char buf[IHK_KMSG_SIZE];
 	char *car, *cdr;
-	struct ihk_device_read_kmsg_buf_desc desc = {
-		.handle = handle, .shift = 1, .buf = buf };
-
-	devfd = ihklib_device_open(dev_index);
-	CHKANDJUMP(devfd < 0, -errno, "ihklib_device_open returned %d\n",
-		   -errno);
 
-	nread = ioctl(devfd, IHK_DEVICE_READ_KMSG_BUF, (unsigned long)&desc);
-	CHKANDJUMP(nread < 0 || nread > IHK_KMSG_SIZE, nread, "ioctl failed\n");
+	nread = read_kmsg(md, mcos, 1);
+	CHKANDJUMP(nread < 0, nread, "read_kmsg returned %ld\n", nread);
 	if (nread == 0) {
 		dprintf("nread is zero\n");
+		ret = 0;
 		goto out;
 	}
-	close(devfd);
-	devfd = -1;
 
-	cdr = buf;
+	cdr = md->kmsg_buf;
 	while ((car = strsep(&cdr, "\n"))) {
+		if (*car == 0) {
+			continue;
+		}
 		printk("<3>%s", car); /* KERN_ERR */
-		usleep(200); /* Prevent messages from getting dropped */
 	}
 
 	ret = 0;
  out:
-	if (devfd >= 0) {
-		close(devfd);
-	}
 	return ret;
 }
 #endif
 
-static int fwrite_kmsg(int dev_index, void* handle, int os_index, FILE **fps, int *sizes, int *prod, int shift) {
+static int fwrite_kmsg(struct ihkmond *md, struct mcos *mcos, int shift) {
 	int ret = 0, ret_lib;
-	int devfd = -1;
 	ssize_t nread;
-	char buf[IHK_KMSG_SIZE];
 	char fn[256];
 	int next_slot = 0;
-	struct ihk_device_read_kmsg_buf_desc desc = {
-		.handle = handle, .shift = shift, .buf = buf };
-	
-	devfd = ihklib_device_open(dev_index);
-	CHKANDJUMP(devfd < 0, -errno, "ihklib_device_open returned %d\n",
-		   -errno);
+	FILE **fps = mcos->fps;
+	int *sizes = mcos->sizes;
+	int *prod = &mcos->prod;
 
-	nread = ioctl(devfd, IHK_DEVICE_READ_KMSG_BUF, (unsigned long)&desc);
-	CHKANDJUMP(nread < 0 || nread > IHK_KMSG_SIZE, nread, "ioctl failed\n");
+	nread = read_kmsg(md, mcos, shift);
+	CHKANDJUMP(nread < 0, nread, "read_kmsg returned %ld\n", nread);
 	if (nread == 0) {
 		dprintf("nread is zero\n");
 		goto out;
 	}
-	close(devfd);
-	devfd = -1;
 
 	if (sizes[*prod] + nread > IHKMOND_SIZE_FILEBUF_SLOT) {
 		*prod = (*prod + 1) % IHKMOND_NUM_FILEBUF_SLOTS;
@@ -280,7 +345,7 @@ static int fwrite_kmsg(int dev_index, void* handle, int os_index, FILE **fps, in
 			ret_lib = mkdir(fn, 0755);
 			CHKANDJUMP(ret_lib != 0 && errno != EEXIST, -errno, "mkdir failed\n");
 
-			sprintf(fn, IHKMOND_TMP "/mcos%d", os_index);
+			sprintf(fn, IHKMOND_TMP "/mcos%d", mcos->os_index);
 			ret_lib = mkdir(fn, 0755);
 			CHKANDJUMP(ret_lib != 0 && errno != EEXIST, -errno, "mkdir failed\n");
 		} else {
@@ -288,263 +353,566 @@ static int fwrite_kmsg(int dev_index, void* handle, int os_index, FILE **fps, in
 			fps[*prod] = NULL;
 		}
 
-		sprintf(fn, IHKMOND_TMP "/mcos%d/kmsg%d", os_index, *prod);
+		sprintf(fn, IHKMOND_TMP "/mcos%d/kmsg%d", mcos->os_index,
+			*prod);
 		fps[*prod] = fopen(fn, "w+");
-		CHKANDJUMP(fps[*prod] == NULL, -EINVAL, "fopen failed\n"); 
+		CHKANDJUMP(fps[*prod] == NULL, -EINVAL, "fopen failed\n");
 		sizes[*prod] = 0;
 		dprintf("fn=%s\n", fn);
 	}
 
-	ret = fwrite(buf, 1, nread, fps[*prod]); 
+	ret = fwrite(md->kmsg_buf, 1, nread, fps[*prod]);
 	sizes[*prod] += nread;
 	dprintf("fwrite returned %d\n", ret);
  out:
-	if (devfd >= 0) {
-		close(devfd);
+	return ret;
+}
+
+static int sink_wait_writable(struct ihkmond *md, int wait)
+{
+	struct epoll_event event;
+
+	if (md->sink_blocked == wait) {
+		return 0;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.events = wait ? EPOLLOUT : 0;
+	event.data.ptr = &md->sink;
+	md->sink_blocked = wait;
+	return epoll_ctl(md->epfd, EPOLL_CTL_MOD, md->sink.fd, &event);
+}
+
+static void drop_pending(struct mcos *mcos)
+{
+	free(mcos->out_buf);
+	mcos->out_buf = NULL;
+	mcos->out_len = 0;
+	mcos->out_off = 0;
+}
+
+/*
+ * Send the pending lines of mcos in batches. Returns 0 when everything
+ * was sent or the receiver is full, in which case the rest is sent when
+ * the sink becomes writable.
+ */
+static int deliver_pending(struct ihkmond *md, struct mcos *mcos)
+{
+	int ret = 0;
+	struct mmsghdr msgs[IHKMOND_LOG_BATCH];
+	struct iovec iovs[IHKMOND_LOG_BATCH][3];
+	size_t ends[IHKMOND_LOG_BATCH];
+	static char newline = '\n';
+
+	if (md->sink.fd < 0) {
+		char *cur = mcos->out_buf + mcos->out_off;
+		char *token;
+
+		while ((token = strsep(&cur, "\n")) != NULL) {
+			if (*token) {
+				syslog(LOG_INFO, "%s", token);
+			}
+		}
+		goto out;
+	}
+
+	while (mcos->out_off < mcos->out_len && !md->sink_blocked) {
+		size_t off = mcos->out_off;
+		int n = 0;
+		int i;
+
+		memset(msgs, 0, sizeof(msgs));
+		while (n < IHKMOND_LOG_BATCH && off < mcos->out_len) {
+			char *line = mcos->out_buf + off;
+			char *nl = memchr(line, '\n', mcos->out_len - off);
+			size_t len = nl ? nl - line : mcos->out_len - off;
+
+			off += len + (nl ? 1 : 0);
+			if (len == 0) {
+				if (n == 0) {
+					mcos->out_off = off;
+				}
+				continue;
+			}
+
+			iovs[n][0].iov_base = mcos->hdr;
+			iovs[n][0].iov_len = mcos->hdr_len;
+			iovs[n][1].iov_base = line;
+			iovs[n][1].iov_len = len;
+			iovs[n][2].iov_base = &newline;
+			iovs[n][2].iov_len = 1;
+			msgs[n].msg_hdr.msg_iov = iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = md->sink_journal ? 3 : 2;
+			ends[n] = off;
+			n++;
+		}
+
+		if (n == 0) {
+			mcos->out_off = off;
+			break;
+		}
+
+		i = sendmmsg(md->sink.fd, msgs, n, MSG_DONTWAIT);
+		if (i < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == ENOBUFS) {
+				dprintf("%s: mcos%d: receiver is full\n",
+					__func__, mcos->os_index);
+				ret = sink_wait_writable(md, 1);
+				CHKANDJUMP(ret != 0, -errno,
+					   "epoll_ctl failed\n");
+				return 0;
+			}
+			CHKANDJUMP(1, -errno, "sendmmsg failed: %s\n",
+				   strerror(errno));
+		}
+
+		mcos->out_off = ends[i - 1];
 	}
+
+	if (mcos->out_off < mcos->out_len) {
+		return 0;
+	}
+ out:
+	drop_pending(mcos);
 	return ret;
 }
 
-static ssize_t syslog_kmsg(FILE **fps, int prod) {
+/*
+ * Make room for incoming bytes by dropping the oldest pending lines
+ * beyond IHKMOND_MAX_PENDING, and move the rest to the start of out_buf
+ */
+static void trim_pending(struct mcos *mcos, size_t incoming)
+{
+	unsigned long dropped = 0;
+
+	while (mcos->out_off < mcos->out_len &&
+	       mcos->out_len - mcos->out_off + incoming >
+	       IHKMOND_MAX_PENDING) {
+		char *line = mcos->out_buf + mcos->out_off;
+		char *nl = memchr(line, '\n', mcos->out_len - mcos->out_off);
+
+		mcos->out_off = nl ? nl - mcos->out_buf + 1 : mcos->out_len;
+		dropped++;
+	}
+
+	if (dropped) {
+		mcos->out_dropped += dropped;
+		eprintf("ihkmond: mcos%d: receiver is full, dropped %lu "
+			"oldest lines (%lu in total)\n", mcos->os_index,
+			dropped, mcos->out_dropped);
+	}
+
+	if (mcos->out_off) {
+		memmove(mcos->out_buf, mcos->out_buf + mcos->out_off,
+			mcos->out_len - mcos->out_off);
+		mcos->out_len -= mcos->out_off;
+		mcos->out_off = 0;
+		mcos->out_buf[mcos->out_len] = 0;
+	}
+}
+
+/* Move the contents of the spool files to the pending lines and send */
+static ssize_t syslog_kmsg(struct ihkmond *md, struct mcos *mcos) {
 	int ret = 0;
-	char *buf = NULL;
-	char *cur;
-	char *token;
+	FILE **fps = mcos->fps;
+	char *buf;
+	size_t size;
 	int cons;
 	int i;
 
-	buf = malloc(IHKMOND_SIZE_FILEBUF_SLOT + 1);
-	CHKANDJUMP(buf == NULL, -ENOMEM, "malloc failed");
-
 	for(i = IHKMOND_NUM_FILEBUF_SLOTS - 1; i >= 0; i--) {
 		if (fps[i] == NULL) {
 			cons = 0;
 			goto no_wrap_around;
 		}
 	}
-	cons = (prod + 1) % IHKMOND_NUM_FILEBUF_SLOTS;
+	cons = (mcos->prod + 1) % IHKMOND_NUM_FILEBUF_SLOTS;
  no_wrap_around:
-	dprintf("%s: prod=%d,cons=%d\n", __FUNCTION__, prod, cons);
+	dprintf("%s: prod=%d,cons=%d\n", __FUNCTION__, mcos->prod, cons);
 
 	for(i = 0; i < IHKMOND_NUM_FILEBUF_SLOTS && fps[cons] != NULL; i++, cons = (cons + 1) % IHKMOND_NUM_FILEBUF_SLOTS) {
 		dprintf("cons=%d\n", cons);
+
+		trim_pending(mcos, mcos->sizes[cons]);
+
+		/* Room for a newline and the terminating NUL */
+		size = mcos->out_len + mcos->sizes[cons] + 2;
+		buf = realloc(mcos->out_buf, size);
+		CHKANDJUMP(buf == NULL, -ENOMEM, "realloc failed\n");
+		mcos->out_buf = buf;
+
 		rewind(fps[cons]);
-		cur = buf;
-		while((ret = fread(cur, 1, IHKMOND_SIZE_FILEBUF_SLOT - (cur - buf) - 1, fps[cons])), ret > 0) {
-			cur += ret;
+		while ((ret = fread(buf + mcos->out_len, 1,
+				    size - mcos->out_len - 2, fps[cons])) > 0) {
+			mcos->out_len += ret;
 		}
 		CHKANDJUMP(ferror(fps[cons]), -EINVAL, "ferror()\n");
-		*cur = 0;
-		dprintf("total=%ld\n", (unsigned long)(cur - buf));
+
+		/* Terminate the last line of the slot */
+		if (mcos->out_len && buf[mcos->out_len - 1] != '\n') {
+			buf[mcos->out_len++] = '\n';
+		}
+		buf[mcos->out_len] = 0;
 
 		/* Mark as consumed for duplicated call to this function */
 		fclose(fps[cons]);
 		fps[cons] = NULL;
+	}
+	dprintf("%d slot(s) transferred, total=%ld\n", i, mcos->out_len);
+
+	ret = deliver_pending(md, mcos);
+ out:
+	return ret;
+}
+
+static int take_kmsg(struct ihkmond *md, struct mcos *mcos, int flush)
+{
+	int ret;
 
-		cur = buf;
-		token = strsep(&cur, "\n");
-		while (token != NULL) {
-			if(*token == 0) {
-				goto empty_token;
+#ifdef ENABLE_KMSG_REDIRECT
+	ret = printk_kmsg(md, mcos);
+	CHKANDJUMP(ret < 0, ret, "printk_kmsg returned %d\n", ret);
+#else
+	ret = fwrite_kmsg(md, mcos, 1);
+	CHKANDJUMP(ret < 0, ret, "fwrite_kmsg returned %d\n", ret);
+
+	if (flush) {
+		ret = syslog_kmsg(md, mcos);
+		CHKANDJUMP(ret < 0, ret, "syslog_kmsg returned %d\n", ret);
+	}
+#endif
+	ret = 0;
+ out:
+	return ret;
+}
+
+static void mcos_deactivate(struct ihkmond *md, struct mcos *mcos)
+{
+	int devfd;
+	int i;
+
+	if (mcos->kmsg_handle) {
+		/* Release (i.e. unref) kmsg_buf */
+		devfd = ihklib_device_open(md->dev_index);
+		if (devfd >= 0) {
+			if (ioctl(devfd, IHK_DEVICE_RELEASE_KMSG_BUF,
+				  mcos->kmsg_handle) != 0) {
+				eprintf("IHK_DEVICE_RELEASE_KMSG_BUF failed\n");
 			}
-			dprintf("token=%s\n", token);
-			syslog(LOG_INFO, "%s", token);
-			usleep(200); /* Prevent syslog from dropping messages */
-		empty_token:
-			token = strsep(&cur, "\n");
+			close(devfd);
 		}
-
+		mcos->kmsg_handle = NULL;
 	}
-	dprintf("%d slot(s) transferred\n", i);
 
- out:
-	if (buf) {
-		free(buf);
+	epoll_del_and_close(md, &mcos->evfd_kmsg);
+	epoll_del_and_close(md, &mcos->evfd_status);
+	timer_arm(mcos->timer.fd, 0, 0);
+
+	for (i = 0; i < IHKMOND_NUM_FILEBUF_SLOTS; i++) {
+		if (mcos->fps[i] != NULL) {
+			fclose(mcos->fps[i]);
+			mcos->fps[i] = NULL;
+		}
+		mcos->sizes[i] = 0;
 	}
-	return ret;
+	mcos->prod = 0;
+
+	mcos->state = MCOS_NONE;
 }
 
-static void* redirect_kmsg(void* _arg) {
-	struct thr_args *arg = (struct thr_args *)_arg;
-	int devfd = -1, evfd_kmsg = -1, evfd_status = -1, epfd = -1;
-	struct epoll_event event;
-	struct epoll_event events[2];
+static int mcos_activate(struct ihkmond *md, struct mcos *mcos)
+{
 	int ret = 0, ret_lib;
-	int i;
-	FILE* fps[IHKMOND_NUM_FILEBUF_SLOTS];
-	int sizes[IHKMOND_NUM_FILEBUF_SLOTS];
-#ifndef ENABLE_KMSG_REDIRECT
-	int prod = 0; /* Producer pointer */
-#endif
+	int devfd = -1;
+	char fn[32];
+	struct stat st;
 	struct ihk_device_get_kmsg_buf_desc desc_get;
 
-	memset(fps, 0, IHKMOND_NUM_FILEBUF_SLOTS * sizeof(FILE *));
-	memset(sizes, 0, IHKMOND_NUM_FILEBUF_SLOTS * sizeof(int));
+	/* udev may report the device before the node is accessible */
+	snprintf(fn, sizeof(fn), "/dev/mcos%d", mcos->os_index);
+	if (stat(fn, &st) == -1) {
+		CHKANDJUMP(errno != ENOENT, -errno,
+			   "/dev/mcosX access failed\n");
+
+		mcos->add_wait_ms += IHKMOND_ADD_RETRY_MS;
+		CHKANDJUMP(mcos->add_wait_ms > IHKMOND_ADD_TIMEOUT_MS,
+			   -ETIMEDOUT, "/dev/mcosX create timeout\n");
+
+		mcos->state = MCOS_ADDING;
+		ret_lib = timer_arm(mcos->timer.fd, IHKMOND_ADD_RETRY_MS, 0);
+		CHKANDJUMP(ret_lib != 0, -errno, "timerfd_settime failed\n");
+		return 0;
+	}
+
+	dprintf("mcos%d add detected\n", mcos->os_index);
+
+	if (md->enable_kmsg) {
+		/* Get (i.e. ref) kmsg_buf */
+		devfd = ihklib_device_open(md->dev_index);
+		CHKANDJUMP(devfd < 0, devfd,
+			   "ihklib_device_open returned %d\n", devfd);
+
+		memset(&desc_get, 0, sizeof(desc_get));
+		desc_get.os_index = mcos->os_index;
+		ret_lib = ioctl(devfd, IHK_DEVICE_GET_KMSG_BUF, &desc_get);
+		CHKANDJUMP(ret_lib < 0, ret_lib,
+			   "IHK_DEVICE_GET_KMSG_BUF returned %d\n", ret_lib);
+		mcos->kmsg_handle = desc_get.handle;
+
+		/* Get notification when the amount of kmsg exceeds a threshold */
+		mcos->evfd_kmsg.fd = ihk_os_get_eventfd(mcos->os_index,
+						IHK_OS_EVENTFD_TYPE_KMSG);
+		CHKANDJUMP(mcos->evfd_kmsg.fd < 0, -EINVAL,
+			   "ihk_os_get_eventfd\n");
+		ret_lib = epoll_add(md, &mcos->evfd_kmsg, EPOLLIN);
+		CHKANDJUMP(ret_lib != 0, -EINVAL, "epoll_ctl failed\n");
+
+		/* Get notification when LWK panics or gets hungup */
+		mcos->evfd_status.fd = ihk_os_get_eventfd(mcos->os_index,
+						IHK_OS_EVENTFD_TYPE_STATUS);
+		CHKANDJUMP(mcos->evfd_status.fd < 0, -EINVAL,
+			   "ihk_os_get_eventfd\n");
+		ret_lib = epoll_add(md, &mcos->evfd_status, EPOLLIN);
+		CHKANDJUMP(ret_lib != 0, -EINVAL, "epoll_ctl failed\n");
+	}
+
+	mcos->state = MCOS_ACTIVE;
+
+	if (md->mon_interval != -1) {
+		detect_hungup(md, mcos);
+		ret_lib = timer_arm(mcos->timer.fd,
+				    md->mon_interval * 1000L, 1);
+		CHKANDJUMP(ret_lib != 0, -errno, "timerfd_settime failed\n");
+	}
 
-	openlog(arg->logid, LOG_PID, arg->facility);
+	ret = 0;
+ out:
+	if (devfd >= 0) {
+		close(devfd);
+	}
+	if (ret) {
+		mcos_deactivate(md, mcos);
+	}
+	return ret;
+}
 
-	epfd = epoll_create(1);
-	CHKANDJUMP(epfd == -1, 255, "epoll_create failed\n");
-	
-	/* mcos remove event live longer than /dev/mcosX itself */
-	memset(&event, 0, sizeof(struct epoll_event));
-	event.events = EPOLLIN;
-	event.data.fd = arg->evfd_mcos_removed;
-	ret_lib = epoll_ctl(epfd, EPOLL_CTL_ADD, arg->evfd_mcos_removed, &event);
-	CHKANDJUMP(ret_lib != 0, -EINVAL, "epoll_ctl failed\n");
+static struct mcos *mcos_get(struct ihkmond *md, int os_index)
+{
+	int ret = 0;
+	struct mcos *mcos;
 
- wait_for_mcos:
-	dprintf("wait for mcos add, dev_index=%d, os_index=%d\n", arg->dev_index, arg->os_index);
+	if (md->mcos[os_index]) {
+		return md->mcos[os_index];
+	}
 
-	/* Wait for add /dev/mcosX event */
-	ret_lib = pthread_mutex_lock(&arg->lock);
-	CHKANDJUMP(ret_lib != 0, 255, "pthread_mutex_lock failed\n");
-	while (arg->mcos_added == 0) {
-		ret_lib = pthread_cond_wait(&arg->cond_mcos_added, &arg->lock);
+	mcos = calloc(1, sizeof(*mcos));
+	CHKANDJUMP(mcos == NULL, -ENOMEM, "calloc failed\n");
+
+	mcos->os_index = os_index;
+	mcos->evfd_kmsg.fd = -1;
+	mcos->evfd_kmsg.type = IHKMOND_FD_KMSG;
+	mcos->evfd_kmsg.mcos = mcos;
+	mcos->evfd_status.fd = -1;
+	mcos->evfd_status.type = IHKMOND_FD_STATUS;
+	mcos->evfd_status.mcos = mcos;
+
+	mcos->timer.type = IHKMOND_FD_TIMER;
+	mcos->timer.mcos = mcos;
+	mcos->timer.fd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_NONBLOCK | TFD_CLOEXEC);
+	CHKANDJUMP(mcos->timer.fd < 0, -errno, "timerfd_create failed\n");
+	ret = epoll_add(md, &mcos->timer, EPOLLIN);
+	CHKANDJUMP(ret != 0, -errno, "epoll_ctl failed\n");
+
+	if (md->sink_journal) {
+		mcos->hdr_len = snprintf(mcos->hdr, sizeof(mcos->hdr),
+				"SYSLOG_IDENTIFIER=%s\n"
+				"SYSLOG_FACILITY=%d\n"
+				"PRIORITY=%d\n"
+				"IHK_OS_INDEX=%d\n"
+				"MESSAGE=",
+				md->logid, md->facility >> 3, LOG_INFO,
+				os_index);
+	} else {
+		mcos->hdr_len = snprintf(mcos->hdr, sizeof(mcos->hdr),
+				"<%d>%s[%d]: ",
+				md->facility | LOG_INFO, md->logid,
+				(int)getpid());
 	}
-	arg->mcos_added = 0;
-	pthread_mutex_unlock(&arg->lock);
 
-	dprintf("mcos add detected\n");
+	md->mcos[os_index] = mcos;
+ out:
+	if (ret) {
+		if (mcos && mcos->timer.fd >= 0) {
+			close(mcos->timer.fd);
+		}
+		free(mcos);
+		mcos = NULL;
+	}
+	return mcos;
+}
 
-	/* Get (i.e. ref) kmsg_buf */
-	devfd = ihklib_device_open(arg->dev_index);
-	CHKANDJUMP(devfd < 0, -errno, "ihklib_device_open returned %d\n",
-		   devfd);
+/* Prefer journald, then syslogd, then syslog() as the last resort */
+static void sink_init(struct ihkmond *md)
+{
+	static const char *paths[] = {
+		IHKMOND_JOURNAL_SOCKET, IHKMOND_SYSLOG_SOCKET };
+	struct sockaddr_un addr;
+	int sndbuf = 8 << 20;
+	int i;
 
-	memset(&desc_get, 0, sizeof(desc_get));
-	desc_get.os_index = arg->os_index;
-	ret_lib = ioctl(devfd, IHK_DEVICE_GET_KMSG_BUF, &desc_get);
-	CHKANDJUMP(ret_lib < 0, ret_lib, "IHK_DEVICE_GET_KMSG_BUF returned %d\n", ret_lib);
+	md->sink.type = IHKMOND_FD_SINK;
+	md->sink.fd = -1;
 
-	close(devfd);
-	devfd = -1;
-	
-	/* Get notification when the amount of kmsg exceeds a threshold */
-	evfd_kmsg = ihk_os_get_eventfd(arg->os_index, IHK_OS_EVENTFD_TYPE_KMSG);
-	CHKANDJUMP(evfd_kmsg < 0, -EINVAL, "ihk_os_get_eventfd\n");
-
-	memset(&event, 0, sizeof(struct epoll_event));
-	event.events = EPOLLIN;
-	event.data.fd = evfd_kmsg;
-	ret_lib = epoll_ctl(epfd, EPOLL_CTL_ADD, evfd_kmsg, &event);
-	CHKANDJUMP(ret_lib != 0, -EINVAL, "epoll_ctl failed\n");
-
-	/* Get notification when LWK panics or gets hungup */
-	evfd_status = ihk_os_get_eventfd(arg->os_index, IHK_OS_EVENTFD_TYPE_STATUS);
-	CHKANDJUMP(evfd_status < 0, -EINVAL, "ihk_os_get_eventfd\n");
-
-	memset(&event, 0, sizeof(struct epoll_event));
-	event.events = EPOLLIN;
-	event.data.fd = evfd_status;
-	ret_lib = epoll_ctl(epfd, EPOLL_CTL_ADD, evfd_status, &event);
-	CHKANDJUMP(ret_lib != 0, -EINVAL, "epoll_ctl failed\n");
+	for (i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+		int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
 
-	do {
-		int nfd = epoll_wait(epfd, events, 2, -1);
-		if (nfd < 0 && errno == EINTR)
+		if (fd < 0) {
+			break;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, paths[i], sizeof(addr.sun_path) - 1);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+			close(fd);
 			continue;
-		CHKANDJUMP(nfd < 0, -EINVAL, "epoll_wait failed\n");
-		for (i = 0; i < nfd; i++) {
-			if (events[i].data.fd == evfd_kmsg) {
-				reap_event(events[i].data.fd);
-				dprintf("kmsg event detected\n");
-#ifdef ENABLE_KMSG_REDIRECT
-				ret_lib = printk_kmsg(arg->dev_index, desc_get.handle);
-#else
-				ret_lib = fwrite_kmsg(arg->dev_index, desc_get.handle, arg->os_index, fps, sizes, &prod, 1);
-#endif
-				CHKANDJUMP(ret_lib < 0, -EINVAL, "fwrite_kmsg returned %d\n", ret_lib);
-			} else if (events[i].data.fd == evfd_status) {
-				reap_event(events[i].data.fd);
-				dprintf("LWK status event detected\n");
-#ifdef ENABLE_KMSG_REDIRECT
-				ret_lib = printk_kmsg(arg->dev_index, desc_get.handle);
-				CHKANDJUMP(ret_lib < 0, -EINVAL, "printk_kmsg returned %d\n", ret_lib);
-#else
-				ret_lib = fwrite_kmsg(arg->dev_index, desc_get.handle, arg->os_index, fps, sizes, &prod, 1);
-				CHKANDJUMP(ret_lib < 0, -EINVAL, "fwrite_kmsg returned %d\n", ret_lib);
+		}
 
-				ret_lib = syslog_kmsg(fps, prod);
-				CHKANDJUMP(ret_lib < 0, ret_lib, "syslog_kmsg returned %d\n", ret_lib);
-#endif
-			} else if (events[i].data.fd == arg->evfd_mcos_removed) {
-				reap_event(events[i].data.fd);
-				dprintf("mcos remove event detected\n");
-#ifdef ENABLE_KMSG_REDIRECT
-				ret_lib = printk_kmsg(arg->dev_index, desc_get.handle);
-				CHKANDJUMP(ret_lib < 0, -EINVAL, "printk_kmsg returned %d\n", ret_lib);
-#else
-				ret_lib = fwrite_kmsg(arg->dev_index, desc_get.handle, arg->os_index, fps, sizes, &prod, 1);
-				CHKANDJUMP(ret_lib < 0, -EINVAL, "fwrite_kmsg returned %d\n", ret_lib);
+		/* Best effort, larger bursts fit before flow control kicks in */
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
 
-				ret_lib = syslog_kmsg(fps, prod);
-				CHKANDJUMP(ret_lib < 0, ret_lib, "syslog_kmsg returned %d\n", ret_lib);
-				dprintf("after syslog_kmsg for destroy\n");
-#endif
+		md->sink.fd = fd;
+		md->sink_journal = (i == 0);
+		if (epoll_add(md, &md->sink, 0)) {
+			close(fd);
+			md->sink.fd = -1;
+			break;
+		}
+		dprintf("%s: delivering logs to %s\n", __func__, paths[i]);
+		return;
+	}
 
-				/* Release (i.e. unref) kmsg_buf */
-				devfd = ihklib_device_open(arg->dev_index);
-				CHKANDJUMP(devfd < 0, -errno,
-					   "ihklib_device_open returned %d\n",
-					   devfd);
-				ret_lib = ioctl(devfd, IHK_DEVICE_RELEASE_KMSG_BUF, desc_get.handle);
-				CHKANDJUMP(ret_lib != 0, ret_lib, "IHK_DEVICE_RELEASE_KMSG_BUF failed\n");
-				close(devfd);
-				devfd = -1;
-
-				ret_lib = epoll_ctl(epfd, EPOLL_CTL_DEL, evfd_kmsg, &event);
-				CHKANDJUMP(ret_lib != 0, -EINVAL, "epoll_ctl failed\n");
-				close(evfd_kmsg);
-				evfd_kmsg = -1;
-
-				ret_lib = epoll_ctl(epfd, EPOLL_CTL_DEL, evfd_status, &event);
-				CHKANDJUMP(ret_lib != 0, -EINVAL, "epoll_ctl failed\n");
-				close(evfd_status);
-				evfd_status = -1;
-
-				for (i = 0; i < IHKMOND_NUM_FILEBUF_SLOTS; i++) {
-					if(fps[i] != NULL) {
-						fclose(fps[i]);
-						fps[i] = NULL;
-#if 0
-						char fn[256];
-						sprintf(fn, IHKMOND_TMP "/mcos%d/kmsg%d", arg->os_index, i);
-						ret_lib = unlink(fn);
-						CHKANDJUMP(ret_lib != 0, -EINVAL, "unlink failed\n");
-						sprintf(fn, IHKMOND_TMP "/mcos%d", arg->os_index);
-						ret_lib = rmdir(fn);
-						CHKANDJUMP(ret_lib != 0, -EINVAL, "rmdir failed\n");
-						sprintf(fn, IHKMOND_TMP);
-						ret_lib = rmdir(fn);
-						CHKANDJUMP(ret_lib != 0, -EINVAL, "rmdir failed\n");
-#endif
-					}
-				}
-				goto wait_for_mcos;
+	openlog(md->logid, LOG_PID, md->facility);
+}
+
+static int handle_udev(struct ihkmond *md)
+{
+	int ret = 0;
+	struct udev_device *dev;
+	const char *action, *sysname;
+	struct mcos *mcos;
+	int os_index;
+
+	/* Don't reap_event(evfd), it's harmful. */
+	dev = udev_monitor_receive_device(md->mon_mcos);
+	CHKANDJUMP(dev == NULL, 0, "udev_monitor_receive_device failed\n");
+
+	action = udev_device_get_action(dev);
+	sysname = udev_device_get_sysname(dev);
+	if (!action || !sysname ||
+	    sscanf(sysname, "mcos%d", &os_index) != 1 ||
+	    os_index < 0 || os_index >= IHKMOND_MAX_NUM_OS_INSTANCES) {
+		goto out;
+	}
+	dprintf("%s: %s %s\n", __func__, action, sysname);
+
+	mcos = mcos_get(md, os_index);
+	if (!mcos) {
+		goto out;
+	}
+
+	if (strcmp(action, "add") == 0) {
+		if (mcos->state != MCOS_NONE) {
+			mcos_deactivate(md, mcos);
+		}
+		mcos->add_wait_ms = 0;
+		mcos_activate(md, mcos);
+	} else if (strcmp(action, "remove") == 0) {
+		dprintf("mcos%d remove detected\n", os_index);
+		if (mcos->kmsg_handle) {
+			ret = take_kmsg(md, mcos, 1);
+			if (ret) {
+				dprintf("%s: warning: take_kmsg failed with %d\n",
+					__func__, ret);
 			}
 		}
-	} while (1);
+		mcos_deactivate(md, mcos);
+	}
 
-out:
-	if (devfd >= 0) {
-		close(devfd);
+	ret = 0;
+ out:
+	if (dev) {
+		udev_device_unref(dev);
 	}
-	if (evfd_kmsg >= 0) {
-		close(evfd_kmsg);
+	return ret;
+}
+
+static void handle_mcos_event(struct ihkmond *md, struct ihkmond_fd *f)
+{
+	struct mcos *mcos = f->mcos;
+	uint64_t expirations;
+	int ret;
+
+	/* Closed by an earlier event of the same epoll_wait() */
+	if (f->fd < 0) {
+		return;
 	}
-	if (evfd_status >= 0) {
-		close(evfd_status);
+
+	switch (f->type) {
+	case IHKMOND_FD_KMSG:
+		reap_event(f->fd);
+		dprintf("kmsg event detected\n");
+		ret = take_kmsg(md, mcos, 0);
+		break;
+	case IHKMOND_FD_STATUS:
+		reap_event(f->fd);
+		dprintf("LWK status event detected\n");
+		ret = take_kmsg(md, mcos, 1);
+		break;
+	case IHKMOND_FD_TIMER:
+		if (read(f->fd, &expirations, sizeof(expirations)) !=
+		    sizeof(expirations)) {
+			return;
+		}
+		if (mcos->state == MCOS_ADDING) {
+			ret = mcos_activate(md, mcos);
+		}
+		else if (mcos->state == MCOS_ACTIVE) {
+			detect_hungup(md, mcos);
+			ret = 0;
+		}
+		else {
+			ret = 0;
+		}
+		break;
+	default:
+		return;
 	}
-	if (epfd >= 0) {
-		close(epfd);
+
+	if (ret) {
+		eprintf("%s: mcos%d: error %d, stop monitoring\n",
+			__func__, mcos->os_index, ret);
+		mcos_deactivate(md, mcos);
 	}
-	arg->ret = ret;
-	closelog();
-	return NULL;
 }
 
-#define MCKUDEV_MAX_NUM_OS_INSTANCES 1
+static void handle_sink_writable(struct ihkmond *md)
+{
+	int i;
+
+	sink_wait_writable(md, 0);
+	for (i = 0; i < IHKMOND_MAX_NUM_OS_INSTANCES && !md->sink_blocked;
+	     i++) {
+		if (md->mcos[i] && md->mcos[i]->out_buf) {
+			deliver_pending(md, md->mcos[i]);
+		}
+	}
+}
 
 static void show_usage(char** argv) {
 	printf("%s [--help|-?] [-f <facility_name>] [-k <redirect_kmsg>] [-n <detect_hungup>]\n"
@@ -560,25 +928,26 @@ static void show_usage(char** argv) {
 int main(int argc, char** argv) {
 	int ret = 0, ret_lib;
 	int opt;
-	int evfd_mcos = -1, epfd = -1;
-	struct epoll_event event;
-	struct epoll_event events[1];
+	struct epoll_event events[IHKMOND_MAX_EVENTS];
 	int i;
-	struct udev *udev = NULL;
-	struct udev_monitor *mon_mcos = NULL;
-	pthread_attr_t attr;
-	struct thr_args mon_args[MCKUDEV_MAX_NUM_OS_INSTANCES];
-	struct thr_args kmsg_args[MCKUDEV_MAX_NUM_OS_INSTANCES];
-	int facility = LOG_LOCAL6;
-	int enable_kmsg = 1;
-	int mon_interval = 600; /* sec */
+	struct ihkmond md;
+	int evfd_mcos;
+
+	memset(&md, 0, sizeof(md));
+	md.epfd = -1;
+	md.sink.fd = -1;
+	md.dev_index = 0;
+	md.facility = LOG_LOCAL6;
+	md.enable_kmsg = 1;
+	md.mon_interval = 600; /* sec */
+	md.logid = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
 
 	while ((opt = getopt_long(argc, argv, "f:k:i:", longopt, NULL)) != -1) {
 		switch (opt) {
 		case 'f':
 			for (i = 0; i < 8; i++) {
 				if (strcmp(optarg, facility_list[i].name) == 0) {
-					facility = facility_list[i].code;
+					md.facility = facility_list[i].code;
 					goto found;
 				}
 			}
@@ -586,10 +955,10 @@ int main(int argc, char** argv) {
 		found:;
 			break;
 		case 'k':
-			enable_kmsg = atoi(optarg);
+			md.enable_kmsg = atoi(optarg);
 			break;
 		case 'i':
-			mon_interval = atoi(optarg);
+			md.mon_interval = atoi(optarg);
 			break;
 		case '?':
 		default:
@@ -598,7 +967,8 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	dprintf("enable_kmsg=%d,mon_interval=%d\n", enable_kmsg, mon_interval);
+	dprintf("enable_kmsg=%d,mon_interval=%d\n", md.enable_kmsg,
+		md.mon_interval);
 
 #ifdef DEBUG
 	ret = daemon(1, 1);
@@ -609,169 +979,86 @@ int main(int argc, char** argv) {
 		ret = -errno;
 		dprintf("%s:%d: daemon failed with %d\n",
 			__FILE__, __LINE__, -ret);
-		goto out_early;
-	}
-
-	ret_lib = pthread_attr_init(&attr);
-	CHKANDJUMP(ret_lib != 0, 255, "pthread_attr_init returned %s\n", strerror(ret_lib));
-	ret_lib = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	CHKANDJUMP(ret_lib != 0, 255, "pthread_attr_setdetachstate returned %s\n", strerror(ret_lib));
-
-	for (i = 0; i < MCKUDEV_MAX_NUM_OS_INSTANCES; i++) {
-		if (mon_interval != -1) {
-			mon_args[i].dev_index = 0;
-			mon_args[i].os_index = i;
-			mon_args[i].interval = mon_interval;
-			mon_args[i].evfd_mcos_removed = eventfd(0, 0);
-			CHKANDJUMP(mon_args[i].evfd_mcos_removed == -1, 255, "eventfd failed\n");
-			
-			ret_lib = pthread_cond_init(&mon_args[i].cond_mcos_added, NULL);
-			CHKANDJUMP(ret_lib != 0, 255, "pthread_cond_init returned %s\n", strerror(ret_lib));
-			
-			ret_lib = pthread_mutex_init(&mon_args[i].lock, NULL);
-			CHKANDJUMP(ret_lib != 0, 255, "pthread_mutex_init returned %s\n", strerror(ret_lib));
-			mon_args[i].mcos_added = 0;
-			
-			ret_lib = pthread_create(&mon_args[i].thread, &attr, detect_hungup, &mon_args[i]);
-			CHKANDJUMP(ret_lib != 0, 255, "pthread_create returned %s\n", strerror(ret_lib));
-		}
-
-		if (enable_kmsg) {
-			kmsg_args[i].dev_index = 0;
-			kmsg_args[i].os_index = i;
-			kmsg_args[i].logid = strrchr(argv[0], '/') + 1;
-			kmsg_args[i].facility = facility;
-			kmsg_args[i].evfd_mcos_removed = eventfd(0, 0);
-			CHKANDJUMP(kmsg_args[i].evfd_mcos_removed == -1, 255, "eventfd failed\n");
-			
-			ret_lib = pthread_cond_init(&kmsg_args[i].cond_mcos_added, NULL);
-			CHKANDJUMP(ret_lib != 0, 255, "pthread_cond_init returned %s\n", strerror(ret_lib));
-
-			ret_lib = pthread_mutex_init(&kmsg_args[i].lock, NULL);
-			CHKANDJUMP(ret_lib != 0, 255, "pthread_mutex_init returned %s\n", strerror(ret_lib));
-			kmsg_args[i].mcos_added = 0;
-			
-			ret_lib = pthread_create(&kmsg_args[i].thread, &attr, redirect_kmsg, &kmsg_args[i]);
-			CHKANDJUMP(ret_lib != 0, 255, "pthread_create returned %s\n", strerror(ret_lib));
-		}
+		goto out;
 	}
 
+	md.kmsg_buf = malloc(IHK_KMSG_SIZE + 1);
+	CHKANDJUMP(md.kmsg_buf == NULL, 255, "malloc failed\n");
+
+	md.epfd = epoll_create1(EPOLL_CLOEXEC);
+	CHKANDJUMP(md.epfd == -1, 255, "epoll_create failed\n");
+
+	/* After daemon() so that the syslog header has the right pid */
+	sink_init(&md);
 
-	udev = udev_new();
-	CHKANDJUMP(udev == NULL, 255, "udev_new failed\n");
+	md.udev = udev_new();
+	CHKANDJUMP(md.udev == NULL, 255, "udev_new failed\n");
 
 	/* Obtain evfd for add /dev/mcosX event */
-	mon_mcos = udev_monitor_new_from_netlink(udev, "udev");
-	CHKANDJUMP(mon_mcos == NULL, 255, "udev_monitor_new_from_netlink failed\n");
+	md.mon_mcos = udev_monitor_new_from_netlink(md.udev, "udev");
+	CHKANDJUMP(md.mon_mcos == NULL, 255, "udev_monitor_new_from_netlink failed\n");
 
-	ret_lib = udev_monitor_filter_add_match_subsystem_devtype(mon_mcos, "mcos", NULL);
+	ret_lib = udev_monitor_filter_add_match_subsystem_devtype(md.mon_mcos, "mcos", NULL);
 	CHKANDJUMP(ret_lib < 0, 255, "udev_monitor_filter_add_match_subsystem_devtype returned %s\n", strerror(-ret_lib));
 
-	ret_lib = udev_monitor_enable_receiving(mon_mcos);
+	ret_lib = udev_monitor_enable_receiving(md.mon_mcos);
 	CHKANDJUMP(ret_lib < 0, 255, "udev_monitor_enable_receiving %s\n", strerror(-ret_lib));
-	
-	evfd_mcos = udev_monitor_get_fd(mon_mcos);
+
+	evfd_mcos = udev_monitor_get_fd(md.mon_mcos);
 	CHKANDJUMP(evfd_mcos < 0, 255, "udev_monitor_get_fd returned %s\n", strerror(-evfd_mcos));
 
-	/* Add evfds to epoll fd */
-	epfd = epoll_create(1);
-	CHKANDJUMP(epfd == -1, 255, "epoll_create failed\n");
-	
-	memset(&event, 0, sizeof(struct epoll_event));
-	event.events = EPOLLIN;
-	event.data.fd = evfd_mcos;
-	ret_lib = epoll_ctl(epfd, EPOLL_CTL_ADD, evfd_mcos, &event);
+	md.udev_fd.fd = evfd_mcos;
+	md.udev_fd.type = IHKMOND_FD_UDEV;
+	ret_lib = epoll_add(&md, &md.udev_fd, EPOLLIN);
 	CHKANDJUMP(ret_lib != 0, 255, "epoll_ctl failed\n");
 
 	do {
-		int nfd = epoll_wait(epfd, events, 1, -1);
+		int nfd = epoll_wait(md.epfd, events, IHKMOND_MAX_EVENTS, -1);
+
+		if (nfd < 0 && errno == EINTR)
+			continue;
+		CHKANDJUMP(nfd < 0, 255, "epoll_wait failed\n");
+
 		for (i = 0; i < nfd; i++) {
-			if (events[i].data.fd == evfd_mcos) {
-#define SZ_LINE 256
-				char action[SZ_LINE];
-				char node[SZ_LINE];
-				struct udev_device *dev;
-				int os_index;
-
-				/* Don't reap_event(evfd), it's harmful. */
-				dev = udev_monitor_receive_device(mon_mcos);
-				CHKANDJUMP(dev == NULL, 255, "udev_monitor_receive_device failed\n");
-				
-				strncpy(node, udev_device_get_devnode(dev), SZ_LINE);
-				node[SZ_LINE - 1] = 0;
-				dprintf("Node: %s\n", node);
-
-				os_index = atoi(node + 4);
-
-				strncpy(action, udev_device_get_action(dev), SZ_LINE);
-				action[SZ_LINE - 1] = 0;
-				
-				if (strcmp(action, "add") == 0) {
-					dprintf("mcos add detected\n");
-					if (mon_interval != -1) {
-						ret_lib = pthread_mutex_lock(&mon_args[os_index].lock);
-						CHKANDJUMP(ret_lib != 0, 255, "pthread_mutex_lock failed\n");
-						mon_args[os_index].mcos_added = 1;
-						ret_lib = pthread_cond_signal(&mon_args[os_index].cond_mcos_added);
-						if (ret_lib != 0) {
-							pthread_mutex_unlock(&mon_args[os_index].lock);
-							eprintf("pthread_cond_signal failed\n");
-							ret = 255;
-							goto out;
-						}
-						ret_lib = pthread_mutex_unlock(&mon_args[os_index].lock);
-						CHKANDJUMP(ret_lib != 0, 255, "pthread_mutex_unlock failed\n");
-					}
-					if (enable_kmsg) {
-						ret_lib = pthread_mutex_lock(&kmsg_args[os_index].lock);
-						CHKANDJUMP(ret_lib != 0, 255, "pthread_mutex_lock failed\n");
-						kmsg_args[os_index].mcos_added = 1;
-						ret_lib = pthread_cond_signal(&kmsg_args[os_index].cond_mcos_added);
-						if (ret_lib != 0) {
-							pthread_mutex_unlock(&kmsg_args[os_index].lock);
-							eprintf("pthread_cond_signal failed\n");
-							ret = 255;
-							goto out;
-						}
-						ret_lib = pthread_mutex_unlock(&kmsg_args[os_index].lock);
-						CHKANDJUMP(ret_lib != 0, 255, "pthread_mutex_unlock failed\n");
-					}
-				} else if (strcmp(action, "remove") == 0) {
-					uint64_t counter = 1;
-					dprintf("mcos remove detected\n");
-					if (mon_interval != -1) {
-						ret_lib = write(mon_args[os_index].evfd_mcos_removed, &counter, sizeof(counter));
-						CHKANDJUMP(ret_lib != sizeof(counter), 255, "write failed\n");
-					}
-					if (enable_kmsg) {
-						ret_lib = write(kmsg_args[os_index].evfd_mcos_removed, &counter, sizeof(counter));
-						CHKANDJUMP(ret_lib != sizeof(counter), 255, "write failed\n");
-					}
-				}
+			struct ihkmond_fd *f = events[i].data.ptr;
+
+			switch (f->type) {
+			case IHKMOND_FD_UDEV:
+				handle_udev(&md);
+				break;
+			case IHKMOND_FD_SINK:
+				handle_sink_writable(&md);
+				break;
+			default:
+				handle_mcos_event(&md, f);
+				break;
 			}
 		}
 	} while (1);
  out:
-	udev_monitor_unref(mon_mcos);
-	udev_unref(udev);
-	for (i = 0; i < MCKUDEV_MAX_NUM_OS_INSTANCES; i++) {
-		if (mon_interval != -1) {
-			if (mon_args[i].evfd_mcos_removed != -1) {
-				close(mon_args[i].evfd_mcos_removed);
-			}
-		}
-		if (enable_kmsg) {
-			if (kmsg_args[i].evfd_mcos_removed != -1) {
-				close(kmsg_args[i].evfd_mcos_removed);
-			}
+	for (i = 0; i < IHKMOND_MAX_NUM_OS_INSTANCES; i++) {
+		if (md.mcos[i]) {
+			mcos_deactivate(&md, md.mcos[i]);
+			close(md.mcos[i]->timer.fd);
+			drop_pending(md.mcos[i]);
+			free(md.mcos[i]);
 		}
 	}
- out_early:
-	if (evfd_mcos != -1) {
-		close(evfd_mcos);
+	if (md.mon_mcos) {
+		/* Closes evfd_mcos */
+		udev_monitor_unref(md.mon_mcos);
+	}
+	if (md.udev) {
+		udev_unref(md.udev);
+	}
+	if (md.sink.fd != -1) {
+		close(md.sink.fd);
+	} else {
+		closelog();
 	}
-	if (epfd != -1) {
-		close(epfd);
+	if (md.epfd != -1) {
+		close(md.epfd);
 	}
+	free(md.kmsg_buf);
 	return ret;
 }
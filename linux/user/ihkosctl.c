@@ -19,9 +19,12 @@
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
 #include <linux/limits.h>
 #include <ihk/ihklib.h>
 #include <ihk/ihklib_private.h>
+#include <ihk/ihkbatch.h>
+#include <ihk/ihkuncore.h>
 
 int __argc;
 char **__argv;
@@ -58,6 +61,9 @@ static int usage(char **arg)
 	else
 		cmd = arg[0];
 	fprintf(stderr, "Usage: %s (dev #) (action)\n", cmd);
+	fprintf(stderr, "       %s (dev #) -f (script|-) [-k] [-t]\n", cmd);
+	fprintf(stderr, "        script: actions below, one per line, on this OS only;\n");
+	fprintf(stderr, "        reserve and create are steps of an ihkconfig script\n");
 	fprintf(stderr, "action:\n");
 	fprintf(stderr, "    load (kernel.img)\n");
 	fprintf(stderr, "    boot\n");
@@ -70,6 +76,16 @@ static int usage(char **arg)
 	fprintf(stderr, "            mem (size@NUMA) \n");
 	fprintf(stderr, "    set ikc_map (cpu_list:cpu+cpu_list:cpu+..) \n");
 	fprintf(stderr, "    get ikc_map\n");
+	fprintf(stderr, "    set ikc_master_cpu (cpu|auto) \n");
+	fprintf(stderr, "    get ikc_master_cpu\n");
+	fprintf(stderr, "    set pwr (cpu_list) (key=val,...) \n");
+	fprintf(stderr, "        key: min_perf|max_perf|epp|epb|turbo|cstate_limit, val: number or keep\n");
+	fprintf(stderr, "    get pwr [interval_ms]\n");
+	fprintf(stderr, "    set debug (none|all|mask|category,...) \n");
+	fprintf(stderr, "        category: ikc|mikc|smp|mem\n");
+	fprintf(stderr, "    get debug\n");
+	fprintf(stderr, "    set group (group id) \n");
+	fprintf(stderr, "    get group\n");
 	fprintf(stderr, "    query [cpu|mem]\n");
 	fprintf(stderr, "    query_free_mem\n");
 	fprintf(stderr, "    kargs (kernel arg)\n");
@@ -78,6 +94,7 @@ static int usage(char **arg)
 	fprintf(stderr, "    clear_kmsg\n");
 	fprintf(stderr, "    intr cpu irq_vector\n");
 	fprintf(stderr, "    ioctl (req) (arg)\n");
+	fprintf(stderr, "    uncore [-i interval_ms] [-n count] [-a] [-e (read|write|link)=pmu/terms/[*bytes]]...\n");
 #ifdef ENABLE_MEMDUMP
 	fprintf(stderr, "    dump [-d level] [file]\n");
 #endif /* ENABLE_MEMDUMP */
@@ -177,6 +194,195 @@ static int do_get_ikc_map(int index)
 	goto fn_exit;
 }
 
+static const char * const debug_names[IHK_DEBUG_NR] = IHK_DEBUG_NAMES;
+
+static int do_get_debug(int index)
+{
+	int ret = 0;
+	int fd = -1;
+	char fn[128];
+	int mask, bit, n = 0;
+
+	sprintf(fn, "/dev/mcos%d", index);
+
+	fd = open(fn, O_RDONLY);
+	IHKOSCTL_CHKANDJUMP(fd < 0, "open", -1);
+
+	mask = ioctl(fd, IHK_OS_GET_DEBUG_MASK);
+	IHKOSCTL_CHKANDJUMP(mask < 0, "IHK_OS_GET_DEBUG_MASK", -1);
+
+	for (bit = 0; bit < IHK_DEBUG_NR; bit++) {
+		if (mask & (1U << bit)) {
+			printf("%s%s", n++ ? "," : "", debug_names[bit]);
+		}
+	}
+	printf("%s\n", n ? "" : "none");
+
+ fn_exit:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+ fn_fail:
+	goto fn_exit;
+}
+
+static int do_get_group(int index)
+{
+	int ret = 0;
+	int fd = -1;
+	char fn[128];
+	int group;
+
+	sprintf(fn, "/dev/mcos%d", index);
+
+	fd = open(fn, O_RDONLY);
+	IHKOSCTL_CHKANDJUMP(fd < 0, "open", -1);
+
+	group = ioctl(fd, IHK_OS_GET_GROUP);
+	IHKOSCTL_CHKANDJUMP(group < 0, "IHK_OS_GET_GROUP", -1);
+
+	printf("%d\n", group);
+
+ fn_exit:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+ fn_fail:
+	goto fn_exit;
+}
+
+static int do_get_ikc_master_cpu(int index)
+{
+	int ret = 0;
+	int fd = -1;
+	char fn[128];
+	int cpu;
+
+	sprintf(fn, "/dev/mcos%d", index);
+
+	fd = open(fn, O_RDONLY);
+	IHKOSCTL_CHKANDJUMP(fd < 0, "open", -1);
+
+	ret = ioctl(fd, IHK_OS_GET_IKC_MASTER_CPU, &cpu);
+	IHKOSCTL_CHKANDJUMP(ret != 0, "IHK_OS_GET_IKC_MASTER_CPU", -1);
+
+	if (cpu == IHK_IKC_MASTER_CPU_AUTO) {
+		printf("auto\n");
+	}
+	else {
+		printf("%d\n", cpu);
+	}
+
+ fn_exit:
+	if (fd != -1) {
+		close(fd);
+	}
+	return ret;
+ fn_fail:
+	goto fn_exit;
+}
+
+static void print_pwr_knob(int val)
+{
+	if (val == IHK_PWR_KEEP) {
+		printf(" %6s", "-");
+	}
+	else {
+		printf(" %6d", val);
+	}
+}
+
+static int do_get_pwr(int index)
+{
+	int ret = 0, i, num_cpus;
+	int *cpus = NULL;
+	struct ihk_pwr_stat *stats[2] = { NULL, NULL };
+	struct timespec ts[2];
+	long interval_ms = 100;
+	double elapsed_us;
+	char *endp;
+
+	if (__argc > 4) {
+		interval_ms = strtol(__argv[4], &endp, 10);
+		IHKOSCTL_CHKANDJUMP(*__argv[4] == '\0' || *endp != '\0' ||
+				    interval_ms <= 0, "parse interval", -1);
+	}
+
+	num_cpus = ihk_os_get_num_assigned_cpus(index);
+	IHKOSCTL_CHKANDJUMP(num_cpus <= 0,
+			    "ihk_os_get_num_assigned_cpus", -1);
+
+	cpus = calloc(sizeof(int), num_cpus);
+	IHKOSCTL_CHKANDJUMP(!cpus, "allocate request space", -1);
+
+	ret = ihk_os_query_cpu(index, cpus, num_cpus);
+	IHKOSCTL_CHKANDJUMP(ret != 0, "ihk_os_query_cpu", -1);
+
+	for (i = 0; i < 2; i++) {
+		int j;
+
+		stats[i] = calloc(sizeof(struct ihk_pwr_stat), num_cpus);
+		IHKOSCTL_CHKANDJUMP(!stats[i], "allocate request space", -1);
+
+		for (j = 0; j < num_cpus; j++) {
+			stats[i][j].cpu = cpus[j];
+		}
+	}
+
+	/* Effective frequency is TSC rate * delta APERF / delta MPERF */
+	clock_gettime(CLOCK_MONOTONIC, &ts[0]);
+	ret = ihk_os_get_pwr(index, stats[0], num_cpus);
+	IHKOSCTL_CHKANDJUMP(ret != 0, "ihk_os_get_pwr", -1);
+
+	if (stats[0][0].running) {
+		usleep(interval_ms * 1000);
+		clock_gettime(CLOCK_MONOTONIC, &ts[1]);
+		ret = ihk_os_get_pwr(index, stats[1], num_cpus);
+		IHKOSCTL_CHKANDJUMP(ret != 0, "ihk_os_get_pwr", -1);
+	}
+	else {
+		ts[1] = ts[0];
+		memcpy(stats[1], stats[0], sizeof(struct ihk_pwr_stat) * num_cpus);
+	}
+
+	elapsed_us = (ts[1].tv_sec - ts[0].tv_sec) * 1000000.0 +
+		(ts[1].tv_nsec - ts[0].tv_nsec) / 1000.0;
+
+	printf("%5s %6s %6s %6s %6s %6s %6s %8s\n", "cpu", "min", "max",
+	       "epp", "epb", "turbo", "cstate", "MHz");
+	for (i = 0; i < num_cpus; i++) {
+		struct ihk_pwr_stat *s0 = &stats[0][i], *s1 = &stats[1][i];
+
+		printf("%5d", s1->cpu);
+		print_pwr_knob(s1->setting.min_perf);
+		print_pwr_knob(s1->setting.max_perf);
+		print_pwr_knob(s1->setting.epp);
+		print_pwr_knob(s1->setting.epb);
+		print_pwr_knob(s1->setting.turbo);
+		print_pwr_knob(s1->setting.cstate_limit);
+
+		if (s0->running && s1->running && s1->mperf != s0->mperf &&
+		    elapsed_us > 0) {
+			printf(" %8.0f\n", (s1->tsc - s0->tsc) / elapsed_us *
+			       (s1->aperf - s0->aperf) /
+			       (s1->mperf - s0->mperf));
+		}
+		else {
+			printf(" %8s\n", "-");
+		}
+	}
+
+ fn_exit:
+	free(cpus);
+	free(stats[0]);
+	free(stats[1]);
+	return ret;
+ fn_fail:
+	goto fn_exit;
+}
+
 static int do_get_buildid(int index)
 {
 	int ret = 0;
@@ -214,6 +420,14 @@ static int do_get(int index)
 		return do_get_status(index);
 	} else if (!strcmp(__argv[3], "ikc_map")) {
 		return do_get_ikc_map(index);
+	} else if (!strcmp(__argv[3], "ikc_master_cpu")) {
+		return do_get_ikc_master_cpu(index);
+	} else if (!strcmp(__argv[3], "pwr")) {
+		return do_get_pwr(index);
+	} else if (!strcmp(__argv[3], "debug")) {
+		return do_get_debug(index);
+	} else if (!strcmp(__argv[3], "group")) {
+		return do_get_group(index);
 	} else if (!strcmp(__argv[3], "buildid")) {
 		return do_get_buildid(index);
 	} else {
@@ -372,6 +586,211 @@ static int do_set_ikc_map(int fd)
 	goto fn_exit;
 }
 
+static int do_set_ikc_master_cpu(int fd)
+{
+	int ret, cpu;
+	char *endp;
+
+	if (__argc < 5) {
+		usage(__argv);
+		return -1;
+	}
+
+	if (!strcmp(__argv[4], "auto")) {
+		cpu = IHK_IKC_MASTER_CPU_AUTO;
+	}
+	else {
+		cpu = strtol(__argv[4], &endp, 10);
+		IHKOSCTL_CHKANDJUMP(*__argv[4] == '\0' || *endp != '\0' ||
+				    cpu < 0, "parse provided cpu", -1);
+	}
+
+	ret = ioctl(fd, IHK_OS_SET_IKC_MASTER_CPU, cpu);
+	if (ret != 0) {
+		fprintf(stderr, "error: setting master channel CPU: %s\n",
+			__argv[4]);
+	}
+
+ fn_exit:
+	dprintf("ret = %d\n", ret);
+	return ret;
+ fn_fail:
+	goto fn_exit;
+}
+
+static int do_set_pwr(int fd)
+{
+	int ret, cnt;
+	struct ihk_cpu_req req_cpu = { 0 };
+	struct ihk_pwr_req req_pwr;
+	char *str = NULL, *tok, *saveptr, *endp;
+
+	if (__argc < 6) {
+		usage(__argv);
+		return -1;
+	}
+
+	cnt = cpu_str2count(__argv[4]);
+	IHKOSCTL_CHKANDJUMP(cnt <= 0, "get num of requested cpus", -1);
+
+	req_cpu.cpus = calloc(sizeof(int), cnt);
+	IHKOSCTL_CHKANDJUMP(!req_cpu.cpus, "allocate request space", -1);
+
+	ret = cpu_str2req(__argv[4], cnt, &req_cpu);
+	IHKOSCTL_CHKANDJUMP(ret < 0, "parse provided cpulist string", -1);
+
+	req_pwr.cpus = req_cpu.cpus;
+	req_pwr.num_cpus = req_cpu.num_cpus;
+	req_pwr.setting.min_perf = IHK_PWR_KEEP;
+	req_pwr.setting.max_perf = IHK_PWR_KEEP;
+	req_pwr.setting.epp = IHK_PWR_KEEP;
+	req_pwr.setting.epb = IHK_PWR_KEEP;
+	req_pwr.setting.turbo = IHK_PWR_KEEP;
+	req_pwr.setting.cstate_limit = IHK_PWR_KEEP;
+
+	str = strdup(__argv[5]);
+	IHKOSCTL_CHKANDJUMP(!str, "strdup", -1);
+
+	for (tok = strtok_r(str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		char *val = strchr(tok, '=');
+		int *knob;
+		long n;
+
+		IHKOSCTL_CHKANDJUMP(!val, "parse key=val", -1);
+		*val++ = '\0';
+
+		if (!strcmp(tok, "min_perf")) {
+			knob = &req_pwr.setting.min_perf;
+		} else if (!strcmp(tok, "max_perf")) {
+			knob = &req_pwr.setting.max_perf;
+		} else if (!strcmp(tok, "epp")) {
+			knob = &req_pwr.setting.epp;
+		} else if (!strcmp(tok, "epb")) {
+			knob = &req_pwr.setting.epb;
+		} else if (!strcmp(tok, "turbo")) {
+			knob = &req_pwr.setting.turbo;
+		} else if (!strcmp(tok, "cstate_limit")) {
+			knob = &req_pwr.setting.cstate_limit;
+		} else {
+			fprintf(stderr, "error: unknown key: %s\n", tok);
+			ret = -1;
+			goto fn_fail;
+		}
+
+		if (!strcmp(val, "keep")) {
+			*knob = IHK_PWR_KEEP;
+			continue;
+		}
+
+		if (!strcmp(val, "reset")) {
+			*knob = IHK_PWR_RESET;
+			continue;
+		}
+
+		n = strtol(val, &endp, 0);
+		IHKOSCTL_CHKANDJUMP(*val == '\0' || *endp != '\0' || n < 0 ||
+				    n > INT_MAX, "parse value", -1);
+		*knob = n;
+	}
+
+	ret = ioctl(fd, IHK_OS_SET_PWR, &req_pwr);
+	if (ret != 0) {
+		fprintf(stderr, "error: setting power knobs: %s\n",
+			strerror(errno));
+	}
+
+ fn_exit:
+	free(str);
+	free(req_cpu.cpus);
+	dprintf("ret = %d\n", ret);
+	return ret;
+ fn_fail:
+	goto fn_exit;
+}
+static int do_set_debug(int fd)
+{
+	int ret = 0, bit;
+	unsigned int mask = 0;
+	char *names = NULL, *name, *saveptr, *endp;
+
+	if (__argc < 5) {
+		usage(__argv);
+		return -1;
+	}
+
+	mask = strtoul(__argv[4], &endp, 0);
+	if (*__argv[4] == '\0' || *endp != '\0') {
+		mask = 0;
+		names = strdup(__argv[4]);
+		IHKOSCTL_CHKANDJUMP(!names, "strdup", -1);
+
+		for (name = strtok_r(names, ",", &saveptr); name;
+		     name = strtok_r(NULL, ",", &saveptr)) {
+			if (!strcmp(name, "all")) {
+				mask |= IHK_DEBUG_ALL;
+				continue;
+			}
+			if (!strcmp(name, "none")) {
+				continue;
+			}
+
+			for (bit = 0; bit < IHK_DEBUG_NR; bit++) {
+				if (!strcmp(name, debug_names[bit])) {
+					break;
+				}
+			}
+			if (bit == IHK_DEBUG_NR) {
+				fprintf(stderr, "error: unknown debug category: %s\n",
+					name);
+				ret = -1;
+				goto fn_fail;
+			}
+			mask |= 1U << bit;
+		}
+	}
+
+	IHKOSCTL_CHKANDJUMP(mask & ~IHK_DEBUG_ALL, "parse provided mask", -1);
+
+	ret = ioctl(fd, IHK_OS_SET_DEBUG_MASK, mask);
+	if (ret != 0) {
+		fprintf(stderr, "error: setting debug categories: %s\n",
+			__argv[4]);
+	}
+
+ fn_exit:
+	free(names);
+	dprintf("ret = %d\n", ret);
+	return ret;
+ fn_fail:
+	goto fn_exit;
+}
+
+static int do_set_group(int fd)
+{
+	int ret;
+	int group;
+	char *endp;
+
+	if (__argc < 5) {
+		usage(__argv);
+		return -1;
+	}
+
+	group = strtol(__argv[4], &endp, 0);
+	if (*__argv[4] == '\0' || *endp != '\0') {
+		fprintf(stderr, "error: invalid group id: %s\n", __argv[4]);
+		return -1;
+	}
+
+	ret = ioctl(fd, IHK_OS_SET_GROUP, group);
+	if (ret != 0) {
+		fprintf(stderr, "error: setting group: %s\n", strerror(errno));
+	}
+
+	return ret;
+}
+
 static int do_set(int fd)
 {
 	if (__argc < 4) {
@@ -381,6 +800,14 @@ static int do_set(int fd)
 
 	if (!strcmp(__argv[3], "ikc_map")) {
 		return do_set_ikc_map(fd);
+	} else if (!strcmp(__argv[3], "ikc_master_cpu")) {
+		return do_set_ikc_master_cpu(fd);
+	} else if (!strcmp(__argv[3], "pwr")) {
+		return do_set_pwr(fd);
+	} else if (!strcmp(__argv[3], "debug")) {
+		return do_set_debug(fd);
+	} else if (!strcmp(__argv[3], "group")) {
+		return do_set_group(fd);
 	} else {
         fprintf(stderr, "Unknown target : %s\n", __argv[3]);
 		usage(__argv);
@@ -745,6 +1172,45 @@ static int do_ioctl(int fd)
 	return r;
 }
 
+static int do_uncore(int os_index)
+{
+	struct ihkuncore_opts opts = {
+		.interval_ms = 1000,
+	};
+	int opt;
+
+	while ((opt = getopt(__argc - 2, __argv + 2, "i:n:ae:")) != -1) {
+		switch (opt) {
+		case 'i':
+			opts.interval_ms = atoi(optarg);
+			break;
+		case 'n':
+			opts.count = atoi(optarg);
+			break;
+		case 'a':
+			opts.all_sockets = 1;
+			break;
+		case 'e':
+			if (opts.nr_user_events == IHKUNCORE_MAX_USER_EVENTS) {
+				fprintf(stderr, "error: too many events\n");
+				return 1;
+			}
+			opts.user_events[opts.nr_user_events++] = optarg;
+			break;
+		default:
+			usage(__argv);
+			return 1;
+		}
+	}
+
+	if (opts.interval_ms == 0 || opts.count < 0) {
+		usage(__argv);
+		return 1;
+	}
+
+	return ihkuncore_run(os_index, &opts) ? 1 : 0;
+}
+
 #ifdef ENABLE_MEMDUMP
 #include <inttypes.h>
 #include <time.h>
@@ -822,12 +1288,55 @@ static int do_dump(int osfd)
 }
 #endif /* ENABLE_MEMDUMP */
 
+static const struct ihkbatch_cmd batch_cmds[] = {
+	{ .name = "get", .func_with_index = do_get },
+	{ .name = "dump", .func_with_index = do_dump },
+	{ .name = "kmsg", .func_with_index = do_kmsg },
+	{ .name = "uncore", .func_with_index = do_uncore },
+	{ .name = "load", .func = do_load },
+	{ .name = "boot", .func = do_boot },
+	{ .name = "shutdown", .func = do_shutdown },
+	{ .name = "alloc", .func = do_alloc },
+	{ .name = "reserve_cpu", .func = do_reserve_cpu },
+	{ .name = "reserve_mem", .func = do_reserve_mem },
+	{ .name = "assign", .func = do_assign },
+	{ .name = "release", .func = do_release },
+	{ .name = "set", .func = do_set },
+	{ .name = "query", .func = do_query },
+	{ .name = "query_free_mem", .func = do_query_free_mem },
+	{ .name = "kargs", .func = do_kargs },
+	{ .name = "clear_kmsg", .func = do_clear_kmsg },
+	{ .name = "intr", .func = do_intr },
+	{ .name = "ioctl", .func = do_ioctl },
+	{ NULL }
+};
+
+static int do_batch(struct ihkbatch_opts *opts)
+{
+	int fd, r;
+	char fn[128];
+
+	sprintf(fn, "/dev/mcos%d", atoi(__argv[1]));
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		perror("error: open failed");
+		return 1;
+	}
+
+	r = ihkbatch_run(opts, __argv[0], __argv[1], "OS", fd, batch_cmds,
+			 &__argc, &__argv);
+	close(fd);
+	return r;
+}
+
 #define HANDLER_WITH_INDEX(name) if (!strcmp(argv[2], #name)) { int r = do_##name(atoi(argv[1])); return r; }
 #define HANDLER(name) if (!strcmp(argv[2], #name)) { int r = do_##name(fd); close(fd); return r; }
 int main(int argc, char **argv)
 {
 	int fd;
 	char fn[128];
+	struct ihkbatch_opts batch_opts;
 
 	__argc = argc;
 	__argv = argv;
@@ -837,9 +1346,18 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	switch (ihkbatch_parse_opts(argc, argv, &batch_opts)) {
+	case 1:
+		return do_batch(&batch_opts);
+	case -1:
+		usage(argv);
+		return 1;
+	}
+
 	HANDLER_WITH_INDEX(get)
 	else HANDLER_WITH_INDEX(dump)
 	else HANDLER_WITH_INDEX(kmsg)
+	else HANDLER_WITH_INDEX(uncore)
 
 	sprintf(fn, "/dev/mcos%d", atoi(argv[1]));
 
@@ -0,0 +1,850 @@
+/**
+ * \file ihkuncore.c
+ *  License details are found in the file LICENSE.
+ * \brief
+ *  Samples the uncore PMUs (memory controllers and socket interconnect)
+ *  of the sockets hosting the NUMA nodes of an OS instance
+ *
+ *  Uncore counters count the traffic of the whole socket, i.e. Linux
+ *  and the LWK together. The traffic is attributed to the OS instance
+ *  through the sockets of its CPUs and memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <ihk/ihklib.h>
+#include <ihk/ihkuncore.h>
+
+#define PMU_SYSFS "/sys/bus/event_source/devices"
+#define NODE_SYSFS "/sys/devices/system/node"
+#define CPU_SYSFS "/sys/devices/system/cpu"
+
+#define UNCORE_MAX_NODES 1024
+#define UNCORE_MAX_PKGS 256
+#define UNCORE_MAX_CPUS 8192
+
+enum uncore_kind {
+	UNCORE_READ,
+	UNCORE_WRITE,
+	UNCORE_LINK,
+	UNCORE_NR_KINDS
+};
+
+static const char * const uncore_kind_str[UNCORE_NR_KINDS] = {
+	"read", "write", "link"
+};
+
+/*
+ * Events used when the PMUs are present. An alias is looked up in
+ * the events directory of the PMU, its .scale and .unit give the bytes
+ * per count. Otherwise terms are used with bytes_per_count.
+ */
+struct uncore_event_def {
+	const char *pmu_prefix;
+	int kind;
+	const char *alias;
+	const char *terms;
+	double bytes_per_count;
+};
+
+static const struct uncore_event_def uncore_builtin_events[] = {
+	/* Intel Xeon memory controller, CAS commands */
+	{ "uncore_imc_", UNCORE_READ, "cas_count_read", NULL, 0 },
+	{ "uncore_imc_", UNCORE_WRITE, "cas_count_write", NULL, 0 },
+	/* Intel Xeon UPI, TxL_FLITS.ALL_DATA, 9 flits per cache line */
+	{ "uncore_upi_", UNCORE_LINK, NULL, "event=0x02,umask=0x0f",
+	  64.0 / 9 },
+	/* AMD Zen 4 and later memory controller, CAS commands */
+	{ "amd_umc_", UNCORE_READ, NULL, "event=0x0a,rdwrmask=0x1", 64 },
+	{ "amd_umc_", UNCORE_WRITE, NULL, "event=0x0a,rdwrmask=0x2", 64 },
+	{ NULL }
+};
+
+struct uncore_counter {
+	struct uncore_counter *next;
+	int fd;
+	int pkg;
+	int kind;
+	double bytes_per_count;
+	uint64_t prev;
+};
+
+static volatile sig_atomic_t uncore_stop;
+
+static void uncore_sigint(int sig)
+{
+	uncore_stop = 1;
+}
+
+static int read_sysfs(const char *path, char *buf, size_t size)
+{
+	FILE *fp;
+	size_t len;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		return -errno;
+	}
+
+	len = fread(buf, 1, size - 1, fp);
+	fclose(fp);
+
+	buf[len] = '\0';
+	while (len > 0 && isspace((unsigned char)buf[len - 1])) {
+		buf[--len] = '\0';
+	}
+
+	return 0;
+}
+
+/* Set the bits of a "0-3,8,16-31"-style list */
+static int parse_list(const char *str, char *set, int max)
+{
+	const char *p = str;
+
+	while (*p) {
+		char *end;
+		long first, last, i;
+
+		first = strtol(p, &end, 10);
+		if (end == p) {
+			return -EINVAL;
+		}
+		last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			if (end == p + 1) {
+				return -EINVAL;
+			}
+			p = end;
+		}
+		if (first < 0 || last >= max || first > last) {
+			return -ERANGE;
+		}
+		for (i = first; i <= last; i++) {
+			set[i] = 1;
+		}
+		if (*p == ',') {
+			p++;
+		}
+		else if (*p) {
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int cpu_pkg(int cpu)
+{
+	char path[PATH_MAX];
+	char buf[32];
+
+	snprintf(path, sizeof(path),
+		 CPU_SYSFS "/cpu%d/topology/physical_package_id", cpu);
+	if (read_sysfs(path, buf, sizeof(buf))) {
+		return -1;
+	}
+
+	return atoi(buf);
+}
+
+static int cpu_node(int cpu)
+{
+	char path[PATH_MAX];
+	struct dirent *ent;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir) {
+		return -1;
+	}
+
+	while ((ent = readdir(dir))) {
+		if (!strncmp(ent->d_name, "node", 4) &&
+		    isdigit((unsigned char)ent->d_name[4])) {
+			node = atoi(ent->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+
+	return node;
+}
+
+/*
+ * Package of a node without online CPUs, e.g. with all of them reserved
+ * or with memory only: the one of its nearest nodes with online CPUs,
+ * when they agree on it and are closer than the other nodes. -1 if the
+ * distances don't tell.
+ */
+static int node_pkg_by_distance(int node, const int *cpu_node_pkg)
+{
+	char path[PATH_MAX];
+	char buf[8192];
+	char *p, *end;
+	int other, dist, min = INT_MAX, max = 0, pkg = -1;
+
+	snprintf(path, sizeof(path), NODE_SYSFS "/node%d/distance", node);
+	if (read_sysfs(path, buf, sizeof(buf))) {
+		return -1;
+	}
+
+	for (p = buf, other = 0; other < UNCORE_MAX_NODES; p = end, other++) {
+		dist = strtol(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		if (other == node) {
+			continue;
+		}
+		if (dist > max) {
+			max = dist;
+		}
+		if (cpu_node_pkg[other] < 0) {
+			continue;
+		}
+		if (dist < min) {
+			min = dist;
+			pkg = cpu_node_pkg[other];
+		}
+		else if (dist == min && pkg != cpu_node_pkg[other]) {
+			pkg = -2;
+		}
+	}
+
+	return (pkg >= 0 && min < max) ? pkg : -1;
+}
+
+/*
+ * Socket of each NUMA node, taken from its first online CPU or else
+ * from the NUMA distances
+ */
+static int map_node_pkgs(int *node_pkg)
+{
+	static char cpus[UNCORE_MAX_CPUS];
+	static int cpu_node_pkg[UNCORE_MAX_NODES];
+	char path[PATH_MAX];
+	char buf[4096];
+	int node, cpu, pkg = -1, multi_pkg = 0;
+
+	for (node = 0; node < UNCORE_MAX_NODES; node++) {
+		node_pkg[node] = -1;
+
+		snprintf(path, sizeof(path), NODE_SYSFS "/node%d/cpulist",
+			 node);
+		if (read_sysfs(path, buf, sizeof(buf))) {
+			continue;
+		}
+
+		memset(cpus, 0, sizeof(cpus));
+		if (parse_list(buf, cpus, UNCORE_MAX_CPUS)) {
+			continue;
+		}
+
+		for (cpu = 0; cpu < UNCORE_MAX_CPUS; cpu++) {
+			if (cpus[cpu] && (node_pkg[node] = cpu_pkg(cpu)) >= 0) {
+				break;
+			}
+		}
+	}
+
+	/* The other nodes are derived from these only */
+	memcpy(cpu_node_pkg, node_pkg, sizeof(cpu_node_pkg));
+	for (node = 0; node < UNCORE_MAX_NODES; node++) {
+		if (cpu_node_pkg[node] < 0) {
+			continue;
+		}
+		if (pkg < 0) {
+			pkg = cpu_node_pkg[node];
+		}
+		else if (cpu_node_pkg[node] != pkg) {
+			multi_pkg = 1;
+		}
+	}
+
+	for (node = 0; node < UNCORE_MAX_NODES; node++) {
+		if (node_pkg[node] >= 0) {
+			continue;
+		}
+
+		snprintf(path, sizeof(path), NODE_SYSFS "/node%d", node);
+		if (access(path, F_OK)) {
+			continue;
+		}
+
+		/* With a single package there's nothing to choose from */
+		node_pkg[node] = !multi_pkg ? pkg :
+			node_pkg_by_distance(node, cpu_node_pkg);
+	}
+
+	return 0;
+}
+
+/* NUMA nodes with CPUs or memory of the OS instance */
+static int get_lwk_nodes(int os_index, char *lwk_node)
+{
+	struct ihk_mem_chunk *chunks = NULL;
+	int *cpus = NULL;
+	int nr_chunks, nr_cpus, i;
+	int ret;
+
+	nr_chunks = ihk_os_get_num_assigned_mem_chunks(os_index);
+	if (nr_chunks < 0) {
+		ret = nr_chunks;
+		goto out;
+	}
+
+	if (nr_chunks > 0) {
+		chunks = calloc(nr_chunks, sizeof(*chunks));
+		if (!chunks) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		ret = ihk_os_query_mem(os_index, chunks, nr_chunks);
+		if (ret) {
+			goto out;
+		}
+
+		for (i = 0; i < nr_chunks; i++) {
+			if (chunks[i].numa_node_number >= 0 &&
+			    chunks[i].numa_node_number < UNCORE_MAX_NODES) {
+				lwk_node[chunks[i].numa_node_number] = 1;
+			}
+		}
+	}
+
+	nr_cpus = ihk_os_get_num_assigned_cpus(os_index);
+	if (nr_cpus < 0) {
+		ret = nr_cpus;
+		goto out;
+	}
+
+	if (nr_cpus > 0) {
+		cpus = calloc(nr_cpus, sizeof(*cpus));
+		if (!cpus) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		ret = ihk_os_query_cpu(os_index, cpus, nr_cpus);
+		if (ret) {
+			goto out;
+		}
+
+		for (i = 0; i < nr_cpus; i++) {
+			int node = cpu_node(cpus[i]);
+
+			if (node >= 0 && node < UNCORE_MAX_NODES) {
+				lwk_node[node] = 1;
+			}
+		}
+	}
+
+	ret = 0;
+ out:
+	free(chunks);
+	free(cpus);
+	return ret;
+}
+
+/*
+ * Place value into the bits of attr described by format/<name>
+ * of the PMU, e.g. "config:0-7,32-35".
+ */
+static int apply_format(const char *pmu, const char *name, uint64_t value,
+			struct perf_event_attr *attr)
+{
+	char path[PATH_MAX];
+	char buf[256];
+	char *p;
+	uint64_t *config;
+	int shift = 0;
+
+	snprintf(path, sizeof(path), PMU_SYSFS "/%s/format/%s", pmu, name);
+	if (read_sysfs(path, buf, sizeof(buf))) {
+		fprintf(stderr, "error: %s: unknown term %s\n", pmu, name);
+		return -EINVAL;
+	}
+
+	if (!strncmp(buf, "config:", 7)) {
+		config = (uint64_t *)&attr->config;
+		p = buf + 7;
+	}
+	else if (!strncmp(buf, "config1:", 8)) {
+		config = (uint64_t *)&attr->config1;
+		p = buf + 8;
+	}
+	else if (!strncmp(buf, "config2:", 8)) {
+		config = (uint64_t *)&attr->config2;
+		p = buf + 8;
+	}
+	else {
+		fprintf(stderr, "error: %s: unsupported format %s\n",
+			pmu, buf);
+		return -EINVAL;
+	}
+
+	while (*p) {
+		char *end;
+		long lo, hi, bit;
+
+		lo = strtol(p, &end, 10);
+		hi = lo;
+		if (*end == '-') {
+			hi = strtol(end + 1, &end, 10);
+		}
+		if (lo < 0 || hi > 63 || lo > hi) {
+			return -EINVAL;
+		}
+
+		for (bit = lo; bit <= hi; bit++, shift++) {
+			if (shift < 64 && (value >> shift) & 1) {
+				*config |= 1ULL << bit;
+			}
+		}
+
+		p = end;
+		if (*p == ',') {
+			p++;
+		}
+		else if (*p) {
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/* "event=0x04,umask=0x03,edge" */
+static int parse_terms(const char *pmu, const char *terms,
+		       struct perf_event_attr *attr)
+{
+	char *dup, *term, *save;
+	int ret = 0;
+
+	dup = strdup(terms);
+	if (!dup) {
+		return -ENOMEM;
+	}
+
+	for (term = strtok_r(dup, ",", &save); term;
+	     term = strtok_r(NULL, ",", &save)) {
+		char *eq = strchr(term, '=');
+		uint64_t value = 1;
+
+		if (eq) {
+			*eq = '\0';
+			value = strtoull(eq + 1, NULL, 0);
+		}
+
+		ret = apply_format(pmu, term, value, attr);
+		if (ret) {
+			break;
+		}
+	}
+
+	free(dup);
+	return ret;
+}
+
+/* Terms and bytes per count of a sysfs event alias */
+static int read_alias(const char *pmu, const char *alias,
+		      char *terms, size_t size, double *bytes_per_count)
+{
+	char path[PATH_MAX];
+	char buf[64];
+
+	snprintf(path, sizeof(path), PMU_SYSFS "/%s/events/%s", pmu, alias);
+	if (read_sysfs(path, terms, size)) {
+		return -ENOENT;
+	}
+
+	*bytes_per_count = 1;
+	snprintf(path, sizeof(path), PMU_SYSFS "/%s/events/%s.scale",
+		 pmu, alias);
+	if (!read_sysfs(path, buf, sizeof(buf))) {
+		*bytes_per_count = strtod(buf, NULL);
+	}
+
+	snprintf(path, sizeof(path), PMU_SYSFS "/%s/events/%s.unit",
+		 pmu, alias);
+	if (!read_sysfs(path, buf, sizeof(buf))) {
+		if (!strcmp(buf, "MiB")) {
+			*bytes_per_count *= 1024 * 1024;
+		}
+		else if (!strcmp(buf, "KiB")) {
+			*bytes_per_count *= 1024;
+		}
+	}
+
+	return 0;
+}
+
+/* Open the event on each CPU of the PMU's cpumask, one per socket */
+static int open_pmu_event(const char *pmu, int kind, const char *terms,
+			  double bytes_per_count,
+			  struct uncore_counter **counters)
+{
+	static char cpus[UNCORE_MAX_CPUS];
+	struct perf_event_attr attr;
+	char path[PATH_MAX];
+	char buf[4096];
+	int type, cpu, nr_opened = 0;
+	int ret;
+
+	snprintf(path, sizeof(path), PMU_SYSFS "/%s/type", pmu);
+	ret = read_sysfs(path, buf, sizeof(buf));
+	if (ret) {
+		return ret;
+	}
+	type = atoi(buf);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.disabled = 1;
+	ret = parse_terms(pmu, terms, &attr);
+	if (ret) {
+		return ret;
+	}
+
+	snprintf(path, sizeof(path), PMU_SYSFS "/%s/cpumask", pmu);
+	if (read_sysfs(path, buf, sizeof(buf))) {
+		strcpy(buf, "0");
+	}
+
+	memset(cpus, 0, sizeof(cpus));
+	ret = parse_list(buf, cpus, UNCORE_MAX_CPUS);
+	if (ret) {
+		return ret;
+	}
+
+	for (cpu = 0; cpu < UNCORE_MAX_CPUS; cpu++) {
+		struct uncore_counter *c;
+		int fd;
+
+		if (!cpus[cpu]) {
+			continue;
+		}
+
+		fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+		if (fd < 0) {
+			ret = -errno;
+			fprintf(stderr, "error: %s: perf_event_open on CPU %d: %s\n",
+				pmu, cpu, strerror(errno));
+			return ret;
+		}
+
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			close(fd);
+			return -ENOMEM;
+		}
+
+		c->fd = fd;
+		c->pkg = cpu_pkg(cpu);
+		c->kind = kind;
+		c->bytes_per_count = bytes_per_count;
+		c->next = *counters;
+		*counters = c;
+		nr_opened++;
+	}
+
+	return nr_opened;
+}
+
+static int open_event_def(const struct uncore_event_def *def,
+			  struct uncore_counter **counters)
+{
+	struct dirent *ent;
+	DIR *dir;
+	size_t len = strlen(def->pmu_prefix);
+	int nr_opened = 0;
+	int ret = 0;
+
+	dir = opendir(PMU_SYSFS);
+	if (!dir) {
+		return -errno;
+	}
+
+	while ((ent = readdir(dir))) {
+		char terms[256];
+		double bytes_per_count = def->bytes_per_count;
+
+		if (strncmp(ent->d_name, def->pmu_prefix, len)) {
+			continue;
+		}
+
+		/* e.g. uncore_imc_free_running_0 for uncore_imc_ */
+		if (len > 0 && def->pmu_prefix[len - 1] == '_' &&
+		    !isdigit((unsigned char)ent->d_name[len])) {
+			continue;
+		}
+
+		if (def->alias) {
+			if (read_alias(ent->d_name, def->alias, terms,
+				       sizeof(terms), &bytes_per_count)) {
+				continue;
+			}
+		}
+		else {
+			snprintf(terms, sizeof(terms), "%s", def->terms);
+		}
+
+		ret = open_pmu_event(ent->d_name, def->kind, terms,
+				     bytes_per_count, counters);
+		if (ret < 0) {
+			break;
+		}
+		nr_opened += ret;
+	}
+	closedir(dir);
+
+	return ret < 0 ? ret : nr_opened;
+}
+
+/* "(read|write|link)=pmu/terms/[*bytes]", pmu is a prefix as well */
+static int open_user_event(const char *spec, struct uncore_counter **counters)
+{
+	struct uncore_event_def def = { 0 };
+	char *dup, *pmu, *terms, *rest;
+	int ret = -EINVAL;
+
+	dup = strdup(spec);
+	if (!dup) {
+		return -ENOMEM;
+	}
+
+	pmu = strchr(dup, '=');
+	if (!pmu) {
+		goto out;
+	}
+	*pmu++ = '\0';
+
+	for (def.kind = 0; def.kind < UNCORE_NR_KINDS; def.kind++) {
+		if (!strcmp(dup, uncore_kind_str[def.kind])) {
+			break;
+		}
+	}
+	if (def.kind == UNCORE_NR_KINDS) {
+		goto out;
+	}
+
+	terms = strchr(pmu, '/');
+	if (!terms) {
+		goto out;
+	}
+	*terms++ = '\0';
+
+	rest = strchr(terms, '/');
+	if (!rest) {
+		goto out;
+	}
+	*rest++ = '\0';
+
+	def.bytes_per_count = 1;
+	if (*rest == '*') {
+		def.bytes_per_count = strtod(rest + 1, NULL);
+	}
+	else if (*rest) {
+		goto out;
+	}
+
+	def.pmu_prefix = pmu;
+	def.terms = terms;
+	ret = open_event_def(&def, counters);
+	if (ret == 0) {
+		fprintf(stderr, "error: no PMU matches %s\n", pmu);
+		ret = -ENOENT;
+	}
+ out:
+	if (ret == -EINVAL) {
+		fprintf(stderr, "error: invalid event: %s\n", spec);
+	}
+	free(dup);
+	return ret;
+}
+
+static void print_header(const int *node_pkg, const char *lwk_node,
+			 const char *report_pkg)
+{
+	int pkg, node, kind;
+
+	printf("# socket: NUMA nodes (* with LWK CPUs or memory)\n");
+	for (pkg = 0; pkg < UNCORE_MAX_PKGS; pkg++) {
+		int first = 1;
+
+		if (!report_pkg[pkg]) {
+			continue;
+		}
+
+		printf("# %d:", pkg);
+		for (node = 0; node < UNCORE_MAX_NODES; node++) {
+			if (node_pkg[node] != pkg) {
+				continue;
+			}
+			printf("%s%d%s", first ? " " : ",", node,
+			       lwk_node[node] ? "*" : "");
+			first = 0;
+		}
+		printf("\n");
+	}
+
+	printf("%10s %6s", "time", "socket");
+	for (kind = 0; kind < UNCORE_NR_KINDS; kind++) {
+		printf(" %9s MB/s", uncore_kind_str[kind]);
+	}
+	printf("\n");
+}
+
+static double elapsed_sec(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+int ihkuncore_run(int os_index, const struct ihkuncore_opts *opts)
+{
+	static int node_pkg[UNCORE_MAX_NODES];
+	static char lwk_node[UNCORE_MAX_NODES];
+	static char report_pkg[UNCORE_MAX_PKGS];
+	static char has_kind[UNCORE_MAX_PKGS][UNCORE_NR_KINDS];
+	static double bytes[UNCORE_MAX_PKGS][UNCORE_NR_KINDS];
+	struct uncore_counter *counters = NULL, *c, *next;
+	const struct uncore_event_def *def;
+	struct sigaction sa, old_sa;
+	struct timespec start, prev;
+	int node, pkg, kind, i, nr_samples = 0;
+	int ret;
+
+	memset(lwk_node, 0, sizeof(lwk_node));
+	ret = get_lwk_nodes(os_index, lwk_node);
+	if (ret) {
+		fprintf(stderr, "error: querying the CPUs and memory of OS %d: %d\n",
+			os_index, ret);
+		goto out;
+	}
+
+	map_node_pkgs(node_pkg);
+
+	memset(report_pkg, 0, sizeof(report_pkg));
+	for (node = 0; node < UNCORE_MAX_NODES; node++) {
+		pkg = node_pkg[node];
+		if (pkg >= 0 && pkg < UNCORE_MAX_PKGS &&
+		    (lwk_node[node] || opts->all_sockets)) {
+			report_pkg[pkg] = 1;
+		}
+	}
+
+	for (def = uncore_builtin_events; def->pmu_prefix; def++) {
+		ret = open_event_def(def, &counters);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	for (i = 0; i < opts->nr_user_events; i++) {
+		ret = open_user_event(opts->user_events[i], &counters);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	if (!counters) {
+		fprintf(stderr, "error: no supported uncore PMU found\n");
+		ret = -ENODEV;
+		goto out;
+	}
+
+	memset(has_kind, 0, sizeof(has_kind));
+	for (c = counters; c; c = c->next) {
+		if (c->pkg >= 0 && c->pkg < UNCORE_MAX_PKGS) {
+			has_kind[c->pkg][c->kind] = 1;
+		}
+		ioctl(c->fd, PERF_EVENT_IOC_ENABLE, 0);
+		if (read(c->fd, &c->prev, sizeof(c->prev)) != sizeof(c->prev)) {
+			c->prev = 0;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = uncore_sigint;
+	sigaction(SIGINT, &sa, &old_sa);
+	uncore_stop = 0;
+
+	print_header(node_pkg, lwk_node, report_pkg);
+	fflush(stdout);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	prev = start;
+	while (!uncore_stop && (opts->count == 0 || nr_samples < opts->count)) {
+		double interval;
+
+		usleep(opts->interval_ms * 1000);
+		interval = elapsed_sec(&prev);
+		clock_gettime(CLOCK_MONOTONIC, &prev);
+
+		memset(bytes, 0, sizeof(bytes));
+		for (c = counters; c; c = c->next) {
+			uint64_t val;
+
+			if (read(c->fd, &val, sizeof(val)) != sizeof(val)) {
+				continue;
+			}
+			if (c->pkg >= 0 && c->pkg < UNCORE_MAX_PKGS) {
+				bytes[c->pkg][c->kind] +=
+					(val - c->prev) * c->bytes_per_count;
+			}
+			c->prev = val;
+		}
+
+		for (pkg = 0; pkg < UNCORE_MAX_PKGS; pkg++) {
+			if (!report_pkg[pkg]) {
+				continue;
+			}
+
+			printf("%10.3f %6d", elapsed_sec(&start), pkg);
+			for (kind = 0; kind < UNCORE_NR_KINDS; kind++) {
+				if (has_kind[pkg][kind]) {
+					printf(" %14.1f", bytes[pkg][kind] /
+					       interval / 1000000);
+				}
+				else {
+					printf(" %14s", "-");
+				}
+			}
+			printf("\n");
+		}
+		fflush(stdout);
+		nr_samples++;
+	}
+
+	sigaction(SIGINT, &old_sa, NULL);
+	ret = 0;
+ out:
+	for (c = counters; c; c = next) {
+		next = c->next;
+		close(c->fd);
+		free(c);
+	}
+	return ret;
+}
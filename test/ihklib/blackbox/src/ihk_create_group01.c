@@ -0,0 +1,72 @@
+#include <errno.h>
+#include <string.h>
+#include <ihklib.h>
+#include <ihk/ihk_host_user.h>
+#include "util.h"
+#include "okng.h"
+#include "params.h"
+#include "linux.h"
+
+const char param[] = "name";
+const char *values[] = {
+	"NULL",
+	"empty",
+	"too long",
+	"new",
+	"existing",
+};
+
+int main(int argc, char **argv)
+{
+	int ret;
+	int i;
+	int group = -1;
+	char too_long[IHK_GROUP_NAME_MAX + 1];
+
+	params_getopt(argc, argv);
+
+	memset(too_long, 'a', IHK_GROUP_NAME_MAX);
+	too_long[IHK_GROUP_NAME_MAX] = '\0';
+
+	const char *names_input[] = {
+		NULL,
+		"",
+		too_long,
+		"ihklib_group",
+		"ihklib_group",
+	};
+
+	int ret_expected[] = {
+		-EFAULT,
+		-EINVAL,
+		-EINVAL,
+		1,	/* The first free slot */
+		-EEXIST,
+	};
+
+	/* Precondition */
+	ret = linux_insmod(0);
+	INTERR(ret, "linux_insmod returned %d\n", ret);
+
+	/* Activate and check */
+	for (i = 0; i < 5; i++) {
+		START("test-case: %s: %s\n", param, values[i]);
+
+		ret = ihk_create_group(0, names_input[i]);
+		OKNG(ret == ret_expected[i],
+		     "return value: %d, expected: %d\n",
+		     ret, ret_expected[i]);
+
+		if (ret > 0) {
+			group = ret;
+		}
+	}
+
+	ret = 0;
+ out:
+	if (group > 0) {
+		ihk_destroy_group(0, group);
+	}
+	linux_rmmod(0);
+	return ret;
+}
@@ -0,0 +1,104 @@
+#include <errno.h>
+#include <ihklib.h>
+#include <ihk/ihk_host_user.h>
+#include "util.h"
+#include "okng.h"
+#include "cpu.h"
+#include "params.h"
+#include "linux.h"
+
+const char param[] = "state of group";
+const char *values[] = {
+	"nonexistent",
+	"os instance bound to it",
+	"no os instance bound to it",
+};
+
+int main(int argc, char **argv)
+{
+	int ret;
+	int i;
+	int group = -1;
+	struct cpus cpus = { 0 };
+
+	params_getopt(argc, argv);
+
+	/* Precondition */
+	ret = linux_insmod(0);
+	INTERR(ret, "linux_insmod returned %d\n", ret);
+
+	ret = ihk_create_group(0, "ihklib_group");
+	INTERR(ret <= 0, "ihk_create_group returned %d\n", ret);
+	group = ret;
+
+	ret = _cpus_ls(&cpus, "online", 2, 2);
+	INTERR(ret, "_cpus_ls returned %d\n", ret);
+
+	ret = ihk_reserve_cpu_group(0, group, cpus.cpus, cpus.ncpus);
+	INTERR(ret, "ihk_reserve_cpu_group returned %d\n", ret);
+
+	int groups_input[] = {
+		group + 1,
+		group,
+		group,
+	};
+
+	int ret_expected[] = {
+		-ENOENT,
+		-EBUSY,
+		0,
+	};
+
+	/* Activate and check */
+	for (i = 0; i < 3; i++) {
+		START("test-case: %s: %s\n", param, values[i]);
+
+		switch (i) {
+		case 1:
+			ret = ihk_create_os(0);
+			INTERR(ret, "ihk_create_os returned %d\n", ret);
+
+			ret = ihk_os_set_group(0, group);
+			INTERR(ret, "ihk_os_set_group returned %d\n", ret);
+			break;
+		case 2:
+			ret = ihk_destroy_os(0, 0);
+			INTERR(ret, "ihk_destroy_os returned %d\n", ret);
+			break;
+		default:
+			break;
+		}
+
+		ret = ihk_destroy_group(0, groups_input[i]);
+		OKNG(ret == ret_expected[i],
+		     "return value: %d, expected: %d\n",
+		     ret, ret_expected[i]);
+
+		if (ret_expected[i]) {
+			continue;
+		}
+
+		struct ihk_group_info info = { .id = group };
+
+		ret = ihk_query_group(0, &info);
+		OKNG(ret == -ENOENT, "group is gone\n");
+
+		/* Its CPUs are given back to Linux */
+		ret = ihk_get_num_reserved_cpus(0);
+		OKNG(ret == 0, "# of reserved cpus: %d\n", ret);
+
+		group = -1;
+	}
+
+	ret = 0;
+ out:
+	if (ihk_get_num_os_instances(0)) {
+		ihk_destroy_os(0, 0);
+	}
+	if (group > 0) {
+		ihk_destroy_group(0, group);
+	}
+	cpus_release();
+	linux_rmmod(0);
+	return ret;
+}
@@ -0,0 +1,108 @@
+#include <errno.h>
+#include <ihklib.h>
+#include "util.h"
+#include "okng.h"
+#include "cpu.h"
+#include "params.h"
+#include "linux.h"
+
+const char param[] = "group of os instance";
+const char *values[] = {
+	"device-wide pool",
+	"nonexistent",
+	"created",
+};
+
+int main(int argc, char **argv)
+{
+	int ret;
+	int i;
+	int group = -1;
+	struct cpus cpus = { 0 };
+
+	params_getopt(argc, argv);
+
+	/* Precondition */
+	ret = linux_insmod(0);
+	INTERR(ret, "linux_insmod returned %d\n", ret);
+
+	ret = ihk_create_group(0, "ihklib_group");
+	INTERR(ret <= 0, "ihk_create_group returned %d\n", ret);
+	group = ret;
+
+	ret = _cpus_ls(&cpus, "online", 2, 2);
+	INTERR(ret, "_cpus_ls returned %d\n", ret);
+
+	ret = ihk_reserve_cpu_group(0, group, cpus.cpus, cpus.ncpus);
+	INTERR(ret, "ihk_reserve_cpu_group returned %d\n", ret);
+
+	ret = ihk_create_os(0);
+	INTERR(ret, "ihk_create_os returned %d\n", ret);
+
+	int groups_input[] = {
+		0,
+		group + 1,
+		group,
+	};
+
+	int ret_expected_set[] = {
+		0,
+		-ENOENT,
+		0,
+	};
+
+	/* CPUs of a group aren't visible to an OS of another group */
+	int ret_expected_assign[] = {
+		-EINVAL,
+		-EINVAL,
+		0,
+	};
+
+	/* Activate and check */
+	for (i = 0; i < 3; i++) {
+		START("test-case: %s: %s\n", param, values[i]);
+
+		ret = ihk_os_set_group(0, groups_input[i]);
+		OKNG(ret == ret_expected_set[i],
+		     "return value of ihk_os_set_group: %d, expected: %d\n",
+		     ret, ret_expected_set[i]);
+
+		ret = ihk_os_assign_cpu(0, cpus.cpus, cpus.ncpus);
+		OKNG(ret == ret_expected_assign[i],
+		     "return value of ihk_os_assign_cpu: %d, expected: %d\n",
+		     ret, ret_expected_assign[i]);
+
+		if (ret_expected_assign[i]) {
+			continue;
+		}
+
+		ret = ihk_os_get_group(0);
+		OKNG(ret == group, "group of os: %d, expected: %d\n",
+		     ret, group);
+
+		ret = cpus_check_assigned(&cpus);
+		OKNG(ret == 0, "assigned as expected\n");
+
+		/* The group can't be left while its CPUs are assigned */
+		ret = ihk_os_set_group(0, 0);
+		OKNG(ret == -EBUSY,
+		     "return value of ihk_os_set_group: %d, expected: %d\n",
+		     ret, -EBUSY);
+
+		/* Clean up */
+		ret = ihk_os_release_cpu(0, cpus.cpus, cpus.ncpus);
+		INTERR(ret, "ihk_os_release_cpu returned %d\n", ret);
+	}
+
+	ret = 0;
+ out:
+	if (ihk_get_num_os_instances(0)) {
+		cpus_os_release();
+		ihk_destroy_os(0, 0);
+	}
+	if (group > 0) {
+		ihk_destroy_group(0, group);
+	}
+	linux_rmmod(0);
+	return ret;
+}
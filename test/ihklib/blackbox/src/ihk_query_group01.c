@@ -0,0 +1,105 @@
+#include <errno.h>
+#include <string.h>
+#include <ihklib.h>
+#include <ihk/ihk_host_user.h>
+#include "util.h"
+#include "okng.h"
+#include "cpu.h"
+#include "params.h"
+#include "linux.h"
+
+const char param[] = "group";
+const char *values[] = {
+	"nonexistent id",
+	"nonexistent name",
+	"id",
+	"name",
+};
+
+int main(int argc, char **argv)
+{
+	int ret;
+	int i;
+	int group = -1;
+	struct cpus cpus = { 0 };
+
+	params_getopt(argc, argv);
+
+	/* Precondition */
+	ret = linux_insmod(0);
+	INTERR(ret, "linux_insmod returned %d\n", ret);
+
+	ret = ihk_create_group(0, "ihklib_group");
+	INTERR(ret <= 0, "ihk_create_group returned %d\n", ret);
+	group = ret;
+
+	ret = _cpus_ls(&cpus, "online", 2, 2);
+	INTERR(ret, "_cpus_ls returned %d\n", ret);
+
+	ret = ihk_reserve_cpu_group(0, group, cpus.cpus, cpus.ncpus);
+	INTERR(ret, "ihk_reserve_cpu_group returned %d\n", ret);
+
+	int ids_input[] = {
+		group + 1,
+		IHK_GROUP_BY_NAME,
+		group,
+		IHK_GROUP_BY_NAME,
+	};
+
+	const char *names_input[] = {
+		"",
+		"ihklib_nonexistent",
+		"",
+		"ihklib_group",
+	};
+
+	int ret_expected[] = {
+		-ENOENT,
+		-ENOENT,
+		0,
+		0,
+	};
+
+	/* Activate and check */
+	for (i = 0; i < 4; i++) {
+		struct ihk_group_info info = { 0 };
+		int result[MAX_NUM_CPUS];
+
+		START("test-case: %s: %s\n", param, values[i]);
+
+		info.id = ids_input[i];
+		strncpy(info.name, names_input[i], IHK_GROUP_NAME_MAX - 1);
+		info.cpus = result;
+		info.num_cpus = MAX_NUM_CPUS;
+
+		ret = ihk_query_group(0, &info);
+		OKNG(ret == ret_expected[i],
+		     "return value: %d, expected: %d\n",
+		     ret, ret_expected[i]);
+
+		if (ret_expected[i] == 0) {
+			struct cpus cpus_result = {
+				.cpus = result,
+				.ncpus = info.num_cpus,
+			};
+
+			OKNG(info.id == group, "id: %d, expected: %d\n",
+			     info.id, group);
+			OKNG(!strcmp(info.name, "ihklib_group"),
+			     "name: %s\n", info.name);
+			OKNG(info.num_os == 0 && info.num_cpus_assigned == 0,
+			     "nothing in use\n");
+
+			ret = cpus_compare(&cpus_result, &cpus);
+			OKNG(ret == 0, "cpus reported as expected\n");
+		}
+	}
+
+	ret = 0;
+ out:
+	if (group > 0) {
+		ihk_destroy_group(0, group);
+	}
+	linux_rmmod(0);
+	return ret;
+}
@@ -0,0 +1,96 @@
+#include <errno.h>
+#include <string.h>
+#include <ihklib.h>
+#include <ihk/ihk_host_user.h>
+#include "util.h"
+#include "okng.h"
+#include "cpu.h"
+#include "params.h"
+#include "linux.h"
+
+const char param[] = "group";
+const char *values[] = {
+	"nonexistent",
+	"device-wide pool",
+	"created",
+};
+
+int main(int argc, char **argv)
+{
+	int ret;
+	int i;
+	int group = -1;
+	struct cpus cpus = { 0 };
+
+	params_getopt(argc, argv);
+
+	/* Precondition */
+	ret = linux_insmod(0);
+	INTERR(ret, "linux_insmod returned %d\n", ret);
+
+	ret = ihk_create_group(0, "ihklib_group");
+	INTERR(ret <= 0, "ihk_create_group returned %d\n", ret);
+	group = ret;
+
+	ret = _cpus_ls(&cpus, "online", 2, 2);
+	INTERR(ret, "_cpus_ls returned %d\n", ret);
+
+	int groups_input[] = {
+		group + 1,
+		0,
+		group,
+	};
+
+	int ret_expected[] = {
+		-ENOENT,
+		0,
+		0,
+	};
+
+	/* Activate and check */
+	for (i = 0; i < 3; i++) {
+		struct ihk_group_info info = { 0 };
+
+		START("test-case: %s: %s\n", param, values[i]);
+
+		ret = ihk_reserve_cpu_group(0, groups_input[i], cpus.cpus,
+					    cpus.ncpus);
+		OKNG(ret == ret_expected[i],
+		     "return value: %d, expected: %d\n",
+		     ret, ret_expected[i]);
+
+		if (ret_expected[i]) {
+			continue;
+		}
+
+		ret = cpus_check_reserved(&cpus);
+		OKNG(ret == 0, "reserved as expected\n");
+
+		/* Only the CPUs of the group are reported for it */
+		info.id = group;
+		ret = ihk_query_group(0, &info);
+		INTERR(ret, "ihk_query_group returned %d\n", ret);
+		OKNG(info.num_cpus == (groups_input[i] ? cpus.ncpus : 0),
+		     "# of cpus of the group: %d\n", info.num_cpus);
+
+		/* They can't be released from another group */
+		if (groups_input[i]) {
+			ret = ihk_release_cpu(0, cpus.cpus, cpus.ncpus);
+			OKNG(ret != 0, "not released from the device-wide pool\n");
+		}
+
+		/* Clean up */
+		ret = ihk_release_cpu_group(0, groups_input[i], cpus.cpus,
+					    cpus.ncpus);
+		INTERR(ret, "ihk_release_cpu_group returned %d\n", ret);
+	}
+
+	ret = 0;
+ out:
+	if (group > 0) {
+		ihk_destroy_group(0, group);
+	}
+	cpus_release();
+	linux_rmmod(0);
+	return ret;
+}
@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <string.h>
+#include <ihklib.h>
+#include <ihk/ihk_host_user.h>
+#include "util.h"
+#include "okng.h"
+#include "mem.h"
+#include "params.h"
+#include "linux.h"
+
+const char param[] = "group";
+const char *values[] = {
+	"nonexistent",
+	"created",
+};
+
+int main(int argc, char **argv)
+{
+	int ret;
+	int i;
+	int group = -1;
+	struct mems mems = { 0 };
+
+	params_getopt(argc, argv);
+
+	/* Precondition */
+	ret = linux_insmod(0);
+	INTERR(ret, "linux_insmod returned %d\n", ret);
+
+	ret = ihk_create_group(0, "ihklib_group");
+	INTERR(ret <= 0, "ihk_create_group returned %d\n", ret);
+	group = ret;
+
+	ret = _mems_ls(&mems, "MemFree", 0.1, -1);
+	INTERR(ret, "_mems_ls returned %d\n", ret);
+
+	int groups_input[] = {
+		group + 1,
+		group,
+	};
+
+	int ret_expected[] = {
+		-ENOENT,
+		0,
+	};
+
+	/* Activate and check */
+	for (i = 0; i < 2; i++) {
+		struct ihk_group_info info = { 0 };
+		struct mems reserved = { 0 };
+		unsigned long total = 0;
+		int j;
+
+		START("test-case: %s: %s\n", param, values[i]);
+
+		ret = ihk_reserve_mem_group(0, groups_input[i],
+					    mems.mem_chunks,
+					    mems.num_mem_chunks);
+		OKNG(ret == ret_expected[i],
+		     "return value: %d, expected: %d\n",
+		     ret, ret_expected[i]);
+
+		if (ret_expected[i]) {
+			continue;
+		}
+
+		/* Exactly what the device reports as reserved */
+		ret = ihk_get_num_reserved_mem_chunks(0);
+		INTERR(ret <= 0,
+		       "ihk_get_num_reserved_mem_chunks returned %d\n", ret);
+
+		ret = mems_init(&reserved, ret);
+		INTERR(ret, "mems_init returned %d\n", ret);
+
+		ret = ihk_query_mem(0, reserved.mem_chunks,
+				    reserved.num_mem_chunks);
+		INTERR(ret, "ihk_query_mem returned %d\n", ret);
+
+		for (j = 0; j < reserved.num_mem_chunks; j++) {
+			total += reserved.mem_chunks[j].size;
+		}
+		mems_free(&reserved);
+
+		info.id = group;
+		ret = ihk_query_group(0, &info);
+		INTERR(ret, "ihk_query_group returned %d\n", ret);
+		OKNG(info.mem_reserved == total,
+		     "mem reserved: %lu, expected: %lu\n",
+		     info.mem_reserved, total);
+
+		/* Releasing "all" is for the device-wide pool only */
+		struct ihk_mem_chunk all[1] = {
+			{ .size = -1UL, .numa_node_number = 0 }
+		};
+
+		ret = ihk_release_mem_group(0, group, all, 1);
+		OKNG(ret == -EINVAL, "return value of releasing all: %d\n",
+		     ret);
+	}
+
+	ret = 0;
+ out:
+	/* Releases the memory of the group */
+	if (group > 0) {
+		ihk_destroy_group(0, group);
+	}
+	mems_release();
+	linux_rmmod(0);
+	return ret;
+}